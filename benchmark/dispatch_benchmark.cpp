@@ -0,0 +1,119 @@
+// Compares the cost of a step called through ChainWrapper (virtual calls), ChainWrapperLS
+// (function pointers) and ChainVariant (switch over the chain types).
+//
+//     runDispatchBenchmark [chains] [rounds]
+//
+// There are twelve chain types of four cheap arithmetic steps each, so the call itself is most
+// of the work. 'chains' (default 100000) chains of random types are kept in a vector, and each
+// round initializes all of them and advances each one to the end. Reported is the time per
+// advanced step in the fastest round, without initialization.
+
+#include <chain_variant.h>
+#include <chain_wrapper.h>
+#include <local_storage_wrapper.h>
+#include <steps_chain.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Value {
+    Value() = default;
+    explicit Value(uint64_t v) : _value{ v } {}
+    explicit Value(std::string&& s) : _value{ std::stoull(s) } {}
+    std::string serialize() const { return std::to_string(_value); }
+
+    uint64_t _value{ 0 };
+};
+
+template <int K>
+struct Add {
+    Value operator()(const Value& v) const { return Value{ v._value + K }; }
+};
+
+template <int K>
+struct Mul {
+    Value operator()(const Value& v) const { return Value{ v._value * (K + 2) }; }
+};
+
+template <int K>
+auto makeChain() {
+    return steps_chain::StepsChain{ Add<K>{}, Mul<K>{}, Add<K + 1>{}, Mul<K + 1>{} };
+}
+
+template <typename Wrapper, int... K>
+Wrapper makeWrapper(int type, std::integer_sequence<int, K...>) {
+    Wrapper result;
+    ((type == K ? (result = makeChain<K>(), 0) : 0), ...);
+    return result;
+}
+
+using Types = std::make_integer_sequence<int, 12>;
+
+template <int... K>
+auto variantOf(std::integer_sequence<int, K...>) {
+    return steps_chain::ChainVariant<decltype(makeChain<K>())...>{};
+}
+
+using Variant = decltype(variantOf(Types{}));
+
+using Clock = std::chrono::steady_clock;
+
+template <typename Wrapper>
+void measure(const char* name, const std::vector<int>& types, size_t rounds) {
+    std::vector<Wrapper> chains;
+    chains.reserve(types.size());
+    for (const int type : types) {
+        chains.push_back(makeWrapper<Wrapper>(type, Types{}));
+    }
+    double best = 0;
+    uint64_t checksum = 0;
+    for (size_t round = 0; round < rounds; ++round) {
+        for (auto& chain : chains) {
+            chain.initialize(std::to_string(round));
+        }
+        size_t steps = 0;
+        const auto start = Clock::now();
+        for (auto& chain : chains) {
+            while (chain.advance()) {
+                ++steps;
+            }
+        }
+        const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+        if (round == 0 || elapsed.count() / steps < best) {
+            best = elapsed.count() / steps;
+        }
+        for (size_t i = 0; i < chains.size(); i += 997) {
+            checksum += chains[i].template peek<Value>()->_value;
+        }
+    }
+    std::printf("%-16s %8zu %10.2f %12llu\n", name, sizeof(Wrapper), best,
+        static_cast<unsigned long long>(checksum));
+}
+
+};  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100'000;
+    const size_t rounds = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20;
+
+    std::mt19937 random{ 42 };
+    std::vector<int> types(count);
+    for (auto& type : types) {
+        type = random() % 12;
+    }
+
+    std::printf("%zu chains of 12 types, %zu rounds\n", count, rounds);
+    std::printf("%-16s %8s %10s %12s\n", "", "sizeof", "ns/step", "checksum");
+    measure<steps_chain::ChainWrapper>("ChainWrapper", types, rounds);
+    measure<steps_chain::ChainWrapperLS>("ChainWrapperLS", types, rounds);
+    measure<Variant>("ChainVariant", types, rounds);
+    return 0;
+}
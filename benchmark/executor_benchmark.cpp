@@ -0,0 +1,114 @@
+// Measures how WorkStealingExecutor scales with the number of threads on CPU-bound chains.
+//
+//     runExecutorBenchmark [chains] [work per step] [max threads]
+//
+// Each chain has 8 steps, every step spins on a pseudo-random number generator for the given
+// number of iterations. All the chains are submitted at once and the executor runs them to the
+// end, which is repeated for 1, 2, 4, ... threads up to the number of hardware threads. Reported
+// are wall time, throughput and speedup over a single thread; on an otherwise idle machine the
+// speedup should stay close to the number of threads.
+
+#include <steps_chain.h>
+#include <chain_wrapper.h>
+#include <executor.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+uint64_t iterations = 20000;
+
+struct Work {
+    Work() = default;
+    explicit Work(uint64_t v) : _value{ v } {}
+    explicit Work(const std::string& s) : _value{ std::stoull(s) } {}
+    std::string serialize() const { return std::to_string(_value); }
+
+    uint64_t _value{ 1 };
+};
+
+Work spin(const Work& w) {
+    uint64_t x = w._value | 1;
+    for (uint64_t i = 0; i < iterations; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    return Work{ x };
+}
+
+steps_chain::ChainWrapper makeChain(size_t seed) {
+    steps_chain::ChainWrapper chain{
+        steps_chain::StepsChain{ spin, spin, spin, spin, spin, spin, spin, spin } };
+    chain.initialize(std::to_string(seed + 1));
+    return chain;
+}
+
+double runWith(size_t threads, size_t chains, uint64_t& checksum) {
+    std::atomic<uint64_t> sum{ 0 };
+    steps_chain::WorkStealingExecutor<> executor{
+        { [&sum](auto, steps_chain::ChainWrapper& chain) {
+              sum += chain.peek<Work>()->_value;
+          },
+          nullptr,
+          nullptr },
+        threads };
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < chains; ++i) {
+        executor.submit(makeChain(i));
+    }
+    executor.wait_idle();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    checksum = sum.load();
+    return elapsed.count();
+}
+
+// 1, 2, 4, ... and 'max_threads' itself if it is not a power of two.
+std::vector<size_t> threadCounts(size_t max_threads) {
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(std::max<size_t>(max_threads, 1));
+    return counts;
+}
+
+};  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    const size_t chains = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000;
+    iterations = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : iterations;
+    const size_t hardware = std::max(std::thread::hardware_concurrency(), 1u);
+    const size_t max_threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : hardware;
+
+    std::printf("%zu chains x 8 steps, %llu iterations per step, %zu hardware threads\n",
+        chains, static_cast<unsigned long long>(iterations), hardware);
+    std::printf("%8s %12s %14s %10s %12s\n", "threads", "wall, s", "chains/s", "speedup",
+        "efficiency");
+    double single = 0;
+    uint64_t expected = 0;
+    for (const size_t threads : threadCounts(max_threads)) {
+        uint64_t checksum = 0;
+        const double seconds = runWith(threads, chains, checksum);
+        if (threads == 1) {
+            single = seconds;
+            expected = checksum;
+        }
+        else if (checksum != expected) {
+            std::fprintf(stderr, "Checksum mismatch with %zu threads.\n", threads);
+            return 1;
+        }
+        const double speedup = single / seconds;
+        std::printf("%8zu %12.3f %14.0f %10.2f %11.0f%%\n", threads, seconds, chains / seconds,
+            speedup, 100 * speedup / threads);
+    }
+    return 0;
+}
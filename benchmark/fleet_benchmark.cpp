@@ -0,0 +1,132 @@
+// Sweeps over a big fleet of chains of which only a few can make progress.
+//
+//     runFleetBenchmark [chains] [active per mille]
+//
+// 'chains' (default 10M) chains of two types are created, and all but 'active per mille'
+// (default 10, i.e. 1%) of them are finished already. The fleet is swept until no chain makes
+// progress, which takes 17 sweeps, as the active chains have 16 steps. ChainFleet finds the
+// active chains in its bitsets, std::vector<ChainWrapperLS> has to ask each chain whether it is
+// finished, through an indirect call. Reported is the time per sweep.
+
+#include <chain_fleet.h>
+#include <local_storage_wrapper.h>
+#include <steps_chain.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Value {
+    Value() = default;
+    explicit Value(uint64_t v) : _value{ v } {}
+    explicit Value(std::string&& s) : _value{ std::stoull(s) } {}
+    std::string serialize() const { return std::to_string(_value); }
+
+    uint64_t _value{ 0 };
+};
+
+Value increment(const Value& v) {
+    return Value{ v._value + 1 };
+}
+
+Value triple(const Value& v) {
+    return Value{ v._value * 3 };
+}
+
+auto incrementChain() {
+    return steps_chain::StepsChain{
+        increment, increment, increment, increment, increment, increment, increment, increment,
+        increment, increment, increment, increment, increment, increment, increment, increment };
+}
+
+auto tripleChain() {
+    return steps_chain::StepsChain{
+        triple, triple, triple, triple, triple, triple, triple, triple,
+        triple, triple, triple, triple, triple, triple, triple, triple };
+}
+
+constexpr size_t steps = 16;
+
+// Active chains start from the first step, the others are finished.
+template <typename Chain>
+Chain initialized(Chain chain, size_t i, size_t activePerMille) {
+    chain.initialize("1", i % 1000 < activePerMille ? 0 : steps);
+    return chain;
+}
+
+using Clock = std::chrono::steady_clock;
+
+void report(const char* name, Clock::time_point start, size_t sweeps, size_t advanced) {
+    const std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    std::printf("%-22s %12.2f %8zu %12zu\n", name, elapsed.count() / sweeps, sweeps, advanced);
+}
+
+void measureFleet(size_t count, size_t activePerMille) {
+    steps_chain::ChainFleet<decltype(incrementChain()), decltype(tripleChain())> fleet;
+    fleet.reserve<decltype(incrementChain())>(count / 2 + 1);
+    fleet.reserve<decltype(tripleChain())>(count / 2 + 1);
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 2) {
+            fleet.add(initialized(incrementChain(), i / 2, activePerMille));
+        }
+        else {
+            fleet.add(initialized(tripleChain(), i / 2, activePerMille));
+        }
+    }
+    const auto start = Clock::now();
+    size_t sweeps = 0;
+    size_t advanced = 0;
+    size_t done = 0;
+    do {
+        done = fleet.advance_all();
+        advanced += done;
+        ++sweeps;
+    } while (done > 0);
+    report("ChainFleet", start, sweeps, advanced);
+}
+
+void measureVector(size_t count, size_t activePerMille) {
+    std::vector<steps_chain::ChainWrapperLS> chains;
+    chains.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 2) {
+            chains.push_back(initialized(incrementChain(), i / 2, activePerMille));
+        }
+        else {
+            chains.push_back(initialized(tripleChain(), i / 2, activePerMille));
+        }
+    }
+    const auto start = Clock::now();
+    size_t sweeps = 0;
+    size_t advanced = 0;
+    size_t done = 0;
+    do {
+        done = 0;
+        for (auto& chain : chains) {
+            if (!chain.is_finished() && chain.advance()) {
+                ++done;
+            }
+        }
+        advanced += done;
+        ++sweeps;
+    } while (done > 0);
+    report("vector<ChainWrapperLS>", start, sweeps, advanced);
+}
+
+};  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10'000'000;
+    const size_t activePerMille = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10;
+
+    std::printf("%zu chains, %zu per mille active\n", count, activePerMille);
+    std::printf("%-22s %12s %8s %12s\n", "", "ms/sweep", "sweeps", "steps");
+    measureFleet(count, activePerMille);
+    measureVector(count, activePerMille);
+    return 0;
+}
@@ -0,0 +1,292 @@
+// Microbenchmarks of the library, built on Google Benchmark:
+//
+//     runMicroBenchmark [--benchmark_filter=<regex>] [--benchmark_out=<file> --benchmark_out_format=json]
+//
+// The 'micro_benchmark' target runs all of them and writes the results to micro_benchmark.json
+// in the build directory, so that runs of two library versions can be compared, e.g. with
+// tools/compare.py from Google Benchmark. Throughput (items_per_second) is counted in steps.
+//
+// Dispatch/   8 cheap arithmetic steps through StepsChain, ContextStepsChain, ChainWrapper and
+//             ChainWrapperLS, against a vector of std::function. Each iteration decodes the
+//             argument from a string and runs the chain to the end, with run() or with
+//             initialize() and an advance() loop.
+// Length/     run() of StepsChain with 1 to 32 steps, whose steps are fused into one function.
+// Fused/      initialize() and resume() of 8 and 32 steps, which go through the dispatch table
+//             one step at a time, to compare with Length/8 and Length/32.
+// ArgSize/    run() of 8 steps whose argument is 8 bytes to 4KiB big, so it is copied on each step.
+// GetCurrentState/, Initialize/
+//             Serializing and decoding the argument of test/parameters.h types and the example's
+//             InitialData.
+
+#include "parameters.h"
+#include "parameters/initial_data.h"
+
+#include <chain_variant.h>
+#include <chain_wrapper.h>
+#include <context_steps_chain.h>
+#include <local_storage_wrapper.h>
+#include <steps_chain.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+struct Value {
+    Value() = default;
+    explicit Value(uint64_t v) : _value{ v } {}
+    explicit Value(std::string_view s) : _value{ std::stoull(std::string{ s }) } {}
+    std::string serialize() const { return std::to_string(_value); }
+
+    uint64_t _value{ 0 };
+};
+
+template <size_t K>
+struct Add {
+    Value operator()(const Value& v) const { return Value{ v._value + K }; }
+};
+
+struct Counter {
+    uint64_t steps{ 0 };
+};
+
+template <size_t K>
+struct AddAndCount {
+    Value operator()(const Value& v, Counter& counter) const {
+        ++counter.steps;
+        return Value{ v._value + K };
+    }
+};
+
+template <size_t... K>
+auto makeChain(std::index_sequence<K...>) {
+    return steps_chain::StepsChain{ Add<K + 1>{}... };
+}
+
+template <size_t... K>
+auto makeContextChain(std::index_sequence<K...>) {
+    return steps_chain::ContextStepsChain{ AddAndCount<K + 1>{}... };
+}
+
+constexpr size_t dispatchSteps = 8;
+using DispatchSteps = std::make_index_sequence<dispatchSteps>;
+
+constexpr std::string_view one{ "1" };
+
+//---------- Dispatch ----------
+
+template <typename Make>
+void runChain(benchmark::State& state, Make make) {
+    auto chain = make();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(chain.run(one));
+        benchmark::DoNotOptimize(chain);
+    }
+    state.SetItemsProcessed(state.iterations() * dispatchSteps);
+}
+
+template <typename Make>
+void advanceChain(benchmark::State& state, Make make) {
+    auto chain = make();
+    for (auto _ : state) {
+        chain.initialize(one);
+        while (chain.advance()) {
+        }
+        benchmark::DoNotOptimize(chain);
+    }
+    state.SetItemsProcessed(state.iterations() * dispatchSteps);
+}
+
+template <size_t... K>
+std::vector<std::function<Value(const Value&)>> functionsOf(std::index_sequence<K...>) {
+    return { Add<K + 1>{}... };
+}
+
+// Same steps as a vector of std::function, without resuming or serialization.
+void functionVector(benchmark::State& state) {
+    const auto steps = functionsOf(DispatchSteps{});
+    for (auto _ : state) {
+        Value value{ one };
+        for (const auto& step : steps) {
+            value = step(value);
+        }
+        benchmark::DoNotOptimize(value);
+    }
+    state.SetItemsProcessed(state.iterations() * dispatchSteps);
+}
+
+//---------- Chain length ----------
+
+template <size_t Length>
+void chainLength(benchmark::State& state) {
+    auto chain = makeChain(std::make_index_sequence<Length>{});
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(chain.run(one));
+        benchmark::DoNotOptimize(chain);
+    }
+    state.SetItemsProcessed(state.iterations() * Length);
+}
+
+//---------- Fused run against the dispatch table ----------
+
+template <size_t Length>
+void tableLoop(benchmark::State& state) {
+    auto chain = makeChain(std::make_index_sequence<Length>{});
+    for (auto _ : state) {
+        chain.initialize(one);
+        benchmark::DoNotOptimize(chain.resume());
+        benchmark::DoNotOptimize(chain);
+    }
+    state.SetItemsProcessed(state.iterations() * Length);
+}
+
+//---------- Argument size ----------
+
+template <size_t Bytes>
+struct Payload {
+    Payload() = default;
+    explicit Payload(std::string_view s) { _words.fill(std::stoull(std::string{ s })); }
+    std::string serialize() const { return std::to_string(_words[0]); }
+
+    std::array<uint64_t, Bytes / sizeof(uint64_t)> _words{};
+};
+
+template <size_t Bytes, size_t K>
+struct Touch {
+    Payload<Bytes> operator()(const Payload<Bytes>& p) const {
+        Payload<Bytes> result = p;
+        result._words[K % result._words.size()] += K;
+        return result;
+    }
+};
+
+template <size_t Bytes, size_t... K>
+auto makePayloadChain(std::index_sequence<K...>) {
+    return steps_chain::StepsChain{ Touch<Bytes, K>{}... };
+}
+
+template <size_t Bytes>
+void argumentSize(benchmark::State& state) {
+    auto chain = makePayloadChain<Bytes>(DispatchSteps{});
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(chain.run(one));
+        benchmark::DoNotOptimize(chain);
+    }
+    state.SetItemsProcessed(state.iterations() * dispatchSteps);
+    state.SetBytesProcessed(state.iterations() * dispatchSteps * Bytes);
+}
+
+//---------- Marshalling ----------
+
+template <typename Parameter>
+auto identityChain() {
+    return steps_chain::StepsChain{ [](const Parameter& p) { return p; } };
+}
+
+template <typename Parameter>
+void getCurrentState(benchmark::State& state, const char* parameters) {
+    auto chain = identityChain<Parameter>();
+    chain.initialize(parameters);
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        benchmark::DoNotOptimize(chain.get_current_state(out));
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * out.size());
+}
+
+template <typename Parameter>
+void initialize(benchmark::State& state, const char* parameters) {
+    auto chain = identityChain<Parameter>();
+    const std::string_view input{ parameters };
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(chain.initialize(input));
+        benchmark::DoNotOptimize(chain);
+    }
+    state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+constexpr const char* longText =
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+constexpr const char* payoutRequest = "ABCD-101 1001 3241 DE0243983278 Thereza Mustermann";
+
+//---------- Registration ----------
+
+template <typename Parameter>
+void registerMarshalling(const std::string& type, const char* parameters) {
+    benchmark::RegisterBenchmark(("GetCurrentState/" + type).c_str(),
+        getCurrentState<Parameter>, parameters);
+    benchmark::RegisterBenchmark(("Initialize/" + type).c_str(),
+        initialize<Parameter>, parameters);
+}
+
+void registerBenchmarks() {
+    const auto rawChain = []() { return makeChain(DispatchSteps{}); };
+    // BoundChain only forwards the calls to the chain with its context, and is inlined.
+    const auto contextChain = []() {
+        return steps_chain::BoundChain{ makeContextChain(DispatchSteps{}), Counter{} };
+    };
+    const auto wrapper = []() {
+        return steps_chain::ChainWrapper{ makeChain(DispatchSteps{}) };
+    };
+    const auto wrapperLS = []() {
+        return steps_chain::ChainWrapperLS{ makeChain(DispatchSteps{}) };
+    };
+    benchmark::RegisterBenchmark("Dispatch/StepsChain/run", runChain<decltype(rawChain)>, rawChain);
+    benchmark::RegisterBenchmark(
+        "Dispatch/StepsChain/advance", advanceChain<decltype(rawChain)>, rawChain);
+    benchmark::RegisterBenchmark(
+        "Dispatch/ContextStepsChain/run", runChain<decltype(contextChain)>, contextChain);
+    benchmark::RegisterBenchmark(
+        "Dispatch/ContextStepsChain/advance", advanceChain<decltype(contextChain)>, contextChain);
+    benchmark::RegisterBenchmark("Dispatch/ChainWrapper/run", runChain<decltype(wrapper)>, wrapper);
+    benchmark::RegisterBenchmark(
+        "Dispatch/ChainWrapper/advance", advanceChain<decltype(wrapper)>, wrapper);
+    benchmark::RegisterBenchmark(
+        "Dispatch/ChainWrapperLS/run", runChain<decltype(wrapperLS)>, wrapperLS);
+    benchmark::RegisterBenchmark(
+        "Dispatch/ChainWrapperLS/advance", advanceChain<decltype(wrapperLS)>, wrapperLS);
+    benchmark::RegisterBenchmark("Dispatch/FunctionVector", functionVector);
+
+    benchmark::RegisterBenchmark("Length/1", chainLength<1>);
+    benchmark::RegisterBenchmark("Length/2", chainLength<2>);
+    benchmark::RegisterBenchmark("Length/4", chainLength<4>);
+    benchmark::RegisterBenchmark("Length/8", chainLength<8>);
+    benchmark::RegisterBenchmark("Length/16", chainLength<16>);
+    benchmark::RegisterBenchmark("Length/32", chainLength<32>);
+
+    benchmark::RegisterBenchmark("Fused/8/table", tableLoop<8>);
+    benchmark::RegisterBenchmark("Fused/32/table", tableLoop<32>);
+
+    benchmark::RegisterBenchmark("ArgSize/8", argumentSize<8>);
+    benchmark::RegisterBenchmark("ArgSize/64", argumentSize<64>);
+    benchmark::RegisterBenchmark("ArgSize/512", argumentSize<512>);
+    benchmark::RegisterBenchmark("ArgSize/4096", argumentSize<4096>);
+
+    registerMarshalling<IntParameter>("IntParameter", "123456");
+    registerMarshalling<TwoIntParameter>("TwoIntParameter", "123456");
+    registerMarshalling<ViewParameter>("ViewParameter", longText);
+    registerMarshalling<InitialData>("InitialData", payoutRequest);
+}
+
+};  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    registerBenchmarks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
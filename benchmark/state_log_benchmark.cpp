@@ -0,0 +1,74 @@
+// Measures durable checkpoint throughput of StateLog with 1, 2, 4, ... appending threads.
+//
+//     runStateLogBenchmark [log file] [checkpoints per thread] [max threads]
+//
+// Each thread stores the state of its own chain, a 64-byte argument, after every step, and each
+// append returns only when the record is synced to disk. Reported are checkpoints per second and
+// the number of checkpoints per group commit (fdatasync). With one thread every checkpoint is a
+// sync of its own; with more threads, appends that arrive while a sync is in flight go with the
+// next one, so the throughput grows with the number of threads until the disk bandwidth is the
+// limit. Run it on the disk the state is meant to live on, not on tmpfs.
+
+#include <state_log.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+double runWith(const std::string& path, size_t threads, size_t checkpoints, double& per_commit) {
+    std::remove(path.c_str());
+    steps_chain::StateLog log{ path };
+    const std::string state(64, 's');
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&log, &state, t, checkpoints]() {
+            const std::string id = "chain-" + std::to_string(t);
+            for (size_t step = 0; step < checkpoints; ++step) {
+                log.append(id, step, state);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    per_commit = static_cast<double>(threads * checkpoints) / log.commits();
+    return elapsed.count();
+}
+
+// 1, 2, 4, ... and 'max_threads' itself if it is not a power of two.
+std::vector<size_t> threadCounts(size_t max_threads) {
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(std::max<size_t>(max_threads, 1));
+    return counts;
+}
+
+};  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    const std::string path = argc > 1 ? argv[1] : "state_log_benchmark.log";
+    const size_t checkpoints = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+    const size_t max_threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 256;
+
+    std::printf("%zu checkpoints of 64 bytes per thread, log in %s\n", checkpoints, path.c_str());
+    std::printf("%8s %12s %16s %18s\n", "threads", "wall, s", "checkpoints/s",
+        "checkpoints/commit");
+    for (const size_t threads : threadCounts(max_threads)) {
+        double per_commit = 0;
+        const double seconds = runWith(path, threads, checkpoints, per_commit);
+        std::printf("%8zu %12.3f %16.0f %18.1f\n", threads, seconds,
+            threads * checkpoints / seconds, per_commit);
+    }
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,91 @@
+// Measures how soon chains can be resumed from a StateTable after a restart.
+//
+//     runStateTableBenchmark [table file] [chains]
+//
+// Stores a 64-byte state for every chain, closes the table and opens it again, as a restarted
+// process would. Reported are the time to open it and to find the first state, which does not
+// depend on the number of chains, since nothing is read up front, then the rate of random
+// lookups and updates, and the time to go through all the states with for_each().
+
+#include <state_table.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string idOf(size_t chain) {
+    return "chain-" + std::to_string(chain);
+}
+
+};  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    const std::string path = argc > 1 ? argv[1] : "state_table_benchmark.table";
+    const size_t chains = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+
+    steps_chain::StateTable::Layout layout;
+    layout.slots = std::max<size_t>(chains * 2, 16);
+    layout.key_capacity = 24;
+    layout.inline_capacity = 64;
+    layout.overflow_bytes = 0;
+
+    const std::string state(64, 's');
+    std::remove(path.c_str());
+    {
+        steps_chain::StateTable table{ path, layout };
+        const auto start = Clock::now();
+        for (size_t chain = 0; chain < chains; ++chain) {
+            table.put(idOf(chain), 1, state);
+        }
+        const double seconds = secondsSince(start);
+        std::printf("%zu chains, 64-byte states, table in %s\n", chains, path.c_str());
+        std::printf("%-28s %12.0f /s\n", "first put", chains / seconds);
+        table.sync();
+    }
+
+    const auto open_start = Clock::now();
+    steps_chain::StateTable table{ path };
+    std::string out;
+    const bool found = table.find(idOf(chains / 2), out).has_value();
+    std::printf("%-28s %12.1f us%s\n", "open and first find", secondsSince(open_start) * 1e6,
+        found ? "" : " (not found)");
+
+    std::vector<std::string> ids;
+    std::mt19937_64 random{ 42 };
+    for (size_t i = 0; i < chains; ++i) {
+        ids.push_back(idOf(random() % chains));
+    }
+    auto start = Clock::now();
+    size_t hits = 0;
+    for (const auto& id : ids) {
+        out.clear();
+        hits += table.find(id, out).has_value();
+    }
+    std::printf("%-28s %12.0f /s\n", "random find", chains / secondsSince(start));
+
+    start = Clock::now();
+    for (size_t i = 0; i < ids.size(); ++i) {
+        table.put(ids[i], 2 + i, state);
+    }
+    std::printf("%-28s %12.0f /s\n", "random update", chains / secondsSince(start));
+
+    start = Clock::now();
+    size_t visited = 0;
+    table.for_each([&visited](std::string_view, size_t, std::string_view) { ++visited; });
+    std::printf("%-28s %12.1f ms\n", "for_each over all", secondsSince(start) * 1e3);
+
+    std::remove(path.c_str());
+    return hits == chains && visited == chains ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+// Compares TimerWheel with a timer service built on std::multimap, at millions of outstanding
+// timers.
+//
+//     runTimerWheelBenchmark [timers] [max delay]
+//
+// Timers are keyed by 64-bit request ids and get random delays of up to 'max delay' ticks
+// (default 10M timers and 3600000 ticks, i.e. an hour of milliseconds). Each container goes
+// through the same phases: set all the timers, restart a tenth of them with a new delay (what a
+// retry does), cancel another tenth, then advance the time tick by tick until every timer has
+// fired. Reported is the time per operation of each phase; the expiration phase is per fired
+// timer and includes the ticks where nothing expires.
+
+#include <timer_wheel.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// The usual alternative: timers ordered by expiration, with an index for cancellation.
+class MapTimers {
+public:
+    explicit MapTimers(std::function<void(uint64_t)> onExpired)
+        : _onExpired{ std::move(onExpired) } {}
+
+    void set(uint64_t key, uint64_t delay) {
+        const auto it = _index.find(key);
+        if (it != _index.end()) {
+            _timers.erase(it->second);
+            it->second = _timers.emplace(_now + delay, key);
+            return;
+        }
+        _index.emplace(key, _timers.emplace(_now + delay, key));
+    }
+
+    bool cancel(uint64_t key) {
+        const auto it = _index.find(key);
+        if (it == _index.end()) {
+            return false;
+        }
+        _timers.erase(it->second);
+        _index.erase(it);
+        return true;
+    }
+
+    size_t advance(uint64_t ticks) {
+        _now += ticks;
+        size_t fired = 0;
+        while (!_timers.empty() && _timers.begin()->first <= _now) {
+            const uint64_t key = _timers.begin()->second;
+            _timers.erase(_timers.begin());
+            _index.erase(key);
+            ++fired;
+            _onExpired(key);
+        }
+        return fired;
+    }
+
+    bool empty() const { return _timers.empty(); }
+
+    void reserve(size_t count) { _index.reserve(count); }
+
+private:
+    std::function<void(uint64_t)> _onExpired;
+    uint64_t _now{ 0 };
+    std::multimap<uint64_t, uint64_t> _timers;
+    std::unordered_map<uint64_t, std::multimap<uint64_t, uint64_t>::iterator> _index;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double nanosecondsPer(Clock::time_point start, size_t operations) {
+    const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    return operations ? elapsed.count() / operations : 0;
+}
+
+template <typename Timers>
+void measure(const char* name, size_t count, uint64_t maxDelay) {
+    uint64_t checksum = 0;
+    Timers timers{ [&checksum](uint64_t key) { checksum += key; } };
+    timers.reserve(count);
+    std::mt19937_64 random{ 42 };
+    std::vector<uint64_t> delays(count);
+    for (auto& delay : delays) {
+        delay = random() % maxDelay + 1;
+    }
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        timers.set(i, delays[i]);
+    }
+    const double set = nanosecondsPer(start, count);
+
+    start = Clock::now();
+    for (size_t i = 0; i < count / 10; ++i) {
+        timers.set(i * 10, delays[i]);
+    }
+    const double restart = nanosecondsPer(start, count / 10);
+
+    start = Clock::now();
+    for (size_t i = 0; i < count / 10; ++i) {
+        timers.cancel(i * 10 + 1);
+    }
+    const double cancel = nanosecondsPer(start, count / 10);
+
+    start = Clock::now();
+    size_t fired = 0;
+    uint64_t ticks = 0;
+    while (!timers.empty()) {
+        fired += timers.advance(1);
+        ++ticks;
+    }
+    const double expire = nanosecondsPer(start, fired);
+
+    std::printf("%-10s %10.1f %10.1f %10.1f %10.1f %12llu %8llu\n", name, set, restart, cancel,
+        expire, static_cast<unsigned long long>(ticks),
+        static_cast<unsigned long long>(checksum % 100000000));
+}
+
+};  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10'000'000;
+    const uint64_t maxDelay = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 3'600'000;
+
+    std::printf("%zu timers, delays up to %llu ticks, ns per operation\n", count,
+        static_cast<unsigned long long>(maxDelay));
+    std::printf("%-10s %10s %10s %10s %10s %12s %8s\n", "", "set", "restart", "cancel", "expire",
+        "ticks", "checksum");
+    measure<steps_chain::TimerWheel<uint64_t>>("wheel", count, maxDelay);
+    measure<MapTimers>("multimap", count, maxDelay);
+    return 0;
+}
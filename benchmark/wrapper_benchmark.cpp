@@ -0,0 +1,97 @@
+// Measures how fast vectors of wrapped chains grow, i.e. how much a move of a wrapper costs.
+//
+//     runWrapperBenchmark [chains]
+//
+// Each vector is filled with 'chains' (default 1M) wrappers, then it is moved to a bigger buffer
+// with reserve(), which is what every reallocation of a growing vector does. Reported are
+// nanoseconds per moved wrapper and the rate at which the vector was copied, next to plain
+// memcpy of the same amount of memory. ChainWrapperLS moves trivially relocatable chains with
+// memcpy, so it should come close to it; chains with a std::string in a step are moved one by one
+// through their move constructors. ChainWrapper only moves pointers, but its chains are scattered
+// over the heap.
+
+#include <chain_wrapper.h>
+#include <local_storage_wrapper.h>
+#include <steps_chain.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Value {
+    Value() = default;
+    explicit Value(int v) : _value{ v } {}
+    explicit Value(std::string&& s) : _value{ std::stoi(s) } {}
+    std::string serialize() const { return std::to_string(_value); }
+
+    int _value{ 0 };
+};
+
+Value increment(const Value& v) {
+    return Value{ v._value + 1 };
+}
+
+auto relocatableChain() {
+    return steps_chain::StepsChain{ increment, increment, increment };
+}
+
+auto movableChain() {
+    return steps_chain::StepsChain{ increment, increment, [name = std::string{ "step" }](
+        const Value& v) { return Value{ v._value + static_cast<int>(name.size()) }; } };
+}
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template <typename Wrapper, typename Factory>
+void measure(const char* name, size_t count, Factory factory) {
+    std::vector<Wrapper> wrappers;
+    wrappers.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        wrappers.push_back(factory());
+    }
+    const auto start = Clock::now();
+    wrappers.reserve(count * 2);
+    const double elapsed = secondsSince(start);
+    int checksum = 0;
+    for (size_t i = 0; i < count; i += count / 16 + 1) {
+        wrappers[i].run("1");
+        checksum += wrappers[i].template peek<Value>()->_value;
+    }
+    std::printf("%-28s %10.1f %10.0f %8d\n", name, elapsed * 1e9 / count,
+        sizeof(Wrapper) * count / elapsed / 1e6, checksum);
+}
+
+// Copies to fresh memory, like the reallocation does, so page faults are counted too.
+void measureMemcpy(size_t bytes) {
+    std::vector<char> from(bytes, 1);
+    std::unique_ptr<char[]> to{ new char[bytes] };
+    const auto start = Clock::now();
+    std::memcpy(to.get(), from.data(), bytes);
+    const double elapsed = secondsSince(start);
+    std::printf("%-28s %10s %10.0f %8d\n", "memcpy", "", bytes / elapsed / 1e6, to[bytes / 2]);
+}
+
+};  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1'000'000;
+
+    std::printf("%zu chains, moving a vector to a bigger buffer\n", count);
+    std::printf("%-28s %10s %10s %8s\n", "", "ns/chain", "MB/s", "checksum");
+    measure<steps_chain::ChainWrapperLS>("ChainWrapperLS relocatable", count, relocatableChain);
+    measure<steps_chain::ChainWrapperLS>("ChainWrapperLS movable", count, movableChain);
+    measure<steps_chain::ChainWrapper>("ChainWrapper relocatable", count, relocatableChain);
+    measure<steps_chain::ChainWrapper>("ChainWrapper movable", count, movableChain);
+    measureMemcpy(sizeof(steps_chain::ChainWrapperLS) * count);
+    return 0;
+}
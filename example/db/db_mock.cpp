@@ -1,8 +1,8 @@
 #include "db_mock.h"
 
 void DbMock::setProcessData(
-	const std::string& requestId, int8_t stepIdx, const std::string& parameters) {
-	_processes[requestId] = RequestProcessRecord{ requestId, stepIdx, parameters };
+	const std::string& requestId, int8_t stepIdx, std::string_view parameters) {
+	_processes[requestId] = RequestProcessRecord{ requestId, stepIdx, std::string{ parameters } };
 }
 
 void DbMock::updateProcessData(const std::string& requestId, const std::string& parameters) {
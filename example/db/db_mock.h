@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -11,7 +12,7 @@ public:
 		int8_t stepIdx{-1};
 		std::string parameters;
 	};
-	void setProcessData(const std::string& requestId, int8_t stepIdx, const std::string& parameters);
+	void setProcessData(const std::string& requestId, int8_t stepIdx, std::string_view parameters);
 	void updateProcessData(const std::string& requestId, const std::string& parameters);
 	RequestProcessRecord fetchProcessData(const std::string& requestId);
 
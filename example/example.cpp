@@ -1,55 +1,89 @@
 #include "payout_process.h"
 #include "api/api_mock.h"
 #include "db/db_mock.h"
+#include "steps/payout_error.h"
 #include "timer/timer_mock.h"
 
+#include <chain_pool.h>
+#include <tracer.h>
+
 #include <cassert>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <stdexcept>
+#include <string_view>
 
-void runProcess(
-    steps_chain::ChainWrapper p,
+void driveProcess(
+    steps_chain::ChainWrapper& p,
     const std::string& requestId,
     std::shared_ptr<DbMock> db
 ) {
-    const auto data = db->fetchProcessData(requestId);
-    p.initialize(data.parameters, data.stepIdx);
     try {
-        while (!p.is_finished()) {
-            if (p.advance()) {
-                const auto [idx, params] = p.get_current_state();
-                db->setProcessData(data.requestId, idx, params);
-            }
-            else {
-                std::cout << "Processing of request [" << data.requestId << "] interrupted.\n";
-                return;
-            }
+        // State is stored after every step, the chain reuses one buffer for all checkpoints.
+        p.run_with_checkpoints(
+            [&](size_t idx, std::string_view params) {
+                db->setProcessData(requestId, idx, params);
+            },
+            steps_chain::CheckpointPolicy::every_step());
+        if (p.failed()) {
+            std::cout << "Processing of request [" << requestId << "] failed: "
+                << p.error<PayoutError>()->message << "\n";
+            return;
+        }
+        if (!p.is_finished()) {
+            std::cout << "Processing of request [" << requestId << "] interrupted.\n";
+            return;
         }
     }
     catch (const std::exception& ex) {
-        std::cout << "Exception in processing of request [" << data.requestId << "]: "
+        std::cout << "Exception in processing of request [" << requestId << "]: "
             << ex.what() << "\n";
         return;
     }
-    std::cout << "Processing of request [" << data.requestId
+    std::cout << "Processing of request [" << requestId
         << "] completed successfully.\n";
     const auto processData = db->fetchProcessData(requestId);
     std::cout << "Finished processing data: output |"
         << processData.parameters << "|\n";
 }
 
+// Step events of every request, written to the file given as the first argument as Chrome trace
+// JSON, which can be opened in Perfetto.
+steps_chain::Tracer tracer;
+// Trace is kept per request, so that a request that is resumed later shows the time it waited.
+std::map<std::string, steps_chain::ChainTrace> traces;
+
+// Chains are taken from the pool and returned there whatever the outcome, so requests reuse
+// the same few chain objects.
+void runProcess(
+    steps_chain::ChainPool<>& pool,
+    const std::string& requestId,
+    std::shared_ptr<DbMock> db
+) {
+    const auto data = db->fetchProcessData(requestId);
+    auto p = pool.acquire(data.parameters, data.stepIdx);
+    auto& trace = traces.try_emplace(requestId, tracer.trace(requestId)).first->second;
+    p.set_observer(&trace);
+    driveProcess(p, requestId, db);
+    // The chain goes back to the pool and must not report to this request any more.
+    p.set_observer(nullptr);
+    pool.release(std::move(p));
+}
+
 int main(int argc, char **argv) {
     auto api = std::make_shared<ApiMock>();
     auto db = std::make_shared<DbMock>();
     auto timer = std::make_shared<TimerMock>();
-    
+    steps_chain::ChainPool<> pool{ [&]() { return payoutProcess(api, db, timer); } };
+
     std::cout << "Positive case -- successful payout without problems.\n";
     db->_consumers[1001] = "Franz Ferdinand";
     api->_balance[1001] = 5000;
     //                                   req-ID   user  amt dest account  dest name
     const std::string incomingRequest_1{"ABCD-101 1001 3241 DE0243983278 Thereza Mustermann"};
     db->setProcessData("ABCD-101", 0, incomingRequest_1);
-    runProcess(payoutProcess(api, db, timer), "ABCD-101", db);
+    runProcess(pool, "ABCD-101", db);
     // Check that the balance is deduced correctly.
     assert(api->_balance[1001] == 5000 - 3241);
 
@@ -58,8 +92,8 @@ int main(int argc, char **argv) {
     api->_balance[1002] = 2000;
     const std::string incomingRequest_2{ "NJDS-102 1002 2001 DE0734574568 Jeremy Soul" };
     db->setProcessData("NJDS-102", 0, incomingRequest_2);
-    runProcess(payoutProcess(api, db, timer), "NJDS-102", db);
-    // Make sure that process did not progress after an exception on the first step
+    runProcess(pool, "NJDS-102", db);
+    // Make sure that process did not progress after the first step failed
     assert(db->_processes["NJDS-102"].stepIdx == 0);
 
     std::cout << "\nNegative case -- request is rejected.\n";
@@ -68,12 +102,12 @@ int main(int argc, char **argv) {
     api->_sanctions.insert("Pablo Escobar");
     const std::string incomingRequest_3{ "KLEN-103 1003 4000 ES0543987821 Pablo Escobar" };
     db->setProcessData("KLEN-103", 0, incomingRequest_3);
-    runProcess(payoutProcess(api, db, timer), "KLEN-103", db);
+    runProcess(pool, "KLEN-103", db);
     assert(db->_processes["KLEN-103"].stepIdx == 2);
     std::cout << "Update request data with rejection and continue processing.\n";
     const std::string updatedRequest_3{ "KLEN-103 1003 1002 4" };
     db->updateProcessData("KLEN-103", updatedRequest_3);
-    runProcess(payoutProcess(api, db, timer), "KLEN-103", db);
+    runProcess(pool, "KLEN-103", db);
     assert(db->_processes["KLEN-103"].stepIdx == 2);
     assert(db->_transactions.size() == 3);
     // Make sure the money is returned back as we reject the transaction.
@@ -85,11 +119,24 @@ int main(int argc, char **argv) {
     api->_errors.insert("DE0203492344");
     const std::string incomingRequest_4{ "IJSA-104 1004 0331 DE0203492344 Elusive Joe" };
     db->setProcessData("IJSA-104", 0, incomingRequest_4);
-    runProcess(payoutProcess(api, db, timer), "IJSA-104", db);
+    runProcess(pool, "IJSA-104", db);
     assert(db->_processes["IJSA-104"].stepIdx == 3);
     // Make sure that retry timer is set
-    assert(timer->_timers.find("IJSA-104") != timer->_timers.end());
+    assert(timer->isSet("IJSA-104"));
     api->_errors.erase("DE0203492344");
-    runProcess(payoutProcess(api, db, timer), "IJSA-104", db);
+    // The process is resumed when the retry timer expires.
+    timer->_onExpired = [&](const std::string& requestId) {
+        runProcess(pool, requestId, db);
+    };
+    assert(timer->advance(59) == 0);
+    assert(timer->advance(1) == 1);
+    assert(db->_processes["IJSA-104"].stepIdx == 4);
+
+    std::string trace;
+    tracer.flush(trace);
+    if (argc > 1) {
+        std::ofstream{ argv[1] } << trace;
+        std::cout << "\nTrace is written to " << argv[1] << ".\n";
+    }
     return 0;
 }
@@ -1,10 +1,11 @@
 #include "compliance_data.h"
+#include "parsing.h"
 
-ComplianceData::ComplianceData(const std::string& data) {
-	requestId = data.substr(0, 8);
-	consumerId = std::stoi(data.substr(9, 4));
-	transactionId = std::stoi(data.substr(14, 4)) - 1000;
-	complianceDecision = std::stoi(data.substr(19));
+ComplianceData::ComplianceData(std::string_view data) {
+	requestId = std::string{ data.substr(0, 8) };
+	consumerId = parseInt(data.substr(9, 4));
+	transactionId = parseInt(data.substr(14, 4)) - 1000;
+	complianceDecision = parseInt(data.substr(19));
 }
 
 std::string ComplianceData::serialize() const {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 const int NOT_REQUIRED = 1;
 const int REQUIRED = 2;
@@ -14,6 +15,6 @@ struct ComplianceData {
 	int complianceDecision;
 
 	ComplianceData() = default;
-	explicit ComplianceData(const std::string& data);
+	explicit ComplianceData(std::string_view data);
 	std::string serialize() const;
 };
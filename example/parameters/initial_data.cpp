@@ -1,11 +1,12 @@
 #include "initial_data.h"
+#include "parsing.h"
 
-InitialData::InitialData(const std::string& data) {
-	requestId = data.substr(0, 8);
-	consumerId = std::stoi(data.substr(9, 4));
-	amount = std::stoi(data.substr(14, 4));
-	beneficiaryAccount = data.substr(19, 12);
-	beneficiaryName = data.substr(32);
+InitialData::InitialData(std::string_view data) {
+	requestId = std::string{ data.substr(0, 8) };
+	consumerId = parseInt(data.substr(9, 4));
+	amount = parseInt(data.substr(14, 4));
+	beneficiaryAccount = std::string{ data.substr(19, 12) };
+	beneficiaryName = std::string{ data.substr(32) };
 }
 
 std::string InitialData::serialize() const {
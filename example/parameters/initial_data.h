@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 struct InitialData {
 	std::string requestId;
@@ -10,6 +11,6 @@ struct InitialData {
 	std::string beneficiaryName;
 
 	InitialData() = default;
-	explicit InitialData(const std::string& data);
+	explicit InitialData(std::string_view data);
 	std::string serialize() const;
 };
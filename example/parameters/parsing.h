@@ -0,0 +1,17 @@
+#pragma once
+
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Parses an integer straight from the view, so that parameters can be built without copying
+// the input into temporary strings.
+inline int parseInt(std::string_view data) {
+	int result = 0;
+	const auto [end, ec] = std::from_chars(data.data(), data.data() + data.size(), result);
+	if (ec != std::errc{}) {
+		throw std::invalid_argument{ "Not a number: " + std::string{ data } };
+	}
+	return result;
+}
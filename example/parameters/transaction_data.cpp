@@ -1,9 +1,10 @@
 #include "transaction_data.h"
+#include "parsing.h"
 
-TransactionData::TransactionData(const std::string& data) {
-	requestId = data.substr(0, 8);
-	consumerId = std::stoi(data.substr(9, 4));
-	transactionId = std::stoi(data.substr(14, 4)) - 1000;
+TransactionData::TransactionData(std::string_view data) {
+	requestId = std::string{ data.substr(0, 8) };
+	consumerId = parseInt(data.substr(9, 4));
+	transactionId = parseInt(data.substr(14, 4)) - 1000;
 }
 
 std::string TransactionData::serialize() const {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 struct TransactionData {
 	std::string requestId;
@@ -8,6 +9,6 @@ struct TransactionData {
 	int transactionId;
 
 	TransactionData() = default;
-	explicit TransactionData(const std::string& data);
+	explicit TransactionData(std::string_view data);
 	std::string serialize() const;
 };
@@ -7,6 +7,16 @@
 #include "context/context.h"
 
 #include <context_steps_chain.h>
+#include <observer.h>
+
+namespace {
+
+// Lets the example attach a Tracer to the chain, see example.cpp.
+struct TracedPolicy : steps_chain::default_policy {
+	using observer = steps_chain::runtime_observer;
+};
+
+};  // anonymous namespace
 
 steps_chain::ChainWrapper payoutProcess(
 	std::shared_ptr<ApiMock> api,
@@ -15,13 +25,16 @@ steps_chain::ChainWrapper payoutProcess(
 ) {
 	// Steps are desined with the Interface Segregation principle in mind, so they accept different
 	// types as their 'context'. So we have to wrap the steps in lambdas here, as ContextStepsChain
-	// requires identical type of 'context' as a second argument of all steps.
+	// requires identical type of 'context' as a second argument of all steps. Wrapper owns the
+	// context through shared_ptr, but steps take it by reference, so no reference counting
+	// happens on each step.
 	return steps_chain::ChainWrapper {
 		steps_chain::ContextStepsChain{
-			[](InitialData d,     std::shared_ptr<PayoutContext> c) { return unloadAccount(d, *c.get()); },
-			[](TransactionData d, std::shared_ptr<PayoutContext> c) { return sanctionsScreening(d, *c.get()); },
-			[](ComplianceData d,  std::shared_ptr<PayoutContext> c) { return possibleRevert(d, *c.get()); },
-			[](TransactionData d, std::shared_ptr<PayoutContext> c) { return startTransfer(d, *c.get()); }
+			steps_chain::with_policy<TracedPolicy>,
+			[](InitialData d,     PayoutContext& c) { return unloadAccount(d, c); },
+			[](TransactionData d, PayoutContext& c) { return sanctionsScreening(d, c); },
+			[](ComplianceData d,  PayoutContext& c) { return possibleRevert(d, c); },
+			[](TransactionData d, PayoutContext& c) { return startTransfer(d, c); }
 		},
 		std::make_shared<PayoutContext>(api, db, timer)
 	};
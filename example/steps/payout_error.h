@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+
+// Business error of a payout step. Steps return it in steps_chain::result instead of throwing,
+// exceptions are left for failures of the infrastructure.
+struct PayoutError {
+	std::string message;
+};
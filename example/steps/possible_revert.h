@@ -2,6 +2,9 @@
 
 #include "../parameters/compliance_data.h"
 #include "../parameters/transaction_data.h"
+#include "payout_error.h"
+
+#include <result.h>
 
 #include <optional>
 
@@ -14,4 +17,5 @@ public:
 	virtual int transactionAmount(int transactionId) = 0;
 };
 
-std::optional<TransactionData> possibleRevert(ComplianceData data, PossibleRevertCtxI& ctx);
+steps_chain::result<std::optional<TransactionData>, PayoutError> possibleRevert(
+	ComplianceData data, PossibleRevertCtxI& ctx);
@@ -1,12 +1,12 @@
 #include "unload_account.h"
 
-#include <stdexcept>
-
-TransactionData unloadAccount(const InitialData& data, UnloadAccountCtxI& ctx) {
+steps_chain::result<TransactionData, PayoutError> unloadAccount(
+	const InitialData& data, UnloadAccountCtxI& ctx
+) {
 	const int transactionId = ctx.createTransaction(
 		data.requestId, data.amount, data.beneficiaryAccount, data.beneficiaryName);
 	if (!ctx.unloadAccount(data.consumerId, data.amount)) {
-		throw std::runtime_error{ "Balance is too low." };
+		return steps_chain::failure{ PayoutError{ "Balance is too low." } };
 	}
 	TransactionData result;
 	result.consumerId = data.consumerId;
@@ -2,6 +2,9 @@
 
 #include "../parameters/initial_data.h"
 #include "../parameters/transaction_data.h"
+#include "payout_error.h"
+
+#include <result.h>
 
 // Each step defines an interface that business logic needs to interact with other modules.
 // This implements the Dependency Inversion principle - instead of depending on other modules,
@@ -17,4 +20,5 @@ public:
 	virtual bool unloadAccount(int consumerId, int amount) = 0;
 };
 
-TransactionData unloadAccount(const InitialData& data, UnloadAccountCtxI& ctx);
+steps_chain::result<TransactionData, PayoutError> unloadAccount(
+	const InitialData& data, UnloadAccountCtxI& ctx);
@@ -1,5 +1,20 @@
 #include "timer_mock.h"
 
+TimerMock::TimerMock() : _timers{ [this](const std::string& requestId) {
+	if (_onExpired) {
+		_onExpired(requestId);
+	}
+} }
+{}
+
 void TimerMock::setTimer(const std::string& requestId, int delay) {
-	_timers[requestId] = delay;
+	_timers.set(requestId, static_cast<uint64_t>(delay));
+}
+
+bool TimerMock::isSet(const std::string& requestId) const {
+	return _timers.contains(requestId);
+}
+
+size_t TimerMock::advance(int ticks) {
+	return _timers.advance(static_cast<uint64_t>(ticks));
 }
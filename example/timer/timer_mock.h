@@ -1,11 +1,23 @@
 #pragma once
 
+#include <timer_wheel.h>
+
+#include <functional>
 #include <string>
-#include <unordered_map>
 
+// Timer service backed by steps_chain::TimerWheel, the time is moved forward by the caller.
+// Expired timers are reported to the callback, which is expected to resume the process.
 class TimerMock {
 public:
+	TimerMock();
+
 	void setTimer(const std::string& requestId, int delay);
+	bool isSet(const std::string& requestId) const;
+	// Moves the time forward, returns the number of expired timers.
+	size_t advance(int ticks);
+
+	std::function<void(const std::string&)> _onExpired;
 
-	std::unordered_map<std::string, int> _timers;
+private:
+	steps_chain::TimerWheel<std::string> _timers;
 };
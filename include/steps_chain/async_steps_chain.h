@@ -0,0 +1,347 @@
+#pragma once
+
+#include "util.h"
+#include "marshalling_helper.h"
+#include "policy.h"
+#include "task.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+namespace steps_chain {
+
+namespace helpers {
+
+template <typename T>
+struct without_optional {
+    using type = T;
+};
+
+template <typename T>
+struct without_optional<std::optional<T>> {
+    using type = T;
+};
+
+// Step types as seen by AsyncStepsChain: for a step returning an awaitable the return type is
+// the value of co_await, with std::optional removed the same way as in 'signature'.
+template <typename Step>
+struct async_signature {
+    using arg_type = typename signature<Step>::arg_type;
+    using context_type = typename signature<Step>::context_type;
+    using invoke_type = std::invoke_result_t<Step&, arg_type>;
+    using result_type = typename awaited<invoke_type>::type;
+    using return_type = typename without_optional<std::decay_t<result_type>>::type;
+    static constexpr bool is_async = awaited<invoke_type>::awaitable;
+};
+
+// Same as invoke_step(), but the step returns an awaitable, which is awaited before the result
+// is emplaced into 'data'. Argument stays in 'data' until the step completes, so steps may keep
+// references to it across suspension points.
+template <bool move_by_value, typename Step, typename Data>
+task<step_status> invoke_async(void* step_ptr, Data& data) {
+    using parameter_type = typename async_signature<Step>::arg_type;
+    using argument_type = std::decay_t<parameter_type>;
+    using result_type = typename async_signature<Step>::result_type;
+    using return_type = typename async_signature<Step>::return_type;
+    constexpr bool can_suspend = is_optional<std::decay_t<result_type>>::value;
+    constexpr bool move_argument = std::is_rvalue_reference_v<parameter_type> ||
+        (move_by_value && !can_suspend && !std::is_reference_v<parameter_type>);
+    auto& step = *std::launder(static_cast<Step*>(step_ptr));
+    auto& argument = std::get<argument_type>(data);
+    if constexpr (can_suspend) {
+        auto result = co_await step(hand_over<move_argument>(argument));
+        if (!result.has_value()) {
+            co_return step_status::suspended;
+        }
+        data.template emplace<return_type>(std::move(*result));
+    }
+    else {
+        data.template emplace<return_type>(co_await step(hand_over<move_argument>(argument)));
+    }
+    co_return step_status::advanced;
+}
+
+// Plain steps of AsyncStepsChain do not return result (see result.h), so there is no error to
+// store.
+template <bool move_by_value, bool detect_unchanged, typename Step, typename Data>
+step_status invoke_plain(void* step, Data& data) {
+    no_errors errors;
+    return invoke_erased<move_by_value, detect_unchanged, Step, Data>(step, data, errors);
+}
+
+template <bool move_by_value, bool detect_unchanged, typename Step, typename Data>
+constexpr auto sync_invoker() -> step_status(*)(void*, Data&) {
+    if constexpr (async_signature<Step>::is_async) {
+        return nullptr;
+    }
+    else {
+        return &invoke_plain<move_by_value, detect_unchanged, Step, Data>;
+    }
+}
+
+template <bool move_by_value, typename Step, typename Data>
+constexpr auto async_invoker() -> task<step_status>(*)(void*, Data&) {
+    if constexpr (async_signature<Step>::is_async) {
+        return &invoke_async<move_by_value, Step, Data>;
+    }
+    else {
+        return nullptr;
+    }
+}
+
+}; // namespace helpers
+
+using namespace helpers;
+
+// StepsChain whose steps may be coroutines: a step can return any awaitable (e.g. task<T>, see
+// task.h) producing the next argument, or std::optional of it. Plain steps can be mixed with
+// asynchronous ones and are called directly. run(), advance() and resume() return task<bool>,
+// which completes when the steps are done, with the same value the StepsChain methods return.
+// While a step is awaiting, no thread is blocked, so a single thread can drive any number of
+// chains by resuming whatever they wait on.
+//
+// Suspension with std::nullopt, initialization and serialization work the same way as in
+// StepsChain. The state is updated only when a step completes, so get_current_state() called
+// while a step is in flight returns the state before that step. The chain must outlive the
+// tasks returned by its methods, and only one of them may run at a time.
+
+template <typename Policy = default_policy, typename... Steps>
+class AsyncStepsChain
+{
+public:
+    static_assert(are_chainable_by<async_signature, Steps...>(),
+                  "Return type (or the awaited value) of the previous function must be the same " \
+                  "as argument type of the next.");
+    static_assert((std::is_same_v<typename signature<Steps>::context_type, void> && ...),
+                  "Steps of AsyncStepsChain must take exactly one argument.");
+    static_assert(
+        (!is_result<std::decay_t<typename async_signature<Steps>::result_type>>::value && ...),
+        "Steps of AsyncStepsChain can not return result, see result.h.");
+    // Step index, the smallest unsigned type that fits the number of steps.
+    using index_type = step_index_t<sizeof...(Steps)>;
+
+    AsyncStepsChain(Steps... steps) : _steps{std::move(steps)...}, _current{0} {}
+    AsyncStepsChain(policy_tag<Policy>, Steps... steps) : AsyncStepsChain{std::move(steps)...} {}
+
+    // Run all remaining steps, beginnig with given index. Arguments are decoded right away, so
+    // the input does not have to outlive the call.
+    task<bool> run(std::string&& parameters, size_t begin_idx = 0) {
+        return run_from(std::move(parameters), begin_idx);
+    }
+
+    task<bool> run(std::string_view parameters, size_t begin_idx = 0) {
+        return run_from(parameters, begin_idx);
+    }
+
+    task<bool> run(const char* parameters, size_t begin_idx = 0) {
+        return run_from(std::string_view{parameters}, begin_idx);
+    }
+
+    // Just initializer, intended to be used in pair with advance(). Indices past the last step
+    // are treated as the index of a finished chain, arguments are decoded as the final result.
+    bool initialize(std::string&& parameters, size_t current_idx = 0) {
+        return initialize_from(std::move(parameters), current_idx);
+    }
+
+    bool initialize(std::string_view parameters, size_t current_idx = 0) {
+        return initialize_from(parameters, current_idx);
+    }
+
+    bool initialize(const char* parameters, size_t current_idx = 0) {
+        return initialize_from(std::string_view{parameters}, current_idx);
+    }
+
+    task<bool> advance() {
+        if (_current >= sizeof...(Steps)) {
+            co_return false;
+        }
+        const step_status status = co_await invoke_current();
+        co_return complete_step(status);
+    }
+
+    // Run all remaining steps, beginning with current index.
+    task<bool> resume() {
+        if (_current >= sizeof...(Steps)) {
+            return done(false);
+        }
+        return execute_from(_current);
+    }
+
+    // Get step index and serialized arguments for current step so that they can be stored.
+    // If final step was executed, final result will be returned.
+    std::tuple<index_type, std::string> get_current_state() const {
+        std::string result;
+        append_current_args(result);
+        return std::make_tuple(_current, std::move(result));
+    }
+
+    // Same as above, but serialized arguments are appended to the caller's buffer. Returns step
+    // index.
+    index_type get_current_state(std::string& out) const {
+        append_current_args(out);
+        return _current;
+    }
+
+    // Current argument (or the final result) if it has type T, nullptr otherwise.
+    template <typename T>
+    const T* peek() const {
+        if constexpr (is_variant_alternative<T, current_arguments_type>::value) {
+            return std::get_if<T>(&_current_args);
+        }
+        else {
+            return nullptr;
+        }
+    }
+
+    bool is_finished() const { return _current >= sizeof...(Steps); }
+
+private:
+    static task<bool> done(bool value) {
+        co_return value;
+    }
+
+    template <typename Input>
+    task<bool> run_from(Input parameters, size_t begin_idx) {
+        if (begin_idx >= sizeof...(Steps)) {
+            return done(false);
+        }
+        initialize_from(std::move(parameters), begin_idx);
+        return execute_from(begin_idx);
+    }
+
+    template <typename Input>
+    bool initialize_from(Input parameters, size_t current_idx) {
+        _current = static_cast<index_type>(std::min(current_idx, sizeof...(Steps)));
+        _state_cache.invalidate();
+        deserialize_arguments(std::move(parameters));
+        return current_idx < sizeof...(Steps);
+    }
+
+    // ----- Instantiate callable invokers -----
+
+    // Plain steps are called through the same invokers as in StepsChain, only the asynchronous
+    // ones create a coroutine frame.
+    static constexpr auto sync_dispatch_table() {
+        std::array<step_status(*)(void*, current_arguments_type&), sizeof...(Steps)>
+            invoke_dispatch = {sync_invoker<
+                Policy::move_arguments, Policy::cache_state, Steps, current_arguments_type>()...};
+        return invoke_dispatch;
+    }
+
+    static constexpr auto async_dispatch_table() {
+        std::array<task<step_status>(*)(void*, current_arguments_type&), sizeof...(Steps)>
+            invoke_dispatch = {async_invoker<
+                Policy::move_arguments, Steps, current_arguments_type>()...};
+        return invoke_dispatch;
+    }
+
+    task<bool> execute_from(size_t begin_idx) {
+        _current = static_cast<index_type>(begin_idx);
+        while (_current < sizeof...(Steps)) {
+            // Kept out of the if condition, GCC 12 skips the loop body with co_await there.
+            const step_status status = co_await invoke_current();
+            if (!complete_step(status)) {
+                co_return false;
+            }
+        }
+        co_return true;
+    }
+
+    // Awaitable status of the current step, ready at once for plain steps.
+    struct step_awaiter {
+        bool await_ready() const noexcept { return !_task.has_value(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+            _awaiter.emplace(std::move(*_task).operator co_await());
+            return _awaiter->await_suspend(caller);
+        }
+        step_status await_resume() { return _awaiter ? _awaiter->await_resume() : _status; }
+
+        step_status _status;
+        std::optional<task<step_status>> _task;
+        std::optional<decltype(std::declval<task<step_status>>().operator co_await())> _awaiter;
+    };
+
+    step_awaiter invoke_current() {
+        constexpr auto sync_table = sync_dispatch_table();
+        constexpr auto async_table = async_dispatch_table();
+        void* step = _steps.address(_current);
+        if (sync_table[_current]) {
+            return {sync_table[_current](step, _current_args), std::nullopt, std::nullopt};
+        }
+        return {step_status::suspended, async_table[_current](step, _current_args), std::nullopt};
+    }
+
+    // Moves to the next step, unless current one was suspended.
+    bool complete_step(step_status status) {
+        if (status == step_status::suspended) {
+            return false;
+        }
+        if (status == step_status::advanced) {
+            _state_cache.invalidate();
+        }
+        ++_current;
+        return true;
+    }
+
+    // ----- Instantiate (de)serialization methods -----
+
+    template <typename Input>
+    inline void deserialize_arguments(Input parameters) {
+        if (_current < sizeof...(Steps)) {
+            constexpr auto table = marshalling::template deserialize_dispatch_table<
+                Input, std::decay_t<typename signature<Steps>::arg_type>...>();
+            table[_current](_current_args, std::move(parameters));
+        }
+        else {
+            _current_args.template emplace<result_type>(
+                codec::template decode<result_type>(std::move(parameters)));
+        }
+    }
+
+    inline void append_current_args(std::string& out) const {
+        _state_cache.append(out, [this](std::string& buffer) { serialize_current_args(buffer); });
+    }
+
+    inline void serialize_current_args(std::string& out) const {
+        if (_current < sizeof...(Steps)) {
+            constexpr auto table = marshalling::template serialize_dispatch_table<
+                std::decay_t<typename signature<Steps>::arg_type>...>();
+            table[_current](_current_args, out);
+        }
+        else {
+            codec::encode(std::get<result_type>(_current_args), out);
+        }
+    }
+
+    // ----- Data members and aliases -----
+
+    using steps_type = steps_storage<Steps...>;
+    static_assert(
+        std::is_default_constructible_v<
+            std::decay_t<typename signature<type_at<0, Steps...>>::arg_type>>,
+        "The argument type of the first step must be default-constructible"
+    );
+    using result_type = typename async_signature<type_at<sizeof...(Steps) - 1, Steps...>>::return_type;
+    using current_arguments_type =
+        unique_variant<std::decay_t<typename signature<Steps>::arg_type>..., result_type>;
+    using codec = typename Policy::codec;
+    using marshalling = MarshallingInvokeTables<current_arguments_type, codec>;
+
+    static_assert(codec::template supports<result_type>() &&
+                      (codec::template supports<
+                          std::decay_t<typename signature<Steps>::arg_type>>() && ...),
+                  "All arguments and return type of the last step must be supported by the codec.");
+
+    steps_type _steps;
+    current_arguments_type _current_args;
+    index_type _current;
+    StateCache<Policy::cache_state> _state_cache;
+};
+
+}; // namespace steps_chain
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "util.h"
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace steps_chain {
+namespace helpers {
+
+//---------- Outcomes of a branching step ----------
+
+// A step returning std::variant has one outcome per alternative, any other step has one outcome.
+template <typename R>
+struct outcomes {
+    using type = type_list<R>;
+    static constexpr size_t count = 1;
+};
+
+template <typename... Ts>
+struct outcomes<std::variant<Ts...>> {
+    using type = type_list<Ts...>;
+    static constexpr size_t count = sizeof...(Ts);
+};
+
+template <typename Step>
+using step_argument_t = std::decay_t<typename signature<Step>::arg_type>;
+
+template <typename Step>
+using step_outcomes = outcomes<std::decay_t<typename signature<Step>::return_type>>;
+
+template <typename T, typename... Ts>
+constexpr size_t alternative_index(type_identity<std::variant<Ts...>>) {
+    constexpr bool matches[] = {std::is_same_v<T, Ts>...};
+    for (size_t i = 0; i < sizeof...(Ts); ++i) {
+        if (matches[i]) {
+            return i;
+        }
+    }
+    return sizeof...(Ts);
+}
+
+template <typename Variant, typename... Ts>
+constexpr auto alternative_indices(type_list<Ts...>) {
+    return std::array<size_t, sizeof...(Ts)>{
+        alternative_index<Ts>(type_identity<Variant>{})...};
+}
+
+template <size_t N, size_t M>
+constexpr void append(std::array<size_t, N>& out, size_t& pos, const std::array<size_t, M>& values) {
+    for (const size_t value : values) {
+        out[pos++] = value;
+    }
+}
+
+template <typename T>
+struct is_variant : std::false_type {};
+
+template <typename... Ts>
+struct is_variant<std::variant<Ts...>> : std::true_type {};
+
+template <typename Data, typename R>
+int emplace_outcome(Data& data, R&& value) {
+    if constexpr (is_variant<std::decay_t<R>>::value) {
+        const auto outcome = static_cast<int>(value.index());
+        std::visit([&data](auto&& alternative) {
+            data.template emplace<std::decay_t<decltype(alternative)>>(std::move(alternative));
+        }, std::move(value));
+        return outcome;
+    }
+    else {
+        data.template emplace<std::decay_t<R>>(std::move(value));
+        return 0;
+    }
+}
+
+// Calls the step with the current argument stored in 'data' and emplaces the result back into
+// 'data', unpacking it if the step returned std::variant. Returns the number of the outcome, that
+// is the index of the returned alternative, or 0 for steps that do not return a variant. Returns
+// -1 if step returned std::nullopt, then 'data' stays the same. Arguments are handed over the
+// same way as in invoke_step().
+template <bool move_by_value, typename Step, typename Data, typename... Context>
+int invoke_branching_step(void* step_ptr, Data& data, Context... ctx) {
+    using parameter_type = typename signature<Step>::arg_type;
+    using argument_type = std::decay_t<parameter_type>;
+    using result_type = std::invoke_result_t<Step&, parameter_type, Context...>;
+    static_assert(!is_result<std::decay_t<result_type>>::value,
+                  "Steps of branching chains can not return result, see result.h.");
+    constexpr bool can_suspend = is_optional<result_type>::value;
+    constexpr bool move_argument = std::is_rvalue_reference_v<parameter_type> ||
+        (move_by_value && !can_suspend && !std::is_reference_v<parameter_type>);
+    auto& step = *std::launder(static_cast<Step*>(step_ptr));
+    auto& argument = std::get<argument_type>(data);
+    result_type result = step(hand_over<move_argument>(argument), std::forward<Context>(ctx)...);
+    if constexpr (can_suspend) {
+        if (!result.has_value()) {
+            return -1;
+        }
+        return emplace_outcome(data, std::move(*result));
+    }
+    else {
+        return emplace_outcome(data, std::move(result));
+    }
+}
+
+//---------- Routing tables ----------
+
+template <typename... Steps>
+constexpr auto branching_types() {
+    return ((unique_types<>{} + ... + type_identity<step_argument_t<Steps>>{}) + ... +
+            typename step_outcomes<Steps>::type{});
+}
+
+// Routes between the steps of a branching chain. Outcome of type T of step i leads to the first
+// step after i that takes T as its argument. If there is no such step, the chain finishes with the
+// result of type T. Finished chain states get indices past the last step, one per result type, so
+// the state is still described by a single index. Routes only go forward, so the chain always
+// finishes.
+template <typename... Steps>
+struct BranchingTables {
+    static constexpr size_t steps_count = sizeof...(Steps);
+    static constexpr size_t outcomes_count = (step_outcomes<Steps>::count + ...);
+
+    // All the argument and result types.
+    using arguments_type = typename decltype(branching_types<Steps...>())::variant;
+    static constexpr size_t types_count = std::variant_size_v<arguments_type>;
+
+    struct Routes {
+        // Outcomes of step i are [first_outcome[i], first_outcome[i + 1]).
+        std::array<size_t, steps_count + 1> first_outcome;
+        // State index each outcome leads to.
+        std::array<size_t, outcomes_count> successor;
+        // Alternative of 'arguments_type' stored in each state, including finished ones.
+        std::array<size_t, steps_count + types_count> state_alternative;
+        size_t results_count;
+    };
+
+    static constexpr Routes routes = [] {
+        constexpr std::array<size_t, steps_count> arguments = {
+            alternative_index<step_argument_t<Steps>>(type_identity<arguments_type>{})...};
+        constexpr std::array<size_t, steps_count> counts = {step_outcomes<Steps>::count...};
+        std::array<size_t, outcomes_count> outcome_types{};
+        size_t pos = 0;
+        (append(outcome_types, pos,
+                alternative_indices<arguments_type>(typename step_outcomes<Steps>::type{})), ...);
+
+        Routes result{};
+        for (size_t i = 0; i < steps_count; ++i) {
+            result.first_outcome[i + 1] = result.first_outcome[i] + counts[i];
+        }
+        // Walk backwards, keeping the nearest following step for each argument type.
+        std::array<size_t, types_count> next_step{};
+        std::array<bool, types_count> is_result{};
+        std::array<bool, outcomes_count> leads_to_result{};
+        for (size_t type = 0; type < types_count; ++type) {
+            next_step[type] = steps_count;
+        }
+        for (size_t i = steps_count; i-- > 0;) {
+            for (size_t o = result.first_outcome[i]; o < result.first_outcome[i + 1]; ++o) {
+                const size_t type = outcome_types[o];
+                result.successor[o] = next_step[type];
+                if (next_step[type] == steps_count) {
+                    is_result[type] = true;
+                    leads_to_result[o] = true;
+                }
+            }
+            next_step[arguments[i]] = i;
+        }
+        // Results are numbered in the order of their types in 'arguments_type'.
+        std::array<size_t, types_count> result_state{};
+        for (size_t i = 0; i < steps_count; ++i) {
+            result.state_alternative[i] = arguments[i];
+        }
+        for (size_t type = 0; type < types_count; ++type) {
+            if (is_result[type]) {
+                result_state[type] = steps_count + result.results_count;
+                result.state_alternative[steps_count + result.results_count++] = type;
+            }
+        }
+        for (size_t o = 0; o < outcomes_count; ++o) {
+            if (leads_to_result[o]) {
+                result.successor[o] = result_state[outcome_types[o]];
+            }
+        }
+        return result;
+    }();
+
+    // Number of valid states: one per step and one per result type.
+    static constexpr size_t states_count = steps_count + routes.results_count;
+
+    // State index of a finished chain with result of type T, if T is a result type.
+    template <typename T>
+    static constexpr size_t result_state() {
+        constexpr size_t type = alternative_index<T>(type_identity<arguments_type>{});
+        for (size_t state = steps_count; state < states_count; ++state) {
+            if (routes.state_alternative[state] == type) {
+                return state;
+            }
+        }
+        return states_count;
+    }
+};
+
+}; // namespace helpers
+}; // namespace steps_chain
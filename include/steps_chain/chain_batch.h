@@ -0,0 +1,430 @@
+#pragma once
+
+#include "util.h"
+#include "steps_chain.h"
+#include "context_steps_chain.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace steps_chain {
+
+// Arguments of the instances that are at the same step, passed to the step's batch() method.
+template <typename T>
+struct batch_args {
+    const T* begin() const { return _data; }
+    const T* end() const { return _data + _size; }
+    size_t size() const { return _size; }
+    const T& operator[](size_t i) const { return _data[i]; }
+
+    const T* _data;
+    size_t _size;
+};
+
+namespace helpers {
+
+// Whether the step has batch(args, out), or batch(args, out, ctx) if it takes a context.
+template <typename Step, typename Arg, typename Result, typename Context, class = void>
+struct has_batch : std::false_type {};
+
+template <typename Step, typename Arg, typename Result>
+struct has_batch<Step, Arg, Result, void, std::void_t<decltype(std::declval<Step&>().batch(
+    std::declval<batch_args<Arg>>(), std::declval<std::vector<Result>&>()))>> : std::true_type {};
+
+template <typename Step, typename Arg, typename Result, typename Context>
+struct has_batch<Step, Arg, Result, Context, std::void_t<decltype(std::declval<Step&>().batch(
+    std::declval<batch_args<Arg>>(), std::declval<std::vector<Result>&>(),
+    std::declval<Context>()))>> : std::true_type {};
+
+// Values of the instances at one step and the ids of these instances, in the same order.
+template <typename T>
+struct batch_column {
+    std::vector<T> values;
+    std::vector<size_t> ids;
+};
+
+// Columns, ids and execution shared by the ChainBatch specializations. 'Context' is the type the
+// steps get the context as, void if they take none.
+template <typename Policy, typename Context, typename... Steps>
+class batch_base {
+    static constexpr size_t steps_count = sizeof...(Steps);
+
+public:
+    using index_type = step_index_t<sizeof...(Steps)>;
+
+    // Adds an instance with the state stored by get_current_state() of the chain and returns its
+    // id. Indices past the last step are treated as the index of a finished chain.
+    size_t add(std::string_view parameters, size_t step_idx = 0) {
+        constexpr auto table = add_table(std::make_index_sequence<steps_count + 1>{});
+        const size_t step = std::min(step_idx, steps_count);
+        const bool reused = !_free_ids.empty();
+        const size_t id = reused ? _free_ids.back() : _steps_of.size();
+        if (!reused) {
+            _steps_of.push_back(0);
+            try {
+                _slots.push_back(0);
+            }
+            catch (...) {
+                _steps_of.pop_back();
+                throw;
+            }
+        }
+        try {
+            table[step](*this, id, parameters);
+        }
+        catch (...) {
+            if (!reused) {
+                _steps_of.pop_back();
+                _slots.pop_back();
+            }
+            throw;
+        }
+        _steps_of[id] = static_cast<index_type>(step);
+        if (reused) {
+            _free_ids.pop_back();
+        }
+        return id;
+    }
+
+    void reserve(size_t count) {
+        _steps_of.reserve(count);
+        _slots.reserve(count);
+    }
+
+    size_t size() const { return _steps_of.size() - _free_ids.size(); }
+
+    // Removes the finished instances. Returns the number of removed instances.
+    size_t compact() {
+        return compact([](size_t, const auto&) {});
+    }
+
+    // Calls 'on_removed(id, result)' for each finished instance before removing it, e.g. to
+    // store its result. Ids of removed instances are given to instances added later.
+    template <typename F>
+    size_t compact(F&& on_removed) {
+        auto& finished = std::get<steps_count>(_columns);
+        const size_t count = finished.ids.size();
+        _free_ids.reserve(_free_ids.size() + count);
+        for (size_t slot = 0; slot < count; ++slot) {
+            on_removed(finished.ids[slot], std::as_const(finished.values[slot]));
+        }
+        _free_ids.insert(_free_ids.end(), finished.ids.begin(), finished.ids.end());
+        finished.values.clear();
+        finished.ids.clear();
+        return count;
+    }
+
+    // Number of instances at the step, 'step_idx' equal to the number of steps gives the number
+    // of finished instances.
+    size_t count_at(size_t step_idx) const {
+        constexpr auto table = count_table(std::make_index_sequence<steps_count + 1>{});
+        return table[std::min(step_idx, steps_count)](*this);
+    }
+
+    index_type step_of(size_t id) const { return _steps_of[id]; }
+
+    bool is_finished(size_t id) const { return _steps_of[id] >= steps_count; }
+
+    // Same as get_current_state() of the chain, for one instance.
+    index_type get_current_state(size_t id, std::string& out) const {
+        constexpr auto table = serialize_table(std::make_index_sequence<steps_count + 1>{});
+        table[_steps_of[id]](*this, _slots[id], out);
+        return _steps_of[id];
+    }
+
+    std::tuple<index_type, std::string> get_current_state(size_t id) const {
+        std::string result;
+        const auto step = get_current_state(id, result);
+        return std::make_tuple(step, std::move(result));
+    }
+
+    // Calls f(id, step index, serialized state) for every instance, step by step, so that the
+    // states can be stored in bulk. The buffer is reused between calls.
+    template <typename F>
+    void for_each_state(F&& f) const {
+        std::string buffer;
+        for_each_column(std::make_index_sequence<steps_count + 1>{}, f, buffer);
+    }
+
+protected:
+    explicit batch_base(const steps_storage<Steps...>& steps) : _steps{steps} {}
+
+    // ----- Execution -----
+
+    // Later steps go first, so that every instance makes at most one step. The comma fold
+    // sequences the calls, the operands of '+' would not be.
+    template <typename... Ctx>
+    size_t advance_steps(Ctx&... ctx) {
+        return advance_backwards(std::make_index_sequence<steps_count>{}, ctx...);
+    }
+
+    // Each step feeds the next one.
+    template <typename... Ctx>
+    size_t run_steps(Ctx&... ctx) {
+        return run_forward(std::make_index_sequence<steps_count>{}, ctx...);
+    }
+
+private:
+    using result_type = std::decay_t<
+        typename signature<type_at<steps_count - 1, Steps...>>::return_type>;
+    using columns_type = std::tuple<
+        batch_column<std::decay_t<typename signature<Steps>::arg_type>>...,
+        batch_column<result_type>>;
+    using codec = typename Policy::codec;
+
+    // ----- Per-column operations, dispatched by the step index -----
+
+    template <size_t I>
+    static void add_to(batch_base& self, size_t id, std::string_view parameters) {
+        auto& column = std::get<I>(self._columns);
+        using value_type = typename decltype(column.values)::value_type;
+        column.values.push_back(codec::template decode<value_type>(parameters));
+        try {
+            column.ids.push_back(id);
+        }
+        catch (...) {
+            column.values.pop_back();
+            throw;
+        }
+        self._slots[id] = column.values.size() - 1;
+    }
+
+    template <size_t... I>
+    static constexpr auto add_table(std::index_sequence<I...>) {
+        return std::array<void(*)(batch_base&, size_t, std::string_view), sizeof...(I)>{
+            &add_to<I>...};
+    }
+
+    template <size_t I>
+    static size_t count_in(const batch_base& self) {
+        return std::get<I>(self._columns).values.size();
+    }
+
+    template <size_t... I>
+    static constexpr auto count_table(std::index_sequence<I...>) {
+        return std::array<size_t(*)(const batch_base&), sizeof...(I)>{&count_in<I>...};
+    }
+
+    template <size_t I>
+    static void serialize_from(const batch_base& self, size_t slot, std::string& out) {
+        codec::encode(std::get<I>(self._columns).values[slot], out);
+    }
+
+    template <size_t... I>
+    static constexpr auto serialize_table(std::index_sequence<I...>) {
+        return std::array<void(*)(const batch_base&, size_t, std::string&), sizeof...(I)>{
+            &serialize_from<I>...};
+    }
+
+    template <size_t... I, typename F>
+    void for_each_column(std::index_sequence<I...>, F& f, std::string& buffer) const {
+        (for_each_in<I>(f, buffer), ...);
+    }
+
+    template <size_t I, typename F>
+    void for_each_in(F& f, std::string& buffer) const {
+        const auto& column = std::get<I>(_columns);
+        for (size_t slot = 0; slot < column.values.size(); ++slot) {
+            buffer.clear();
+            codec::encode(column.values[slot], buffer);
+            f(column.ids[slot], I, std::string_view{buffer});
+        }
+    }
+
+    template <size_t... I, typename... Ctx>
+    size_t advance_backwards(std::index_sequence<I...>, Ctx&... ctx) {
+        size_t steps = 0;
+        ((steps += execute_step<steps_count - 1 - I>(ctx...)), ...);
+        return steps;
+    }
+
+    template <size_t... I, typename... Ctx>
+    size_t run_forward(std::index_sequence<I...>, Ctx&... ctx) {
+        size_t steps = 0;
+        ((steps += execute_step<I>(ctx...)), ...);
+        return steps;
+    }
+
+    // Records that the instance is now at step I, at position 'slot' of its column.
+    template <size_t I>
+    void moved_to(size_t id, size_t slot) {
+        _steps_of[id] = static_cast<index_type>(I);
+        _slots[id] = slot;
+    }
+
+    template <size_t I, typename... Ctx>
+    size_t execute_step(Ctx&... ctx) {
+        using step_type = type_at<I, Steps...>;
+        using parameter_type = typename signature<step_type>::arg_type;
+        using argument_type = std::decay_t<parameter_type>;
+        using return_type = std::decay_t<typename signature<step_type>::return_type>;
+        static_assert(std::is_void_v<typename signature<step_type>::error_type>,
+                      "Steps of ChainBatch can not return result, see result.h.");
+        auto& in = std::get<I>(_columns);
+        auto& out = std::get<I + 1>(_columns);
+        auto& step = _steps.template get<I>();
+        const size_t count = in.values.size();
+        if (count == 0) {
+            return 0;
+        }
+        const size_t before = out.values.size();
+        if constexpr (has_batch<step_type, argument_type, return_type, Context>::value) {
+            try {
+                step.batch(batch_args<argument_type>{in.values.data(), count}, out.values, ctx...);
+                if (out.values.size() != before + count) {
+                    throw std::logic_error{"ChainBatch: batch() must add a result per argument."};
+                }
+                out.ids.insert(out.ids.end(), in.ids.begin(), in.ids.end());
+            }
+            catch (...) {
+                out.values.erase(out.values.begin() + before, out.values.end());
+                throw;
+            }
+            for (size_t k = 0; k < count; ++k) {
+                moved_to<I + 1>(in.ids[k], before + k);
+            }
+            in.values.clear();
+            in.ids.clear();
+            return count;
+        }
+        else {
+            using result_type = std::invoke_result_t<step_type&, parameter_type, Ctx&...>;
+            constexpr bool can_suspend = is_optional<result_type>::value;
+            constexpr bool move_argument = std::is_rvalue_reference_v<parameter_type> ||
+                (Policy::move_arguments && !can_suspend && !std::is_reference_v<parameter_type>);
+            // Suspended instances are packed at the front of the column.
+            size_t kept = 0;
+            size_t k = 0;
+            auto keep = [&](size_t from) {
+                if (kept != from) {
+                    in.values[kept] = std::move(in.values[from]);
+                    in.ids[kept] = in.ids[from];
+                    _slots[in.ids[kept]] = kept;
+                }
+                ++kept;
+            };
+            try {
+                for (; k < count; ++k) {
+                    result_type result = step(hand_over<move_argument>(in.values[k]), ctx...);
+                    if constexpr (can_suspend) {
+                        if (!result.has_value()) {
+                            keep(k);
+                            continue;
+                        }
+                        out.values.push_back(std::move(*result));
+                    }
+                    else {
+                        out.values.push_back(std::move(result));
+                    }
+                    out.ids.push_back(in.ids[k]);
+                    moved_to<I + 1>(in.ids[k], out.values.size() - 1);
+                }
+            }
+            catch (...) {
+                // The instance that failed and the ones after it stay at this step.
+                if (out.ids.size() < out.values.size()) {
+                    out.values.pop_back();
+                }
+                for (; k < count; ++k) {
+                    keep(k);
+                }
+                in.values.erase(in.values.begin() + kept, in.values.end());
+                in.ids.resize(kept);
+                throw;
+            }
+            in.values.erase(in.values.begin() + kept, in.values.end());
+            in.ids.resize(kept);
+            return out.values.size() - before;
+        }
+    }
+
+    steps_storage<Steps...> _steps;
+    columns_type _columns;
+    // Step and position in the column of each instance, by id, and the ids of removed instances.
+    std::vector<index_type> _steps_of;
+    std::vector<size_t> _slots;
+    std::vector<size_t> _free_ids;
+};
+
+}; // namespace helpers
+
+// Many instances of the same StepsChain or ContextStepsChain type, stored column-wise: instances
+// that are at step i keep their arguments in one contiguous vector, so each step is called for
+// all of them in a row, and a step can process them at once if it provides a batch method:
+//
+//     struct Screening {
+//         ComplianceData operator()(const TransactionData& t) const;
+//         // Appends a result for each argument, in the same order.
+//         void batch(steps_chain::batch_args<TransactionData> in,
+//                    std::vector<ComplianceData>& out) const;
+//     };
+//
+// Steps of a ContextStepsChain take the context as the last argument of batch() as well, and all
+// the instances share the context passed to advance_all() and run_all().
+//
+// Batch methods cannot suspend, steps without one are called in a loop and may return
+// std::optional. Steps are copied from the prototype chain once and shared by all the instances.
+// Instances are identified by the id returned from add(), which does not change while they move
+// from step to step. compact() removes the finished instances, and their ids are given to
+// instances added later.
+template <typename Chain>
+class ChainBatch;
+
+template <typename Policy, typename... Steps>
+class ChainBatch<StepsChain<Policy, Steps...>>
+    : public helpers::batch_base<Policy, void, Steps...> {
+public:
+    explicit ChainBatch(const StepsChain<Policy, Steps...>& prototype)
+        : helpers::batch_base<Policy, void, Steps...>{prototype._steps} {}
+
+    // Runs each instance that is not finished one step forward, returns the number of steps
+    // that were completed.
+    size_t advance_all() {
+        return this->advance_steps();
+    }
+
+    // Runs all the instances until they are finished or suspended, returns the number of steps
+    // that were completed.
+    size_t run_all() {
+        return this->run_steps();
+    }
+};
+
+template <typename Policy, typename... Steps>
+class ChainBatch<ContextStepsChain<Policy, Steps...>>
+    : public helpers::batch_base<
+        Policy, typename ContextStepsChain<Policy, Steps...>::context_reference, Steps...> {
+    using chain_type = ContextStepsChain<Policy, Steps...>;
+    using base_type = helpers::batch_base<Policy, typename chain_type::context_reference, Steps...>;
+
+public:
+    using context_reference = typename chain_type::context_reference;
+
+    explicit ChainBatch(const chain_type& prototype) : base_type{prototype._steps} {}
+
+    // Same as above, each step gets 'ctx'.
+    size_t advance_all(context_reference ctx) {
+        return this->advance_steps(ctx);
+    }
+
+    size_t run_all(context_reference ctx) {
+        return this->run_steps(ctx);
+    }
+};
+
+template <typename Policy, typename... Steps>
+ChainBatch(const StepsChain<Policy, Steps...>&) -> ChainBatch<StepsChain<Policy, Steps...>>;
+
+template <typename Policy, typename... Steps>
+ChainBatch(const ContextStepsChain<Policy, Steps...>&)
+    -> ChainBatch<ContextStepsChain<Policy, Steps...>>;
+
+}; // namespace steps_chain
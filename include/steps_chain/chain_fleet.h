@@ -0,0 +1,431 @@
+#pragma once
+
+#include "util.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace steps_chain {
+
+// Many chains of a closed set of types, grouped by type: each type has its own contiguous segment
+// of chains, so a sweep over the fleet calls the same code for long runs of chains, with no
+// indirect calls. Each segment keeps bitsets of the finished, suspended and failed chains, and
+// advance_all() looks for the chains that can make progress in the bitsets 64 at a time, without
+// touching the others:
+//
+//     steps_chain::ChainFleet<decltype(payoutChain()), decltype(refundChain())> fleet;
+//     const size_t id = fleet.add(payoutChain());  // the chain must be initialized
+//     while (fleet.active() > 0) {
+//         fleet.advance_all();
+//     }
+//     fleet.compact();  // drops the finished and failed chains
+//
+// A chain whose step is suspended (returns std::nullopt) stays out of the sweeps until wake()
+// is called with its id. If a step throws, the chain is marked as suspended as well and the
+// exception leaves advance_all(), the chains after it are not advanced in that sweep. A chain
+// whose step returns an error in result (see result.h) is marked as failed instead, wake() does
+// not call the step again, and the error is available through error<E>(id) until compact()
+// removes the chain.
+//
+// Ids do not change when compact() moves the chains, ids of the removed chains are given to
+// chains added later.
+template <typename... Chains>
+class ChainFleet {
+    static_assert(sizeof...(Chains) > 0, "ChainFleet must have at least one chain type.");
+
+    template <typename Chain>
+    static constexpr size_t type_index() {
+        constexpr bool same[] = {std::is_same_v<Chain, Chains>...};
+        for (size_t i = 0; i < sizeof...(Chains); ++i) {
+            if (same[i]) {
+                return i;
+            }
+        }
+        return sizeof...(Chains);
+    }
+
+public:
+    template <typename Chain>
+    size_t add(Chain chain) {
+        constexpr size_t type = type_index<Chain>();
+        static_assert(type < sizeof...(Chains), "Chain type is not in the fleet.");
+        auto& segment = std::get<type>(_segments);
+        const bool reused = !_free_ids.empty();
+        const size_t id = reused ? _free_ids.back() : _locations.size();
+        const size_t position = segment.chains.size();
+        // Room is made first, so that nothing changes if an allocation or the move throws.
+        reserve_one(segment.chains);
+        reserve_one(segment.ids);
+        if (!reused) {
+            reserve_one(_locations);
+        }
+        if (position % 64 == 0) {
+            reserve_one(segment.finished);
+            reserve_one(segment.suspended);
+            reserve_one(segment.failed);
+        }
+        segment.chains.push_back(std::move(chain));
+        if (position % 64 == 0) {
+            segment.finished.push_back(0);
+            segment.suspended.push_back(0);
+            segment.failed.push_back(0);
+        }
+        segment.ids.push_back(id);
+        if (reused) {
+            _locations[id] = {type, position};
+            _free_ids.pop_back();
+        }
+        else {
+            _locations.push_back({type, position});
+        }
+        ++_size;
+        if (segment.chains.back().is_finished()) {
+            set(segment.finished, position);
+        }
+        else {
+            ++_active;
+        }
+        return id;
+    }
+
+    template <typename Chain>
+    void reserve(size_t count) {
+        auto& segment = std::get<type_index<Chain>()>(_segments);
+        segment.chains.reserve(count);
+        segment.ids.reserve(count);
+        segment.finished.reserve((count + 63) / 64);
+        segment.suspended.reserve((count + 63) / 64);
+        segment.failed.reserve((count + 63) / 64);
+    }
+
+    // Advances each chain that is not finished, suspended or failed up to 'max_steps' steps and
+    // returns the number of steps that were completed.
+    size_t advance_all(size_t max_steps = 1) {
+        size_t steps = 0;
+        std::apply([&](auto&... segments) {
+            ((steps += advance_segment(segments, max_steps)), ...);
+        }, _segments);
+        return steps;
+    }
+
+    // Lets a suspended chain be advanced again. Returns false if there is no such chain or it is
+    // not suspended, failed chains included.
+    bool wake(size_t id) {
+        if (!contains(id)) {
+            return false;
+        }
+        const auto [type, position] = _locations[id];
+        return with_segment(type, [this, position = position](auto& segment) {
+            if (!test(segment.suspended, position)) {
+                return false;
+            }
+            clear(segment.suspended, position);
+            ++_active;
+            return true;
+        });
+    }
+
+    // Removes the finished and failed chains, the rest keep their order. Returns the number of
+    // removed chains.
+    size_t compact() {
+        return compact([](size_t, const auto&) {});
+    }
+
+    // Calls 'on_removed(id, chain)' for each finished or failed chain before removing it, e.g. to
+    // store its result; chain.failed() tells them apart.
+    template <typename F>
+    size_t compact(F&& on_removed) {
+        size_t removed = 0;
+        std::apply([&](auto&... segments) {
+            ((removed += compact_segment(segments, on_removed)), ...);
+        }, _segments);
+        _size -= removed;
+        return removed;
+    }
+
+    // Calls 'f' with the chain, passed as its own type. Returns false if there is no such chain.
+    // The chain may be changed: whether it is finished or failed is read from it afterwards, so
+    // e.g. a failed chain initialized again is advanced by the next sweep. A suspended chain that
+    // is neither stays suspended until wake().
+    template <typename F>
+    bool visit(size_t id, F&& f) {
+        if (!contains(id)) {
+            return false;
+        }
+        const auto [type, position] = _locations[id];
+        with_segment(type, [this, &f, position = position](auto& segment) {
+            f(segment.chains[position]);
+            refresh(segment, position);
+            return true;
+        });
+        return true;
+    }
+
+    bool contains(size_t id) const {
+        return id < _locations.size() && _locations[id].type != removed;
+    }
+
+    bool is_finished(size_t id) const {
+        return contains(id) && flag(id, &segment_base::finished);
+    }
+
+    bool is_suspended(size_t id) const {
+        return contains(id) && flag(id, &segment_base::suspended);
+    }
+
+    // True if the current step of the chain returned an error in result.
+    bool is_failed(size_t id) const {
+        return contains(id) && flag(id, &segment_base::failed);
+    }
+
+    // Error returned by the current step of the chain if it has type E, nullptr otherwise.
+    template <typename E>
+    const E* error(size_t id) const {
+        if (!contains(id)) {
+            return nullptr;
+        }
+        const E* error = nullptr;
+        const auto [type, position] = _locations[id];
+        with_segment(type, [&error, position = position](const auto& segment) {
+            error = static_cast<const E*>(
+                helpers::chain_error(segment.chains[position], helpers::type_id<E>()));
+            return true;
+        });
+        return error;
+    }
+
+    // Number of chains, finished and failed ones included until compact() removes them.
+    size_t size() const { return _size; }
+
+    // Number of chains that are not finished, suspended or failed.
+    size_t active() const { return _active; }
+
+    template <typename Chain>
+    size_t count() const {
+        return std::get<type_index<Chain>()>(_segments).chains.size();
+    }
+
+private:
+    static constexpr size_t removed = std::numeric_limits<size_t>::max();
+
+    struct location {
+        size_t type;
+        size_t position;
+    };
+
+    struct segment_base {
+        std::vector<size_t> ids;
+        std::vector<uint64_t> finished;
+        std::vector<uint64_t> suspended;
+        std::vector<uint64_t> failed;
+    };
+
+    template <typename Chain>
+    struct segment : segment_base {
+        std::vector<Chain> chains;
+    };
+
+    static bool test(const std::vector<uint64_t>& bits, size_t i) {
+        return (bits[i / 64] >> (i % 64)) & 1;
+    }
+
+    static void set(std::vector<uint64_t>& bits, size_t i) {
+        bits[i / 64] |= uint64_t{1} << (i % 64);
+    }
+
+    static void clear(std::vector<uint64_t>& bits, size_t i) {
+        bits[i / 64] &= ~(uint64_t{1} << (i % 64));
+    }
+
+    // Makes room for one more element, so that the next push_back() does not throw.
+    template <typename T>
+    static void reserve_one(std::vector<T>& items) {
+        if (items.size() == items.capacity()) {
+            items.reserve(items.empty() ? 1 : 2 * items.size());
+        }
+    }
+
+    // Bits of the positions that hold chains in the last word.
+    static uint64_t tail_mask(size_t count) {
+        return count % 64 ? (uint64_t{1} << (count % 64)) - 1 : ~uint64_t{0};
+    }
+
+    bool flag(size_t id, std::vector<uint64_t> segment_base::* bits) const {
+        const auto [type, position] = _locations[id];
+        return with_segment(type, [bits, position = position](const auto& segment) {
+            return test(segment.*bits, position);
+        });
+    }
+
+    // Calls 'f' with the segment of the type and returns its result.
+    template <typename F, size_t... I>
+    bool with_segment(size_t type, F&& f, std::index_sequence<I...>) {
+        bool result = false;
+        ((type == I ? (result = f(std::get<I>(_segments)), true) : false) || ...);
+        return result;
+    }
+
+    template <typename F>
+    bool with_segment(size_t type, F&& f) {
+        return with_segment(type, std::forward<F>(f), std::index_sequence_for<Chains...>{});
+    }
+
+    template <typename F, size_t... I>
+    bool with_segment(size_t type, F&& f, std::index_sequence<I...>) const {
+        bool result = false;
+        ((type == I ? (result = f(std::get<I>(_segments)), true) : false) || ...);
+        return result;
+    }
+
+    template <typename F>
+    bool with_segment(size_t type, F&& f) const {
+        return with_segment(type, std::forward<F>(f), std::index_sequence_for<Chains...>{});
+    }
+
+    template <typename Chain>
+    size_t advance_segment(segment<Chain>& segment, size_t max_steps) {
+        size_t steps = 0;
+        const size_t words = segment.finished.size();
+        for (size_t w = 0; w < words && _active > 0; ++w) {
+            uint64_t ready = ~(segment.finished[w] | segment.suspended[w] | segment.failed[w]);
+            if (w + 1 == words) {
+                ready &= tail_mask(segment.chains.size());
+            }
+            while (ready) {
+                const size_t i = w * 64 + helpers::lowest_bit(ready);
+                ready &= ready - 1;
+                Chain& chain = segment.chains[i];
+                bool progressed = true;
+                try {
+                    for (size_t n = 0; n < max_steps && (progressed = chain.advance()); ++n) {
+                        ++steps;
+                    }
+                }
+                catch (...) {
+                    set(segment.suspended, i);
+                    --_active;
+                    throw;
+                }
+                if (chain.is_finished()) {
+                    set(segment.finished, i);
+                    --_active;
+                }
+                else if (!progressed) {
+                    set(helpers::chain_failed(chain) ? segment.failed : segment.suspended, i);
+                    --_active;
+                }
+            }
+        }
+        return steps;
+    }
+
+    // Sets the bits of the chain and the number of active chains from the state of the chain.
+    template <typename Chain>
+    void refresh(segment<Chain>& segment, size_t i) {
+        const bool was_active = !test(segment.finished, i) && !test(segment.suspended, i)
+            && !test(segment.failed, i);
+        const Chain& chain = segment.chains[i];
+        const bool finished = chain.is_finished();
+        const bool failed = !finished && helpers::chain_failed(chain);
+        const bool suspended = !finished && !failed && test(segment.suspended, i);
+        clear(segment.finished, i);
+        clear(segment.failed, i);
+        clear(segment.suspended, i);
+        if (finished) {
+            set(segment.finished, i);
+        }
+        else if (failed) {
+            set(segment.failed, i);
+        }
+        else if (suspended) {
+            set(segment.suspended, i);
+        }
+        const bool active = !finished && !failed && !suspended;
+        if (active && !was_active) {
+            ++_active;
+        }
+        else if (!active && was_active) {
+            --_active;
+        }
+    }
+
+    // Chains that can be move-assigned are moved down in place, the others (e.g. with lambda
+    // steps) are moved to a new vector.
+    template <typename Chain, typename F>
+    size_t compact_segment(segment<Chain>& segment, F& on_removed) {
+        constexpr bool in_place = std::is_move_assignable_v<Chain>;
+        const size_t count = segment.chains.size();
+        size_t first = 0;
+        while (first < segment.finished.size()
+            && (segment.finished[first] | segment.failed[first]) == 0) {
+            ++first;
+        }
+        if (first == segment.finished.size()) {
+            return 0;
+        }
+        std::vector<Chain> moved;
+        size_t kept = 0;
+        if constexpr (in_place) {
+            kept = first * 64;
+        }
+        else {
+            moved.reserve(count);
+        }
+        for (size_t i = kept; i < count; ++i) {
+            const size_t id = segment.ids[i];
+            if (test(segment.finished, i) || test(segment.failed, i)) {
+                on_removed(id, segment.chains[i]);
+                _locations[id].type = removed;
+                _free_ids.push_back(id);
+                continue;
+            }
+            if constexpr (in_place) {
+                if (kept != i) {
+                    segment.chains[kept] = std::move(segment.chains[i]);
+                }
+            }
+            else {
+                moved.push_back(std::move(segment.chains[i]));
+            }
+            if (kept != i) {
+                segment.ids[kept] = id;
+                if (test(segment.suspended, i)) {
+                    set(segment.suspended, kept);
+                }
+                else {
+                    clear(segment.suspended, kept);
+                }
+                _locations[id].position = kept;
+            }
+            ++kept;
+        }
+        if constexpr (in_place) {
+            segment.chains.erase(segment.chains.begin() + kept, segment.chains.end());
+        }
+        else {
+            segment.chains = std::move(moved);
+        }
+        segment.ids.resize(kept);
+        const size_t words = (kept + 63) / 64;
+        segment.finished.assign(words, 0);
+        segment.failed.assign(words, 0);
+        segment.suspended.resize(words);
+        if (words > 0) {
+            segment.suspended.back() &= tail_mask(kept);
+        }
+        return count - kept;
+    }
+
+    std::tuple<segment<Chains>...> _segments;
+    std::vector<location> _locations;
+    std::vector<size_t> _free_ids;
+    size_t _size{0};
+    size_t _active{0};
+};
+
+}; // namespace steps_chain
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "chain_wrapper.h"
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace steps_chain {
+
+// Keeps chains that are done with their requests, so that the next request reuses one of them
+// instead of building a new wrapper (and its context) from scratch:
+//
+//     steps_chain::ChainPool<> pool{[&]() { return payoutProcess(api, db, timer); }};
+//     auto chain = pool.acquire(data.parameters, data.stepIdx);
+//     chain.run_with_checkpoints(sink);
+//     pool.release(std::move(chain));
+//
+// acquire() resets the chain with initialize(), so a released chain may be in any state, even
+// after a step threw. The steps and the context are kept as they are, so they must not hold
+// anything specific to one request. Once the pool holds as many chains as there are requests
+// in flight, taking and returning chains allocates nothing. At most 'max_idle' chains are kept,
+// room for them is reserved up front, and the rest are destroyed when they are released.
+//
+// Chain is ChainWrapper, ChainWrapperLS or any type with initialize(). The pool can be used
+// from several threads at once.
+template <typename Chain = ChainWrapper>
+class ChainPool {
+public:
+    explicit ChainPool(std::function<Chain()> factory, size_t max_idle = 1024)
+        : _factory{std::move(factory)}, _max_idle{max_idle} {
+        _idle.reserve(_max_idle);
+    }
+
+    // A chain initialized with the state, the same way as StepsChain::initialize().
+    Chain acquire(std::string_view parameters, size_t step_idx = 0) {
+        Chain chain = take();
+        chain.initialize(parameters, step_idx);
+        return chain;
+    }
+
+    Chain acquire(std::string&& parameters, size_t step_idx = 0) {
+        Chain chain = take();
+        chain.initialize(std::move(parameters), step_idx);
+        return chain;
+    }
+
+    Chain acquire(const char* parameters, size_t step_idx = 0) {
+        return acquire(std::string_view{parameters}, step_idx);
+    }
+
+    // Taken by value, so a chain the pool has no room for is destroyed here, outside the lock.
+    void release(Chain chain) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (_idle.size() < _max_idle) {
+            _idle.push_back(std::move(chain));
+        }
+    }
+
+    // Builds chains in advance, up to 'count' idle ones, so that the first requests do not
+    // allocate either.
+    void prefill(size_t count) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        count = count < _max_idle ? count : _max_idle;
+        while (_idle.size() < count) {
+            _idle.push_back(_factory());
+        }
+    }
+
+    size_t idle() const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _idle.size();
+    }
+
+private:
+    Chain take() {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            if (!_idle.empty()) {
+                Chain chain = std::move(_idle.back());
+                _idle.pop_back();
+                return chain;
+            }
+        }
+        return _factory();
+    }
+
+    std::function<Chain()> _factory;
+    const size_t _max_idle;
+    mutable std::mutex _mutex;
+    std::vector<Chain> _idle;
+};
+
+}; // namespace steps_chain
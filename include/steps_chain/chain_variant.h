@@ -0,0 +1,270 @@
+#pragma once
+
+#include "checkpoint.h"
+#include "observer.h"
+#include "result.h"
+#include "util.h"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace steps_chain {
+
+// ContextStepsChain together with its own context, with the interface of StepsChain, so that it
+// can be an alternative of ChainVariant. Context may be a smart pointer, see ChainWrapper.
+template <typename Chain, typename Context>
+class BoundChain {
+public:
+    BoundChain(Chain chain, Context context)
+        : _chain{std::move(chain)}, _context{std::move(context)} {
+    }
+
+    bool run(std::string&& parameters, size_t begin = 0) {
+        return _chain.run(std::move(parameters), context(), begin);
+    }
+
+    bool run(std::string_view parameters, size_t begin = 0) {
+        return _chain.run(parameters, context(), begin);
+    }
+
+    bool initialize(std::string&& parameters, size_t begin = 0) {
+        return _chain.initialize(std::move(parameters), begin);
+    }
+
+    bool initialize(std::string_view parameters, size_t begin = 0) {
+        return _chain.initialize(parameters, begin);
+    }
+
+    bool advance() {
+        return _chain.advance(context());
+    }
+
+    bool resume() {
+        return _chain.resume(context());
+    }
+
+    bool run_with_checkpoints(
+        StateSink sink,
+        CheckpointPolicy policy = CheckpointPolicy::every_step()
+    ) {
+        return _chain.run_with_checkpoints(context(), sink, policy);
+    }
+
+    std::tuple<size_t, std::string> get_current_state() const {
+        return _chain.get_current_state();
+    }
+
+    size_t get_current_state(std::string& out) const {
+        return _chain.get_current_state(out);
+    }
+
+    const void* peek(const void* type) const {
+        return _chain.peek(type);
+    }
+
+    bool is_finished() const {
+        return _chain.is_finished();
+    }
+
+    bool failed() const {
+        return helpers::chain_failed(_chain);
+    }
+
+    const void* error(const void* type) const {
+        return helpers::chain_error(_chain, type);
+    }
+
+    template <typename C = Chain>
+    auto observer() -> decltype(std::declval<C&>().observer()) {
+        return _chain.observer();
+    }
+
+private:
+    decltype(auto) context() {
+        return helpers::context_from<typename Chain::context_reference>(_context);
+    }
+
+    Chain _chain;
+    Context _context;
+};
+
+template <typename Chain, typename Context>
+struct is_trivially_relocatable<BoundChain<Chain, Context>> : std::bool_constant<
+    is_trivially_relocatable<Chain>::value && is_trivially_relocatable<Context>::value> {};
+
+// Wrapper for a closed set of chain types, known in advance:
+//
+//     using Process = steps_chain::ChainVariant<
+//         decltype(payoutChain()),
+//         steps_chain::BoundChain<decltype(registrationChain()), std::shared_ptr<DB>>>;
+//     std::vector<Process> processes{payoutChain(), Process{registrationChain(), db}};
+//
+// It has the interface of ChainWrapper, but the chain is kept in a std::variant, which is as big
+// as the largest chain, and calls are dispatched by comparing the index with each alternative in
+// turn. The compiler can turn that into a switch, and it sees the called chain, so the chain's
+// methods are inlined, which is not possible through the virtual calls of ChainWrapper or the
+// function pointers of ChainWrapperLS. Steps themselves are still called through the chain's
+// dispatch table. A chain with context is an alternative of type BoundChain, and is
+// constructed from the chain and the context, like in ChainWrapper.
+//
+// Default-constructed wrapper is empty and behaves like an empty ChainWrapper.
+template <typename... Chains>
+class ChainVariant {
+    static_assert(sizeof...(Chains) > 0, "ChainVariant must have at least one chain type.");
+
+    template <typename T>
+    using one_of = std::enable_if_t<(std::is_same_v<std::decay_t<T>, Chains> || ...)>;
+
+public:
+    ChainVariant() = default;
+
+    template <typename Chain, typename = one_of<Chain>>
+    ChainVariant(Chain chain)
+        : _chain{std::in_place_type<Chain>, std::move(chain)} {
+    }
+
+    template <typename Chain, typename Context, typename = one_of<BoundChain<Chain, Context>>>
+    ChainVariant(Chain chain, Context context)
+        : _chain{std::in_place_type<BoundChain<Chain, Context>>,
+                 std::move(chain), std::move(context)} {
+    }
+
+    bool run(std::string&& parameters, size_t begin = 0) {
+        return visit(
+            [&](auto& chain) { return chain.run(std::move(parameters), begin); },
+            false);
+    }
+
+    bool run(std::string_view parameters, size_t begin = 0) {
+        return visit([&](auto& chain) { return chain.run(parameters, begin); }, false);
+    }
+
+    bool run(const char* parameters, size_t begin = 0) {
+        return run(std::string_view{parameters}, begin);
+    }
+
+    bool initialize(std::string&& parameters, size_t begin = 0) {
+        return visit(
+            [&](auto& chain) { return chain.initialize(std::move(parameters), begin); },
+            false);
+    }
+
+    bool initialize(std::string_view parameters, size_t begin = 0) {
+        return visit([&](auto& chain) { return chain.initialize(parameters, begin); }, false);
+    }
+
+    bool initialize(const char* parameters, size_t begin = 0) {
+        return initialize(std::string_view{parameters}, begin);
+    }
+
+    bool advance() {
+        return visit([](auto& chain) { return chain.advance(); }, false);
+    }
+
+    bool resume() {
+        return visit([](auto& chain) { return chain.resume(); }, false);
+    }
+
+    bool run_with_checkpoints(
+        StateSink sink,
+        CheckpointPolicy policy = CheckpointPolicy::every_step()
+    ) {
+        return visit(
+            [&](auto& chain) { return chain.run_with_checkpoints(sink, policy); },
+            false);
+    }
+
+    std::tuple<size_t, std::string> get_current_state() const {
+        return visit(
+            [](const auto& chain) { return chain.get_current_state(); },
+            std::make_tuple(size_t(-1), std::string{}));
+    }
+
+    // Appends serialized arguments to the caller's buffer and returns step index.
+    size_t get_current_state(std::string& out) const {
+        return visit([&](const auto& chain) { return chain.get_current_state(out); }, size_t(-1));
+    }
+
+    template <typename T>
+    const T* peek() const {
+        return static_cast<const T*>(visit(
+            [](const auto& chain) { return chain.peek(helpers::type_id<T>()); },
+            static_cast<const void*>(nullptr)));
+    }
+
+    bool is_finished() const {
+        return visit([](const auto& chain) { return chain.is_finished(); }, false);
+    }
+
+    // True if the current step returned an error in result, see result.h.
+    bool failed() const {
+        return visit([](const auto& chain) { return helpers::chain_failed(chain); }, false);
+    }
+
+    // Error returned by the current step if it has type E, nullptr otherwise.
+    template <typename E>
+    const E* error() const {
+        return static_cast<const E*>(visit(
+            [](const auto& chain) { return helpers::chain_error(chain, helpers::type_id<E>()); },
+            static_cast<const void*>(nullptr)));
+    }
+
+    // Attaches the observer to the chain, nullptr detaches it. Returns false if the chain's
+    // policy observer is not runtime_observer, see observer.h.
+    bool set_observer(StepObserver* observer) {
+        return visit(
+            [observer](auto& chain) { return helpers::attach_observer(chain, observer); },
+            false);
+    }
+
+    // True if the wrapper holds a chain of this type.
+    template <typename Chain>
+    bool holds() const {
+        return std::holds_alternative<Chain>(_chain);
+    }
+
+    bool empty() const {
+        return _chain.index() == 0;
+    }
+
+private:
+    // Calls 'f' with the chain, or returns 'otherwise' if the wrapper is empty.
+    template <size_t I = 1, typename F, typename R>
+    R visit(F&& f, R otherwise) {
+        if constexpr (I > sizeof...(Chains)) {
+            return otherwise;
+        }
+        else {
+            if (_chain.index() == I) {
+                return f(*std::get_if<I>(&_chain));
+            }
+            return visit<I + 1>(std::forward<F>(f), std::move(otherwise));
+        }
+    }
+
+    template <size_t I = 1, typename F, typename R>
+    R visit(F&& f, R otherwise) const {
+        if constexpr (I > sizeof...(Chains)) {
+            return otherwise;
+        }
+        else {
+            if (_chain.index() == I) {
+                return f(*std::get_if<I>(&_chain));
+            }
+            return visit<I + 1>(std::forward<F>(f), std::move(otherwise));
+        }
+    }
+
+    std::variant<std::monostate, Chains...> _chain;
+};
+
+template <typename... Chains>
+struct is_trivially_relocatable<ChainVariant<Chains...>>
+    : std::bool_constant<(is_trivially_relocatable<Chains>::value && ...)> {};
+
+}; // namespace steps_chain
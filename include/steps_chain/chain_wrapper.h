@@ -1,29 +1,85 @@
 #pragma once
 
+#include "checkpoint.h"
+#include "observer.h"
+#include "result.h"
+#include "util.h"
+
 #include <memory>
+#include <cstddef>
+#include <new>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
 
 namespace steps_chain {
 
+namespace helpers {
+
+#if __has_include(<memory_resource>)
+template <typename Alloc>
+using not_memory_resource =
+    std::enable_if_t<!std::is_convertible_v<Alloc, std::pmr::memory_resource*>>;
+#else
+template <typename Alloc>
+using not_memory_resource = void;
+#endif
+
+}; // namespace helpers
+
 class ChainWrapper {
 public:
     ChainWrapper() : _self{nullptr} {
     }
 
     template <typename T>
-    ChainWrapper(T x) : _self{std::make_unique<model<T>>(std::move(x))} {
+    ChainWrapper(T x) : ChainWrapper{std::allocator_arg, std::allocator<T>{}, std::move(x)} {
     }
 
     // Wrapper can hold context for ContextStepsChain, but then it will be copied (or moved)
     // in the ctor, and there are 2 more moves involved when creating polymorphic concept.
-    // Use smart pointers to avoid copying heavy instances.
+    // Use smart pointers to avoid copying heavy instances. If steps take the context by
+    // reference, smart pointer is dereferenced on each call and is never copied.
     template <typename T, typename C>
-    ChainWrapper(T x, C c) :
-        _self{std::make_unique<context_model<T, C>>(std::move(x), std::move(c))} {
+    ChainWrapper(T x, C c)
+        : ChainWrapper{std::allocator_arg, std::allocator<T>{}, std::move(x), std::move(c)} {
     }
 
-    ChainWrapper(const ChainWrapper& other) : _self{other._self->copy()} {
+    // The wrapped chain is allocated with the allocator, and so are the copies of the wrapper.
+    // A std::pmr::memory_resource pointer can be given instead of the allocator.
+    template <typename Alloc, typename T, typename = helpers::not_memory_resource<Alloc>>
+    ChainWrapper(std::allocator_arg_t, const Alloc& alloc, T x)
+        : _self{create<model<T, Alloc>>(alloc, std::move(x))} {
+    }
+
+    template <typename Alloc, typename T, typename C,
+              typename = helpers::not_memory_resource<Alloc>>
+    ChainWrapper(std::allocator_arg_t, const Alloc& alloc, T x, C c)
+        : _self{create<context_model<T, C, Alloc>>(alloc, std::move(x), std::move(c))} {
+    }
+
+#if __has_include(<memory_resource>)
+    template <typename T>
+    ChainWrapper(std::allocator_arg_t, std::pmr::memory_resource* resource, T x)
+        : ChainWrapper{std::allocator_arg, std::pmr::polymorphic_allocator<T>{resource},
+                       std::move(x)} {
+    }
+
+    template <typename T, typename C>
+    ChainWrapper(std::allocator_arg_t, std::pmr::memory_resource* resource, T x, C c)
+        : ChainWrapper{std::allocator_arg, std::pmr::polymorphic_allocator<T>{resource},
+                       std::move(x), std::move(c)} {
+    }
+#endif
+
+    ChainWrapper(const ChainWrapper& other)
+        : _self{other._self ? other._self->copy() : nullptr} {
     }
 
     ChainWrapper(ChainWrapper&&) noexcept = default;
@@ -33,16 +89,34 @@ public:
     }
     ChainWrapper& operator=(ChainWrapper&&) noexcept = default;
 
-    bool run(std::string parameters, uint8_t begin = 0) {
+    bool run(std::string&& parameters, size_t begin = 0) {
         if(_self) { return _self->run(std::move(parameters), begin); }
         else { return false; }
     }
 
-    bool initialize(std::string parameters, uint8_t begin = 0) {
+    bool run(std::string_view parameters, size_t begin = 0) {
+        if(_self) { return _self->run(parameters, begin); }
+        else { return false; }
+    }
+
+    bool run(const char* parameters, size_t begin = 0) {
+        return run(std::string_view{parameters}, begin);
+    }
+
+    bool initialize(std::string&& parameters, size_t begin = 0) {
         if(_self) { return _self->initialize(std::move(parameters), begin); }
         else { return false; }
     }
 
+    bool initialize(std::string_view parameters, size_t begin = 0) {
+        if(_self) { return _self->initialize(parameters, begin); }
+        else { return false; }
+    }
+
+    bool initialize(const char* parameters, size_t begin = 0) {
+        return initialize(std::string_view{parameters}, begin);
+    }
+
     bool advance() {
         if(_self) { return _self->advance(); }
         else { return false; }
@@ -53,93 +127,235 @@ public:
         else { return false; }
     }
 
-    std::tuple<uint8_t, std::string> get_current_state() const {
+    bool run_with_checkpoints(
+        StateSink sink,
+        CheckpointPolicy policy = CheckpointPolicy::every_step()
+    ) {
+        if(_self) { return _self->run_with_checkpoints(sink, policy); }
+        else { return false; }
+    }
+
+    std::tuple<size_t, std::string> get_current_state() const {
         if(_self) { return _self->get_current_state(); }
         return std::make_tuple(-1, "");
     }
 
+    // Appends serialized arguments to the caller's buffer and returns step index.
+    size_t get_current_state(std::string& out) const {
+        if(_self) { return _self->get_current_state(out); }
+        return -1;
+    }
+
+    template <typename T>
+    const T* peek() const {
+        if(_self) { return static_cast<const T*>(_self->peek(helpers::type_id<T>())); }
+        return nullptr;
+    }
+
     bool is_finished() const {
         if(_self) { return _self->is_finished(); }
         return false;
     }
 
+    // True if the current step returned an error in result, see result.h.
+    bool failed() const {
+        if(_self) { return _self->failed(); }
+        return false;
+    }
+
+    // Error returned by the current step if it has type E, nullptr otherwise.
+    template <typename E>
+    const E* error() const {
+        if(_self) { return static_cast<const E*>(_self->error(helpers::type_id<E>())); }
+        return nullptr;
+    }
+
+    // Attaches the observer to the chain, nullptr detaches it. Returns false if the chain's
+    // policy observer is not runtime_observer, see observer.h.
+    bool set_observer(StepObserver* observer) {
+        if(_self) { return _self->set_observer(observer); }
+        return false;
+    }
+
 private:
+    struct chain_concept;
+
+    // Models destroy themselves, each knows the allocator it came from.
+    struct disposer {
+        void operator()(chain_concept* self) const { self->dispose(); }
+    };
+
+    using pointer = std::unique_ptr<chain_concept, disposer>;
+
+    template <typename Model, typename Alloc, typename... Args>
+    static pointer create(const Alloc& alloc, Args&&... args) {
+        using traits = typename std::allocator_traits<Alloc>::template rebind_traits<Model>;
+        typename traits::allocator_type model_alloc{alloc};
+        Model* self = traits::allocate(model_alloc, 1);
+        try {
+            ::new (static_cast<void*>(self)) Model{alloc, std::forward<Args>(args)...};
+        }
+        catch (...) {
+            traits::deallocate(model_alloc, self, 1);
+            throw;
+        }
+        return pointer{self};
+    }
+
+    template <typename Model, typename Alloc>
+    static void destroy(Model* self, const Alloc& alloc) {
+        using traits = typename std::allocator_traits<Alloc>::template rebind_traits<Model>;
+        typename traits::allocator_type model_alloc{alloc};
+        self->~Model();
+        traits::deallocate(model_alloc, self, 1);
+    }
+
     struct chain_concept {
         virtual ~chain_concept() = default;
-        virtual std::unique_ptr<chain_concept> copy() = 0;
+        virtual pointer copy() const = 0;
+        virtual void dispose() = 0;
 
-        virtual bool run(std::string parameters, uint8_t begin) = 0;
-        virtual bool initialize(std::string parameters, uint8_t begin) = 0;
+        virtual bool run(std::string&& parameters, size_t begin) = 0;
+        virtual bool run(std::string_view parameters, size_t begin) = 0;
+        virtual bool initialize(std::string&& parameters, size_t begin) = 0;
+        virtual bool initialize(std::string_view parameters, size_t begin) = 0;
         virtual bool advance() = 0;
         virtual bool resume() = 0;
-        virtual std::tuple<uint8_t, std::string> get_current_state() const = 0;
+        virtual bool run_with_checkpoints(StateSink sink, CheckpointPolicy policy) = 0;
+        virtual std::tuple<size_t, std::string> get_current_state() const = 0;
+        virtual size_t get_current_state(std::string& out) const = 0;
+        virtual const void* peek(const void* type) const = 0;
         virtual bool is_finished() const = 0;
+        virtual bool failed() const = 0;
+        virtual const void* error(const void* type) const = 0;
+        virtual bool set_observer(StepObserver* observer) = 0;
     };
 
-    template <typename T>
+    template <typename T, typename Alloc>
     struct model final : chain_concept {
-        model(T x) : _data{std::move(x)} {
+        model(const Alloc& alloc, T x) : _data{std::move(x)}, _alloc{alloc} {
         }
 
-        std::unique_ptr<chain_concept> copy() override { 
-            return std::make_unique<model>(*this);
+        pointer copy() const override {
+            return create<model>(_alloc, _data);
+        }
+        void dispose() override {
+            destroy(this, Alloc{_alloc});
         }
 
-        bool run(std::string parameters, uint8_t begin) override {
+        bool run(std::string&& parameters, size_t begin) override {
             return _data.run(std::move(parameters), begin);
         }
-        bool initialize(std::string parameters, uint8_t begin) override {
+        bool run(std::string_view parameters, size_t begin) override {
+            return _data.run(parameters, begin);
+        }
+        bool initialize(std::string&& parameters, size_t begin) override {
             return _data.initialize(std::move(parameters), begin);
         }
+        bool initialize(std::string_view parameters, size_t begin) override {
+            return _data.initialize(parameters, begin);
+        }
         bool advance() override {
             return _data.advance();
         }
         bool resume() override {
             return _data.resume();
         }
-        std::tuple<uint8_t, std::string> get_current_state() const override {
+        bool run_with_checkpoints(StateSink sink, CheckpointPolicy policy) override {
+            return _data.run_with_checkpoints(sink, policy);
+        }
+        std::tuple<size_t, std::string> get_current_state() const override {
             return _data.get_current_state();
         }
+        size_t get_current_state(std::string& out) const override {
+            return _data.get_current_state(out);
+        }
+        const void* peek(const void* type) const override {
+            return _data.peek(type);
+        }
         bool is_finished() const override {
             return _data.is_finished();
         }
+        bool failed() const override {
+            return helpers::chain_failed(_data);
+        }
+        const void* error(const void* type) const override {
+            return helpers::chain_error(_data, type);
+        }
+        bool set_observer(StepObserver* observer) override {
+            return helpers::attach_observer(_data, observer);
+        }
 
         T _data;
+        Alloc _alloc;
     };
 
-    template <typename T, typename C>
+    template <typename T, typename C, typename Alloc>
     struct context_model final : chain_concept {
-        context_model(T x, C ctx) : _data{std::move(x)}, _context{std::move(ctx)} {
+        context_model(const Alloc& alloc, T x, C ctx)
+            : _data{std::move(x)}, _context{std::move(ctx)}, _alloc{alloc} {
         }
 
-        std::unique_ptr<chain_concept> copy() override { 
-            return std::make_unique<context_model>(*this);
+        pointer copy() const override {
+            return create<context_model>(_alloc, _data, _context);
+        }
+        void dispose() override {
+            destroy(this, Alloc{_alloc});
         }
 
-        bool run(std::string parameters, uint8_t begin) override {
-            return _data.run(std::move(parameters), _context, begin);
+        bool run(std::string&& parameters, size_t begin) override {
+            return _data.run(std::move(parameters), context(), begin);
+        }
+        bool run(std::string_view parameters, size_t begin) override {
+            return _data.run(parameters, context(), begin);
         }
-        bool initialize(std::string parameters, uint8_t begin) override {
+        bool initialize(std::string&& parameters, size_t begin) override {
             return _data.initialize(std::move(parameters), begin);
         }
+        bool initialize(std::string_view parameters, size_t begin) override {
+            return _data.initialize(parameters, begin);
+        }
         bool advance() override {
-            return _data.advance(_context);
+            return _data.advance(context());
         }
         bool resume() override {
-            return _data.resume(_context);
+            return _data.resume(context());
+        }
+        bool run_with_checkpoints(StateSink sink, CheckpointPolicy policy) override {
+            return _data.run_with_checkpoints(context(), sink, policy);
         }
-        std::tuple<uint8_t, std::string> get_current_state() const override {
+        std::tuple<size_t, std::string> get_current_state() const override {
             return _data.get_current_state();
         }
+        size_t get_current_state(std::string& out) const override {
+            return _data.get_current_state(out);
+        }
+        const void* peek(const void* type) const override {
+            return _data.peek(type);
+        }
         bool is_finished() const override {
             return _data.is_finished();
         }
+        bool failed() const override {
+            return helpers::chain_failed(_data);
+        }
+        const void* error(const void* type) const override {
+            return helpers::chain_error(_data, type);
+        }
+        bool set_observer(StepObserver* observer) override {
+            return helpers::attach_observer(_data, observer);
+        }
+
+        decltype(auto) context() {
+            return helpers::context_from<typename T::context_reference>(_context);
+        }
 
         T _data;
         C _context;
+        Alloc _alloc;
     };
 
-    std::unique_ptr<chain_concept> _self;
+    pointer _self;
 };
 
 }; // namespace steps_chain
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "util.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace steps_chain {
+
+// Decides when run_with_checkpoints() passes the chain state to the sink. The state the chain had
+// when the call started is considered to be already stored, so it is never passed again.
+class CheckpointPolicy {
+public:
+    enum class Mode : uint8_t {
+        every_step,           // after each completed step
+        every_n_steps,        // after every n-th completed step and when the run stops
+        before_side_effects,  // before each step wrapped in side_effect() and when the run stops
+        on_interruption       // only when a step is suspended or throws
+    };
+
+    static constexpr CheckpointPolicy every_step() { return {Mode::every_step, 1}; }
+    static constexpr CheckpointPolicy every_n_steps(size_t n) {
+        return {Mode::every_n_steps, n > 0 ? n : 1};
+    }
+    static constexpr CheckpointPolicy before_side_effects() {
+        return {Mode::before_side_effects, 0};
+    }
+    static constexpr CheckpointPolicy on_interruption() { return {Mode::on_interruption, 0}; }
+
+    constexpr Mode mode() const { return _mode; }
+    constexpr size_t period() const { return _period; }
+
+private:
+    constexpr CheckpointPolicy(Mode mode, size_t period) : _mode{mode}, _period{period} {}
+
+    Mode _mode;
+    size_t _period;
+};
+
+// Non-owning reference to a callable that receives the checkpoints: void(size_t, string_view).
+// State buffer is reused between calls, so the sink must copy the state if it needs to keep it.
+// A function is referred to by its address, so it can be passed as is.
+class StateSink {
+public:
+    template <
+        typename F,
+        typename = std::enable_if_t<
+            !std::is_same_v<std::decay_t<F>, StateSink> &&
+            !std::is_function_v<std::remove_pointer_t<std::decay_t<F>>>>>
+    StateSink(F&& f)
+        : _call{[](callable c, size_t step, std::string_view state) {
+            (*static_cast<std::remove_reference_t<F>*>(c.object))(step, state);
+        }} {
+        _callable.object = const_cast<void*>(static_cast<const void*>(&f));
+    }
+
+    template <typename R, typename... Args>
+    StateSink(R (*f)(Args...))
+        : _call{[](callable c, size_t step, std::string_view state) {
+            reinterpret_cast<R (*)(Args...)>(c.function)(step, state);
+        }} {
+        _callable.function = reinterpret_cast<void (*)()>(f);
+    }
+
+    void operator()(size_t step, std::string_view state) const {
+        _call(_callable, step, state);
+    }
+
+private:
+    union callable {
+        void* object;
+        void (*function)();
+    };
+
+    callable _callable;
+    void (*_call)(callable, size_t, std::string_view);
+};
+
+// Marks a step as having side effects (e.g. remote calls), so that the
+// CheckpointPolicy::before_side_effects() policy stores the state right before it.
+template <typename F>
+struct SideEffect : F {
+    using F::operator();
+};
+
+template <typename R, typename... Args>
+struct SideEffect<R(*)(Args...)> {
+    R operator()(Args... args) const {
+        return _f(std::forward<Args>(args)...);
+    }
+
+    R(*_f)(Args...);
+};
+
+template <typename F>
+auto side_effect(F f) {
+    if constexpr (std::is_pointer_v<F>) {
+        return SideEffect<F>{f};
+    }
+    else {
+        return SideEffect<F>{std::move(f)};
+    }
+}
+
+template <typename R, typename... Args>
+auto side_effect(R(&f)(Args...)) {
+    return SideEffect<R(*)(Args...)>{f};
+}
+
+namespace helpers {
+
+template <typename T>
+struct is_side_effect : std::false_type {};
+
+template <typename F>
+struct is_side_effect<SideEffect<F>> : std::true_type {};
+
+// Run loop shared by the chains. 'advance' executes current step and returns false if it was
+// suspended, 'current' is the chain's state index. Steps are counted rather than compared by
+// index, since in a branching chain a step may jump over several indices.
+template <typename Chain, typename Advance, typename Index, size_t N>
+bool run_with_checkpoints(
+    const Chain& chain,
+    Advance advance,
+    const Index& current,
+    const std::array<bool, N>& side_effects,
+    StateSink sink,
+    CheckpointPolicy policy
+) {
+    using Mode = CheckpointPolicy::Mode;
+    Index stored = current;
+    size_t executed = 0;
+    std::string buffer;
+    auto checkpoint = [&]() {
+        if (current != stored) {
+            buffer.clear();
+            const auto step = chain.get_current_state(buffer);
+            sink(step, buffer);
+            stored = current;
+            executed = 0;
+        }
+    };
+    try {
+        while (current < N) {
+            if (policy.mode() == Mode::before_side_effects && side_effects[current]) {
+                checkpoint();
+            }
+            if (!advance()) {
+                checkpoint();
+                return false;
+            }
+            ++executed;
+            if (policy.mode() == Mode::every_step ||
+                (policy.mode() == Mode::every_n_steps && executed >= policy.period())) {
+                checkpoint();
+            }
+        }
+    }
+    catch (...) {
+        checkpoint();
+        throw;
+    }
+    if (policy.mode() != Mode::on_interruption) {
+        checkpoint();
+    }
+    return true;
+}
+
+}; // namespace helpers
+}; // namespace steps_chain
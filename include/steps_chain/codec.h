@@ -0,0 +1,191 @@
+#pragma once
+
+#include "util.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+namespace steps_chain {
+
+// Codec defines how chain arguments are turned into bytes and back. Encoded bytes are stored in
+// std::string, which is used here as a plain byte buffer, so wrappers and storage do not depend on
+// the codec being used. Every codec provides:
+//
+//     template <typename T> static constexpr bool supports();
+//     template <typename T> static void encode(const T& value, std::string& out);  // appends
+//     template <typename T> static T decode(std::string_view in);
+//
+// and optionally 'T decode(std::string&& in)', if it can make use of an owned input.
+
+// Default codec. Types must be constructible from std::string and provide a serialize() method
+// that returns a std::string. Types that are also constructible from std::string_view are built
+// straight from the view, for the rest a temporary string is created.
+struct string_codec {
+    template <typename T>
+    static constexpr bool supports() {
+        return helpers::is_serializable<T>::value;
+    }
+
+    template <typename T>
+    static void encode(const T& value, std::string& out) {
+        if (out.empty()) {
+            out = value.serialize();
+        }
+        else {
+            out += value.serialize();
+        }
+    }
+
+    template <typename T>
+    static T decode(std::string&& in) {
+        return T{std::move(in)};
+    }
+
+    template <typename T>
+    static T decode(std::string_view in) {
+        if constexpr (std::is_constructible_v<T, std::string_view>) {
+            return T{in};
+        }
+        else {
+            return T{std::string{in}};
+        }
+    }
+};
+
+namespace helpers {
+
+template <class T, class = void>
+struct has_fields : std::false_type {};
+
+template <class T>
+struct has_fields<T, std::void_t<
+    decltype(std::declval<T&>().fields()),
+    decltype(std::declval<const T&>().fields())>> : std::true_type {};
+
+}; // namespace helpers
+
+// Opts a trivially copyable type into being stored by binary_codec as its raw bytes, padding
+// included. Only for plain values: a pointer, a std::string_view or any other member referring to
+// memory would be read back as a dangling address.
+//
+//     template <> struct steps_chain::raw_bytes<Point> : std::true_type {};
+template <typename T>
+struct raw_bytes : std::false_type {};
+
+// Compact binary codec. Arithmetic and enum values, and types opted in through raw_bytes, are
+// stored as raw bytes in host byte order, strings are prefixed with their length. Any other type
+// must be default constructible and provide 'fields()' and 'fields() const' methods, returning
+// std::tie() of its members, which are encoded one after another:
+//
+//     struct Transaction {
+//         std::string requestId;
+//         int amount;
+//         auto fields() { return std::tie(requestId, amount); }
+//         auto fields() const { return std::tie(requestId, amount); }
+//     };
+
+struct binary_codec {
+    template <typename T>
+    static constexpr bool supports() {
+        if constexpr (std::is_same_v<T, std::string>) {
+            return true;
+        }
+        else if constexpr (helpers::has_fields<T>::value) {
+            using fields_type = decltype(std::declval<const T&>().fields());
+            return std::is_default_constructible_v<T> &&
+                fields_supported(static_cast<fields_type*>(nullptr));
+        }
+        else {
+            return std::is_arithmetic_v<T> || std::is_enum_v<T> ||
+                (raw_bytes<T>::value && std::is_trivially_copyable_v<T> && !std::is_pointer_v<T>);
+        }
+    }
+
+    template <typename T>
+    static void encode(const T& value, std::string& out) {
+        static_assert(supports<T>(), "Type is not supported by binary_codec.");
+        if constexpr (std::is_same_v<T, std::string>) {
+            write_size(value.size(), out);
+            out.append(value);
+        }
+        else if constexpr (helpers::has_fields<T>::value) {
+            std::apply([&out](const auto&... field) { (encode(field, out), ...); }, value.fields());
+        }
+        else {
+            out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+    }
+
+    template <typename T>
+    static T decode(std::string_view in) {
+        size_t pos = 0;
+        T value{};
+        read(value, in, pos);
+        if (pos != in.size()) {
+            throw std::invalid_argument{"binary_codec: unexpected trailing bytes."};
+        }
+        return value;
+    }
+
+private:
+    template <typename... Ts>
+    static constexpr bool fields_supported(std::tuple<Ts...>*) {
+        return (supports<std::decay_t<Ts>>() && ...);
+    }
+
+    static void write_size(size_t size, std::string& out) {
+        // LEB128, one byte is enough for strings shorter than 128 characters.
+        do {
+            uint8_t byte = size & 0x7f;
+            size >>= 7;
+            if (size) {
+                byte |= 0x80;
+            }
+            out.push_back(static_cast<char>(byte));
+        } while (size);
+    }
+
+    static size_t read_size(std::string_view in, size_t& pos) {
+        size_t size = 0;
+        for (unsigned shift = 0; shift < sizeof(size_t) * 8; shift += 7) {
+            require(in, pos, 1);
+            const auto byte = static_cast<uint8_t>(in[pos++]);
+            size |= static_cast<size_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return size;
+            }
+        }
+        throw std::invalid_argument{"binary_codec: malformed length."};
+    }
+
+    static void require(std::string_view in, size_t pos, size_t size) {
+        if (in.size() - pos < size) {
+            throw std::invalid_argument{"binary_codec: input is too short."};
+        }
+    }
+
+    template <typename T>
+    static void read(T& value, std::string_view in, size_t& pos) {
+        if constexpr (std::is_same_v<T, std::string>) {
+            const size_t size = read_size(in, pos);
+            require(in, pos, size);
+            value.assign(in.data() + pos, size);
+            pos += size;
+        }
+        else if constexpr (helpers::has_fields<T>::value) {
+            std::apply([&](auto&... field) { (read(field, in, pos), ...); }, value.fields());
+        }
+        else {
+            require(in, pos, sizeof(T));
+            std::memcpy(&value, in.data() + pos, sizeof(T));
+            pos += sizeof(T);
+        }
+    }
+};
+
+}; // namespace steps_chain
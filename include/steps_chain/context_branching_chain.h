@@ -0,0 +1,260 @@
+#pragma once
+
+#include "util.h"
+#include "branching_helper.h"
+#include "checkpoint.h"
+#include "marshalling_helper.h"
+#include "policy.h"
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <variant>
+
+namespace steps_chain {
+
+using namespace helpers;
+
+// ContextBranchingChain whose steps take a context as the second argument, the same way as in
+// ContextStepsChain. Routing between the steps and state indices are described in
+// branching_chain.h.
+
+template <typename Policy = default_policy, typename... Steps>
+class ContextBranchingChain
+{
+    using tables = BranchingTables<Steps...>;
+
+public:
+    using context_type = typename signature<type_at<0, Steps...>>::context_type;
+    static_assert(!std::is_same_v<context_type, void>,
+                  "ContextBranchingChain steps must have 2 arguments.");
+    static_assert(!std::is_rvalue_reference_v<context_type>,
+                  "Context must be passed by value or by lvalue reference.");
+    static_assert((std::is_same_v<typename signature<Steps>::context_type, context_type> && ...),
+                  "Second argument ('context') types must be identical.");
+
+    // Context type that chain methods accept.
+    using context_reference = std::conditional_t<
+        std::is_reference_v<context_type>, context_type, const context_type&>;
+
+    // State index, the smallest unsigned type that fits the number of steps and result types.
+    using index_type = step_index_t<sizeof...(Steps) + tables::types_count>;
+
+    ContextBranchingChain(Steps... steps) : _steps{std::move(steps)...}, _current{0} {}
+    ContextBranchingChain(policy_tag<Policy>, Steps... steps) : ContextBranchingChain{std::move(steps)...} {}
+
+    // Index of the finished state with the result of type T.
+    template <typename T>
+    static constexpr index_type result_index() {
+        static_assert(tables::template result_state<T>() < tables::states_count,
+                      "T is not a result type of this chain.");
+        return static_cast<index_type>(tables::template result_state<T>());
+    }
+
+    // Run all remaining steps, beginnig with given index.
+    bool run(std::string&& parameters, context_reference ctx, size_t begin_idx = 0) {
+        return run_from(std::move(parameters), ctx, begin_idx);
+    }
+
+    bool run(std::string_view parameters, context_reference ctx, size_t begin_idx = 0) {
+        return run_from(parameters, ctx, begin_idx);
+    }
+
+    bool run(const char* parameters, context_reference ctx, size_t begin_idx = 0) {
+        return run_from(std::string_view{parameters}, ctx, begin_idx);
+    }
+
+    // Just initializer, intended to be used in pair with advance(). Indices of finished states
+    // restore the result, other indices past the last step are rejected with
+    // std::invalid_argument.
+    bool initialize(std::string&& parameters, size_t current_idx = 0) {
+        return initialize_from(std::move(parameters), current_idx);
+    }
+
+    bool initialize(std::string_view parameters, size_t current_idx = 0) {
+        return initialize_from(parameters, current_idx);
+    }
+
+    bool initialize(const char* parameters, size_t current_idx = 0) {
+        return initialize_from(std::string_view{parameters}, current_idx);
+    }
+
+    bool advance(context_reference ctx) {
+        if (_current >= sizeof...(Steps)) {
+            return false;
+        }
+        return execute_current(ctx);
+    }
+
+    // Run all remaining steps, beginning with current index.
+    bool resume(context_reference ctx) {
+        if (_current >= sizeof...(Steps)) {
+            return false;
+        }
+        return execute_from(_current, ctx);
+    }
+
+    // Run all remaining steps like resume(), passing the state to the sink whenever the policy
+    // requires it. Returns false if chain was suspended or already finished.
+    bool run_with_checkpoints(
+        context_reference ctx,
+        StateSink sink,
+        CheckpointPolicy policy = CheckpointPolicy::every_step()
+    ) {
+        if (_current >= sizeof...(Steps)) {
+            return false;
+        }
+        return helpers::run_with_checkpoints(
+            *this, [this, &ctx]() { return execute_current(ctx); },
+            _current, _side_effects, sink, policy);
+    }
+
+    // Get state index and serialized arguments for current step so that they can be stored.
+    // If the chain is finished, the result and index of its type will be returned.
+    std::tuple<index_type, std::string> get_current_state() const {
+        std::string result;
+        append_current_args(result);
+        return std::make_tuple(_current, std::move(result));
+    }
+
+    // Same as above, but serialized arguments are appended to the caller's buffer. Returns state
+    // index.
+    index_type get_current_state(std::string& out) const {
+        append_current_args(out);
+        return _current;
+    }
+
+    // Current argument (or the result) if it has type T, nullptr otherwise.
+    template <typename T>
+    const T* peek() const {
+        if constexpr (is_variant_alternative<T, current_arguments_type>::value) {
+            return std::get_if<T>(&_current_args);
+        }
+        else {
+            return nullptr;
+        }
+    }
+
+    // Type-erased version of peek() used by wrappers, 'type' is a value of type_id<T>().
+    const void* peek(const void* type) const {
+        return std::visit([type](const auto& value) -> const void* {
+            return type_id<std::decay_t<decltype(value)>>() == type ? &value : nullptr;
+        }, _current_args);
+    }
+
+    bool is_finished() const { return _current >= sizeof...(Steps); }
+
+private:
+    template <typename Input>
+    bool run_from(Input parameters, context_reference ctx, size_t begin_idx) {
+        if (begin_idx >= sizeof...(Steps)) {
+            return false;
+        }
+        initialize_from(std::move(parameters), begin_idx);
+        return execute_from(begin_idx, ctx);
+    }
+
+    template <typename Input>
+    bool initialize_from(Input parameters, size_t current_idx) {
+        if (current_idx >= tables::states_count) {
+            throw std::invalid_argument{"ContextBranchingChain: state index is out of range."};
+        }
+        _current = static_cast<index_type>(current_idx);
+        _state_cache.invalidate();
+        deserialize_arguments(std::move(parameters));
+        return current_idx < sizeof...(Steps);
+    }
+
+    // ----- Instantiate callable invokers -----
+
+    static constexpr auto invoke_dispatch_table() {
+        std::array<
+            int(*)(void*, current_arguments_type&, context_reference), sizeof...(Steps)
+        > invoke_dispatch = {&invoke_branching_step<
+            Policy::move_arguments, Steps, current_arguments_type, context_reference>...};
+        return invoke_dispatch;
+    }
+
+    bool execute_from(size_t begin_idx, context_reference ctx) {
+        _current = static_cast<index_type>(begin_idx);
+        while (_current < sizeof...(Steps)) {
+            if (!execute_current(ctx)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Executes current step and moves to the state its outcome leads to, unless the step was
+    // suspended.
+    bool execute_current(context_reference ctx) {
+        constexpr auto table = invoke_dispatch_table();
+        const int outcome = table[_current](_steps.address(_current), _current_args, ctx);
+        if (outcome < 0) {
+            return false;
+        }
+        _state_cache.invalidate();
+        _current = static_cast<index_type>(
+            tables::routes.successor[tables::routes.first_outcome[_current] + outcome]);
+        return true;
+    }
+
+    // ----- Instantiate (de)serialization methods -----
+
+    template <typename Input, typename... Ts>
+    static constexpr auto deserialize_dispatch_table(type_identity<std::variant<Ts...>>) {
+        return marshalling::template deserialize_dispatch_table<Input, Ts...>();
+    }
+
+    template <typename... Ts>
+    static constexpr auto serialize_dispatch_table(type_identity<std::variant<Ts...>>) {
+        return marshalling::template serialize_dispatch_table<Ts...>();
+    }
+
+    template <typename Input>
+    inline void deserialize_arguments(Input parameters) {
+        constexpr auto table =
+            deserialize_dispatch_table<Input>(type_identity<current_arguments_type>{});
+        table[tables::routes.state_alternative[_current]](_current_args, std::move(parameters));
+    }
+
+    inline void append_current_args(std::string& out) const {
+        _state_cache.append(out, [this](std::string& buffer) { serialize_current_args(buffer); });
+    }
+
+    inline void serialize_current_args(std::string& out) const {
+        constexpr auto table = serialize_dispatch_table(type_identity<current_arguments_type>{});
+        table[_current_args.index()](_current_args, out);
+    }
+
+    // ----- Data members and aliases -----
+
+    using steps_type = steps_storage<Steps...>;
+    static_assert(
+        std::is_default_constructible_v<step_argument_t<type_at<0, Steps...>>>,
+        "The argument type of the first step must be default-constructible"
+    );
+    using current_arguments_type = typename tables::arguments_type;
+    using codec = typename Policy::codec;
+    using marshalling = MarshallingInvokeTables<current_arguments_type, codec>;
+
+    template <typename... Ts>
+    static constexpr bool all_supported(type_identity<std::variant<Ts...>>) {
+        return (codec::template supports<Ts>() && ...);
+    }
+    static_assert(all_supported(type_identity<current_arguments_type>{}),
+                  "All arguments and results must be supported by the codec.");
+
+    static constexpr std::array<bool, sizeof...(Steps)> _side_effects{
+        is_side_effect<Steps>::value...};
+
+    steps_type _steps;
+    current_arguments_type _current_args;
+    index_type _current;
+    StateCache<Policy::cache_state> _state_cache;
+};
+
+}; // namespace steps_chain
@@ -0,0 +1,455 @@
+#pragma once
+
+#include "chain_wrapper.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace steps_chain {
+
+// Runs chains held in wrappers (ChainWrapper, ChainWrapperLS or anything with advance() and
+// is_finished()) on a pool of threads. Each thread has its own queue of chains and takes work
+// from the others when it runs out, so CPU-bound chains keep all the threads busy.
+//
+// A chain is advanced up to 'steps_per_slice' steps at a time, then it goes back to the queue,
+// so long chains do not hold up the rest. When a step is suspended (returns std::nullopt), the
+// chain is parked until reschedule() is called with its id, e.g. from a timer or an I/O
+// completion. Calling reschedule() while the chain is still running is fine, it is queued again
+// as soon as it stops. Finished chains are passed to 'on_finished', chains whose step threw
+// to 'on_error', and chains whose step returned an error in result (see result.h) to
+// 'on_failed', all called on the worker thread, after which the executor drops the chain. Failed
+// steps do not throw, so chains that fail this way take no exception path.
+// An exception thrown by a callback does not stop the worker: the first one is kept and rethrown
+// from the next wait_idle(), the others are ignored.
+// Chains must be initialized before they are submitted.
+//
+// Workers share no counters or locks on the way of a chain through the executor: chains live in
+// slots that are reused through per-thread free lists, ids carry the slot index and a generation
+// that tells a reused slot from the old one, and the number of running chains is kept per thread.
+template <typename Chain = ChainWrapper>
+class WorkStealingExecutor {
+public:
+    using chain_id = uint64_t;
+
+    struct Callbacks {
+        std::function<void(chain_id, Chain&)> on_finished;
+        std::function<void(chain_id, Chain&, std::exception_ptr)> on_error;
+        std::function<void(chain_id, Chain&)> on_failed;
+    };
+
+    // 'threads' equal to 0 means one thread per hardware thread.
+    explicit WorkStealingExecutor(
+        Callbacks callbacks,
+        size_t threads = 0,
+        size_t steps_per_slice = 64
+    )
+        : _callbacks{std::move(callbacks)}
+        , _steps_per_slice{std::max<size_t>(steps_per_slice, 1)}
+        , _queues(threads ? threads : std::max(std::thread::hardware_concurrency(), 1u))
+        , _locals(_queues.size() + 1) {
+        _workers.reserve(_queues.size());
+        for (size_t i = 0; i < _queues.size(); ++i) {
+            _workers.emplace_back([this, i]() { work(i); });
+        }
+    }
+
+    WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+    WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+    // Stops the threads once they are done with the current slices, chains that were not
+    // finished are dropped.
+    ~WorkStealingExecutor() {
+        {
+            std::lock_guard<std::mutex> lock{_sleep_mutex};
+            _stop.store(true);
+        }
+        _wake.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    chain_id submit(Chain chain) {
+        Slot& slot = acquire_slot();
+        slot.chain.emplace(std::move(chain));
+        const uint32_t generation = generation_of(slot.control.load(std::memory_order_relaxed));
+        slot.control.store(control_of(generation, State::queued), std::memory_order_relaxed);
+        local().started.fetch_add(1, std::memory_order_release);
+        // The chain may be finished and dropped before push() returns.
+        push(&slot);
+        return (chain_id{generation} << 32) | slot.index;
+    }
+
+    // Queues a parked chain again. Returns false if there is no such chain, e.g. it has finished.
+    bool reschedule(chain_id id) {
+        Slot* slot = find(static_cast<uint32_t>(id));
+        if (!slot) {
+            return false;
+        }
+        const auto generation = static_cast<uint32_t>(id >> 32);
+        auto control = slot->control.load(std::memory_order_acquire);
+        while (generation_of(control) == generation) {
+            switch (state_of(control)) {
+            case State::parked:
+                if (slot->control.compare_exchange_weak(
+                        control, control_of(generation, State::queued))) {
+                    local().started.fetch_add(1, std::memory_order_release);
+                    push(slot);
+                    return true;
+                }
+                break;
+            case State::running:
+                if (slot->control.compare_exchange_weak(
+                        control, control_of(generation, State::wake_pending))) {
+                    return true;
+                }
+                break;
+            case State::free:
+                return false;
+            default:
+                return true;  // Already queued or going to be.
+            }
+        }
+        return false;
+    }
+
+    // Blocks until every chain is either finished or parked. Rethrows the first exception thrown
+    // by a callback since the previous call.
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock{_idle_mutex};
+        _idle_waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        _idle.wait(lock, [this]() { return idle(); });
+        _idle_waiters.fetch_sub(1);
+        if (_callback_error) {
+            std::rethrow_exception(std::exchange(_callback_error, nullptr));
+        }
+    }
+
+    size_t threads() const { return _workers.size(); }
+
+private:
+    enum class State : uint8_t {
+        queued,
+        running,
+        wake_pending,  // rescheduled while running
+        parked,
+        free
+    };
+
+    struct Slot {
+        std::optional<Chain> chain;
+        // Generation of the slot above the lowest byte, State in it. The generation changes
+        // when the chain is dropped, so a stale id does not match the next chain in the slot.
+        std::atomic<uint64_t> control{0};
+        uint32_t index{0};
+    };
+
+    // Owner takes chains from the back, thieves from the front. 'size' lets sleeping threads
+    // look for work without taking the locks.
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<Slot*> slots;
+        std::atomic<size_t> size{0};
+    };
+
+    // Written by one worker only. A chain is active from the time it is queued by submit() or
+    // reschedule() until it is parked or dropped, that is, 'started' minus 'stopped' summed over
+    // all the threads. The last entry is shared by the threads outside the pool, its free list
+    // is guarded by '_shared_mutex'.
+    struct alignas(64) Local {
+        std::atomic<uint64_t> started{0};
+        std::atomic<uint64_t> stopped{0};
+        std::vector<uint32_t> free;
+    };
+
+    // Slots are allocated in chunks of 1024, 2048, 4096, ... and never move.
+    static constexpr size_t first_chunk_bits = 10;
+    static constexpr size_t max_chunks = 22;
+    // Slots moved between a worker's free list and the shared one at a time.
+    static constexpr size_t free_batch = 64;
+
+    static uint64_t control_of(uint32_t generation, State state) {
+        return (uint64_t{generation} << 8) | static_cast<uint8_t>(state);
+    }
+
+    static State state_of(uint64_t control) {
+        return static_cast<State>(control & 0xff);
+    }
+
+    static uint32_t generation_of(uint64_t control) {
+        return static_cast<uint32_t>(control >> 8);
+    }
+
+    bool on_worker() const {
+        return _current_executor == this;
+    }
+
+    Local& local() {
+        return on_worker() ? _locals[_current_worker] : _locals.back();
+    }
+
+    Slot* find(uint32_t index) const {
+        if (index >= _slot_count.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        const size_t chunk = helpers::highest_bit((index >> first_chunk_bits) + 1);
+        const size_t first = ((size_t{1} << chunk) - 1) << first_chunk_bits;
+        return &_chunks[chunk][index - first];
+    }
+
+    Slot& acquire_slot() {
+        auto& free = local().free;
+        if (on_worker()) {
+            if (free.empty()) {
+                auto& shared = _locals.back().free;
+                std::lock_guard<std::mutex> lock{_shared_mutex};
+                const size_t count = std::min(shared.size(), free_batch);
+                free.insert(free.end(), shared.end() - count, shared.end());
+                shared.resize(shared.size() - count);
+            }
+            if (!free.empty()) {
+                const uint32_t index = free.back();
+                free.pop_back();
+                return *find(index);
+            }
+        }
+        else {
+            std::lock_guard<std::mutex> lock{_shared_mutex};
+            if (!free.empty()) {
+                const uint32_t index = free.back();
+                free.pop_back();
+                return *find(index);
+            }
+        }
+        std::lock_guard<std::mutex> lock{_grow_mutex};
+        const auto index = static_cast<uint32_t>(_slot_count.load(std::memory_order_relaxed));
+        const size_t chunk = helpers::highest_bit((index >> first_chunk_bits) + 1);
+        if (chunk >= max_chunks) {
+            throw std::length_error{"Too many chains in the executor."};
+        }
+        if (!_chunks[chunk]) {
+            _chunks[chunk] = std::make_unique<Slot[]>(size_t{1} << (chunk + first_chunk_bits));
+        }
+        Slot& slot = _chunks[chunk][index - (((size_t{1} << chunk) - 1) << first_chunk_bits)];
+        slot.index = index;
+        _slot_count.store(index + 1, std::memory_order_release);
+        return slot;
+    }
+
+    // Only called on workers.
+    void release_slot(Slot& slot) {
+        slot.chain.reset();
+        const uint32_t generation = generation_of(slot.control.load(std::memory_order_relaxed));
+        slot.control.store(control_of(generation + 1, State::free), std::memory_order_release);
+        auto& free = local().free;
+        free.push_back(slot.index);
+        if (free.size() >= 2 * free_batch) {
+            auto& shared = _locals.back().free;
+            std::lock_guard<std::mutex> lock{_shared_mutex};
+            shared.insert(shared.end(), free.end() - free_batch, free.end());
+            free.resize(free.size() - free_batch);
+        }
+    }
+
+    void push(Slot* slot) {
+        const size_t index = on_worker()
+            ? _current_worker
+            : _next_queue.fetch_add(1, std::memory_order_relaxed) % _queues.size();
+        auto& queue = _queues[index];
+        {
+            std::lock_guard<std::mutex> lock{queue.mutex};
+            queue.slots.push_back(slot);
+            queue.size.store(queue.slots.size(), std::memory_order_relaxed);
+        }
+        // Pairs with the fence in work(): either this thread sees the sleeper, or the sleeper
+        // sees the queued chain.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_sleeping.load(std::memory_order_relaxed) > 0) {
+            { std::lock_guard<std::mutex> lock{_sleep_mutex}; }
+            _wake.notify_one();
+        }
+    }
+
+    Slot* pop(size_t own) {
+        {
+            auto& queue = _queues[own];
+            std::lock_guard<std::mutex> lock{queue.mutex};
+            if (!queue.slots.empty()) {
+                Slot* slot = queue.slots.back();
+                queue.slots.pop_back();
+                queue.size.store(queue.slots.size(), std::memory_order_relaxed);
+                return slot;
+            }
+        }
+        for (size_t i = 1; i < _queues.size(); ++i) {
+            auto& queue = _queues[(own + i) % _queues.size()];
+            if (queue.size.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock{queue.mutex};
+            if (!queue.slots.empty()) {
+                Slot* slot = queue.slots.front();
+                queue.slots.pop_front();
+                queue.size.store(queue.slots.size(), std::memory_order_relaxed);
+                return slot;
+            }
+        }
+        return nullptr;
+    }
+
+    bool has_queued() const {
+        for (const auto& queue : _queues) {
+            if (queue.size.load(std::memory_order_relaxed) > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t index) {
+        _current_executor = this;
+        _current_worker = index;
+        while (!_stop.load(std::memory_order_relaxed)) {
+            if (Slot* slot = pop(index)) {
+                run_slice(*slot);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock{_sleep_mutex};
+            _sleeping.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            _wake.wait(lock, [this]() { return _stop.load() || has_queued(); });
+            _sleeping.fetch_sub(1);
+        }
+    }
+
+    void run_slice(Slot& slot) {
+        const uint32_t generation = generation_of(slot.control.load(std::memory_order_relaxed));
+        slot.control.store(control_of(generation, State::running));
+        Chain& chain = *slot.chain;
+        const chain_id id = (chain_id{generation} << 32) | slot.index;
+        bool suspended = false;
+        try {
+            for (size_t i = 0; i < _steps_per_slice; ++i) {
+                if (!chain.advance()) {
+                    suspended = !chain.is_finished();
+                    break;
+                }
+            }
+        }
+        catch (...) {
+            notify(_callbacks.on_error, id, chain, std::current_exception());
+            drop(slot);
+            return;
+        }
+        if (chain.is_finished()) {
+            notify(_callbacks.on_finished, id, chain);
+            drop(slot);
+            return;
+        }
+        if (suspended && helpers::chain_failed(chain)) {
+            notify(_callbacks.on_failed, id, chain);
+            drop(slot);
+            return;
+        }
+        if (suspended) {
+            auto control = control_of(generation, State::running);
+            if (slot.control.compare_exchange_strong(
+                    control, control_of(generation, State::parked))) {
+                stop_active();
+                return;
+            }
+            // Rescheduled while running.
+        }
+        slot.control.store(control_of(generation, State::queued), std::memory_order_relaxed);
+        push(&slot);
+    }
+
+    // Calls the callback if it is set, an exception from it is kept for wait_idle().
+    template <typename F, typename... Args>
+    void notify(const F& callback, Args&&... args) {
+        if (!callback) {
+            return;
+        }
+        try {
+            callback(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock{_idle_mutex};
+            if (!_callback_error) {
+                _callback_error = std::current_exception();
+            }
+        }
+    }
+
+    void drop(Slot& slot) {
+        release_slot(slot);
+        stop_active();
+    }
+
+    void stop_active() {
+        local().stopped.fetch_add(1, std::memory_order_release);
+        // Pairs with the fence in wait_idle(), as the one in push() with work().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_idle_waiters.load(std::memory_order_relaxed) > 0 && idle()) {
+            { std::lock_guard<std::mutex> lock{_idle_mutex}; }
+            _idle.notify_all();
+        }
+    }
+
+    // Each chain is stopped after it is started, so when all the stops read first are matched
+    // by the starts read after them, there was a moment with no active chains.
+    bool idle() const {
+        uint64_t stopped = 0;
+        for (const auto& counters : _locals) {
+            stopped += counters.stopped.load(std::memory_order_acquire);
+        }
+        uint64_t started = 0;
+        for (const auto& counters : _locals) {
+            started += counters.started.load(std::memory_order_acquire);
+        }
+        return started == stopped;
+    }
+
+    Callbacks _callbacks;
+    const size_t _steps_per_slice;
+    std::vector<Queue> _queues;
+    std::vector<Local> _locals;  // one per worker and one for the other threads
+    std::vector<std::thread> _workers;
+
+    std::array<std::unique_ptr<Slot[]>, max_chunks> _chunks;
+    std::atomic<size_t> _slot_count{0};
+    std::mutex _grow_mutex;
+    std::mutex _shared_mutex;
+
+    std::atomic<size_t> _next_queue{0};
+    std::atomic<size_t> _sleeping{0};
+    std::atomic<size_t> _idle_waiters{0};
+
+    std::mutex _sleep_mutex;
+    std::condition_variable _wake;
+    std::atomic<bool> _stop{false};
+
+    std::mutex _idle_mutex;
+    std::condition_variable _idle;
+    std::exception_ptr _callback_error;
+
+    static inline thread_local const WorkStealingExecutor* _current_executor = nullptr;
+    static inline thread_local size_t _current_worker = 0;
+};
+
+}; // namespace steps_chain
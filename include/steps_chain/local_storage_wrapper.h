@@ -1,190 +1,414 @@
 #pragma once
 
+#include "checkpoint.h"
+#include "observer.h"
+#include "result.h"
+#include "util.h"
+
+#include <cstddef>
+#include <cstring>
+#include <new>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <type_traits>
+#include <utility>
 
 namespace steps_chain {
 
 namespace _detail {
 
     struct vtable {
-        bool (*run)(void* ptr, std::string parameters, uint8_t begin);
-        bool (*initialize)(void* ptr, std::string parameters, uint8_t begin);
+        bool (*run)(void* ptr, std::string&& parameters, size_t begin);
+        bool (*run_view)(void* ptr, std::string_view parameters, size_t begin);
+        bool (*initialize)(void* ptr, std::string&& parameters, size_t begin);
+        bool (*initialize_view)(void* ptr, std::string_view parameters, size_t begin);
         bool (*advance)(void* ptr);
         bool (*resume)(void* ptr);
-        std::tuple<uint8_t, std::string> (*get_current_state)(const void* ptr);
+        bool (*run_with_checkpoints)(void* ptr, StateSink sink, CheckpointPolicy policy);
+        std::tuple<size_t, std::string> (*get_current_state)(const void* ptr);
+        size_t (*append_current_state)(const void* ptr, std::string& out);
+        const void* (*peek)(const void* ptr, const void* type);
         bool (*is_finished)(const void* ptr);
+        bool (*failed)(const void* ptr);
+        const void* (*error)(const void* ptr, const void* type);
+        bool (*set_observer)(void* ptr, StepObserver* observer);
 
         void (*destroy_)(void* ptr);
         void (*clone)(void* storage, const void* ptr);
-        void (*move_clone)(void* storage, void* ptr);
+        // Moves the object to the storage and destroys the source, nullptr if the wrapper's
+        // buffer can simply be copied.
+        void (*relocate)(void* storage, void* ptr);
     };
 
-    template<typename Chain>
-    constexpr vtable vtable_for {
-        [](void* ptr, std::string parameters, uint8_t begin) {
-            return static_cast<Chain*>(ptr)->run(std::move(parameters), begin);
+    // Object of type T kept in the wrapper's buffer, either in place or, if 'on_heap', as a
+    // pointer to a heap allocated one.
+    template<typename T, bool on_heap>
+    struct holder {
+        static T* get(void* storage) {
+            if constexpr (on_heap) {
+                return *std::launder(static_cast<T**>(storage));
+            }
+            else {
+                return std::launder(static_cast<T*>(storage));
+            }
+        }
+
+        static const T* get(const void* storage) {
+            return get(const_cast<void*>(storage));
+        }
+
+        template<typename... Args>
+        static void create(void* storage, Args&&... args) {
+            if constexpr (on_heap) {
+                new (storage) T*{new T{std::forward<Args>(args)...}};
+            }
+            else {
+                new (storage) T{std::forward<Args>(args)...};
+            }
+        }
+
+        static void destroy(void* storage) {
+            if constexpr (on_heap) {
+                delete get(storage);
+            }
+            else {
+                get(storage)->~T();
+            }
+        }
+
+        static void clone(void* storage, const void* ptr) {
+            create(storage, *get(ptr));
+        }
+
+        static void relocate(void* storage, void* ptr) {
+            T* source = get(ptr);
+            new (storage) T{std::move(*source)};
+            source->~T();
+        }
+
+        // Pointers are relocated by copying them.
+        static constexpr auto relocator() -> void(*)(void*, void*) {
+            if constexpr (on_heap || is_trivially_relocatable<T>::value) {
+                return nullptr;
+            }
+            else {
+                return &relocate;
+            }
+        }
+    };
+
+    template<typename Chain, bool on_heap>
+    inline constexpr vtable vtable_for {
+        [](void* ptr, std::string&& parameters, size_t begin) {
+            return holder<Chain, on_heap>::get(ptr)->run(std::move(parameters), begin);
+        },
+        [](void* ptr, std::string_view parameters, size_t begin) {
+            return holder<Chain, on_heap>::get(ptr)->run(parameters, begin);
         },
-        [](void* ptr, std::string parameters, uint8_t begin) {
-            return static_cast<Chain*>(ptr)->initialize(std::move(parameters), begin);
+        [](void* ptr, std::string&& parameters, size_t begin) {
+            return holder<Chain, on_heap>::get(ptr)->initialize(std::move(parameters), begin);
+        },
+        [](void* ptr, std::string_view parameters, size_t begin) {
+            return holder<Chain, on_heap>::get(ptr)->initialize(parameters, begin);
         },
         [](void* ptr) {
-            return static_cast<Chain*>(ptr)->advance();
+            return holder<Chain, on_heap>::get(ptr)->advance();
         },
         [](void* ptr) {
-            return static_cast<Chain*>(ptr)->resume();
+            return holder<Chain, on_heap>::get(ptr)->resume();
+        },
+        [](void* ptr, StateSink sink, CheckpointPolicy policy) {
+            return holder<Chain, on_heap>::get(ptr)->run_with_checkpoints(sink, policy);
         },
-        [](const void* ptr) -> std::tuple<uint8_t, std::string> {
-            return static_cast<const Chain*>(ptr)->get_current_state();
+        [](const void* ptr) -> std::tuple<size_t, std::string> {
+            return holder<Chain, on_heap>::get(ptr)->get_current_state();
+        },
+        [](const void* ptr, std::string& out) -> size_t {
+            return holder<Chain, on_heap>::get(ptr)->get_current_state(out);
+        },
+        [](const void* ptr, const void* type) -> const void* {
+            return holder<Chain, on_heap>::get(ptr)->peek(type);
         },
         [](const void* ptr) -> bool {
-            return static_cast<const Chain*>(ptr)->is_finished();
+            return holder<Chain, on_heap>::get(ptr)->is_finished();
         },
-
-        [](void* ptr) {
-            static_cast<Chain*>(ptr)->~Chain();
+        [](const void* ptr) -> bool {
+            return helpers::chain_failed(*holder<Chain, on_heap>::get(ptr));
         },
-        [](void* storage, const void* ptr) {
-            new (storage) Chain{*static_cast<const Chain*>(ptr)};
+        [](const void* ptr, const void* type) -> const void* {
+            return helpers::chain_error(*holder<Chain, on_heap>::get(ptr), type);
         },
-        [](void* storage, void* ptr) {
-            new (storage) Chain{std::move(*static_cast<Chain*>(ptr))};
-        }
+        [](void* ptr, StepObserver* observer) {
+            return helpers::attach_observer(*holder<Chain, on_heap>::get(ptr), observer);
+        },
+
+        &holder<Chain, on_heap>::destroy,
+        &holder<Chain, on_heap>::clone,
+        holder<Chain, on_heap>::relocator()
     };
 
     template<typename Chain, typename Context>
-    constexpr vtable vtable_ctx_for {
-        [](void* ptr, std::string parameters, uint8_t begin) {
-            auto* p = static_cast<std::pair<Chain, Context>*>(ptr);
-            return p->first.run(std::move(parameters), p->second, begin);
+    decltype(auto) context_of(std::pair<Chain, Context>* p) {
+        return helpers::context_from<typename Chain::context_reference>(p->second);
+    }
+
+    template<typename Chain, typename Context, bool on_heap>
+    inline constexpr vtable vtable_ctx_for {
+        [](void* ptr, std::string&& parameters, size_t begin) {
+            auto* p = holder<std::pair<Chain, Context>, on_heap>::get(ptr);
+            return p->first.run(std::move(parameters), context_of(p), begin);
         },
-        [](void* ptr, std::string parameters, uint8_t begin) {;
-            return static_cast<std::pair<Chain, Context>*>(ptr)->first
+        [](void* ptr, std::string_view parameters, size_t begin) {
+            auto* p = holder<std::pair<Chain, Context>, on_heap>::get(ptr);
+            return p->first.run(parameters, context_of(p), begin);
+        },
+        [](void* ptr, std::string&& parameters, size_t begin) {
+            return holder<std::pair<Chain, Context>, on_heap>::get(ptr)->first
                 .initialize(std::move(parameters), begin);
         },
+        [](void* ptr, std::string_view parameters, size_t begin) {
+            return holder<std::pair<Chain, Context>, on_heap>::get(ptr)->first
+                .initialize(parameters, begin);
+        },
         [](void* ptr) {
-            auto* p = static_cast<std::pair<Chain, Context>*>(ptr);
-            return p->first.advance(p->second);
+            auto* p = holder<std::pair<Chain, Context>, on_heap>::get(ptr);
+            return p->first.advance(context_of(p));
         },
         [](void* ptr) {
-            auto* p = static_cast<std::pair<Chain, Context>*>(ptr);
-            return p->first.resume(p->second);
+            auto* p = holder<std::pair<Chain, Context>, on_heap>::get(ptr);
+            return p->first.resume(context_of(p));
+        },
+        [](void* ptr, StateSink sink, CheckpointPolicy policy) {
+            auto* p = holder<std::pair<Chain, Context>, on_heap>::get(ptr);
+            return p->first.run_with_checkpoints(context_of(p), sink, policy);
+        },
+        [](const void* ptr) -> std::tuple<size_t, std::string> {
+            return holder<std::pair<Chain, Context>, on_heap>::get(ptr)->first.get_current_state();
+        },
+        [](const void* ptr, std::string& out) -> size_t {
+            return holder<std::pair<Chain, Context>, on_heap>::get(ptr)->first
+                .get_current_state(out);
         },
-        [](const void* ptr) -> std::tuple<uint8_t, std::string> {
-            return static_cast<const std::pair<Chain, Context>*>(ptr)->first.get_current_state();
+        [](const void* ptr, const void* type) -> const void* {
+            return holder<std::pair<Chain, Context>, on_heap>::get(ptr)->first.peek(type);
         },
         [](const void* ptr) -> bool {
-            return static_cast<const std::pair<Chain, Context>*>(ptr)->first.is_finished();
+            return holder<std::pair<Chain, Context>, on_heap>::get(ptr)->first.is_finished();
         },
-
-        [](void* ptr) {
-            static_cast<std::pair<Chain, Context>*>(ptr)->~pair();
+        [](const void* ptr) -> bool {
+            return helpers::chain_failed(
+                holder<std::pair<Chain, Context>, on_heap>::get(ptr)->first);
         },
-        [](void* storage, const void* ptr) {
-            new (storage) std::pair<Chain, Context>{
-                *static_cast<const std::pair<Chain, Context>*>(ptr)};
+        [](const void* ptr, const void* type) -> const void* {
+            return helpers::chain_error(
+                holder<std::pair<Chain, Context>, on_heap>::get(ptr)->first, type);
         },
-        [](void* storage, void* ptr) {
-            new (storage) std::pair<Chain, Context>{
-                std::move(*static_cast<std::pair<Chain, Context>*>(ptr))};
-        }
+        [](void* ptr, StepObserver* observer) {
+            return helpers::attach_observer(
+                holder<std::pair<Chain, Context>, on_heap>::get(ptr)->first, observer);
+        },
+
+        &holder<std::pair<Chain, Context>, on_heap>::destroy,
+        &holder<std::pair<Chain, Context>, on_heap>::clone,
+        holder<std::pair<Chain, Context>, on_heap>::relocator()
+    };
+
+    // Default-constructed (or moved from) wrapper behaves like an empty ChainWrapper.
+    inline constexpr vtable empty_vtable {
+        [](void*, std::string&&, size_t) { return false; },
+        [](void*, std::string_view, size_t) { return false; },
+        [](void*, std::string&&, size_t) { return false; },
+        [](void*, std::string_view, size_t) { return false; },
+        [](void*) { return false; },
+        [](void*) { return false; },
+        [](void*, StateSink, CheckpointPolicy) { return false; },
+        [](const void*) -> std::tuple<size_t, std::string> { return std::make_tuple(-1, ""); },
+        [](const void*, std::string&) -> size_t { return -1; },
+        [](const void*, const void*) -> const void* { return nullptr; },
+        [](const void*) { return false; },
+        [](const void*) { return false; },
+        [](const void*, const void*) -> const void* { return nullptr; },
+        [](void*, StepObserver*) { return false; },
+
+        [](void*) {},
+        [](void*, const void*) {},
+        nullptr
     };
 
 };  // namespace _detail
 
-// This wrapper will store its content in local buffer, so no heap allocations will occur.
-// Everything will be on the stack, so big containers with these wrappers may cause overflow.
-// It is also slightly faster to dispatch calls.
+// This wrapper stores the chain (and the context) in its own buffer of 'Capacity' bytes, so
+// usually no heap allocations occur. Chains that do not fit, need a stricter alignment or may
+// throw when moved are allocated on the heap, and the buffer keeps the pointer. Everything else
+// is on the stack, so big arrays of these wrappers may cause overflow. It is also slightly faster
+// to dispatch calls.
+//
+// Moving the wrapper copies the buffer with memcpy if the chain is trivially relocatable (see
+// is_trivially_relocatable) or is on the heap, so growing a vector of such wrappers does not
+// call into the chains at all. Calls on an empty wrapper return the same values as ChainWrapper.
+template <size_t Capacity = 64, size_t Alignment = alignof(std::max_align_t)>
+class BasicChainWrapperLS {
+    static_assert(Capacity >= sizeof(void*), "Wrapper buffer must fit at least a pointer.");
+    static_assert(Alignment >= alignof(void*), "Wrapper buffer must be aligned for a pointer.");
 
-class ChainWrapperLS {
 public:
-    ChainWrapperLS()
-        : vtable_{nullptr} {
+    // True if the object (a chain, or a pair of the chain and its context) is kept in the buffer.
+    template<typename T>
+    static constexpr bool stored_inline = sizeof(T) <= Capacity && alignof(T) <= Alignment &&
+        (std::is_nothrow_move_constructible_v<T> || is_trivially_relocatable<T>::value);
+
+    BasicChainWrapperLS()
+        : vtable_{&_detail::empty_vtable} {
     }
 
-    template<typename Chain>
-    ChainWrapperLS(Chain chain)
-        : vtable_{&_detail::vtable_for<Chain>}
+    template<typename Chain, typename = helpers::not_wrapper<Chain, BasicChainWrapperLS>>
+    BasicChainWrapperLS(Chain chain)
+        : vtable_{&_detail::vtable_for<Chain, !stored_inline<Chain>>}
     {
-        static_assert(sizeof(Chain) <= sizeof(buf_), "Wrapper buffer is too small!");
-        new(&buf_) Chain{std::move(chain)};
+        _detail::holder<Chain, !stored_inline<Chain>>::create(buf_, std::move(chain));
     }
 
     template<typename Chain, typename Context>
-    ChainWrapperLS(Chain x, Context c)
-        : vtable_{&_detail::vtable_ctx_for<Chain, Context>}
+    BasicChainWrapperLS(Chain x, Context c)
+        : vtable_{&_detail::vtable_ctx_for<Chain, Context,
+                                           !stored_inline<std::pair<Chain, Context>>>}
     {
-        static_assert(sizeof(std::pair<Chain, Context>) <= sizeof(buf_),
-            "Wrapper buffer is too small!");
-        new(&buf_) std::pair<Chain, Context>{std::move(x), std::move(c)};
+        _detail::holder<std::pair<Chain, Context>, !stored_inline<std::pair<Chain, Context>>>
+            ::create(buf_, std::move(x), std::move(c));
     }
 
-    ~ChainWrapperLS() {
-        if (vtable_) {
-            vtable_->destroy_(&buf_);
+    // Moved from wrappers are empty, checking for that saves an indirect call for each element
+    // when a vector reallocates.
+    ~BasicChainWrapperLS() {
+        if (vtable_ != &_detail::empty_vtable) {
+            vtable_->destroy_(buf_);
         }
     }
 
-    // Copy/move operations will fail if right operand will be a default-constructed wrapper.
-    // For now I will not add handling for that, as that would be a pessimization. Such assignments
-    // are unlikely and will lead to a crash, so handling will be added if necessary.
-    ChainWrapperLS(const ChainWrapperLS& other) {
-        other.vtable_->clone(&buf_, &other.buf_);
+    BasicChainWrapperLS(const BasicChainWrapperLS& other)
+        : vtable_{&_detail::empty_vtable} {
+        other.vtable_->clone(buf_, other.buf_);
         vtable_ = other.vtable_;
     }
 
-    ChainWrapperLS(ChainWrapperLS&& other) noexcept {
-        other.vtable_->move_clone(&buf_, &other.buf_);
-        vtable_ = other.vtable_;
-        other.vtable_ = nullptr;
+    BasicChainWrapperLS(BasicChainWrapperLS&& other) noexcept {
+        take(other);
     }
 
-    ChainWrapperLS& operator=(const ChainWrapperLS& other) {
-        if (vtable_) {
-            vtable_->destroy_(&buf_);
+    // If copying the chain throws, the wrapper is left empty.
+    BasicChainWrapperLS& operator=(const BasicChainWrapperLS& other) {
+        if (this != &other) {
+            reset();
+            other.vtable_->clone(buf_, other.buf_);
+            vtable_ = other.vtable_;
         }
-        other.vtable_->clone(&buf_, &other.buf_);
-        vtable_ = other.vtable_;
         return *this;
     }
-    ChainWrapperLS& operator=(ChainWrapperLS&& other) noexcept {
-        if (vtable_) {
-            vtable_->destroy_(&buf_);
+
+    BasicChainWrapperLS& operator=(BasicChainWrapperLS&& other) noexcept {
+        if (this != &other) {
+            vtable_->destroy_(buf_);
+            take(other);
         }
-        other.vtable_->move_clone(&buf_, &other.buf_);
-        vtable_ = other.vtable_;
-        other.vtable_ = nullptr;
         return *this;
     }
 
-    bool run(std::string parameters, uint8_t begin = 0) {
-        return vtable_->run(&buf_, std::move(parameters), begin);
+    bool run(std::string&& parameters, size_t begin = 0) {
+        return vtable_->run(buf_, std::move(parameters), begin);
     }
 
-    bool initialize(std::string parameters, uint8_t begin = 0) {
-        return vtable_->initialize(&buf_, std::move(parameters), begin);
+    bool run(std::string_view parameters, size_t begin = 0) {
+        return vtable_->run_view(buf_, parameters, begin);
+    }
+
+    bool run(const char* parameters, size_t begin = 0) {
+        return run(std::string_view{parameters}, begin);
+    }
+
+    bool initialize(std::string&& parameters, size_t begin = 0) {
+        return vtable_->initialize(buf_, std::move(parameters), begin);
+    }
+
+    bool initialize(std::string_view parameters, size_t begin = 0) {
+        return vtable_->initialize_view(buf_, parameters, begin);
+    }
+
+    bool initialize(const char* parameters, size_t begin = 0) {
+        return initialize(std::string_view{parameters}, begin);
     }
 
     bool advance() {
-        return vtable_->advance(&buf_);
+        return vtable_->advance(buf_);
     }
 
     bool resume() {
-        return vtable_->resume(&buf_);
+        return vtable_->resume(buf_);
     }
 
-    std::tuple<uint8_t, std::string> get_current_state() const {
-        return vtable_->get_current_state(&buf_);
+    bool run_with_checkpoints(
+        StateSink sink,
+        CheckpointPolicy policy = CheckpointPolicy::every_step()
+    ) {
+        return vtable_->run_with_checkpoints(buf_, sink, policy);
+    }
+
+    std::tuple<size_t, std::string> get_current_state() const {
+        return vtable_->get_current_state(buf_);
+    }
+
+    // Appends serialized arguments to the caller's buffer and returns step index.
+    size_t get_current_state(std::string& out) const {
+        return vtable_->append_current_state(buf_, out);
+    }
+
+    template <typename T>
+    const T* peek() const {
+        return static_cast<const T*>(vtable_->peek(buf_, helpers::type_id<T>()));
     }
 
     bool is_finished() const {
-        return vtable_->is_finished(&buf_);
+        return vtable_->is_finished(buf_);
+    }
+
+    // True if the current step returned an error in result, see result.h.
+    bool failed() const {
+        return vtable_->failed(buf_);
+    }
+
+    // Error returned by the current step if it has type E, nullptr otherwise.
+    template <typename E>
+    const E* error() const {
+        return static_cast<const E*>(vtable_->error(buf_, helpers::type_id<E>()));
+    }
+
+    // Attaches the observer to the chain, nullptr detaches it. Returns false if the chain's
+    // policy observer is not runtime_observer, see observer.h.
+    bool set_observer(StepObserver* observer) {
+        return vtable_->set_observer(buf_, observer);
     }
 
 private:
-    std::aligned_storage_t<64> buf_;
+    void reset() {
+        vtable_->destroy_(buf_);
+        vtable_ = &_detail::empty_vtable;
+    }
+
+    // Leaves 'other' empty.
+    void take(BasicChainWrapperLS& other) noexcept {
+        if (other.vtable_->relocate) {
+            other.vtable_->relocate(buf_, other.buf_);
+        }
+        else {
+            std::memcpy(buf_, other.buf_, Capacity);
+        }
+        vtable_ = std::exchange(other.vtable_, &_detail::empty_vtable);
+    }
+
+    alignas(Alignment) unsigned char buf_[Capacity];
     const _detail::vtable* vtable_;
 };
 
+using ChainWrapperLS = BasicChainWrapperLS<>;
+
 }; // namespace steps_chain
@@ -3,46 +3,71 @@
 #include "util.h"
 
 #include <array>
-#include <tuple>
+#include <string>
 
 namespace steps_chain {
 namespace helpers {
 
-template<typename Steps, typename Arg>
+// Tables are built from the argument types of the steps, so steps sharing an argument type share
+// the (de)serializer too.
+template<typename Arg, typename Codec>
 struct MarshallingInvokeTables {
-    template <size_t idx>
-    static constexpr auto make_deserializer() {
-        return [](Arg& data, std::string parameters) -> void {
-            using argument_type = std::decay_t<
-                typename signature<std::tuple_element_t<idx, Steps>>::arg_type>;
-            data = argument_type{std::move(parameters)};
-        };
+    // Input is either an owning std::string or a std::string_view.
+    template <typename T, typename Input>
+    static void deserialize(Arg& data, Input parameters) {
+        data.template emplace<T>(Codec::template decode<T>(std::move(parameters)));
     }
 
-    template <size_t... Idx>
-    static constexpr auto deserialize_dispatch_table(std::index_sequence<Idx...>) {
-        std::array<void(*)(Arg&, std::string), sizeof...(Idx)>
-            deserialize_dispatch = {make_deserializer<Idx>()...};
+    template <typename Input, typename... Ts>
+    static constexpr auto deserialize_dispatch_table() {
+        std::array<void(*)(Arg&, Input), sizeof...(Ts)>
+            deserialize_dispatch = {&deserialize<Ts, Input>...};
         return deserialize_dispatch;
     }
 
-    // TODO: add static assert for the required 'serialize' method signature (const)
-    template <size_t idx>
-    static constexpr auto make_serializer() {
-        return [](const Arg& data) -> std::string {
-            using arg_type = std::decay_t<
-                typename signature<std::tuple_element_t<idx, Steps>>::arg_type>;
-            return std::get<arg_type>(data).serialize();
-        };
+    template <typename T>
+    static void serialize(const Arg& data, std::string& out) {
+        Codec::encode(std::get<T>(data), out);
     }
 
-    template <size_t... Idx>
-    static constexpr auto serialize_dispatch_table(std::index_sequence<Idx...>) {
-        std::array<std::string(*)(const Arg&), sizeof...(Idx)>
-            serialize_dispatch = {make_serializer<Idx>()...};
+    template <typename... Ts>
+    static constexpr auto serialize_dispatch_table() {
+        std::array<void(*)(const Arg&, std::string&), sizeof...(Ts)>
+            serialize_dispatch = {&serialize<Ts>...};
         return serialize_dispatch;
     }
 };
 
+// Keeps the last serialized form of the current arguments, see default_policy::cache_state.
+template <bool enabled>
+struct StateCache {
+    void invalidate() {}
+
+    template <typename Serialize>
+    void append(std::string& out, Serialize serialize) const {
+        serialize(out);
+    }
+};
+
+template <>
+struct StateCache<true> {
+    void invalidate() {
+        _valid = false;
+    }
+
+    template <typename Serialize>
+    void append(std::string& out, Serialize serialize) const {
+        if (!_valid) {
+            _state.clear();
+            serialize(_state);
+            _valid = true;
+        }
+        out.append(_state);
+    }
+
+    mutable std::string _state;
+    mutable bool _valid{false};
+};
+
 }; // namespace helpers
 }; // namespace steps_chain
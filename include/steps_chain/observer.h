@@ -0,0 +1,120 @@
+#pragma once
+
+#include "util.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace steps_chain {
+
+// How a step ended, as seen by an observer.
+enum class step_outcome : uint8_t {
+    advanced,   // step returned a value, chain moves to the next step
+    suspended,  // step returned std::nullopt
+    failed      // step returned an error in result, see result.h
+};
+
+// Observer is a policy member (see policy.h) that StepsChain and ContextStepsChain call around
+// each step:
+//
+//     void on_step_begin(size_t step_idx);
+//     void on_step_end(size_t step_idx, step_outcome outcome);
+//     void on_exception(size_t step_idx);  // step threw, the exception is rethrown afterwards
+//
+// The chain holds an instance of it, available through observer(). The default one does nothing
+// and the chain does not call it at all, so it costs nothing.
+struct no_observer {
+    void on_step_begin(size_t) {}
+    void on_step_end(size_t, step_outcome) {}
+    void on_exception(size_t) {}
+};
+
+// Observer attached to a chain at runtime, e.g. through ChainWrapper::set_observer().
+class StepObserver {
+public:
+    virtual ~StepObserver() = default;
+
+    virtual void on_step_begin(size_t step_idx) = 0;
+    virtual void on_step_end(size_t step_idx, step_outcome outcome) = 0;
+    virtual void on_exception(size_t step_idx) = 0;
+};
+
+// Policy observer that forwards the calls to the attached StepObserver, if there is one. It is
+// a pointer, so copies of the chain report to the same observer, which must outlive them:
+//
+//     struct ObservedPolicy : steps_chain::default_policy {
+//         using observer = steps_chain::runtime_observer;
+//     };
+class runtime_observer {
+public:
+    void attach(StepObserver* observer) { _target = observer; }
+
+    StepObserver* attached() const { return _target; }
+
+    void on_step_begin(size_t step_idx) {
+        if (_target) { _target->on_step_begin(step_idx); }
+    }
+
+    void on_step_end(size_t step_idx, step_outcome outcome) {
+        if (_target) { _target->on_step_end(step_idx, outcome); }
+    }
+
+    void on_exception(size_t step_idx) {
+        if (_target) { _target->on_exception(step_idx); }
+    }
+
+private:
+    StepObserver* _target{nullptr};
+};
+
+namespace helpers {
+
+// Calls 'invoke' that runs step 'step_idx' and reports it to the observer.
+template <typename Observer, typename Invoke>
+inline step_status observe_step(Observer& observer, size_t step_idx, Invoke&& invoke) {
+    if constexpr (std::is_same_v<Observer, no_observer>) {
+        return invoke();
+    }
+    else {
+        observer.on_step_begin(step_idx);
+        step_status status;
+        try {
+            status = invoke();
+        }
+        catch (...) {
+            observer.on_exception(step_idx);
+            throw;
+        }
+        observer.on_step_end(step_idx,
+            status == step_status::suspended ? step_outcome::suspended
+            : status == step_status::failed ? step_outcome::failed
+            : step_outcome::advanced);
+        return status;
+    }
+}
+
+template <typename Chain, class = void>
+struct accepts_observer : std::false_type {};
+
+template <typename Chain>
+struct accepts_observer<Chain, std::void_t<decltype(
+    std::declval<Chain&>().observer().attach(std::declval<StepObserver*>()))>>
+    : std::true_type {};
+
+// Used by wrappers. Returns false if the chain's policy observer can not be attached at runtime.
+template <typename Chain>
+bool attach_observer(Chain& chain, StepObserver* observer) {
+    if constexpr (accepts_observer<Chain>::value) {
+        chain.observer().attach(observer);
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+}; // namespace helpers
+
+}; // namespace steps_chain
@@ -0,0 +1,341 @@
+#pragma once
+
+#include "util.h"
+#include "codec.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace steps_chain {
+
+// Values returned by the branches of parallel(), in the order the branches were given. Access
+// them with std::get or structured bindings. The default codec stores each value as its own
+// serialized form prefixed with the length, e.g. "2:423:abc", binary codec encodes the values
+// one after another through fields().
+template <typename... Ts>
+struct joined : std::tuple<Ts...> {
+    joined() = default;
+    joined(std::tuple<Ts...> values) : std::tuple<Ts...>{std::move(values)} {}
+    explicit joined(const std::string& in) : joined{std::string_view{in}} {}
+    explicit joined(std::string_view in) { parse(in, std::index_sequence_for<Ts...>{}); }
+
+    std::string serialize() const {
+        std::string out;
+        std::apply([&out](const auto&... value) { (append(value, out), ...); }, values());
+        return out;
+    }
+
+    auto fields() { return std::apply([](auto&... value) { return std::tie(value...); }, values()); }
+    auto fields() const {
+        return std::apply([](const auto&... value) { return std::tie(value...); }, values());
+    }
+
+    std::tuple<Ts...>& values() { return *this; }
+    const std::tuple<Ts...>& values() const { return *this; }
+
+private:
+    template <typename T>
+    static void append(const T& value, std::string& out) {
+        std::string encoded;
+        string_codec::encode(value, encoded);
+        out += std::to_string(encoded.size());
+        out += ':';
+        out += encoded;
+    }
+
+    template <size_t... I>
+    void parse(std::string_view in, std::index_sequence<I...>) {
+        size_t pos = 0;
+        ((std::get<I>(values()) = read<Ts>(in, pos)), ...);
+        if (pos != in.size()) {
+            throw std::invalid_argument{"joined: unexpected trailing characters."};
+        }
+    }
+
+    template <typename T>
+    static T read(std::string_view in, size_t& pos) {
+        size_t size = 0;
+        size_t digits = 0;
+        for (; pos < in.size() && in[pos] >= '0' && in[pos] <= '9'; ++pos, ++digits) {
+            size = size * 10 + static_cast<size_t>(in[pos] - '0');
+        }
+        if (digits == 0 || pos == in.size() || in[pos] != ':' || in.size() - pos - 1 < size) {
+            throw std::invalid_argument{"joined: malformed input."};
+        }
+        pos += 1 + size;
+        return string_codec::decode<T>(in.substr(pos - size, size));
+    }
+};
+
+// Runs each task on a new detached thread, i.e. starts a thread per branch on every run of the
+// step. Fine for rare, long branches, use a thread pool otherwise.
+struct new_thread_executor {
+    void operator()(std::function<void()> task) const {
+        std::thread{std::move(task)}.detach();
+    }
+};
+
+// Runs each task right away on the calling thread, so branches run one after another. Handy in
+// tests and for debugging.
+struct inline_executor {
+    void operator()(std::function<void()> task) const {
+        task();
+    }
+};
+
+namespace helpers {
+
+// State of one join, shared by the caller and the tasks handed to the executor. A branch runs
+// where it is claimed first: on the executor, or on the caller, which takes back the branches
+// the executor has not started yet. A task that comes too late does nothing, the state is shared
+// so that it outlives the join.
+template <size_t Branches>
+class join_state {
+public:
+    bool claim(size_t branch) {
+        return !_claimed[branch].exchange(true, std::memory_order_acq_rel);
+    }
+
+    void arrive() {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (--_pending == 0) {
+            _done.notify_one();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock{_mutex};
+        _done.wait(lock, [this]() { return _pending == 0; });
+    }
+
+private:
+    std::array<std::atomic<bool>, Branches> _claimed{};
+    std::mutex _mutex;
+    std::condition_variable _done;
+    size_t _pending{Branches - 1};
+};
+
+// What the branch returns, std::optional included.
+template <typename Step, typename Context = typename signature<Step>::context_type>
+struct branch_result {
+    using type = std::invoke_result_t<const Step&, typename signature<Step>::arg_type, Context>;
+};
+
+template <typename Step>
+struct branch_result<Step, void> {
+    using type = std::invoke_result_t<const Step&, typename signature<Step>::arg_type>;
+};
+
+// Base providing operator() with the signature the chains expect: it takes the argument and,
+// if the branches take a context, the context of the same type.
+template <typename Derived, typename Result, typename Arg, typename Context>
+struct parallel_call {
+    Result operator()(const Arg& argument, Context ctx) const {
+        return static_cast<const Derived&>(*this).join(argument, ctx);
+    }
+};
+
+template <typename Derived, typename Result, typename Arg>
+struct parallel_call<Derived, Result, Arg, void> {
+    Result operator()(const Arg& argument) const {
+        return static_cast<const Derived&>(*this).join(argument);
+    }
+};
+
+template <typename... Steps>
+using parallel_result = std::conditional_t<
+    (is_optional<typename branch_result<Steps>::type>::value || ...),
+    std::optional<joined<std::decay_t<typename signature<Steps>::return_type>...>>,
+    joined<std::decay_t<typename signature<Steps>::return_type>...>>;
+
+template <typename Derived, typename... Steps>
+using parallel_base = parallel_call<
+    Derived,
+    parallel_result<Steps...>,
+    std::decay_t<typename signature<type_at<0, Steps...>>::arg_type>,
+    typename signature<type_at<0, Steps...>>::context_type>;
+
+}; // namespace helpers
+
+// A single chain step made of several independent steps ('branches'), which take the same
+// argument (and context, if any) and run concurrently. The first branch runs on the calling
+// thread, the rest are handed to the executor, and the step returns when all of them are done,
+// so it takes as long as the slowest branch. Once done with the first branch, the calling thread
+// runs the branches the executor has not started yet itself, so the step does not wait for a busy
+// executor, and does not deadlock on a pool that the chain itself runs on. Results are joined
+// into joined<R...> for the next step:
+//
+//     auto chain = steps_chain::StepsChain{
+//         parse,                                                          // ... -> Request
+//         steps_chain::parallel(executor, checkSanctions, lookupAccount), // Request -> ...
+//         payout  // const joined<SanctionsResult, Account>& -> ...
+//     };
+//
+// The chain sees it as one step, so it is checkpointed and restarted as a whole: if any branch
+// returns std::nullopt, the step is suspended and all the branches run again on resume. If
+// branches throw, the exception of the first of them (in the order of branches) is rethrown
+// after all of them are done. Branches get the argument by const reference and share the
+// context, so the context must be safe to use from several threads at once.
+//
+// Executor is a callable taking std::function<void()> and running it, on any thread. It is
+// invoked as const and stored by value, wrap shared executors with std::ref(). If submitting a
+// task throws, the branch runs on the calling thread.
+template <typename Executor, typename... Steps>
+class Parallel : public helpers::parallel_base<Parallel<Executor, Steps...>, Steps...> {
+    using argument_type = std::decay_t<typename signature<type_at<0, Steps...>>::arg_type>;
+    using context_type = typename signature<type_at<0, Steps...>>::context_type;
+    using result_type = helpers::parallel_result<Steps...>;
+
+    static_assert(
+        (std::is_same_v<std::decay_t<typename signature<Steps>::arg_type>, argument_type> && ...),
+        "All branches must take the same argument type.");
+    static_assert(
+        ((!std::is_reference_v<typename signature<Steps>::arg_type> ||
+          std::is_const_v<std::remove_reference_t<typename signature<Steps>::arg_type>>) && ...),
+        "Branches must take the argument by value or by const reference.");
+    static_assert(
+        (std::is_same_v<typename signature<Steps>::context_type, context_type> && ...),
+        "Second argument ('context') types of all branches must be identical.");
+    static_assert((std::is_void_v<typename signature<Steps>::error_type> && ...),
+        "Branches of parallel() can not return result, see result.h.");
+
+public:
+    Parallel(Executor executor, Steps... steps)
+        : _executor{std::move(executor)}, _steps{std::move(steps)...} {}
+
+private:
+    friend struct helpers::parallel_call<Parallel, result_type, argument_type, context_type>;
+
+    template <typename... Context>
+    result_type join(const argument_type& argument, Context&... ctx) const {
+        std::tuple<std::optional<std::decay_t<typename signature<Steps>::return_type>>...> results;
+        std::array<std::exception_ptr, sizeof...(Steps)> errors;
+        const auto state = std::make_shared<helpers::join_state<sizeof...(Steps)>>();
+        start_branches(
+            std::make_index_sequence<sizeof...(Steps)>{}, results, errors, state, argument, ctx...);
+        run_branch<0>(results, errors, argument, ctx...);
+        take_back(std::make_index_sequence<sizeof...(Steps)>{}, results, errors, *state, argument,
+                  ctx...);
+        state->wait();
+        for (const auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+        return collect(std::make_index_sequence<sizeof...(Steps)>{}, results);
+    }
+
+    template <size_t I, typename Results, typename... Context>
+    void run_branch(
+        Results& results,
+        std::array<std::exception_ptr, sizeof...(Steps)>& errors,
+        const argument_type& argument,
+        Context&... ctx
+    ) const noexcept {
+        try {
+            auto result = std::get<I>(_steps)(argument, ctx...);
+            if constexpr (is_optional<decltype(result)>::value) {
+                if (!result.has_value()) {
+                    return;
+                }
+                std::get<I>(results).emplace(std::move(*result));
+            }
+            else {
+                std::get<I>(results).emplace(std::move(result));
+            }
+        }
+        catch (...) {
+            errors[I] = std::current_exception();
+        }
+    }
+
+    // Hands all the branches but the first one to the executor.
+    template <size_t... I, typename Results, typename... Context>
+    void start_branches(
+        std::index_sequence<0, I...>,
+        Results& results,
+        std::array<std::exception_ptr, sizeof...(Steps)>& errors,
+        const std::shared_ptr<helpers::join_state<sizeof...(Steps)>>& state,
+        const argument_type& argument,
+        Context&... ctx
+    ) const {
+        (submit([this, state, &results, &errors, &argument, &ctx...]() {
+            if (state->claim(I)) {
+                run_branch<I>(results, errors, argument, ctx...);
+                state->arrive();
+            }
+        }), ...);
+    }
+
+    // Runs on the calling thread the branches the executor has not started yet.
+    template <size_t... I, typename Results, typename... Context>
+    void take_back(
+        std::index_sequence<0, I...>,
+        Results& results,
+        std::array<std::exception_ptr, sizeof...(Steps)>& errors,
+        helpers::join_state<sizeof...(Steps)>& state,
+        const argument_type& argument,
+        Context&... ctx
+    ) const {
+        ((state.claim(I) ? (run_branch<I>(results, errors, argument, ctx...), state.arrive())
+                         : void()), ...);
+    }
+
+    template <typename Task>
+    void submit(Task task) const {
+        try {
+            _executor(std::function<void()>{task});
+        }
+        catch (...) {
+            task();
+        }
+    }
+
+    template <size_t... I, typename Results>
+    static result_type collect(std::index_sequence<I...>, Results& results) {
+        if constexpr (helpers::is_optional<result_type>::value) {
+            if (!(std::get<I>(results).has_value() && ...)) {
+                return std::nullopt;
+            }
+        }
+        return joined<std::decay_t<typename signature<Steps>::return_type>...>{
+            std::tuple<std::decay_t<typename signature<Steps>::return_type>...>{
+                std::move(*std::get<I>(results))...}};
+    }
+
+    Executor _executor;
+    std::tuple<Steps...> _steps;
+};
+
+template <typename Executor, typename... Steps>
+auto parallel(Executor executor, Steps... steps) {
+    static_assert(sizeof...(Steps) > 0, "parallel() needs at least one branch.");
+    return Parallel<Executor, Steps...>{std::move(executor), std::move(steps)...};
+}
+
+}; // namespace steps_chain
+
+// Makes structured bindings work with joined.
+namespace std {
+
+template <typename... Ts>
+struct tuple_size<steps_chain::joined<Ts...>> : integral_constant<size_t, sizeof...(Ts)> {};
+
+template <size_t I, typename... Ts>
+struct tuple_element<I, steps_chain::joined<Ts...>> : tuple_element<I, tuple<Ts...>> {};
+
+}; // namespace std
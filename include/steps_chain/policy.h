@@ -0,0 +1,50 @@
+#pragma once
+
+#include "codec.h"
+#include "observer.h"
+
+namespace steps_chain {
+
+// Policy is a set of compile-time options shared by StepsChain and ContextStepsChain. To change
+// some of them, derive from default_policy and redefine required members, then pass the policy
+// to the chain constructor as the first argument:
+//
+//     struct MovingPolicy : steps_chain::default_policy {
+//         static constexpr bool move_arguments = true;
+//     };
+//     auto chain = steps_chain::StepsChain{steps_chain::with_policy<MovingPolicy>, f, g};
+
+struct default_policy {
+    // If true, current argument is moved into the steps that take it by value. Such argument is
+    // consumed even if the step throws, so chain must be re-initialized from the stored state
+    // before it can be resumed. Steps that return std::optional always get a copy, so suspended
+    // chain keeps its argument intact. Steps taking rvalue reference get the argument moved
+    // regardless of this option.
+    static constexpr bool move_arguments = false;
+
+    // Codec used to encode current arguments in get_current_state() and to decode them in
+    // initialize(), see codec.h.
+    using codec = string_codec;
+
+    // If true, chain keeps the last serialized form of the current arguments, so repeated
+    // get_current_state() calls do not serialize them again. Cache is dropped by initialize()
+    // and by steps producing a new value. A step that returns a value equal to its argument
+    // (compared with operator==, if the type has one) keeps the cache. Cache is updated from
+    // const methods, so concurrent get_current_state() calls on the same chain must be
+    // synchronized by the caller.
+    static constexpr bool cache_state = false;
+
+    // Called around each step, see observer.h. Use runtime_observer to attach observers through
+    // the wrappers.
+    using observer = no_observer;
+};
+
+template <typename Policy>
+struct policy_tag {
+    using type = Policy;
+};
+
+template <typename Policy>
+inline constexpr policy_tag<Policy> with_policy{};
+
+}; // namespace steps_chain
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace steps_chain {
+
+// Error returned from a step, converts to any result with a compatible error type:
+//
+//     if (!ctx.unloadAccount(data.consumerId, data.amount)) {
+//         return steps_chain::failure{ PayoutError{ "Balance is too low." } };
+//     }
+template <typename E>
+class failure {
+public:
+    explicit failure(E error) : _error{std::move(error)} {}
+
+    E& error() & { return _error; }
+    const E& error() const& { return _error; }
+    E&& error() && { return std::move(_error); }
+
+private:
+    E _error;
+};
+
+template <typename E>
+failure(E) -> failure<E>;
+
+// Return value of a step that can fail without throwing, like std::expected: it holds either the
+// next argument, or an error. StepsChain and ContextStepsChain stop on the error and keep the
+// argument of the failed step, so the state can be stored and the step called again, the same as
+// after an exception. The error is available through failed() and error<E>() of the chain and
+// the wrappers until the step is called again or the chain is initialized.
+//
+// The value may be std::optional, then the step can also suspend. Other chains (branching,
+// asynchronous, batch, parallel steps) do not support result and reject such steps at compile
+// time.
+template <typename T, typename E>
+class result {
+    template <typename U>
+    using value_like = std::enable_if_t<
+        std::is_constructible_v<T, U&&> && !std::is_same_v<std::decay_t<U>, result>>;
+
+public:
+    using value_type = T;
+    using error_type = E;
+
+    template <typename U = T, typename = value_like<U>>
+    result(U&& value) : _data{std::in_place_index<0>, std::forward<U>(value)} {}
+
+    template <typename G>
+    result(failure<G> error) : _data{std::in_place_index<1>, std::move(error).error()} {}
+
+    bool has_value() const noexcept { return _data.index() == 0; }
+    explicit operator bool() const noexcept { return has_value(); }
+
+    T& operator*() & { return *std::get_if<0>(&_data); }
+    const T& operator*() const& { return *std::get_if<0>(&_data); }
+    T&& operator*() && { return std::move(*std::get_if<0>(&_data)); }
+    T* operator->() { return std::get_if<0>(&_data); }
+    const T* operator->() const { return std::get_if<0>(&_data); }
+
+    E& error() & { return *std::get_if<1>(&_data); }
+    const E& error() const& { return *std::get_if<1>(&_data); }
+    E&& error() && { return std::move(*std::get_if<1>(&_data)); }
+
+private:
+    std::variant<T, E> _data;
+};
+
+namespace helpers {
+
+template <typename T>
+struct is_result : std::false_type {};
+
+template <typename T, typename E>
+struct is_result<result<T, E>> : std::true_type {};
+
+// Error storage of a chain whose steps never return result.
+struct no_errors {};
+
+// Error of the last failed step, std::monostate if there is none.
+template <typename... Errors>
+constexpr bool has_error(const std::variant<std::monostate, Errors...>& errors) {
+    return errors.index() != 0;
+}
+
+constexpr bool has_error(const no_errors&) {
+    return false;
+}
+
+template <typename... Errors>
+void clear_error(std::variant<std::monostate, Errors...>& errors) {
+    if (errors.index() != 0) {
+        errors.template emplace<0>();
+    }
+}
+
+inline void clear_error(no_errors&) {
+}
+
+template <typename Chain, class = void>
+struct reports_failures : std::false_type {};
+
+template <typename Chain>
+struct reports_failures<Chain, std::void_t<decltype(std::declval<const Chain&>().failed())>>
+    : std::true_type {};
+
+template <typename Chain, class = void>
+struct reports_errors : std::false_type {};
+
+template <typename Chain>
+struct reports_errors<Chain, std::void_t<
+    decltype(std::declval<const Chain&>().error(std::declval<const void*>()))>>
+    : std::true_type {};
+
+// Used by wrappers and the executor, chains without the error channel never fail.
+template <typename Chain>
+bool chain_failed(const Chain& chain) {
+    if constexpr (reports_failures<Chain>::value) {
+        return chain.failed();
+    }
+    else {
+        return false;
+    }
+}
+
+template <typename Chain>
+const void* chain_error(const Chain& chain, const void* type) {
+    if constexpr (reports_errors<Chain>::value) {
+        return chain.error(type);
+    }
+    else {
+        return nullptr;
+    }
+}
+
+}; // namespace helpers
+
+}; // namespace steps_chain
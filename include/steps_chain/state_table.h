@@ -0,0 +1,740 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace steps_chain {
+
+// Chain states in a memory-mapped file of fixed-size slots, keyed by request id, so that a
+// restarted process maps the file and looks up the state of any chain at once, instead of
+// reading all the records first:
+//
+//     steps_chain::StateTable table{ "payouts.table" };
+//     auto sink = table.sink(requestId);
+//     chain.run_with_checkpoints(sink);
+//     ...
+//     std::string state;                          // after a restart
+//     if (const auto step = table.find(requestId, state)) {
+//         chain.initialize(state, *step);
+//     }
+//
+// A slot holds the request id, and two copies of the state: step index, payload length and the
+// payload, inline if it fits, otherwise in a block of the overflow area at the end of the file.
+// put() writes the copy that is not in use and then switches to it with a single store to the
+// slot's control word, which also carries a version. So a process that dies in the middle of
+// put() leaves the previous state intact, and readers never wait: they check that the control
+// word did not change while they copied the state, and read again if it did. Any number of
+// threads, and processes that open the table read-only, may read while one writer updates it;
+// the writer holds an exclusive lock on the file. The number of chains and of tombstones in the
+// header are updated after the control word, so the writer marks the header as open for its whole
+// run; if a new writer finds the mark still set, the last one died, and the counters are counted
+// again from the control words, which reads one word of every slot. A clean reopen reads only the
+// header.
+//
+// Slots are found by linear probing from the hash of the request id. Erased ones are kept as
+// tombstones, which put() reuses, until erase() finds that no probe has to step over them any more
+// and makes them empty again. That keeps misses short while the table is up to about three quarters
+// full; with more chains, tombstones on the probe paths of other keys stay. The number of slots and
+// the size of the overflow area are fixed when the file is created, put() throws std::length_error
+// when either runs out, leaving the old state. An overflow block is reused while the payload fits
+// into it, a new one is allocated otherwise, and the old one is not reclaimed.
+//
+// Updates are in the page cache as soon as put() returns, so they survive a crash of the process;
+// sync() writes them to disk, for a crash of the machine, and so does closing the table for
+// writing. The file uses the byte order of the
+// host. POSIX only.
+class StateTable {
+public:
+    // Geometry of a new table, an existing one keeps its own.
+    struct Layout {
+        size_t slots = size_t{1} << 16;
+        size_t key_capacity = 40;
+        size_t inline_capacity = 176;
+        size_t overflow_bytes = size_t{16} << 20;
+    };
+
+    struct read_only_t {};
+    static constexpr read_only_t read_only{};
+
+    // Opens the table for writing, creating it if there is none or the file is empty. Any other
+    // file that is not a state table is left alone, the constructor throws.
+    explicit StateTable(const std::string& path) : StateTable{path, Layout{}} {}
+
+    StateTable(const std::string& path, const Layout& layout) : _writable{true} {
+        open_file(path, O_RDWR | O_CREAT);
+        try {
+            if (::flock(_fd, LOCK_EX | LOCK_NB) != 0) {
+                if (errno == EWOULDBLOCK) {
+                    throw std::runtime_error{
+                        "StateTable: the table is open for writing elsewhere."};
+                }
+                throw_errno("flock");
+            }
+            struct stat info;
+            if (::fstat(_fd, &info) != 0) {
+                throw_errno("fstat");
+            }
+            if (info.st_size == 0) {
+                create(layout);
+            }
+            else {
+                map(static_cast<size_t>(info.st_size));
+                if (_header->open_for_writing != 0) {
+                    recount();
+                }
+            }
+            mark_open();
+        }
+        catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    // Opens an existing table for reading, while another process may be writing to it.
+    StateTable(const std::string& path, read_only_t) : _writable{false} {
+        open_file(path, O_RDONLY);
+        try {
+            struct stat info;
+            if (::fstat(_fd, &info) != 0) {
+                throw_errno("fstat");
+            }
+            map(static_cast<size_t>(info.st_size));
+        }
+        catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    StateTable(const StateTable&) = delete;
+    StateTable& operator=(const StateTable&) = delete;
+
+    ~StateTable() {
+        close();
+    }
+
+    // Stores the state of the chain. Only one thread may write at a time.
+    void put(std::string_view request_id, size_t step, std::string_view state) {
+        check_writable();
+        if (request_id.size() > _key_capacity) {
+            throw std::length_error{"StateTable: request id is too long."};
+        }
+        if (step > std::numeric_limits<uint32_t>::max() ||
+            state.size() > std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error{"StateTable: state is too big."};
+        }
+        size_t found = npos;
+        size_t free_slot = npos;
+        size_t i = hash_of(request_id) % _slots;
+        for (size_t probes = 0; probes < _slots; ++probes, i = next(i)) {
+            const uint64_t control = control_of(slot_at(i)).load(std::memory_order_relaxed);
+            const auto kind = kind_of(control);
+            if (kind == slot_kind::used) {
+                if (key_matches(slot_at(i), request_id)) {
+                    found = i;
+                    break;
+                }
+                continue;
+            }
+            if (free_slot == npos) {
+                free_slot = i;
+            }
+            if (kind == slot_kind::empty) {
+                break;
+            }
+        }
+        if (found == npos && free_slot == npos) {
+            throw std::length_error{"StateTable: the table is full."};
+        }
+        // The writes below go to a copy, or a key, that readers may still be reading if they
+        // loaded the control word before the last store to it. The fence keeps that store ahead
+        // of them, so such readers see the control word changed, see find().
+        std::atomic_thread_fence(std::memory_order_release);
+        if (found != npos) {
+            char* slot = slot_at(found);
+            write(slot, control_of(slot).load(std::memory_order_relaxed), slot_kind::used, step,
+                  state);
+            return;
+        }
+        // The slot is not in use, readers skip it until the control word says otherwise.
+        char* slot = slot_at(free_slot);
+        const uint64_t control = control_of(slot).load(std::memory_order_relaxed);
+        store_word(slot + key_length_offset, request_id.size());
+        store_bytes(slot + key_offset, request_id);
+        write(slot, control, slot_kind::used, step, state);
+        if (kind_of(control) == slot_kind::erased) {
+            add(_header->tombstones, -1);
+        }
+        add(_header->size, 1);
+    }
+
+    // Callable for run_with_checkpoints() of the chain with the given id. StateSink does not own
+    // it, so it has to outlive the call.
+    auto sink(std::string request_id) {
+        return [this, request_id = std::move(request_id)](size_t step, std::string_view state) {
+            put(request_id, step, state);
+        };
+    }
+
+    // Returns false if there was no state for the chain.
+    bool erase(std::string_view request_id) {
+        check_writable();
+        size_t i = hash_of(request_id) % _slots;
+        for (size_t probes = 0; probes < _slots; ++probes, i = next(i)) {
+            char* slot = slot_at(i);
+            const uint64_t control = control_of(slot).load(std::memory_order_relaxed);
+            const auto kind = kind_of(control);
+            if (kind == slot_kind::empty) {
+                return false;
+            }
+            if (kind == slot_kind::used && key_matches(slot, request_id)) {
+                control_of(slot).store(next_control(control, slot_kind::erased, active_of(control)),
+                                       std::memory_order_release);
+                add(_header->tombstones, 1);
+                add(_header->size, -1);
+                reclaim_tombstones(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Appends the state of the chain to 'out' and returns its step index, or std::nullopt if
+    // there is none. Safe to call while the writer updates the table.
+    std::optional<size_t> find(std::string_view request_id, std::string& out) const {
+        size_t i = hash_of(request_id) % _slots;
+        for (size_t probes = 0; probes < _slots; ++probes, i = next(i)) {
+            const char* slot = slot_at(i);
+            for (;;) {
+                const uint64_t control = control_of(slot).load(std::memory_order_acquire);
+                const auto kind = kind_of(control);
+                if (kind == slot_kind::empty) {
+                    return std::nullopt;
+                }
+                if (kind == slot_kind::erased) {
+                    break;
+                }
+                const bool matches = key_matches(slot, request_id);
+                const size_t begin = out.size();
+                std::optional<size_t> step;
+                if (matches) {
+                    step = read_copy(slot, active_of(control), out);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (control_of(slot).load(std::memory_order_relaxed) == control) {
+                    if (!matches) {
+                        break;
+                    }
+                    if (!step) {
+                        throw std::runtime_error{"StateTable: the file is damaged."};
+                    }
+                    return step;
+                }
+                out.resize(begin);  // changed while being read
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Calls f(request_id, step, state) for every chain with a state, e.g. to resume all of them
+    // after a restart. Slots are read one at a time, so a concurrent writer is not blocked.
+    template <typename F>
+    void for_each(F&& f) const {
+        std::string key;
+        std::string state;
+        for (size_t i = 0; i < _slots; ++i) {
+            const char* slot = slot_at(i);
+            for (;;) {
+                const uint64_t control = control_of(slot).load(std::memory_order_acquire);
+                if (kind_of(control) != slot_kind::used) {
+                    break;
+                }
+                key.clear();
+                read_key(slot, key);
+                state.clear();
+                const auto step = read_copy(slot, active_of(control), state);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (control_of(slot).load(std::memory_order_relaxed) == control) {
+                    if (!step) {
+                        throw std::runtime_error{"StateTable: the file is damaged."};
+                    }
+                    f(std::string_view{key}, *step, std::string_view{state});
+                    break;
+                }
+            }
+        }
+    }
+
+    // Writes the updates to disk.
+    void sync() const {
+        if (::msync(_base, _mapped, MS_SYNC) != 0) {
+            throw_errno("msync");
+        }
+    }
+
+    // Number of chains with a state.
+    size_t size() const {
+        return static_cast<size_t>(_header->size.load(std::memory_order_relaxed));
+    }
+
+    size_t capacity() const { return _slots; }
+
+    // Erased slots that probing still has to step over.
+    size_t tombstones() const {
+        return static_cast<size_t>(_header->tombstones.load(std::memory_order_relaxed));
+    }
+
+    // Bytes of the overflow area taken by blocks, including the ones no longer in use.
+    size_t overflow_used() const {
+        return static_cast<size_t>(_header->overflow_used.load(std::memory_order_relaxed));
+    }
+
+private:
+    // First 64 bytes of the file. The magic is written last when the file is created.
+    // 'open_for_writing' is set while a writer has the table open, only that writer touches it.
+    struct header {
+        char magic[8];
+        uint16_t format;
+        uint16_t open_for_writing;
+        uint32_t slot_size;
+        uint64_t slots;
+        uint32_t key_capacity;
+        uint32_t inline_capacity;
+        uint64_t overflow_bytes;
+        std::atomic<uint64_t> overflow_used;
+        std::atomic<uint64_t> size;
+        std::atomic<uint64_t> tombstones;
+    };
+    static_assert(sizeof(header) == 64, "StateTable header must take one cache line.");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                  sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+                  "StateTable keeps atomics in the mapped file.");
+
+    static constexpr char magic[8] = {'S', 'C', 'S', 'T', 'A', 'T', 'E', '1'};
+    static constexpr uint16_t format = 1;
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    // Slot: control word, key length, key, then two copies of the state. Control word: kind in
+    // the low two bits, the copy in use in the next one, and the version above.
+    //
+    // Everything in a slot, and the overflow blocks, is read and written as aligned 64-bit words
+    // through relaxed atomics, so that readers racing with the writer are well-defined and the
+    // control word check is enough to reject what they read. This relies on std::atomic<uint64_t>
+    // being lock-free and address-free, which the standard recommends, so that it also works
+    // between processes mapping the same file.
+    enum class slot_kind : uint64_t {
+        empty = 0,
+        used = 1,
+        erased = 2
+    };
+
+    static constexpr size_t key_length_offset = 8;
+    static constexpr size_t key_offset = 16;
+
+    // Copy of the state: step index and payload length (low and high half of a word), overflow
+    // block offset and capacity, and the inline payload.
+    static constexpr size_t copy_sizes = 0;
+    static constexpr size_t copy_block = 8;
+    static constexpr size_t copy_block_capacity = 16;
+    static constexpr size_t copy_inline = 24;
+
+    static constexpr size_t block_alignment = 64;
+
+    static constexpr size_t round_up(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    void open_file(const std::string& path, int flags) {
+        _fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+        if (_fd < 0) {
+            throw_errno("open");
+        }
+    }
+
+    void create(const Layout& layout) {
+        if (layout.slots == 0 || layout.key_capacity > std::numeric_limits<uint32_t>::max() ||
+            layout.inline_capacity > std::numeric_limits<uint32_t>::max()) {
+            throw std::invalid_argument{"StateTable: invalid layout."};
+        }
+        const size_t copy_size = round_up(copy_inline + layout.inline_capacity, 8);
+        const size_t slot_size = round_up(key_offset + round_up(layout.key_capacity, 8) +
+                                          2 * copy_size, 64);
+        const size_t overflow_bytes = round_up(layout.overflow_bytes, block_alignment);
+        constexpr size_t max_size = std::numeric_limits<off_t>::max();
+        if (slot_size > std::numeric_limits<uint32_t>::max() || overflow_bytes > max_size / 2 ||
+            layout.slots > (max_size / 2 - sizeof(header)) / slot_size) {
+            throw std::invalid_argument{"StateTable: invalid layout."};
+        }
+        const size_t total = sizeof(header) + layout.slots * slot_size + overflow_bytes;
+        // Zero-filled, so all slots are empty.
+        if (::ftruncate(_fd, static_cast<off_t>(total)) != 0) {
+            throw_errno("ftruncate");
+        }
+        map_bytes(total);
+        auto* created = new (_base) header{};
+        created->format = format;
+        created->slot_size = static_cast<uint32_t>(slot_size);
+        created->slots = layout.slots;
+        created->key_capacity = static_cast<uint32_t>(layout.key_capacity);
+        created->inline_capacity = static_cast<uint32_t>(layout.inline_capacity);
+        created->overflow_bytes = overflow_bytes;
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(created->magic, magic, sizeof(magic));
+        sync();
+        read_header();
+    }
+
+    void map(size_t file_size) {
+        if (file_size < sizeof(header)) {
+            throw std::runtime_error{"StateTable: not a state table."};
+        }
+        map_bytes(file_size);
+        read_header();
+    }
+
+    void map_bytes(size_t size) {
+        void* base = ::mmap(nullptr, size, _writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                            MAP_SHARED, _fd, 0);
+        if (base == MAP_FAILED) {
+            throw_errno("mmap");
+        }
+        _base = static_cast<char*>(base);
+        _mapped = size;
+    }
+
+    void read_header() {
+        _header = reinterpret_cast<header*>(_base);
+        if (std::memcmp(_header->magic, magic, sizeof(magic)) != 0 || _header->format != format) {
+            throw std::runtime_error{"StateTable: not a state table."};
+        }
+        _slots = _header->slots;
+        _slot_size = _header->slot_size;
+        _key_capacity = _header->key_capacity;
+        _inline_capacity = _header->inline_capacity;
+        _copy_size = round_up(copy_inline + _inline_capacity, 8);
+        _copies_offset = key_offset + round_up(_key_capacity, 8);
+        _overflow_bytes = _header->overflow_bytes;
+        // Checked without overflowing, so that a damaged header cannot point past the mapping.
+        if (_slots == 0 || _slot_size % 64 != 0 || _slot_size < _copies_offset + 2 * _copy_size ||
+            _overflow_bytes % block_alignment != 0 || _overflow_bytes > _mapped - sizeof(header) ||
+            _slots > (_mapped - sizeof(header) - _overflow_bytes) / _slot_size ||
+            _header->overflow_used.load(std::memory_order_relaxed) > _overflow_bytes) {
+            throw std::runtime_error{"StateTable: the file is damaged."};
+        }
+        _overflow = _base + sizeof(header) + _slots * _slot_size;
+    }
+
+    // Sets the counters in the header from the control words, the last writer may have died
+    // between a control word store and the counter update.
+    void recount() {
+        uint64_t used = 0;
+        uint64_t erased = 0;
+        for (size_t i = 0; i < _slots; ++i) {
+            const auto kind = kind_of(load_word(slot_at(i)));
+            used += kind == slot_kind::used;
+            erased += kind == slot_kind::erased;
+        }
+        _header->size.store(used, std::memory_order_relaxed);
+        _header->tombstones.store(erased, std::memory_order_relaxed);
+    }
+
+    // The mark is on disk before anything else changes, so that a crash of the machine leaves it
+    // set as well.
+    void mark_open() {
+        _header->open_for_writing = 1;
+        if (::msync(_base, sizeof(header), MS_SYNC) != 0) {
+            throw_errno("msync");
+        }
+        _marked_open = true;
+    }
+
+    // Clears the mark once the slots and the counters are on disk. If they can not be written,
+    // the mark stays and the next writer counts again.
+    void mark_closed() noexcept {
+        if (::msync(_base, _mapped, MS_SYNC) != 0) {
+            return;
+        }
+        _header->open_for_writing = 0;
+        ::msync(_base, sizeof(header), MS_SYNC);
+    }
+
+    void close() {
+        if (_marked_open) {
+            mark_closed();
+            _marked_open = false;
+        }
+        if (_base != nullptr) {
+            ::munmap(_base, _mapped);
+            _base = nullptr;
+        }
+        if (_fd >= 0) {
+            ::close(_fd);  // also releases the lock
+            _fd = -1;
+        }
+    }
+
+    void check_writable() const {
+        if (!_writable) {
+            throw std::logic_error{"StateTable: the table is open read-only."};
+        }
+    }
+
+    // Writes the copy that is not in use and switches the slot to it.
+    void write(char* slot, uint64_t control, slot_kind kind, size_t step, std::string_view state) {
+        const size_t copy_idx = active_of(control) ^ 1;
+        char* copy = copy_at(slot, copy_idx);
+        if (state.size() <= _inline_capacity) {
+            store_bytes(copy + copy_inline, state);
+        }
+        else {
+            uint64_t block = load_word(copy + copy_block);
+            if (load_word(copy + copy_block_capacity) < state.size()) {
+                const uint64_t capacity = round_up(state.size(), block_alignment);
+                const uint64_t used = _header->overflow_used.load(std::memory_order_relaxed);
+                if (capacity > _overflow_bytes - used) {
+                    throw std::length_error{"StateTable: the overflow area is full."};
+                }
+                block = used;
+                _header->overflow_used.store(used + capacity, std::memory_order_relaxed);
+                store_word(copy + copy_block, block);
+                store_word(copy + copy_block_capacity, capacity);
+            }
+            store_bytes(_overflow + block, state);
+        }
+        store_word(copy + copy_sizes, uint64_t{step} | uint64_t{state.size()} << 32);
+        control_of(slot).store(next_control(control, kind, copy_idx), std::memory_order_release);
+    }
+
+    // Appends the payload of the copy to 'out' and returns the step index. The copy may be
+    // overwritten meanwhile, the caller checks the control word afterwards, so bounds are checked
+    // here before anything is copied; std::nullopt if they are off.
+    std::optional<size_t> read_copy(const char* slot, size_t copy_idx, std::string& out) const {
+        const char* copy = copy_at(slot, copy_idx);
+        const uint64_t sizes = load_word(copy + copy_sizes);
+        const size_t step = static_cast<uint32_t>(sizes);
+        const size_t length = static_cast<size_t>(sizes >> 32);
+        if (length <= _inline_capacity) {
+            load_bytes(copy + copy_inline, length, out);
+            return step;
+        }
+        const uint64_t block = load_word(copy + copy_block);
+        if (block % 8 != 0 || block > _overflow_bytes ||
+            round_up(length, 8) > _overflow_bytes - block) {
+            return std::nullopt;
+        }
+        load_bytes(_overflow + block, length, out);
+        return step;
+    }
+
+    // Keys are stored padded with zeros, so they are compared a word at a time.
+    bool key_matches(const char* slot, std::string_view key) const {
+        if (load_word(slot + key_length_offset) != key.size()) {
+            return false;
+        }
+        const size_t whole = key.size() / 8 * 8;
+        for (size_t offset = 0; offset < whole; offset += 8) {
+            uint64_t expected;
+            std::memcpy(&expected, key.data() + offset, 8);
+            if (load_word(slot + key_offset + offset) != expected) {
+                return false;
+            }
+        }
+        if (whole < key.size()) {
+            uint64_t expected = 0;
+            std::memcpy(&expected, key.data() + whole, key.size() - whole);
+            return load_word(slot + key_offset + whole) == expected;
+        }
+        return true;
+    }
+
+    void read_key(const char* slot, std::string& out) const {
+        const size_t length =
+            std::min<size_t>(load_word(slot + key_length_offset), _key_capacity);
+        load_bytes(slot + key_offset, length, out);
+    }
+
+    char* slot_at(size_t i) const {
+        return _base + sizeof(header) + i * _slot_size;
+    }
+
+    char* copy_at(const char* slot, size_t copy_idx) const {
+        return const_cast<char*>(slot) + _copies_offset + copy_idx * _copy_size;
+    }
+
+    size_t next(size_t i) const {
+        return i + 1 == _slots ? 0 : i + 1;
+    }
+
+    size_t previous(size_t i) const {
+        return i == 0 ? _slots - 1 : i - 1;
+    }
+
+    // Turns the tombstones of the run of slots around 'erased' back into empty slots where no
+    // probe for a stored key has to step over them, so that misses and new ids stop at them.
+    // Walks the run backwards from the empty slot after it, counting how many slots before the
+    // current one are on the probe path of a used slot after it. Keys are not moved, so readers
+    // still find every key on the way from its hash to its slot. When the table has no empty slot,
+    // the walk goes around twice, and only the second round, which starts with the right count,
+    // reclaims.
+    void reclaim_tombstones(size_t erased) {
+        size_t i = erased;
+        size_t probes = 0;
+        while (probes < _slots && kind_of(load_word(slot_at(i))) != slot_kind::empty) {
+            i = next(i);
+            ++probes;
+        }
+        const size_t skipped = probes < _slots ? 0 : _slots;
+        size_t covered = 0;
+        size_t after = 0;  // probe distance of the used slot after 'i', if it is one
+        for (size_t step = 0; step < skipped + _slots; ++step) {
+            i = previous(i);
+            covered = std::max(covered == 0 ? 0 : covered - 1, after);
+            after = 0;
+            char* slot = slot_at(i);
+            const uint64_t control = control_of(slot).load(std::memory_order_relaxed);
+            const auto kind = kind_of(control);
+            if (kind == slot_kind::empty) {
+                if (skipped == 0) {
+                    return;
+                }
+            }
+            else if (kind == slot_kind::used) {
+                after = (i + _slots - home_of(slot)) % _slots;
+            }
+            else if (covered == 0 && step >= skipped) {
+                control_of(slot).store(next_control(control, slot_kind::empty, active_of(control)),
+                                       std::memory_order_release);
+                add(_header->tombstones, -1);
+            }
+        }
+    }
+
+    // Slot the probing for the key stored in the slot starts from.
+    size_t home_of(const char* slot) const {
+        const size_t length =
+            std::min<size_t>(load_word(slot + key_length_offset), _key_capacity);
+        uint64_t hash = fnv_basis;
+        for (size_t offset = 0; offset < length; offset += 8) {
+            const uint64_t word = load_word(slot + key_offset + offset);
+            char bytes[8];
+            std::memcpy(bytes, &word, 8);
+            hash = hash_of(std::string_view{bytes, std::min<size_t>(length - offset, 8)}, hash);
+        }
+        return hash % _slots;
+    }
+
+    static std::atomic<uint64_t>& control_of(const char* slot) {
+        return word_at(slot);
+    }
+
+    static slot_kind kind_of(uint64_t control) {
+        return static_cast<slot_kind>(control & 3);
+    }
+
+    static size_t active_of(uint64_t control) {
+        return static_cast<size_t>((control >> 2) & 1);
+    }
+
+    static uint64_t next_control(uint64_t control, slot_kind kind, size_t copy_idx) {
+        return ((control >> 3) + 1) << 3 | uint64_t{copy_idx} << 2 | static_cast<uint64_t>(kind);
+    }
+
+    // Only the writer changes the counters, so no read-modify-write is needed.
+    static void add(std::atomic<uint64_t>& counter, int64_t delta) {
+        counter.store(counter.load(std::memory_order_relaxed) + static_cast<uint64_t>(delta),
+                      std::memory_order_relaxed);
+    }
+
+    static constexpr uint64_t fnv_basis = 0xcbf29ce484222325ull;
+
+    // FNV-1a, 'hash' is that of the preceding bytes.
+    static uint64_t hash_of(std::string_view key, uint64_t hash = fnv_basis) {
+        for (const char c : key) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    static std::atomic<uint64_t>& word_at(const char* at) {
+        return *reinterpret_cast<std::atomic<uint64_t>*>(const_cast<char*>(at));
+    }
+
+    static uint64_t load_word(const char* at) {
+        return word_at(at).load(std::memory_order_relaxed);
+    }
+
+    static void store_word(char* at, uint64_t value) {
+        word_at(at).store(value, std::memory_order_relaxed);
+    }
+
+    // Stores the bytes word by word, the last word padded with zeros.
+    static void store_bytes(char* out, std::string_view bytes) {
+        const size_t whole = bytes.size() / 8 * 8;
+        for (size_t offset = 0; offset < whole; offset += 8) {
+            uint64_t word;
+            std::memcpy(&word, bytes.data() + offset, 8);
+            store_word(out + offset, word);
+        }
+        if (whole < bytes.size()) {
+            uint64_t word = 0;
+            std::memcpy(&word, bytes.data() + whole, bytes.size() - whole);
+            store_word(out + whole, word);
+        }
+    }
+
+    // Appends 'length' bytes to 'out', loading them word by word.
+    static void load_bytes(const char* in, size_t length, std::string& out) {
+        const size_t begin = out.size();
+        const size_t whole = length / 8 * 8;
+        out.resize(begin + length);
+        char* to = &out[begin];
+        for (size_t offset = 0; offset < whole; offset += 8) {
+            const uint64_t word = load_word(in + offset);
+            std::memcpy(to + offset, &word, 8);
+        }
+        if (whole < length) {
+            const uint64_t word = load_word(in + whole);
+            std::memcpy(to + whole, &word, length - whole);
+        }
+    }
+
+    [[noreturn]] static void throw_errno(const char* call) {
+        throw std::system_error{
+            errno, std::generic_category(), std::string{"StateTable: "} + call + " failed."};
+    }
+
+    const bool _writable;
+    bool _marked_open{false};
+    int _fd{-1};
+    char* _base{nullptr};
+    size_t _mapped{0};
+    header* _header{nullptr};
+    size_t _slots{0};
+    size_t _slot_size{0};
+    size_t _key_capacity{0};
+    size_t _inline_capacity{0};
+    size_t _copy_size{0};
+    size_t _copies_offset{0};
+    char* _overflow{nullptr};
+    size_t _overflow_bytes{0};
+};
+
+}; // namespace steps_chain
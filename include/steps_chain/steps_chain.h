@@ -1,25 +1,36 @@
 #pragma once
 
 #include "util.h"
+#include "checkpoint.h"
 #include "marshalling_helper.h"
+#include "policy.h"
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
 #include <tuple>
 
 namespace steps_chain {
 
 using namespace helpers;
 
+template <typename Chain>
+class ChainBatch;
+
 // A class implementing resumable serial sequence of steps, without forks.
 //
 // Each step must be a callable (function, static method, lambda or functor) that takes
 // a single argument and returns a single value.
 //
 // Return value can be std::optional in that case returning std::nullopt will break
-// the chain execution and current argument will stay the same.
+// the chain execution and current argument will stay the same. Steps can also return result,
+// then returning an error breaks the chain execution the same way, see result.h.
 //
 // Types of arguments and return values must be constructible from std::string and
-// provide a serialize() method that returns a std::string.
+// provide a serialize() method that returns a std::string. Other encodings can be used
+// by setting a codec in the chain policy, see codec.h.
 //
 // Initial step is initialized with serialized arguments, each step output is
 // passed to the next step as an input.
@@ -27,30 +38,52 @@ using namespace helpers;
 // On each step current status can be serialized and stored if needed, alternatively
 // it is possible to run until an exception occurs or final step is reached and then
 // serialize, if needed.
+//
+// Steps are moved into the chain. Step results are emplaced into the chain storage without
+// copying, and arguments are moved into steps that take them by rvalue reference. See policy.h
+// to enable moving arguments into steps that take them by value.
 
-template <typename... Steps>
+template <typename Policy = default_policy, typename... Steps>
 class StepsChain
 {
 public:
     static_assert(are_chainable<Steps...>(),
                   "Return type of the previous function must be the same as argument type of the next." \
                   "If you use optional return type, next function argument should not be optional");
-    StepsChain(Steps... steps) : _steps{steps...}, _current{0} {}
+    // Step index, the smallest unsigned type that fits the number of steps.
+    using index_type = step_index_t<sizeof...(Steps)>;
+    using observer_type = typename Policy::observer;
+
+    StepsChain(Steps... steps) : _steps{std::move(steps)...}, _current{0} {}
+    StepsChain(policy_tag<Policy>, Steps... steps) : StepsChain{std::move(steps)...} {}
 
     // Run all remaining steps, beginnig with given index.
-    bool run(std::string parameters, uint8_t begin_idx = 0) {
-        if (begin_idx >= sizeof...(Steps)) {
-            return false;
-        }
-        initialize(std::move(parameters), begin_idx);
-        return execute_from(begin_idx);
+    bool run(std::string&& parameters, size_t begin_idx = 0) {
+        return run_from(std::move(parameters), begin_idx);
     }
 
-    // Just initializer, intended to be used in pair with advance()
-    bool initialize(std::string parameters, uint8_t current_idx = 0) {
-        _current = current_idx;
-        deserialize_arguments(std::move(parameters));
-        return current_idx < sizeof...(Steps);
+    // Arguments are decoded straight from the view when their type allows it (see codec.h), so
+    // input held in a foreign buffer does not have to be copied into a temporary string.
+    bool run(std::string_view parameters, size_t begin_idx = 0) {
+        return run_from(parameters, begin_idx);
+    }
+
+    bool run(const char* parameters, size_t begin_idx = 0) {
+        return run_from(std::string_view{parameters}, begin_idx);
+    }
+
+    // Just initializer, intended to be used in pair with advance(). Indices past the last step
+    // are treated as the index of a finished chain, arguments are decoded as the final result.
+    bool initialize(std::string&& parameters, size_t current_idx = 0) {
+        return initialize_from(std::move(parameters), current_idx);
+    }
+
+    bool initialize(std::string_view parameters, size_t current_idx = 0) {
+        return initialize_from(parameters, current_idx);
+    }
+
+    bool initialize(const char* parameters, size_t current_idx = 0) {
+        return initialize_from(std::string_view{parameters}, current_idx);
     }
 
     bool advance() {
@@ -68,118 +101,256 @@ public:
         return execute_from(_current);
     }
 
+    // Run all remaining steps like resume(), passing the state to the sink whenever the policy
+    // requires it. Returns false if chain was suspended or already finished.
+    bool run_with_checkpoints(
+        StateSink sink,
+        CheckpointPolicy policy = CheckpointPolicy::every_step()
+    ) {
+        if (_current >= sizeof...(Steps)) {
+            return false;
+        }
+        return helpers::run_with_checkpoints(
+            *this, [this]() { return execute_current(); }, _current, _side_effects, sink, policy);
+    }
+
     // Get step index and serialized arguments for current step so that they can be stored.
     // If final step was executed, final result will be returned.
-    std::tuple<uint8_t, std::string> get_current_state() const {
-        return std::make_tuple(_current, serialize_current_args());
+    std::tuple<index_type, std::string> get_current_state() const {
+        std::string result;
+        append_current_args(result);
+        return std::make_tuple(_current, std::move(result));
+    }
+
+    // Same as above, but serialized arguments are appended to the caller's buffer, so it can be
+    // reused between calls. With a codec that encodes in place, such as binary_codec, nothing is
+    // allocated once the buffer is big enough; string_codec still builds a string per call.
+    // Returns step index.
+    index_type get_current_state(std::string& out) const {
+        append_current_args(out);
+        return _current;
+    }
+
+    // Current argument (or the final result) if it has type T, nullptr otherwise. Unlike
+    // get_current_state() it does not serialize anything.
+    template <typename T>
+    const T* peek() const {
+        if constexpr (is_variant_alternative<T, current_arguments_type>::value) {
+            return std::get_if<T>(&_current_args);
+        }
+        else {
+            return nullptr;
+        }
+    }
+
+    // Type-erased version of peek() used by wrappers, 'type' is a value of type_id<T>().
+    const void* peek(const void* type) const {
+        return std::visit([type](const auto& value) -> const void* {
+            return type_id<std::decay_t<decltype(value)>>() == type ? &value : nullptr;
+        }, _current_args);
     }
 
     bool is_finished() const { return _current >= sizeof...(Steps); }
 
+    // True if the current step returned an error in result (see result.h). The chain stays at the
+    // step, advance() and resume() call it again.
+    bool failed() const { return has_error(_error); }
+
+    // Error returned by the current step if it has type E, nullptr otherwise.
+    template <typename E>
+    const E* error() const {
+        return static_cast<const E*>(error_of(_error, type_id<E>()));
+    }
+
+    // Type-erased version of error() used by wrappers, 'type' is a value of type_id<E>().
+    const void* error(const void* type) const {
+        return error_of(_error, type);
+    }
+
+    // Policy observer called around each step, see observer.h.
+    observer_type& observer() { return _observer; }
+    const observer_type& observer() const { return _observer; }
+
 private:
-    // ----- Instantiate callable invokers -----
+    template <typename Input>
+    bool run_from(Input parameters, size_t begin_idx) {
+        if (begin_idx >= sizeof...(Steps)) {
+            return false;
+        }
+        initialize_from(std::move(parameters), begin_idx);
+        if constexpr (std::is_same_v<observer_type, no_observer> &&
+                      fused_steps<Policy::move_arguments, Steps...>::enabled) {
+            return execute_fused(begin_idx);
+        }
+        else {
+            return execute_from(begin_idx);
+        }
+    }
 
-    template <uint8_t idx>
-    static constexpr auto make_invoker() {
-        return [](steps_type& steps, current_arguments_type& data) -> uint8_t {
-            using argument_type = std::decay_t<
-                typename signature<std::tuple_element_t<idx, steps_type>>::arg_type>;
-            using return_type = std::decay_t<
-                typename signature<std::tuple_element_t<idx, steps_type>>::return_type>;
-            std::optional<return_type> tmp = std::get<idx>(steps)(std::get<argument_type>(data));
-            if (tmp.has_value()) {
-                data = tmp.value();
-                return idx + 1;
-            }
-            return idx;
-        };
+    template <typename Input>
+    bool initialize_from(Input parameters, size_t current_idx) {
+        _current = static_cast<index_type>(std::min(current_idx, sizeof...(Steps)));
+        _state_cache.invalidate();
+        clear_error(_error);
+        deserialize_arguments(std::move(parameters));
+        return current_idx < sizeof...(Steps);
     }
 
-    // We have to iterate over tuple because there can be functions with same signature but with
-    // different logic, or even same function can be repeated. So std::get by type may not help us.
-    template <size_t... Idx>
-    static constexpr auto invoke_dispatch_table(std::index_sequence<Idx...>) {
-        std::array<uint8_t(*)(steps_type&, current_arguments_type&), sizeof...(Idx)>
-            invoke_dispatch = {make_invoker<Idx>()...};
+    // ----- Instantiate callable invokers -----
+
+    // We have to dispatch by index because there can be functions with same signature but with
+    // different logic, or even same function can be repeated. Invokers are instantiated per step
+    // type and get the step by its address in the storage.
+    static constexpr auto invoke_dispatch_table() {
+        std::array<step_status(*)(void*, current_arguments_type&, errors_type&), sizeof...(Steps)>
+            invoke_dispatch = {&invoke_erased<Policy::move_arguments, Policy::cache_state, Steps,
+                                              current_arguments_type, errors_type>...};
         return invoke_dispatch;
     }
 
     // It can be implemented in terms of 'is_finished()' + 'advance()' but that would mean extra
     // function calls.
-    inline bool execute_from(uint8_t begin_idx) {
-        constexpr auto table =
-            invoke_dispatch_table(std::make_index_sequence<sizeof...(Steps)>{});
-        size_t previous = 0;
-        for (uint8_t i = begin_idx; i < sizeof...(Steps); ++i) {
-            previous = _current;
-            _current = table[i](_steps, _current_args);
-            if (_current == previous) {
+    inline bool execute_from(size_t begin_idx) {
+        constexpr auto table = invoke_dispatch_table();
+        for (size_t i = begin_idx; i < sizeof...(Steps); ++i) {
+            if (!complete_step(observe_step(_observer, i, [&]() {
+                return table[i](_steps.address(i), _current_args, _error);
+            }))) {
                 return false;
             }
         }
         return true;
     }
 
+    // Same as execute_from() for a chain that was just initialized, with the remaining steps fused
+    // into one function per starting index, see fused_steps. Not used with an observer, which
+    // has to see every step, nor for very long chains.
+    bool execute_fused(size_t begin_idx) {
+        constexpr auto table = fused_dispatch_table(std::index_sequence_for<Steps...>{});
+        // Running the whole chain is the common case, it is called directly so it can be inlined.
+        return begin_idx == 0 ? run_fused<0>(*this) : table[begin_idx](*this);
+    }
+
+    template <size_t... I>
+    static constexpr auto fused_dispatch_table(std::index_sequence<I...>) {
+        return std::array<bool(*)(StepsChain&), sizeof...(Steps)>{&run_fused<I>...};
+    }
+
+    template <size_t idx>
+    static bool run_fused(StepsChain& chain) {
+        using argument_type = std::decay_t<typename signature<type_at<idx, Steps...>>::arg_type>;
+        return fused_steps<Policy::move_arguments, Steps...>::template run<idx, true>(
+            chain._steps, chain._current_args, chain._error, chain._current,
+            *std::get_if<argument_type>(&chain._current_args));
+    }
+
     bool execute_current() {
-        constexpr auto table =
-            invoke_dispatch_table(std::make_index_sequence<sizeof...(Steps)>{});
-        size_t previous = _current;
-        _current = table[_current](_steps, _current_args);
-        return _current > previous;
+        constexpr auto table = invoke_dispatch_table();
+        return complete_step(observe_step(_observer, _current, [&]() {
+            return table[_current](_steps.address(_current), _current_args, _error);
+        }));
+    }
+
+    // Moves to the next step, unless current one was suspended or failed. Error of the previous
+    // call is kept only if the step failed again.
+    bool complete_step(step_status status) {
+        if (status == step_status::failed) {
+            return false;
+        }
+        clear_error(_error);
+        if (status == step_status::suspended) {
+            return false;
+        }
+        if (status == step_status::advanced) {
+            _state_cache.invalidate();
+        }
+        ++_current;
+        return true;
     }
 
     // ----- Instantiate deserialization methods -----    
 
-    inline void deserialize_arguments(std::string parameters) {
+    template <typename Input>
+    inline void deserialize_arguments(Input parameters) {
         if (_current < sizeof...(Steps)) {
-            constexpr auto table =
-                marshalling::deserialize_dispatch_table(std::make_index_sequence<sizeof...(Steps)>{});
+            constexpr auto table = marshalling::template deserialize_dispatch_table<
+                Input, std::decay_t<typename signature<Steps>::arg_type>...>();
             table[_current](_current_args, std::move(parameters));
         }
         else {
-            _current_args = result_type{std::move(parameters)};
+            _current_args.template emplace<result_type>(
+                codec::template decode<result_type>(std::move(parameters)));
         }
     }
 
     // ----- Instantiate serialization methods -----
 
-    inline std::string serialize_current_args() const {
+    inline void append_current_args(std::string& out) const {
+        _state_cache.append(out, [this](std::string& buffer) { serialize_current_args(buffer); });
+    }
+
+    inline void serialize_current_args(std::string& out) const {
         if (_current < sizeof...(Steps)) {
-            constexpr auto table =
-                marshalling::serialize_dispatch_table(std::make_index_sequence<sizeof...(Steps)>{});
-            return table[_current](_current_args);
+            constexpr auto table = marshalling::template serialize_dispatch_table<
+                std::decay_t<typename signature<Steps>::arg_type>...>();
+            table[_current](_current_args, out);
         }
         else {
-            return std::get<result_type>(_current_args).serialize();
+            codec::encode(std::get<result_type>(_current_args), out);
         }
     }
 
     // ----- Data members and aliases -----
 
-    using steps_type = std::tuple<Steps...>;
+    // Batch copies the steps from a prototype chain.
+    template <typename Chain>
+    friend class ChainBatch;
+
+    using steps_type = steps_storage<Steps...>;
     static_assert(
         std::is_default_constructible_v<
-            std::decay_t<typename signature<std::tuple_element_t<0, steps_type>>::arg_type>>,
+            std::decay_t<typename signature<type_at<0, Steps...>>::arg_type>>,
         "The argument type of the first step must be default-constructible"
     );
     using result_type = std::decay_t<
-        typename signature<std::tuple_element_t<sizeof...(Steps) - 1, steps_type>>::return_type>;
+        typename signature<type_at<sizeof...(Steps) - 1, Steps...>>::return_type>;
     using current_arguments_type =
         unique_variant<std::decay_t<typename signature<Steps>::arg_type>..., result_type>;
-    using marshalling = MarshallingInvokeTables<steps_type, current_arguments_type>;
+    using errors_type = step_errors_t<Steps...>;
+    using codec = typename Policy::codec;
+    using marshalling = MarshallingInvokeTables<current_arguments_type, codec>;
 
     using all_serializable =
         typename std::conditional<
-            is_serializable<result_type>::value &&
-                (is_serializable<std::decay_t<typename signature<Steps>::arg_type>>::value && ...),
+            codec::template supports<result_type>() &&
+                (codec::template supports<
+                    std::decay_t<typename signature<Steps>::arg_type>>() && ...),
             std::true_type,
             std::false_type>::type;
     static_assert(all_serializable::value,
-                  "All arguments and return type of the last step must be (de-)serializable.");
+                  "All arguments and return type of the last step must be supported by the codec.");
+
+    static constexpr std::array<bool, sizeof...(Steps)> _side_effects{
+        is_side_effect<Steps>::value...};
 
     steps_type _steps;
     current_arguments_type _current_args;
-    uint8_t _current;
+    index_type _current;
+    StateCache<Policy::cache_state> _state_cache;
+    observer_type _observer;
+    errors_type _error;
 };
 
+// The chain keeps its steps, the current argument, the observer and the error in place, so it is
+// relocatable if they are, unless it caches the serialized state in a string.
+template <typename Policy, typename... Steps>
+struct is_trivially_relocatable<StepsChain<Policy, Steps...>> : std::bool_constant<
+    !Policy::cache_state &&
+    is_trivially_relocatable<typename Policy::observer>::value &&
+    is_trivially_relocatable<step_errors_t<Steps...>>::value &&
+    (is_trivially_relocatable<Steps>::value && ...) &&
+    (is_trivially_relocatable<std::decay_t<typename signature<Steps>::arg_type>>::value && ...) &&
+    is_trivially_relocatable<std::decay_t<typename signature<
+        type_at<sizeof...(Steps) - 1, Steps...>>::return_type>>::value> {};
+
 }; // namespace steps_chain
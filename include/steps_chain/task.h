@@ -0,0 +1,197 @@
+#pragma once
+
+#if !defined(__cpp_impl_coroutine)
+#error "task.h requires C++20 coroutines."
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace steps_chain {
+
+template <typename T>
+class task;
+
+namespace helpers {
+
+template <typename T>
+class task_promise_base {
+public:
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    // Resumes the coroutine that awaited the task, if any, without growing the stack.
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+            if (auto continuation = self.promise()._continuation) {
+                return continuation;
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { _exception = std::current_exception(); }
+
+    void set_continuation(std::coroutine_handle<> continuation) { _continuation = continuation; }
+
+protected:
+    void rethrow_if_failed() {
+        if (_exception) {
+            std::rethrow_exception(_exception);
+        }
+    }
+
+    std::coroutine_handle<> _continuation;
+    std::exception_ptr _exception;
+};
+
+template <typename T>
+class task_promise : public task_promise_base<T> {
+public:
+    task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U&& value) { _value.emplace(std::forward<U>(value)); }
+
+    T result() {
+        this->rethrow_if_failed();
+        return std::move(*_value);
+    }
+
+private:
+    std::optional<T> _value;
+};
+
+template <>
+class task_promise<void> : public task_promise_base<void> {
+public:
+    task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result() { this->rethrow_if_failed(); }
+};
+
+}; // namespace helpers
+
+// Lazily started coroutine producing a value of type T, the coroutine type used by
+// AsyncStepsChain. It starts when it is awaited, and the awaiting coroutine is resumed right
+// after the task finishes, on the same thread. Code that is not a coroutine itself can start the
+// task with start() and check done(), e.g. in an event loop driving many chains.
+template <typename T>
+class [[nodiscard]] task {
+public:
+    using promise_type = helpers::task_promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    task() noexcept = default;
+    explicit task(handle_type handle) noexcept : _handle{handle} {}
+
+    task(task&& other) noexcept : _handle{std::exchange(other._handle, nullptr)} {}
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            destroy();
+            _handle = std::exchange(other._handle, nullptr);
+        }
+        return *this;
+    }
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task() { destroy(); }
+
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                _handle.promise().set_continuation(caller);
+                return _handle;
+            }
+            T await_resume() { return _handle.promise().result(); }
+
+            handle_type _handle;
+        };
+        return awaiter{_handle};
+    }
+
+    // Runs the task on the calling thread until its first suspension point.
+    void start() {
+        if (_handle && !_handle.done()) {
+            _handle.resume();
+        }
+    }
+
+    bool done() const noexcept { return _handle && _handle.done(); }
+
+    // Result of a finished task, exception thrown by the coroutine is rethrown.
+    T result() { return _handle.promise().result(); }
+
+private:
+    void destroy() {
+        if (_handle) {
+            _handle.destroy();
+            _handle = nullptr;
+        }
+    }
+
+    handle_type _handle;
+};
+
+namespace helpers {
+
+template <typename T>
+task<T> task_promise<T>::get_return_object() noexcept {
+    return task<T>{std::coroutine_handle<task_promise>::from_promise(*this)};
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept {
+    return task<void>{std::coroutine_handle<task_promise>::from_promise(*this)};
+}
+
+//---------- Awaitable detection ----------
+
+template <typename T, class = void>
+struct has_member_co_await : std::false_type {};
+
+template <typename T>
+struct has_member_co_await<T, std::void_t<decltype(std::declval<T>().operator co_await())>>
+    : std::true_type {};
+
+template <typename T, class = void>
+struct is_awaiter : std::false_type {};
+
+template <typename T>
+struct is_awaiter<T, std::void_t<
+    decltype(std::declval<T&>().await_ready()),
+    decltype(std::declval<T&>().await_resume())>> : std::true_type {};
+
+// Types with a member operator co_await() or with the awaiter methods are awaitable, the value
+// of co_await is 'type'. For any other type 'type' is the type itself.
+template <typename T, class = void>
+struct awaited {
+    using type = T;
+    static constexpr bool awaitable = false;
+};
+
+template <typename T>
+struct awaited<T, std::enable_if_t<has_member_co_await<T>::value>> {
+    using type = decltype(std::declval<T>().operator co_await().await_resume());
+    static constexpr bool awaitable = true;
+};
+
+template <typename T>
+struct awaited<T, std::enable_if_t<!has_member_co_await<T>::value && is_awaiter<T>::value>> {
+    using type = decltype(std::declval<T&>().await_resume());
+    static constexpr bool awaitable = true;
+};
+
+}; // namespace helpers
+}; // namespace steps_chain
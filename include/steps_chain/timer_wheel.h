@@ -0,0 +1,383 @@
+#pragma once
+
+#include "util.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace steps_chain {
+
+// Timers keyed by e.g. request id, for re-driving suspended chains: a step that returns
+// std::nullopt sets a timer for its request, and when the timer expires 'on_expired' is called
+// with the key to load and resume the chain (or reschedule it on WorkStealingExecutor).
+//
+//     steps_chain::TimerWheel<std::string> timers{
+//         [&](const std::string& requestId) { executor.reschedule(chains[requestId]); }};
+//     timers.set("ABCD-101", 60);
+//     ...
+//     timers.advance(elapsed_ticks);  // from the event loop
+//
+// Time is counted in ticks of any length, the wheel does not read a clock, the owner moves it
+// forward with advance(). Timers are kept in a hierarchy of 8 wheels of 256 buckets each, a
+// wheel per byte of the expiration tick, so setting and cancelling a timer takes constant time
+// regardless of how many are pending. A timer is moved to a lower wheel when the time reaches
+// its bucket, at most 7 times, and advance() skips over empty buckets, so the time may jump
+// forward arbitrarily far. Timers live in one vector, buckets and the index by key (an open
+// addressing table) refer to them by position, so there is no allocation per timer once the
+// storage has grown, and a timer that expires is removed from the index with a single store.
+//
+// A timer is removed before its callback is called, so the callback may set it again. If the
+// callback throws, the exception leaves advance(), and timers that were due at the same tick
+// fire on the next call. Callbacks must not call advance(). The wheel is not thread-safe.
+template <typename Key = std::string, typename Hash = std::hash<Key>>
+class TimerWheel {
+public:
+    using tick_type = uint64_t;
+    using callback_type = std::function<void(const Key&)>;
+
+    explicit TimerWheel(callback_type on_expired, tick_type now = 0)
+        : _on_expired{std::move(on_expired)}, _now{now} {
+        for (auto& level : _occupied) {
+            level.fill(0);
+        }
+    }
+
+    // Sets the timer for the key to expire 'delay' ticks from now, but not earlier than on the
+    // next tick. If the timer is already set, it is restarted.
+    void set(const Key& key, tick_type delay) {
+        delay = std::max<tick_type>(delay, 1);
+        const tick_type expires = delay > max_tick - _now ? max_tick : _now + delay;
+        const uint32_t hash = hash_of(key);
+        const size_t entry = find(key, hash);
+        if (entry != npos) {
+            restart(_table[entry].node, expires);
+            return;
+        }
+        if ((_size + _tombstones + 1) * 4 > _table.size() * 3) {
+            rehash(table_size_for(_size + 1));
+        }
+        const uint32_t i = allocate(key, expires);
+        try {
+            link(i);
+        }
+        catch (...) {
+            release(i);
+            throw;
+        }
+        insert(i, hash);
+        ++_size;
+    }
+
+    // Returns false if the timer was not set.
+    bool cancel(const Key& key) {
+        const size_t entry = find(key, hash_of(key));
+        if (entry == npos) {
+            return false;
+        }
+        const uint32_t i = _table[entry].node;
+        unlink(i);
+        erase(i);
+        release(i);
+        return true;
+    }
+
+    bool contains(const Key& key) const { return find(key, hash_of(key)) != npos; }
+
+    // Tick at which the timer for the key expires, throws std::out_of_range if it is not set.
+    tick_type expires_at(const Key& key) const {
+        const size_t entry = find(key, hash_of(key));
+        if (entry == npos) {
+            throw std::out_of_range{"TimerWheel: the timer is not set."};
+        }
+        return _nodes[_table[entry].node].expires;
+    }
+
+    // Moves the time 'ticks' forward and fires the timers that expire on the way, in the order
+    // of their expiration (timers due at the same tick in no particular order). Returns the number
+    // of timers fired.
+    size_t advance(tick_type ticks) {
+        return advance_to(ticks > max_tick - _now ? max_tick : _now + ticks);
+    }
+
+    // Same as advance(), up to an absolute tick. Does nothing if the tick is in the past.
+    size_t advance_to(tick_type tick) {
+        // Due timers left by a callback that threw.
+        size_t fired = fire_current();
+        while (_now < tick) {
+            if (_size == 0) {
+                _now = tick;
+                break;
+            }
+            const auto [next, level] = next_event();
+            if (next > tick) {
+                _now = tick;
+                break;
+            }
+            _now = next;
+            if (level > 0) {
+                cascade(level);
+            }
+            fired += fire_current();
+        }
+        return fired;
+    }
+
+    tick_type now() const { return _now; }
+
+    size_t size() const { return _size; }
+
+    bool empty() const { return _size == 0; }
+
+    void reserve(size_t count) {
+        _nodes.reserve(count);
+        if (count * 4 > _table.size() * 3) {
+            rehash(table_size_for(count));
+        }
+    }
+
+private:
+    static constexpr unsigned level_bits = 8;
+    static constexpr unsigned levels = 64 / level_bits;
+    static constexpr size_t slots = size_t{1} << level_bits;
+    static constexpr tick_type slot_mask = slots - 1;
+    static constexpr size_t words = slots / 64;
+    static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t tombstone = none - 1;
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+    static constexpr tick_type max_tick = std::numeric_limits<tick_type>::max();
+
+    struct Node {
+        Key key;
+        tick_type expires;
+        uint32_t bucket;
+        uint32_t position;  // in the bucket, or the next free node while the node is free
+        uint32_t entry;     // in the index
+    };
+
+    // Index entry, 'hash' is compared before the key, so probing rarely touches the nodes.
+    struct Entry {
+        uint32_t node;
+        uint32_t hash;
+    };
+
+    // ----- Nodes -----
+
+    uint32_t allocate(const Key& key, tick_type expires) {
+        uint32_t i = _free;
+        if (i != none) {
+            _nodes[i].key = key;
+            _free = _nodes[i].position;
+        }
+        else {
+            if (_nodes.size() >= tombstone) {
+                throw std::length_error{"TimerWheel: too many timers."};
+            }
+            i = static_cast<uint32_t>(_nodes.size());
+            _nodes.push_back(Node{key, 0, none, none, none});
+        }
+        _nodes[i].expires = expires;
+        return i;
+    }
+
+    void release(uint32_t i) {
+        _nodes[i].position = _free;
+        _free = i;
+    }
+
+    // ----- Index -----
+
+    // Multiplication spreads the bits, std::hash of integers is usually the identity.
+    uint32_t hash_of(const Key& key) const {
+        const auto hash = static_cast<uint64_t>(_hash(key));
+        return static_cast<uint32_t>((hash * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+
+    static size_t table_size_for(size_t count) {
+        size_t size = 16;
+        while (size * 3 < count * 4 + 4) {
+            size *= 2;
+        }
+        return size;
+    }
+
+    size_t find(const Key& key, uint32_t hash) const {
+        if (_table.empty()) {
+            return npos;
+        }
+        const size_t mask = _table.size() - 1;
+        for (size_t p = hash & mask;; p = (p + 1) & mask) {
+            const Entry& entry = _table[p];
+            if (entry.node == none) {
+                return npos;
+            }
+            if (entry.node != tombstone && entry.hash == hash && _nodes[entry.node].key == key) {
+                return p;
+            }
+        }
+    }
+
+    void insert(uint32_t i, uint32_t hash) {
+        const size_t mask = _table.size() - 1;
+        size_t p = hash & mask;
+        for (; _table[p].node != none && _table[p].node != tombstone; p = (p + 1) & mask) {}
+        if (_table[p].node == tombstone) {
+            --_tombstones;
+        }
+        _table[p] = Entry{i, hash};
+        _nodes[i].entry = static_cast<uint32_t>(p);
+    }
+
+    void erase(uint32_t i) {
+        const size_t p = _nodes[i].entry;
+        // No probe sequence goes past an empty entry, so the tombstone is not needed before one.
+        if (_table[(p + 1) & (_table.size() - 1)].node == none) {
+            _table[p].node = none;
+        }
+        else {
+            _table[p].node = tombstone;
+            ++_tombstones;
+        }
+        --_size;
+    }
+
+    // Also drops the tombstones.
+    void rehash(size_t size) {
+        std::vector<Entry> old(size, Entry{none, 0});
+        _table.swap(old);
+        _tombstones = 0;
+        for (const Entry& entry : old) {
+            if (entry.node < tombstone) {
+                insert(entry.node, entry.hash);
+            }
+        }
+    }
+
+    // ----- Wheels -----
+
+    // The wheel is chosen by the highest byte in which the expiration differs from now, and the
+    // bucket by the value of that byte, so a bucket of a wheel above the lowest one holds timers
+    // expiring within the same 256^level ticks.
+    static uint32_t bucket_of(tick_type expires, tick_type now) {
+        const tick_type diff = expires ^ now;
+        const unsigned level = diff == 0 ? 0 : helpers::highest_bit(diff) / level_bits;
+        const auto slot = static_cast<uint32_t>((expires >> (level * level_bits)) & slot_mask);
+        return static_cast<uint32_t>(level * slots) + slot;
+    }
+
+    void set_occupied(uint32_t bucket, bool occupied) {
+        auto& word = _occupied[bucket / slots][(bucket % slots) / 64];
+        const uint64_t bit = uint64_t{1} << (bucket % 64);
+        word = occupied ? (word | bit) : (word & ~bit);
+    }
+
+    void link(uint32_t i) {
+        Node& node = _nodes[i];
+        const uint32_t b = bucket_of(node.expires, _now);
+        auto& bucket = _buckets[b];
+        bucket.push_back(i);
+        node.bucket = b;
+        node.position = static_cast<uint32_t>(bucket.size() - 1);
+        if (bucket.size() == 1) {
+            set_occupied(b, true);
+        }
+    }
+
+    // The last timer of the bucket takes the place of the removed one.
+    void unlink(uint32_t i) {
+        const Node& node = _nodes[i];
+        auto& bucket = _buckets[node.bucket];
+        const uint32_t last = bucket.back();
+        bucket[node.position] = last;
+        _nodes[last].position = node.position;
+        bucket.pop_back();
+        if (bucket.empty()) {
+            set_occupied(node.bucket, false);
+        }
+    }
+
+    void restart(uint32_t i, tick_type expires) {
+        Node& node = _nodes[i];
+        const uint32_t b = bucket_of(expires, _now);
+        if (b != node.bucket) {
+            // Added to the new bucket first, so that a failed allocation leaves the timer as is.
+            _buckets[b].push_back(i);
+            unlink(i);
+            node.bucket = b;
+            node.position = static_cast<uint32_t>(_buckets[b].size() - 1);
+            set_occupied(b, true);
+        }
+        node.expires = expires;
+    }
+
+    // The earliest tick at which something happens: either a timer of the lowest wheel expires,
+    // or a bucket of a higher wheel has to be spread over the lower ones. Each wheel holds only
+    // buckets ahead of the current time, so it is the first occupied bucket of the lowest
+    // occupied wheel. Returns the tick and the level of the wheel.
+    std::pair<tick_type, unsigned> next_event() const {
+        for (unsigned level = 0; level < levels; ++level) {
+            for (size_t w = 0; w < words; ++w) {
+                if (_occupied[level][w] == 0) {
+                    continue;
+                }
+                const tick_type slot = w * 64 + helpers::lowest_bit(_occupied[level][w]);
+                const unsigned shift = level * level_bits;
+                const unsigned above = shift + level_bits;
+                const tick_type base = above >= 64 ? 0 : (_now >> above) << above;
+                return {base | (slot << shift), level};
+            }
+        }
+        return {max_tick, 0};
+    }
+
+    // Spreads the bucket of the wheel that corresponds to the current time over the lower ones.
+    // Buckets are arrays of node indices rather than lists, so the nodes can be fetched from
+    // memory in parallel.
+    void cascade(unsigned level) {
+        const auto bucket = static_cast<uint32_t>(
+            level * slots + ((_now >> (level * level_bits)) & slot_mask));
+        _cascading.swap(_buckets[bucket]);
+        set_occupied(bucket, false);
+        for (const uint32_t i : _cascading) {
+            link(i);
+        }
+        _cascading.clear();
+    }
+
+    size_t fire_current() {
+        auto& bucket = _buckets[_now & slot_mask];
+        size_t fired = 0;
+        while (!bucket.empty()) {
+            const uint32_t i = bucket.back();
+            unlink(i);
+            erase(i);
+            // The node may be reused by the callback.
+            const Key key = std::move(_nodes[i].key);
+            release(i);
+            ++fired;
+            _on_expired(key);
+        }
+        return fired;
+    }
+
+    callback_type _on_expired;
+    tick_type _now;
+    Hash _hash;
+    std::vector<Node> _nodes;
+    uint32_t _free{none};
+    std::vector<Entry> _table;
+    size_t _size{0};
+    size_t _tombstones{0};
+    std::array<std::vector<uint32_t>, levels * slots> _buckets;
+    std::vector<uint32_t> _cascading;
+    std::array<std::array<uint64_t, words>, levels> _occupied;
+};
+
+}; // namespace steps_chain
@@ -0,0 +1,356 @@
+#pragma once
+
+#include "observer.h"
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+namespace steps_chain {
+
+// One record per observer call, see ChainTrace.
+enum class trace_event_kind : uint8_t {
+    step_begin,
+    step_end,
+    suspended,  // step returned std::nullopt
+    resumed,    // the suspended step is called again
+    exception,  // step threw
+    failed      // step returned an error in result
+};
+
+struct trace_event {
+    uint64_t time;  // nanoseconds since the tracer was created
+    uint64_t chain_id;
+    uint32_t step_idx;
+    trace_event_kind kind;
+};
+
+class Tracer;
+
+// StepObserver that records the steps of one chain into a Tracer. It is attached to a chain with
+// runtime_observer policy through set_observer() of a wrapper, and has to outlive the chain, or
+// be detached. A step that returns std::nullopt is reported as suspended, and the next call of
+// the same step as resumed, so the trace shows how long the chain waited. To see that across
+// runs, e.g. when the chain is loaded from the database again, keep the ChainTrace with the
+// request rather than with the chain.
+//
+// Default-constructed one is not sampled and records nothing, same as those returned by
+// Tracer::trace() for chains that are not sampled.
+class ChainTrace : public StepObserver {
+public:
+    ChainTrace() = default;
+
+    uint64_t id() const { return _id; }
+
+    bool sampled() const { return _tracer != nullptr; }
+
+    inline void on_step_begin(size_t step_idx) override;
+    inline void on_step_end(size_t step_idx, step_outcome outcome) override;
+    inline void on_exception(size_t step_idx) override;
+
+private:
+    friend class Tracer;
+
+    ChainTrace(Tracer* tracer, uint64_t id) : _tracer{tracer}, _id{id} {}
+
+    Tracer* _tracer{nullptr};
+    uint64_t _id{0};
+    bool _suspended{false};
+};
+
+// Collects step events of many chains, from any number of threads, and writes them as Chrome
+// trace-event JSON, which can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing:
+//
+//     steps_chain::Tracer tracer{ 100 };  // one chain in a hundred
+//     auto trace = tracer.trace("ABCD-101");
+//     if (trace.sampled()) {
+//         wrapper.set_observer(&trace);
+//     }
+//     ...
+//     std::string json;
+//     tracer.flush(json);
+//
+// Each chain is a track (a "thread" in the trace, with the chain id as tid) with a slice per
+// step and per suspension, and an instant event where a step threw or returned an error.
+//
+// Each thread writes to its own ring buffer of 'buffer_capacity' events, which is found through
+// a thread_local pointer, so recording an event is a clock read and a store, without locks or
+// atomic read-modify-write. When a buffer is full, new events are dropped and counted, see
+// dropped(). flush() takes the recorded events out of the buffers and may be called while the
+// chains run. Buffers are kept until the tracer is destroyed, also when their thread exits.
+//
+// Chains are sampled by id or name: with 'sample_one_in' equal to N, about one chain in N is
+// traced, always the same ones, so a chain that is resumed later is traced again.
+class Tracer {
+public:
+    explicit Tracer(size_t sample_one_in = 1, size_t buffer_capacity = 1 << 16)
+        : _sample_one_in{std::max<size_t>(sample_one_in, 1)}
+        , _buffer_capacity{size_t(1) << (helpers::highest_bit(
+              std::max<size_t>(buffer_capacity, 2) - 1) + 1)} {
+    }
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // Observer for the chain, not sampled ones record nothing.
+    ChainTrace trace(uint64_t chain_id) {
+        return sampled(chain_id) ? ChainTrace{this, chain_id} : ChainTrace{};
+    }
+
+    // Same for a chain identified by name, e.g. request id, which is sampled by a hash of the
+    // name. A sampled name gets the next free id, starting from 1, and becomes the name of the
+    // track. Names are kept only until the next flush() writes them, a name traced after that
+    // gets a new id and a new track. Do not mix with numeric ids.
+    ChainTrace trace(std::string_view name) {
+        if (!sampled(hash_of(name))) {
+            return ChainTrace{};
+        }
+        std::lock_guard<std::mutex> lock{_mutex};
+        const auto [it, inserted] = _names.try_emplace(std::string{name}, _next_name_id);
+        if (inserted) {
+            ++_next_name_id;
+        }
+        return ChainTrace{this, it->second};
+    }
+
+    bool sampled(uint64_t chain_id) const {
+        // Fibonacci hashing, so that sequential ids are sampled evenly.
+        return _sample_one_in == 1 ||
+            ((chain_id * 0x9E3779B97F4A7C15ull) >> 32) % _sample_one_in == 0;
+    }
+
+    void record(trace_event_kind kind, uint64_t chain_id, size_t step_idx) {
+        const auto elapsed = std::chrono::steady_clock::now() - _start;
+        buffer().push(trace_event{
+            static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+            chain_id,
+            static_cast<uint32_t>(step_idx),
+            kind });
+    }
+
+    // Appends a JSON document with the events recorded since the last flush to the caller's
+    // buffer and returns the number of events. A step or suspension that spans two flushes is
+    // split between the documents.
+    size_t flush(std::string& out) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        out += "{\"traceEvents\":[\n";
+        out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"args\":{\"name\":\"steps_chain\"}}";
+        for (const auto& [name, chain_id] : _names) {
+            out += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+            out += std::to_string(chain_id);
+            out += ",\"args\":{\"name\":\"";
+            append_escaped(out, name);
+            out += "\"}}";
+        }
+        _names.clear();
+        size_t count = 0;
+        for (auto& [thread, buffer] : _buffers) {
+            count += buffer->drain([&out](const trace_event& event) {
+                append_event(out, event);
+            });
+        }
+        out += "\n],\"displayTimeUnit\":\"ns\"}\n";
+        return count;
+    }
+
+    // Events lost because a buffer was full.
+    size_t dropped() const {
+        std::lock_guard<std::mutex> lock{_mutex};
+        size_t count = 0;
+        for (const auto& [thread, buffer] : _buffers) {
+            count += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        return count;
+    }
+
+private:
+    // Single-producer single-consumer ring: the owning thread pushes, flush() drains under the
+    // tracer's mutex.
+    class event_buffer {
+    public:
+        explicit event_buffer(size_t capacity)
+            : _events{new trace_event[capacity]}, _mask{capacity - 1} {
+        }
+
+        void push(const trace_event& event) {
+            const size_t head = _head.load(std::memory_order_relaxed);
+            if (head - _tail.load(std::memory_order_acquire) > _mask) {
+                dropped.store(
+                    dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+            _events[head & _mask] = event;
+            _head.store(head + 1, std::memory_order_release);
+        }
+
+        template <typename F>
+        size_t drain(F&& f) {
+            const size_t tail = _tail.load(std::memory_order_relaxed);
+            const size_t head = _head.load(std::memory_order_acquire);
+            for (size_t i = tail; i != head; ++i) {
+                f(_events[i & _mask]);
+            }
+            _tail.store(head, std::memory_order_release);
+            return head - tail;
+        }
+
+        std::atomic<size_t> dropped{0};
+
+    private:
+        std::unique_ptr<trace_event[]> _events;
+        const size_t _mask;
+        std::atomic<size_t> _head{0};
+        std::atomic<size_t> _tail{0};
+    };
+
+    // The calling thread's buffer. The thread remembers the last tracer it recorded to, by its
+    // unique id, so the mutex is taken only on the first event and when switching tracers.
+    event_buffer& buffer() {
+        struct last_used {
+            uint64_t tracer{0};
+            event_buffer* buffer{nullptr};
+        };
+        static thread_local last_used cached;
+        if (cached.tracer != _id) {
+            std::lock_guard<std::mutex> lock{_mutex};
+            auto& buffer = _buffers[std::this_thread::get_id()];
+            if (!buffer) {
+                buffer = std::make_unique<event_buffer>(_buffer_capacity);
+            }
+            cached = last_used{_id, buffer.get()};
+        }
+        return *cached.buffer;
+    }
+
+    static void append_event(std::string& out, const trace_event& event) {
+        // Microseconds, with nanosecond precision.
+        char ts[32];
+        std::snprintf(ts, sizeof(ts), "%llu.%03u",
+            static_cast<unsigned long long>(event.time / 1000),
+            static_cast<unsigned>(event.time % 1000));
+        std::string common = ",\"pid\":1,\"tid\":" + std::to_string(event.chain_id);
+        common += ",\"ts\":";
+        common += ts;
+        const std::string step = std::to_string(event.step_idx);
+        const auto begin = [&](std::string_view name, std::string_view category) {
+            out += ",\n{\"name\":\"";
+            out += name;
+            out += step;
+            out += "\",\"cat\":\"";
+            out += category;
+            out += "\",\"ph\":\"B\"";
+            out += common;
+            out += '}';
+        };
+        const auto end = [&]() {
+            out += ",\n{\"ph\":\"E\"";
+            out += common;
+            out += '}';
+        };
+        switch (event.kind) {
+        case trace_event_kind::step_begin:
+            begin("step ", "step");
+            break;
+        case trace_event_kind::step_end:
+            end();
+            break;
+        case trace_event_kind::suspended:
+            end();
+            begin("suspended at step ", "suspension");
+            break;
+        case trace_event_kind::resumed:
+            end();
+            begin("step ", "step");
+            break;
+        case trace_event_kind::exception:
+        case trace_event_kind::failed:
+            out += event.kind == trace_event_kind::exception
+                ? ",\n{\"name\":\"exception\"" : ",\n{\"name\":\"error\"";
+            out += ",\"cat\":\"step\",\"ph\":\"i\",\"s\":\"t\"";
+            out += common;
+            out += ",\"args\":{\"step\":";
+            out += step;
+            out += "}}";
+            end();
+            break;
+        }
+    }
+
+    // FNV-1a.
+    static uint64_t hash_of(std::string_view name) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const char c : name) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    static void append_escaped(std::string& out, std::string_view text) {
+        for (const char c : text) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+                out += code;
+            }
+            else {
+                out += c;
+            }
+        }
+    }
+
+    static inline std::atomic<uint64_t> _next_id{1};
+
+    const uint64_t _id{_next_id.fetch_add(1, std::memory_order_relaxed)};
+    const size_t _sample_one_in;
+    const size_t _buffer_capacity;
+    const std::chrono::steady_clock::time_point _start{std::chrono::steady_clock::now()};
+    mutable std::mutex _mutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<event_buffer>> _buffers;
+    // Names of the sampled chains that were not flushed yet.
+    std::unordered_map<std::string, uint64_t> _names;
+    uint64_t _next_name_id{1};
+};
+
+void ChainTrace::on_step_begin(size_t step_idx) {
+    if (_tracer) {
+        _tracer->record(
+            _suspended ? trace_event_kind::resumed : trace_event_kind::step_begin, _id, step_idx);
+        _suspended = false;
+    }
+}
+
+void ChainTrace::on_step_end(size_t step_idx, step_outcome outcome) {
+    if (_tracer) {
+        _suspended = outcome == step_outcome::suspended;
+        _tracer->record(
+            _suspended ? trace_event_kind::suspended
+            : outcome == step_outcome::failed ? trace_event_kind::failed
+            : trace_event_kind::step_end,
+            _id, step_idx);
+    }
+}
+
+void ChainTrace::on_exception(size_t step_idx) {
+    if (_tracer) {
+        _tracer->record(trace_event_kind::exception, _id, step_idx);
+    }
+}
+
+}; // namespace steps_chain
@@ -1,8 +1,17 @@
 #pragma once
 
+#include "result.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <optional>
 #include <string>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 #include <variant>
 
 namespace steps_chain {
@@ -10,35 +19,59 @@ namespace helpers {
 
 //---------- SFINAE detectors for function return and argument types ----------
 
+// Value produced by a step returning R. std::optional is removed by the specializations of
+// 'signature' below, result (see result.h) here, together with std::optional inside it.
+template <typename R>
+struct step_value {
+    using type = R;
+    using error_type = void;
+};
+
+template <typename T, typename E>
+struct step_value<result<T, E>> {
+    using type = T;
+    using error_type = E;
+};
+
+template <typename T, typename E>
+struct step_value<result<std::optional<T>, E>> {
+    using type = T;
+    using error_type = E;
+};
+
 // Dispatch lambda types to correct specialization
 template <typename T>
 struct signature {
     using return_type = typename signature<decltype(&T::operator())>::return_type;
     using arg_type = typename signature<decltype(&T::operator())>::arg_type;
-    using context_type = typename signature<decltype(&T::operator())>::context_type;;
+    using context_type = typename signature<decltype(&T::operator())>::context_type;
+    using error_type = typename signature<decltype(&T::operator())>::error_type;
 };
 
 // Function type unwrapper for two arguments
 template <typename R, typename T, typename C>
 struct signature<R(T, C)> {
-    using return_type = R;
+    using return_type = typename step_value<R>::type;
     using arg_type = T;
     using context_type = C;
+    using error_type = typename step_value<R>::error_type;
 };
 
 // Core function type unwrapper
 template <typename R, typename T>
 struct signature<R(T)> {
-    using return_type = R;
+    using return_type = typename step_value<R>::type;
     using arg_type = T;
     using context_type = void;
+    using error_type = typename step_value<R>::error_type;
 };
 
 template <typename R>
 struct signature<R()> {
-    using return_type = R;
+    using return_type = typename step_value<R>::type;
     using arg_type = void;
     using context_type = void;
+    using error_type = typename step_value<R>::error_type;
 };
 
 // We are not interested in functions with 3+ arguments
@@ -47,6 +80,7 @@ struct signature<R(T, Ts...)> {
     using return_type = void;
     using arg_type = void;
     using context_type = void;
+    using error_type = void;
 };
 
 // Match with function pointers
@@ -103,23 +137,406 @@ struct is_serializable<P, std::void_t<
         int>,
     void>> : std::true_type {};
 
+//---------- Indexed access to parameter packs ----------
+
+// Chains may consist of thousands of steps, so recursion over the steps pack must be avoided:
+// every recursion level instantiates a template with the rest of the pack, which makes compile
+// time and memory grow quadratically and hits the instantiation depth limit. Helpers below are
+// built with a single pack expansion instead. This is also why steps are not kept in std::tuple.
+
+template <typename... Ts>
+struct type_list {};
+
+template <size_t I, typename T>
+struct indexed_type {
+    using type = T;
+};
+
+template <typename Seq, typename... Ts>
+struct indexed_types;
+
+template <size_t... I, typename... Ts>
+struct indexed_types<std::index_sequence<I...>, Ts...> : indexed_type<I, Ts>... {};
+
+template <size_t I, typename T>
+indexed_type<I, T> select_indexed(const indexed_type<I, T>&);
+
+#if defined(__has_builtin)
+#if __has_builtin(__type_pack_element)
+#define STEPS_CHAIN_HAS_TYPE_PACK_ELEMENT
+#endif
+#endif
+
+// I-th type of the pack.
+#ifdef STEPS_CHAIN_HAS_TYPE_PACK_ELEMENT
+template <size_t I, typename... Ts>
+using type_at = __type_pack_element<I, Ts...>;
+#else
+template <size_t I, typename... Ts>
+using type_at = typename decltype(select_indexed<I>(
+    std::declval<indexed_types<std::index_sequence_for<Ts...>, Ts...>>()))::type;
+#endif
+
+//---------- Storage of the steps ----------
+
+// Steps are placed one after another in a byte buffer, at offsets computed at compile time. Any
+// step can be reached by its index at runtime, so dispatch tables hold a function per step type
+// rather than a function per index, whose symbol name would spell out the whole chain type.
+template <typename Step>
+void destroy_step(void* step) {
+    std::launder(static_cast<Step*>(step))->~Step();
+}
+
+template <typename Seq, typename... Steps>
+class steps_storage_impl;
+
+template <size_t... I, typename... Steps>
+class steps_storage_impl<std::index_sequence<I...>, Steps...> {
+    struct disabled {};
+
+public:
+    explicit steps_storage_impl(Steps... steps) {
+        construct(std::move(steps)...);
+    }
+
+    steps_storage_impl(const steps_storage_impl& other) {
+        construct(*std::launder(static_cast<const Steps*>(other.address(I)))...);
+    }
+
+    steps_storage_impl(steps_storage_impl&& other)
+        noexcept((std::is_nothrow_move_constructible_v<Steps> && ...)) {
+        construct(std::move(*std::launder(static_cast<Steps*>(other.address(I))))...);
+    }
+
+    // Steps are assigned one by one, like in std::tuple. Storage is not assignable if any of the
+    // steps is not (e.g. a lambda).
+    steps_storage_impl& operator=(std::conditional_t<(std::is_copy_assignable_v<Steps> && ...),
+                                  const steps_storage_impl&, const disabled&> other) {
+        ((*std::launder(static_cast<Steps*>(address(I))) =
+            *std::launder(static_cast<const Steps*>(other.address(I)))), ...);
+        return *this;
+    }
+
+    steps_storage_impl& operator=(std::conditional_t<(std::is_move_assignable_v<Steps> && ...),
+                                  steps_storage_impl&&, disabled&&> other) {
+        ((*std::launder(static_cast<Steps*>(address(I))) =
+            std::move(*std::launder(static_cast<Steps*>(other.address(I))))), ...);
+        return *this;
+    }
+
+    ~steps_storage_impl() {
+        destroy(sizeof...(Steps));
+    }
+
+    template <size_t idx>
+    type_at<idx, Steps...>& get() {
+        return *std::launder(static_cast<type_at<idx, Steps...>*>(address(idx)));
+    }
+
+    template <size_t idx>
+    const type_at<idx, Steps...>& get() const {
+        return *std::launder(static_cast<const type_at<idx, Steps...>*>(address(idx)));
+    }
+
+    void* address(size_t idx) {
+        return _buffer + offsets[idx];
+    }
+
+    const void* address(size_t idx) const {
+        return _buffer + offsets[idx];
+    }
+
+private:
+    template <typename... Sources>
+    void construct(Sources&&... sources) {
+        size_t constructed = 0;
+        try {
+            ((new (address(I)) Steps(std::forward<Sources>(sources)), ++constructed), ...);
+        }
+        catch (...) {
+            destroy(constructed);
+            throw;
+        }
+    }
+
+    // Destroys first 'count' steps in reverse order.
+    void destroy(size_t count) {
+        if constexpr (!(std::is_trivially_destructible_v<Steps> && ...)) {
+            constexpr std::array<void(*)(void*), sizeof...(Steps)> destructors = {
+                &destroy_step<Steps>...};
+            while (count > 0) {
+                --count;
+                destructors[count](address(count));
+            }
+        }
+    }
+
+    static constexpr std::array<size_t, sizeof...(Steps)> offsets = [] {
+        constexpr size_t sizes[] = {sizeof(Steps)...};
+        constexpr size_t alignments[] = {alignof(Steps)...};
+        std::array<size_t, sizeof...(Steps)> result{};
+        size_t offset = 0;
+        for (size_t i = 0; i < sizeof...(Steps); ++i) {
+            offset = (offset + alignments[i] - 1) / alignments[i] * alignments[i];
+            result[i] = offset;
+            offset += sizes[i];
+        }
+        return result;
+    }();
+
+    alignas(Steps...) unsigned char
+        _buffer[offsets.back() + sizeof(type_at<sizeof...(Steps) - 1, Steps...>)];
+};
+
+template <typename... Steps>
+using steps_storage = steps_storage_impl<std::index_sequence_for<Steps...>, Steps...>;
+
+// Smallest unsigned type that holds indices of all N steps and N itself, the index of a finished
+// chain.
+template <size_t N>
+using step_index_t = std::conditional_t<(N <= UINT8_MAX), uint8_t,
+    std::conditional_t<(N <= UINT16_MAX), uint16_t, uint32_t>>;
+
 //---------- SFINAE check if functions are eligible to chaining in given order ----------
 
-template <typename T, typename... Ts>
-constexpr bool are_chainable() {
-    using return_type = std::decay_t<typename signature<T>::return_type>;
-    using arg_types = std::tuple<std::decay_t<typename signature<Ts>::arg_type>...>;
-    using context_type = typename signature<T>::context_type;
-    using next_contexts = std::tuple<typename signature<Ts>::context_type...>;
-    if constexpr (sizeof...(Ts) > 0) {
+// Argument types shifted by one position against the return types line each return type up with
+// the argument of the next step, so the whole chain is checked by a single comparison of two
+// lists. Contexts are compared the same way against the list rotated by one. 'Signature' provides
+// the types of a step, the same way as 'signature' does.
+template <template <typename> class Signature, typename... Ts>
+constexpr bool are_chainable_by() {
+    if constexpr (sizeof...(Ts) < 2) {
+        return true;
+    }
+    else {
+        using first = type_at<0, Ts...>;
+        using last = type_at<sizeof...(Ts) - 1, Ts...>;
         return std::is_same_v<
-                    return_type, std::tuple_element_t<0, arg_types>> &&
-               std:: is_same_v<
-                    context_type, std::tuple_element_t<0, next_contexts>> &&
-               are_chainable<Ts...>();
+                    type_list<std::decay_t<typename Signature<first>::arg_type>,
+                              std::decay_t<typename Signature<Ts>::return_type>...>,
+                    type_list<std::decay_t<typename Signature<Ts>::arg_type>...,
+                              std::decay_t<typename Signature<last>::return_type>>> &&
+               std::is_same_v<
+                    type_list<typename Signature<first>::context_type,
+                              typename Signature<Ts>::context_type...>,
+                    type_list<typename Signature<Ts>::context_type...,
+                              typename Signature<first>::context_type>>;
+    }
+}
+
+template <typename... Ts>
+constexpr bool are_chainable() {
+    return are_chainable_by<signature, Ts...>();
+}
+
+//---------- Step invocation ----------
+
+template <typename T>
+struct is_optional : std::false_type {};
+
+template <typename T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+template <bool move, typename T>
+constexpr decltype(auto) hand_over(T& argument) {
+    if constexpr (move) {
+        return std::move(argument);
     }
     else {
-        return true;
+        return (argument);
+    }
+}
+
+template <typename T, class = void>
+struct is_equality_comparable : std::false_type {};
+
+template <typename T>
+struct is_equality_comparable<T, std::void_t<
+    decltype(std::declval<const T&>() == std::declval<const T&>())>> : std::true_type {};
+
+enum class step_status : uint8_t {
+    suspended,  // step returned std::nullopt, argument stays the same
+    advanced,   // step produced a new value
+    unchanged,  // step returned a value equal to its argument
+    failed      // step returned an error in result, argument stays the same
+};
+
+// Emplaces the value returned by a step into 'data', unless it is std::nullopt, or 'compare' is
+// set and the value is equal to the argument.
+template <bool compare, typename Return, typename Data, typename Argument, typename Value>
+step_status store_step_value(Data& data, const Argument& argument, Value&& value) {
+    if constexpr (is_optional<std::decay_t<Value>>::value) {
+        if (!value.has_value()) {
+            return step_status::suspended;
+        }
+        return store_step_value<compare, Return>(data, argument, std::move(*value));
+    }
+    else {
+        if constexpr (compare) {
+            if (value == argument) {
+                return step_status::unchanged;
+            }
+        }
+        data.template emplace<Return>(std::move(value));
+        return step_status::advanced;
+    }
+}
+
+// Calls the step with the current argument stored in 'data' and emplaces the result back into
+// 'data'. If step returned std::nullopt 'data' stays the same. If it returned an error in result,
+// 'data' stays the same too and the error is emplaced into 'errors'.
+// Argument is moved into the step if it takes an rvalue reference, or if it takes the argument
+// by value, 'move_by_value' is set and the step can neither suspend nor fail. Otherwise it is
+// passed as lvalue.
+// If 'detect_unchanged' is set, step returns its argument type and the argument was not moved,
+// result is compared with the argument, so that the caller can tell if the value has changed.
+template <bool move_by_value, bool detect_unchanged, typename Step, typename Data,
+          typename Errors, typename... Context>
+step_status invoke_step(Step& step, Data& data, Errors& errors, Context&&... ctx) {
+    using parameter_type = typename signature<Step>::arg_type;
+    using argument_type = std::decay_t<parameter_type>;
+    using return_type = std::decay_t<typename signature<Step>::return_type>;
+    using result_type = std::invoke_result_t<Step&, parameter_type, Context...>;
+    constexpr bool can_fail = is_result<result_type>::value;
+    constexpr bool can_suspend = is_optional<result_type>::value;
+    constexpr bool move_argument = std::is_rvalue_reference_v<parameter_type> ||
+        (move_by_value && !can_suspend && !can_fail && !std::is_reference_v<parameter_type>);
+    constexpr bool compare = detect_unchanged && !move_argument &&
+        std::is_same_v<argument_type, return_type> && is_equality_comparable<return_type>::value;
+    auto& argument = std::get<argument_type>(data);
+    if constexpr (can_fail) {
+        result_type tmp = step(hand_over<move_argument>(argument), std::forward<Context>(ctx)...);
+        if (!tmp.has_value()) {
+            errors.template emplace<typename result_type::error_type>(std::move(tmp).error());
+            return step_status::failed;
+        }
+        return store_step_value<compare, return_type>(data, argument, std::move(*tmp));
+    }
+    else if constexpr (can_suspend || compare) {
+        return store_step_value<compare, return_type>(
+            data, argument, step(hand_over<move_argument>(argument), std::forward<Context>(ctx)...));
+    }
+    else {
+        data.template emplace<return_type>(
+            step(hand_over<move_argument>(argument), std::forward<Context>(ctx)...));
+        return step_status::advanced;
+    }
+}
+
+// Same as above for dispatch tables, 'step' points to a step of type Step.
+template <bool move_by_value, bool detect_unchanged, typename Step, typename Data,
+          typename Errors, typename... Context>
+step_status invoke_erased(void* step, Data& data, Errors& errors, Context... ctx) {
+    return invoke_step<move_by_value, detect_unchanged>(
+        *std::launder(static_cast<Step*>(step)), data, errors, std::forward<Context>(ctx)...);
+}
+
+//---------- Fused run ----------
+
+// Runs steps from 'idx' to the last one as one straight-line sequence that the compiler can
+// inline as a whole: the value returned by a step is kept in a local and passed to the next step,
+// without going through 'data'. Only the final result, or the argument of the step that
+// suspended, failed or threw, is emplaced into 'data', and 'current' is set to the index where
+// the run stopped. Only steps that return std::optional or result are checked.
+//
+// 'argument' is the argument of step 'idx', 'stored' tells that it is held by 'data' already.
+// Arguments are handed over to steps the same way as in invoke_step(). Unchanged values are not
+// detected, the run is expected to start from a freshly initialized chain.
+//
+// This is recursion over the step index (see the note on indexed access above): each step adds
+// two levels of instantiation and a function whose name spells out the chain type, so chains
+// longer than 'max_steps' are run through the dispatch table instead.
+template <bool move_by_value, typename... Steps>
+struct fused_steps {
+    static constexpr size_t max_steps = 64;
+    static constexpr bool enabled = sizeof...(Steps) <= max_steps;
+
+    template <size_t idx, bool stored, typename Storage, typename Data, typename Errors,
+              typename Index, typename Argument, typename... Context>
+    static bool run(Storage& steps, Data& data, Errors& errors, Index& current,
+                    Argument& argument, Context&... ctx) {
+        if constexpr (idx == sizeof...(Steps)) {
+            stop<idx, stored>(data, current, argument);
+            return true;
+        }
+        else {
+            using Step = type_at<idx, Steps...>;
+            using result_type = std::invoke_result_t<Step&, typename signature<Step>::arg_type,
+                                                     Context&...>;
+            result_type returned = call<idx, stored>(steps, data, current, argument, ctx...);
+            if constexpr (is_result<result_type>::value) {
+                if (!returned.has_value()) {
+                    errors.template emplace<typename result_type::error_type>(
+                        std::move(returned).error());
+                    stop<idx, stored>(data, current, argument);
+                    return false;
+                }
+                return next<idx, stored>(steps, data, errors, current, argument, *returned, ctx...);
+            }
+            else {
+                return next<idx, stored>(steps, data, errors, current, argument, returned, ctx...);
+            }
+        }
+    }
+
+private:
+    template <size_t idx, bool stored, typename Storage, typename Data, typename Errors,
+              typename Index, typename Argument, typename Value, typename... Context>
+    static bool next(Storage& steps, Data& data, Errors& errors, Index& current,
+                     Argument& argument, Value& value, Context&... ctx) {
+        if constexpr (is_optional<Value>::value) {
+            if (!value.has_value()) {
+                stop<idx, stored>(data, current, argument);
+                return false;
+            }
+            return run<idx + 1, false>(steps, data, errors, current, *value, ctx...);
+        }
+        else {
+            return run<idx + 1, false>(steps, data, errors, current, value, ctx...);
+        }
+    }
+
+    // Only the step call is guarded, so that a step that throws stores its own argument.
+    template <size_t idx, bool stored, typename Storage, typename Data, typename Index,
+              typename Argument, typename... Context>
+    static auto call(Storage& steps, Data& data, Index& current, Argument& argument,
+                     Context&... ctx) {
+        using Step = type_at<idx, Steps...>;
+        using parameter_type = typename signature<Step>::arg_type;
+        using result_type = std::invoke_result_t<Step&, parameter_type, Context&...>;
+        constexpr bool move_argument = std::is_rvalue_reference_v<parameter_type> ||
+            (move_by_value && !is_optional<result_type>::value &&
+             !is_result<result_type>::value && !std::is_reference_v<parameter_type>);
+        try {
+            return steps.template get<idx>()(hand_over<move_argument>(argument), ctx...);
+        }
+        catch (...) {
+            stop<idx, stored>(data, current, argument);
+            throw;
+        }
+    }
+
+    template <size_t idx, bool stored, typename Data, typename Index, typename Argument>
+    static void stop(Data& data, Index& current, Argument& argument) {
+        if constexpr (!stored) {
+            data.template emplace<Argument>(std::move(argument));
+        }
+        current = static_cast<Index>(idx);
+    }
+};
+
+//---------- Context adapter ----------
+
+// Wrappers own the context, but it may be held through a smart pointer (or any other pointer-like
+// type) while steps take the pointed-to object by reference. In that case the holder is
+// dereferenced, so passing the context to a step costs no copies or reference counting.
+template <typename Param, typename Holder>
+constexpr decltype(auto) context_from(Holder& holder) {
+    if constexpr (std::is_convertible_v<Holder&, Param>) {
+        return (holder);
+    }
+    else {
+        return *holder;
     }
 }
 
@@ -130,18 +547,134 @@ struct type_identity {
     using type = T;
 };
 
-template <typename T, typename... Ts>
-struct unique : type_identity<T> {};
+// Folding over the pack keeps only the set of types found so far in the intermediate
+// instantiations, so for the usual chains, that pass a handful of types through many steps, it
+// takes linear time.
+template <typename... Ts>
+struct unique_types {
+    template <typename U>
+    constexpr auto operator+(type_identity<U>) const {
+        if constexpr ((std::is_same_v<U, Ts> || ...)) {
+            return unique_types{};
+        }
+        else {
+            return unique_types<Ts..., U>{};
+        }
+    }
 
-template <typename... Ts, typename U, typename... Us>
-struct unique<std::variant<Ts...>, U, Us...>
-    : std::conditional_t<(std::is_same_v<U, Ts> || ...),
-        unique<std::variant<Ts...>, Us...>,
-        unique<std::variant<Ts..., U>, Us...>
-    > {};
+    template <typename... Us>
+    constexpr auto operator+(type_list<Us...>) const {
+        return (*this + ... + type_identity<Us>{});
+    }
+
+    using variant = std::variant<Ts...>;
+};
 
 template <typename... Ts>
-using unique_variant = typename unique<std::variant<>, Ts...>::type;
+constexpr auto unique_of() {
+    return (unique_types<>{} + ... + type_identity<Ts>{});
+}
+
+template <typename... Ts>
+using unique_variant = typename decltype(unique_of<Ts...>())::variant;
+
+template <typename T, typename Variant>
+struct is_variant_alternative : std::false_type {};
+
+template <typename T, typename... Ts>
+struct is_variant_alternative<T, std::variant<Ts...>>
+    : std::bool_constant<(std::is_same_v<T, Ts> || ...)> {};
+
+// Error storage of a chain: a variant of std::monostate and the errors its steps may return, or
+// no_errors if none of the steps returns result.
+template <typename E>
+using error_alternative = std::conditional_t<std::is_void_v<E>, std::monostate, E>;
+
+template <typename... Steps>
+using step_errors_t = std::conditional_t<
+    (!std::is_void_v<typename signature<Steps>::error_type> || ...),
+    unique_variant<std::monostate, error_alternative<typename signature<Steps>::error_type>...>,
+    no_errors>;
+
+//---------- Type identifiers that do not require RTTI ----------
+
+template <typename T>
+struct type_key {
+    static constexpr char id = 0;
+};
+
+template <typename T>
+constexpr const void* type_id() {
+    return &type_key<T>::id;
+}
+
+// Type-erased access to the error of a chain, 'type' is a value of type_id<E>().
+template <typename... Errors>
+const void* error_of(const std::variant<std::monostate, Errors...>& errors, const void* type) {
+    return std::visit([type](const auto& error) -> const void* {
+        using error_type = std::decay_t<decltype(error)>;
+        if constexpr (std::is_same_v<error_type, std::monostate>) {
+            return nullptr;
+        }
+        else {
+            return type_id<error_type>() == type ? &error : nullptr;
+        }
+    }, errors);
+}
+
+inline const void* error_of(const no_errors&, const void*) {
+    return nullptr;
+}
+
+//---------- Bit scans ----------
+
+inline unsigned lowest_bit(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(x));
+#else
+    unsigned i = 0;
+    for (; !(x & 1); x >>= 1, ++i) {}
+    return i;
+#endif
+}
+
+inline unsigned highest_bit(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63u - static_cast<unsigned>(__builtin_clzll(x));
+#else
+    unsigned i = 0;
+    for (; x >>= 1; ++i) {}
+    return i;
+#endif
+}
+
+// Keeps a converting constructor template from hijacking the copy constructor of the wrapper.
+template <typename T, typename Wrapper>
+using not_wrapper = std::enable_if_t<!std::is_same_v<std::decay_t<T>, Wrapper>>;
 
 }; // namespace helpers
+
+//---------- Trivial relocation ----------
+
+// True for types whose objects may be moved to another address with memcpy, after which the
+// source is treated as raw memory and is not destroyed. Trivially copyable types are, other types
+// can opt in by specializing the trait. Wrappers use it to move chains without calling their
+// move constructors and destructors.
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+template <typename A, typename B>
+struct is_trivially_relocatable<std::pair<A, B>> : std::bool_constant<
+    is_trivially_relocatable<A>::value && is_trivially_relocatable<B>::value> {};
+
+template <typename... Ts>
+struct is_trivially_relocatable<std::variant<Ts...>>
+    : std::bool_constant<(is_trivially_relocatable<Ts>::value && ...)> {};
+
+template <typename T>
+struct is_trivially_relocatable<std::shared_ptr<T>> : std::true_type {};
+
+template <typename T>
+struct is_trivially_relocatable<std::unique_ptr<T>> : std::true_type {};
+
 }; // namespace steps_chain
@@ -0,0 +1,176 @@
+#include "parameters.h"
+#include <async_steps_chain.h>
+
+#include <coroutine>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+// Single-threaded event loop, coroutines waiting for "I/O" are resumed in order.
+struct Loop {
+    void run() {
+        while (!_ready.empty()) {
+            auto handle = _ready.front();
+            _ready.pop_front();
+            handle.resume();
+        }
+    }
+
+    std::deque<std::coroutine_handle<>> _ready;
+};
+
+struct Yield {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) { _loop._ready.push_back(handle); }
+    void await_resume() const noexcept {}
+
+    Loop& _loop;
+};
+
+// Awaiter that is not a coroutine, produces the value when resumed by the loop.
+struct Deferred {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) { _loop._ready.push_back(handle); }
+    IntParameter await_resume() const noexcept { return IntParameter{ _value }; }
+
+    Loop& _loop;
+    int _value;
+};
+
+IntParameter increment(const IntParameter& p) {
+    return IntParameter{ p._value + 1 };
+}
+
+auto asyncIncrement(Loop& loop) {
+    return [&loop](const IntParameter& p) -> steps_chain::task<IntParameter> {
+        co_await Yield{ loop };
+        co_return IntParameter{ p._value + 1 };
+    };
+}
+
+auto deferredDouble(Loop& loop) {
+    return [&loop](const IntParameter& p) { return Deferred{ loop, p._value * 2 }; };
+}
+
+auto suspendOnZero(Loop& loop) {
+    return [&loop](const IntParameter& p) -> steps_chain::task<std::optional<IntParameter>> {
+        co_await Yield{ loop };
+        if (p._value == 0) {
+            co_return std::nullopt;
+        }
+        co_return p;
+    };
+}
+
+auto throwOnZero(Loop& loop) {
+    return [&loop](const IntParameter& p) -> steps_chain::task<IntParameter> {
+        co_await Yield{ loop };
+        if (p._value == 0) {
+            throw std::runtime_error{ "zero" };
+        }
+        co_return p;
+    };
+}
+
+};  // anonymous namespace
+
+TEST(AsyncChainTests, MixedSteps) {
+    Loop loop;
+    auto chain = steps_chain::AsyncStepsChain{
+        increment, asyncIncrement(loop), deferredDouble(loop), increment };
+    auto running = chain.run("1");
+    running.start();
+    // Waiting for the second step.
+    ASSERT_FALSE(running.done());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(1, std::string{ "2" }));
+    loop.run();
+    ASSERT_TRUE(running.done());
+    ASSERT_TRUE(running.result());
+    ASSERT_TRUE(chain.is_finished());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(4, std::string{ "7" }));
+}
+
+TEST(AsyncChainTests, Advance) {
+    Loop loop;
+    auto chain = steps_chain::AsyncStepsChain{ asyncIncrement(loop), increment };
+    chain.initialize("10");
+    auto step = chain.advance();
+    step.start();
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(0, std::string{ "10" }));
+    loop.run();
+    ASSERT_TRUE(step.result());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(1, std::string{ "11" }));
+
+    // Plain step completes without suspending.
+    step = chain.advance();
+    step.start();
+    ASSERT_TRUE(step.done());
+    ASSERT_TRUE(step.result());
+    step = chain.advance();
+    step.start();
+    ASSERT_FALSE(step.result());
+    step = chain.resume();
+    step.start();
+    ASSERT_FALSE(step.result());
+}
+
+TEST(AsyncChainTests, Suspend) {
+    Loop loop;
+    auto chain = steps_chain::AsyncStepsChain{ increment, suspendOnZero(loop), increment };
+    auto running = chain.run("0", 1);
+    running.start();
+    loop.run();
+    ASSERT_FALSE(running.result());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(1, std::string{ "0" }));
+
+    chain.initialize("5", 1);
+    running = chain.resume();
+    running.start();
+    loop.run();
+    ASSERT_TRUE(running.result());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(3, std::string{ "6" }));
+}
+
+TEST(AsyncChainTests, Exception) {
+    Loop loop;
+    auto chain = steps_chain::AsyncStepsChain{ increment, throwOnZero(loop) };
+    auto running = chain.run("-1");
+    running.start();
+    loop.run();
+    ASSERT_THROW(running.result(), std::runtime_error);
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(1, std::string{ "0" }));
+}
+
+namespace {
+
+auto makeChain(Loop& loop) {
+    return steps_chain::AsyncStepsChain{
+        asyncIncrement(loop), increment, asyncIncrement(loop), deferredDouble(loop) };
+}
+
+};  // anonymous namespace
+
+TEST(AsyncChainTests, OneThreadDrivesManyChains) {
+    constexpr size_t count = 20000;
+    Loop loop;
+    std::vector<decltype(makeChain(loop))> chains;
+    chains.reserve(count);  // Chains must not move while their steps are in flight.
+    std::vector<steps_chain::task<bool>> running;
+    for (size_t i = 0; i < count; ++i) {
+        chains.push_back(makeChain(loop));
+        running.push_back(chains.back().run(std::to_string(i)));
+        running.back().start();
+    }
+    ASSERT_EQ(loop._ready.size(), count);
+    loop.run();
+    for (size_t i = 0; i < count; ++i) {
+        ASSERT_TRUE(running[i].result());
+        ASSERT_EQ(chains[i].peek<IntParameter>()->_value, (static_cast<int>(i) + 3) * 2);
+    }
+}
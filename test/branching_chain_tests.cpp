@@ -0,0 +1,184 @@
+#include <branching_chain.h>
+#include <context_branching_chain.h>
+#include <chain_wrapper.h>
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+// Distinct types with the same contents, so that each one can lead to a different step.
+template <int Tag>
+struct Amount {
+    Amount() = default;
+    explicit Amount(int v) : _value{ v } {}
+    explicit Amount(std::string&& s) : _value{ std::stoi(s) } {}
+    std::string serialize() const { return std::to_string(_value); }
+
+    int _value{ 0 };
+};
+
+using Request = Amount<0>;
+using Approved = Amount<1>;
+using Rejected = Amount<2>;
+using Transferred = Amount<3>;
+using Reverted = Amount<4>;
+using Done = Amount<5>;
+
+std::variant<Approved, Rejected> screen(const Request& r) {
+    if (r._value <= 100) {
+        return Approved{ r._value };
+    }
+    return Rejected{ r._value };
+}
+
+std::optional<std::variant<Approved, Rejected>> screenLater(const Request& r) {
+    if (r._value == 0) {
+        return std::nullopt;
+    }
+    return screen(r);
+}
+
+Transferred transfer(const Approved& a) {
+    return Transferred{ a._value };
+}
+
+Reverted revert(const Rejected& r) {
+    return Reverted{ -r._value };
+}
+
+Done notifyTransferred(const Transferred& t) {
+    return Done{ t._value + 1000 };
+}
+
+Done notifyReverted(const Reverted& r) {
+    return Done{ r._value - 1000 };
+}
+
+};  // anonymous namespace
+
+TEST(BranchingChainTests, TakesBranchByResultType) {
+    auto chain = steps_chain::BranchingChain{ screen, transfer, revert };
+    using Chain = decltype(chain);
+    static_assert(Chain::result_index<Transferred>() == 3);
+    static_assert(Chain::result_index<Reverted>() == 4);
+
+    ASSERT_TRUE(chain.run("42"));
+    ASSERT_TRUE(chain.is_finished());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(3, std::string{ "42" }));
+    ASSERT_NE(chain.peek<Transferred>(), nullptr);
+    ASSERT_EQ(chain.peek<Reverted>(), nullptr);
+
+    ASSERT_TRUE(chain.run("500"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(4, std::string{ "-500" }));
+    ASSERT_EQ(chain.peek<Reverted>()->_value, -500);
+}
+
+TEST(BranchingChainTests, BranchesJoin) {
+    auto chain = steps_chain::BranchingChain{
+        screen, transfer, revert, notifyTransferred, notifyReverted };
+    static_assert(decltype(chain)::result_index<Done>() == 5);
+    ASSERT_TRUE(chain.run("7"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(5, std::string{ "1007" }));
+    ASSERT_TRUE(chain.run("200"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(5, std::string{ "-1200" }));
+}
+
+TEST(BranchingChainTests, StepByStep) {
+    auto chain = steps_chain::BranchingChain{ screen, transfer, revert };
+    ASSERT_TRUE(chain.initialize("300"));
+    ASSERT_TRUE(chain.advance());
+    // Approval step is skipped.
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(2, std::string{ "300" }));
+    ASSERT_TRUE(chain.advance());
+    ASSERT_TRUE(chain.is_finished());
+    ASSERT_FALSE(chain.advance());
+    ASSERT_FALSE(chain.resume());
+}
+
+TEST(BranchingChainTests, RestoreState) {
+    auto chain = steps_chain::BranchingChain{ screen, transfer, revert };
+    ASSERT_TRUE(chain.initialize("15", 2));
+    ASSERT_EQ(chain.peek<Rejected>()->_value, 15);
+    ASSERT_TRUE(chain.resume());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(4, std::string{ "-15" }));
+
+    // Finished states restore the result of their type.
+    ASSERT_FALSE(chain.initialize("8", 3));
+    ASSERT_TRUE(chain.is_finished());
+    ASSERT_EQ(chain.peek<Transferred>()->_value, 8);
+    std::string buffer;
+    ASSERT_EQ(chain.get_current_state(buffer), 3);
+    ASSERT_EQ(buffer, "8");
+
+    ASSERT_THROW(chain.initialize("1", 5), std::invalid_argument);
+    ASSERT_FALSE(chain.run("1", 3));
+}
+
+TEST(BranchingChainTests, Suspend) {
+    auto chain = steps_chain::BranchingChain{ screenLater, transfer, revert };
+    ASSERT_FALSE(chain.run("0"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(0, std::string{ "0" }));
+    ASSERT_TRUE(chain.run("1"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(3, std::string{ "1" }));
+}
+
+namespace {
+
+struct Ledger {
+    std::vector<int> entries;
+};
+
+std::variant<Approved, Rejected> screenWithLedger(const Request& r, Ledger& l) {
+    l.entries.push_back(r._value);
+    return screen(r);
+}
+
+Transferred transferWithLedger(const Approved& a, Ledger& l) {
+    l.entries.push_back(a._value);
+    return transfer(a);
+}
+
+Reverted revertWithLedger(const Rejected& r, Ledger& l) {
+    l.entries.push_back(-r._value);
+    return revert(r);
+}
+
+};  // anonymous namespace
+
+TEST(BranchingChainTests, Context) {
+    auto chain = steps_chain::ContextBranchingChain{
+        screenWithLedger, transferWithLedger, revertWithLedger };
+    Ledger ledger;
+    ASSERT_TRUE(chain.run("5", ledger));
+    ASSERT_TRUE(chain.run("101", ledger));
+    ASSERT_EQ(ledger.entries, (std::vector<int>{ 5, 5, 101, -101 }));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(4, std::string{ "-101" }));
+}
+
+TEST(BranchingChainTests, WrapperAndCheckpoints) {
+    using Checkpoints = std::vector<std::pair<size_t, std::string>>;
+    Checkpoints checkpoints;
+    auto recorder = [&checkpoints](size_t step, std::string_view state) {
+        checkpoints.emplace_back(step, std::string{ state });
+    };
+    auto wrapper = steps_chain::ChainWrapper{
+        steps_chain::BranchingChain{ screen, transfer, revert, notifyTransferred, notifyReverted } };
+    wrapper.initialize("500");
+    ASSERT_TRUE(wrapper.run_with_checkpoints(recorder));
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 2, "500" }, { 4, "-500" }, { 5, "-1500" } }));
+
+    // Steps are counted, not indices.
+    checkpoints.clear();
+    wrapper.initialize("500");
+    ASSERT_TRUE(wrapper.run_with_checkpoints(
+        recorder, steps_chain::CheckpointPolicy::every_n_steps(2)));
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 4, "-500" }, { 5, "-1500" } }));
+}
@@ -0,0 +1,194 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <context_steps_chain.h>
+#include <chain_batch.h>
+
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+IntParameter increment(const IntParameter& p) {
+    return IntParameter{ p._value + 1 };
+}
+
+std::optional<IntParameter> suspendOnOdd(const IntParameter& p) {
+    if (p._value % 2) {
+        return std::nullopt;
+    }
+    return p;
+}
+
+IntParameter throwOnFive(const IntParameter& p) {
+    if (p._value == 5) {
+        throw std::runtime_error{ "five" };
+    }
+    return p;
+}
+
+struct Calls {
+    int single{ 0 };
+    int batch{ 0 };
+};
+
+// Step that processes all the instances at once.
+struct Doubler {
+    IntParameter operator()(const IntParameter& p) const {
+        ++_calls->single;
+        return IntParameter{ p._value * 2 };
+    }
+
+    void batch(steps_chain::batch_args<IntParameter> in, std::vector<IntParameter>& out) const {
+        ++_calls->batch;
+        for (const auto& p : in) {
+            out.emplace_back(p._value * 2);
+        }
+    }
+
+    Calls* _calls;
+};
+
+using States = std::map<size_t, std::pair<size_t, std::string>>;
+
+template <typename Batch>
+States states(const Batch& batch) {
+    States result;
+    batch.for_each_state([&result](size_t id, size_t step, std::string_view state) {
+        result[id] = { step, std::string{ state } };
+    });
+    return result;
+}
+
+};  // anonymous namespace
+
+TEST(ChainBatchTests, RunAll) {
+    Calls calls;
+    auto batch = steps_chain::ChainBatch{
+        steps_chain::StepsChain{ increment, Doubler{ &calls }, increment } };
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(batch.add(std::to_string(i)), static_cast<size_t>(i));
+    }
+    ASSERT_EQ(batch.count_at(0), 100);
+    ASSERT_EQ(batch.run_all(), 300);
+    ASSERT_EQ(batch.count_at(3), 100);
+    // Batch method was called once for all the instances.
+    ASSERT_EQ(calls.batch, 1);
+    ASSERT_EQ(calls.single, 0);
+    for (size_t id = 0; id < batch.size(); ++id) {
+        ASSERT_TRUE(batch.is_finished(id));
+        ASSERT_EQ(batch.get_current_state(id),
+                  std::make_tuple(3, std::to_string((static_cast<int>(id) + 1) * 2 + 1)));
+    }
+}
+
+TEST(ChainBatchTests, AdvanceAllMakesOneStep) {
+    auto batch = steps_chain::ChainBatch{ steps_chain::StepsChain{ increment, increment, increment } };
+    batch.add("0");
+    batch.add("10", 1);
+    batch.add("20", 3);
+    ASSERT_EQ(batch.advance_all(), 2);
+    ASSERT_EQ(states(batch), (States{ { 0, { 1, "1" } }, { 1, { 2, "11" } }, { 2, { 3, "20" } } }));
+    ASSERT_EQ(batch.advance_all(), 2);
+    ASSERT_EQ(batch.advance_all(), 1);
+    ASSERT_EQ(batch.advance_all(), 0);
+    ASSERT_EQ(states(batch), (States{ { 0, { 3, "3" } }, { 1, { 3, "12" } }, { 2, { 3, "20" } } }));
+}
+
+TEST(ChainBatchTests, SuspendedInstancesStay) {
+    auto batch = steps_chain::ChainBatch{ steps_chain::StepsChain{ increment, suspendOnOdd, increment } };
+    for (int i = 0; i < 6; ++i) {
+        batch.add(std::to_string(i));
+    }
+    ASSERT_EQ(batch.run_all(), 6 + 3 + 3);
+    ASSERT_EQ(batch.count_at(1), 3);
+    for (size_t id = 0; id < batch.size(); ++id) {
+        // Instances with even values are suspended on the second step.
+        ASSERT_EQ(batch.step_of(id), id % 2 ? 3 : 1);
+    }
+    ASSERT_EQ(batch.get_current_state(4), std::make_tuple(1, std::string{ "5" }));
+    ASSERT_EQ(batch.get_current_state(5), std::make_tuple(3, std::string{ "7" }));
+}
+
+TEST(ChainBatchTests, ExceptionKeepsRemainingInstances) {
+    auto batch = steps_chain::ChainBatch{ steps_chain::StepsChain{ throwOnFive, increment } };
+    for (int i = 3; i < 8; ++i) {
+        batch.add(std::to_string(i));
+    }
+    ASSERT_THROW(batch.run_all(), std::runtime_error);
+    // Instances before the failed one made the step, the rest were not touched.
+    ASSERT_EQ(states(batch), (States{
+        { 0, { 1, "3" } }, { 1, { 1, "4" } }, { 2, { 0, "5" } }, { 3, { 0, "6" } }, { 4, { 0, "7" } } }));
+    ASSERT_EQ(batch.count_at(0), 3);
+    ASSERT_EQ(batch.count_at(1), 2);
+}
+
+TEST(ChainBatchTests, CompactReusesIds) {
+    auto batch = steps_chain::ChainBatch{ steps_chain::StepsChain{ increment, suspendOnOdd } };
+    for (int i = 0; i < 4; ++i) {
+        batch.add(std::to_string(i));
+    }
+    batch.run_all();
+    std::map<size_t, int> removed;
+    ASSERT_EQ(batch.compact([&removed](size_t id, const IntParameter& p) { removed[id] = p._value; }), 2);
+    ASSERT_EQ(removed, (std::map<size_t, int>{ { 1, 2 }, { 3, 4 } }));
+    ASSERT_EQ(batch.size(), 2);
+    ASSERT_EQ(batch.count_at(2), 0);
+    // Removed ids are given to new instances, the others keep theirs.
+    ASSERT_THROW(batch.add("x"), std::invalid_argument);
+    ASSERT_EQ(batch.size(), 2);
+    const size_t first = batch.add("10");
+    const size_t second = batch.add("20", 1);
+    ASSERT_EQ(first + second, 1 + 3);
+    ASSERT_NE(first, second);
+    ASSERT_EQ(batch.add("30"), 4);
+    ASSERT_EQ(batch.size(), 5);
+    ASSERT_EQ(batch.get_current_state(second), std::make_tuple(1, std::string{ "20" }));
+    ASSERT_EQ(batch.get_current_state(0), std::make_tuple(1, std::string{ "1" }));
+    ASSERT_EQ(batch.compact(), 0);
+}
+
+namespace {
+
+struct Factor {
+    int _value;
+};
+
+IntParameter multiply(const IntParameter& p, const Factor& f) {
+    return IntParameter{ p._value * f._value };
+}
+
+// Batch step with a context.
+struct Adder {
+    IntParameter operator()(const IntParameter& p, const Factor& f) const {
+        return IntParameter{ p._value + f._value };
+    }
+
+    void batch(steps_chain::batch_args<IntParameter> in, std::vector<IntParameter>& out,
+               const Factor& f) const {
+        ++*_batches;
+        for (const auto& p : in) {
+            out.emplace_back(p._value + f._value);
+        }
+    }
+
+    int* _batches;
+};
+
+};  // anonymous namespace
+
+TEST(ChainBatchTests, SharedContext) {
+    int batches = 0;
+    auto batch = steps_chain::ChainBatch{ steps_chain::ContextStepsChain{ multiply, Adder{ &batches } } };
+    for (int i = 1; i < 4; ++i) {
+        batch.add(std::to_string(i));
+    }
+    ASSERT_EQ(batch.advance_all(Factor{ 10 }), 3);
+    ASSERT_EQ(batch.run_all(Factor{ 5 }), 3);
+    ASSERT_EQ(batches, 1);
+    ASSERT_EQ(states(batch), (States{ { 0, { 2, "15" } }, { 1, { 2, "25" } }, { 2, { 2, "35" } } }));
+}
\ No newline at end of file
@@ -0,0 +1,325 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <chain_fleet.h>
+#include <result.h>
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+
+namespace {
+
+IntParameter doubleValue(const IntParameter& data) {
+    return IntParameter{ data._value * 2 };
+}
+
+auto make_chain() {
+    return steps_chain::StepsChain{
+        doubleValue,
+        doubleValue,
+        doubleValue
+    };
+}
+
+// Lambda steps can not be assigned, so the chain is not move-assignable either.
+auto make_lambda_chain() {
+    return steps_chain::StepsChain{ [](const IntParameter& data) {
+        return IntParameter{ data._value + 1 };
+    } };
+}
+
+bool approved = false;
+int approvalCalls = 0;
+
+std::optional<IntParameter> waitForApproval(const IntParameter& data) {
+    ++approvalCalls;
+    if (!approved) {
+        return std::nullopt;
+    }
+    return IntParameter{ data._value };
+}
+
+auto make_approval_chain() {
+    return steps_chain::StepsChain{ doubleValue, waitForApproval, doubleValue };
+}
+
+template <typename Chain>
+Chain initialized(Chain chain, const char* parameters, size_t step_idx = 0) {
+    chain.initialize(parameters, step_idx);
+    return chain;
+}
+
+using Fleet = steps_chain::ChainFleet<
+    decltype(make_chain()), decltype(make_lambda_chain()), decltype(make_approval_chain())>;
+
+int valueOf(Fleet& fleet, size_t id) {
+    int value = -1;
+    fleet.visit(id, [&value](const auto& chain) {
+        value = chain.template peek<IntParameter>()->_value;
+    });
+    return value;
+}
+
+};  // anonymous namespace
+
+TEST(ChainFleetTests, AdvancesUntilFinished) {
+    Fleet fleet;
+    std::vector<size_t> ids;
+    for (int i = 0; i < 100; ++i) {
+        ids.push_back(i % 2
+            ? fleet.add(initialized(make_chain(), std::to_string(i).c_str()))
+            : fleet.add(initialized(make_lambda_chain(), std::to_string(i).c_str())));
+    }
+    EXPECT_EQ(fleet.size(), 100u);
+    EXPECT_EQ(fleet.count<decltype(make_chain())>(), 50u);
+    EXPECT_EQ(fleet.active(), 100u);
+    EXPECT_EQ(fleet.advance_all(), 100u);
+    EXPECT_EQ(fleet.active(), 50u);  // lambda chains have one step
+    EXPECT_EQ(fleet.advance_all(5), 100u);
+    EXPECT_EQ(fleet.active(), 0u);
+    EXPECT_EQ(fleet.advance_all(), 0u);
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_TRUE(fleet.is_finished(ids[i]));
+        EXPECT_EQ(valueOf(fleet, ids[i]), i % 2 ? i * 8 : i + 1);
+    }
+}
+
+// Suspended chains are left alone until they are woken up.
+TEST(ChainFleetTests, SuspendedChainsWaitForWake) {
+    approved = false;
+    approvalCalls = 0;
+    Fleet fleet;
+    const size_t first = fleet.add(initialized(make_approval_chain(), "1"));
+    const size_t second = fleet.add(initialized(make_approval_chain(), "2"));
+    EXPECT_EQ(fleet.advance_all(10), 2u);
+    EXPECT_TRUE(fleet.is_suspended(first));
+    EXPECT_TRUE(fleet.is_suspended(second));
+    EXPECT_EQ(fleet.active(), 0u);
+    EXPECT_EQ(approvalCalls, 2);
+    EXPECT_EQ(fleet.advance_all(), 0u);
+    EXPECT_EQ(approvalCalls, 2);
+
+    approved = true;
+    EXPECT_TRUE(fleet.wake(second));
+    EXPECT_FALSE(fleet.wake(second));
+    EXPECT_EQ(fleet.advance_all(10), 2u);
+    EXPECT_TRUE(fleet.is_finished(second));
+    EXPECT_EQ(valueOf(fleet, second), 8);
+    EXPECT_TRUE(fleet.is_suspended(first));
+    EXPECT_FALSE(fleet.wake(1000));
+}
+
+// Ids stay valid when compact() moves the chains, both move-assignable and not.
+TEST(ChainFleetTests, CompactKeepsIds) {
+    approved = false;
+    Fleet fleet;
+    std::vector<size_t> ids;
+    for (int i = 0; i < 300; ++i) {
+        const auto parameters = std::to_string(i);
+        switch (i % 3) {
+        case 0:  // finished from the start every other time
+            ids.push_back(fleet.add(
+                initialized(make_chain(), parameters.c_str(), i % 2 ? 3 : 0)));
+            break;
+        case 1:
+            ids.push_back(fleet.add(initialized(make_lambda_chain(), parameters.c_str())));
+            break;
+        default:
+            ids.push_back(fleet.add(initialized(make_approval_chain(), parameters.c_str())));
+        }
+    }
+    fleet.advance_all(2);
+    // Half of the first kind and all the lambda chains are finished, approval chains wait.
+    std::vector<size_t> removed;
+    EXPECT_EQ(fleet.compact([&removed](size_t id, const auto&) { removed.push_back(id); }), 150u);
+    EXPECT_EQ(removed.size(), 150u);
+    EXPECT_EQ(fleet.size(), 150u);
+    EXPECT_EQ(fleet.count<decltype(make_lambda_chain())>(), 0u);
+    EXPECT_EQ(fleet.compact(), 0u);
+    for (int i = 0; i < 300; ++i) {
+        const bool kept = i % 3 == 2 || (i % 3 == 0 && i % 2 == 0);
+        ASSERT_EQ(fleet.contains(ids[i]), kept) << i;
+        if (i % 3 == 2) {
+            EXPECT_TRUE(fleet.is_suspended(ids[i]));
+            EXPECT_EQ(valueOf(fleet, ids[i]), i * 2);
+        }
+        else if (kept) {
+            EXPECT_FALSE(fleet.is_suspended(ids[i]));
+            EXPECT_EQ(valueOf(fleet, ids[i]), i * 4);
+        }
+    }
+    approved = true;
+    for (int i = 2; i < 300; i += 3) {
+        EXPECT_TRUE(fleet.wake(ids[i]));
+    }
+    EXPECT_EQ(fleet.active(), 150u);  // 50 of the first kind did not finish yet
+    while (fleet.active() > 0) {
+        fleet.advance_all();
+    }
+    EXPECT_EQ(fleet.compact(), 150u);
+    EXPECT_EQ(fleet.size(), 0u);
+}
+
+TEST(ChainFleetTests, CompactedIdsAreReused) {
+    approved = false;
+    Fleet fleet;
+    const size_t first = fleet.add(initialized(make_chain(), "1"));
+    const size_t second = fleet.add(initialized(make_lambda_chain(), "2"));
+    while (fleet.active() > 0) {
+        fleet.advance_all();
+    }
+    EXPECT_EQ(fleet.compact(), 2u);
+    EXPECT_FALSE(fleet.contains(first));
+    // New chains of any type take the removed ids, no new ones are made.
+    const size_t third = fleet.add(initialized(make_approval_chain(), "3"));
+    const size_t fourth = fleet.add(initialized(make_chain(), "4"));
+    const size_t fifth = fleet.add(initialized(make_chain(), "5"));
+    EXPECT_TRUE((third == first && fourth == second) || (third == second && fourth == first));
+    EXPECT_EQ(fifth, 2u);
+    EXPECT_EQ(fleet.size(), 3u);
+    fleet.advance_all(3);
+    EXPECT_TRUE(fleet.is_suspended(third));
+    EXPECT_EQ(valueOf(fleet, fourth), 32);
+    EXPECT_EQ(valueOf(fleet, fifth), 40);
+}
+
+namespace {
+
+// Counts its own steps, and throws when moved while 'throwOnMove' is set.
+struct MoveThrowingChain {
+    static inline bool throwOnMove = false;
+
+    explicit MoveThrowingChain(int steps) : _steps{ steps } {}
+    MoveThrowingChain(MoveThrowingChain&& other) : _steps{ other._steps } {
+        if (throwOnMove) {
+            throw std::runtime_error{ "move" };
+        }
+    }
+    MoveThrowingChain& operator=(MoveThrowingChain&&) = default;
+
+    bool advance() { return _steps-- > 0; }
+    bool is_finished() const { return _steps <= 0; }
+
+    int _steps;
+};
+
+};  // anonymous namespace
+
+TEST(ChainFleetTests, ThrowingAddChangesNothing) {
+    steps_chain::ChainFleet<MoveThrowingChain> fleet;
+    // The first chain of a word of the bitsets and a chain after it.
+    for (const size_t count : { 64, 65 }) {
+        while (fleet.size() < count) {
+            fleet.add(MoveThrowingChain{ 1 });
+        }
+        MoveThrowingChain::throwOnMove = true;
+        EXPECT_THROW(fleet.add(MoveThrowingChain{ 2 }), std::runtime_error);
+        MoveThrowingChain::throwOnMove = false;
+        EXPECT_EQ(fleet.size(), count);
+        EXPECT_EQ(fleet.count<MoveThrowingChain>(), count);
+        EXPECT_FALSE(fleet.contains(count));
+    }
+    const size_t id = fleet.add(MoveThrowingChain{ 2 });
+    EXPECT_EQ(id, 65u);
+    EXPECT_EQ(fleet.advance_all(), 66u);
+    EXPECT_EQ(fleet.advance_all(), 1u);
+    EXPECT_TRUE(fleet.is_finished(id));
+    EXPECT_EQ(fleet.active(), 0u);
+}
+
+namespace {
+
+IntParameter failOnOdd(const IntParameter& data) {
+    if (data._value % 2) {
+        throw std::runtime_error{ "odd" };
+    }
+    return data;
+}
+
+};  // anonymous namespace
+
+TEST(ChainFleetTests, ThrowingStepSuspendsChain) {
+    steps_chain::ChainFleet<decltype(steps_chain::StepsChain{ failOnOdd })> fleet;
+    const size_t even = fleet.add(initialized(steps_chain::StepsChain{ failOnOdd }, "2"));
+    const size_t odd = fleet.add(initialized(steps_chain::StepsChain{ failOnOdd }, "3"));
+    EXPECT_THROW(fleet.advance_all(), std::runtime_error);
+    EXPECT_TRUE(fleet.is_finished(even));
+    EXPECT_TRUE(fleet.is_suspended(odd));
+    EXPECT_EQ(fleet.advance_all(), 0u);
+    EXPECT_TRUE(fleet.wake(odd));
+    EXPECT_THROW(fleet.advance_all(), std::runtime_error);
+}
+
+namespace {
+
+struct OddValue {
+    int value;
+};
+
+steps_chain::result<IntParameter, OddValue> rejectOdd(const IntParameter& data) {
+    if (data._value % 2) {
+        return steps_chain::failure{ OddValue{ data._value } };
+    }
+    return data;
+}
+
+};  // anonymous namespace
+
+TEST(ChainFleetTests, FailedChainsAreKeptApart) {
+    using Chain = decltype(steps_chain::StepsChain{ rejectOdd, doubleValue });
+    steps_chain::ChainFleet<Chain> fleet;
+    const size_t even = fleet.add(
+        initialized(steps_chain::StepsChain{ rejectOdd, doubleValue }, "2"));
+    const size_t odd = fleet.add(
+        initialized(steps_chain::StepsChain{ rejectOdd, doubleValue }, "3"));
+    EXPECT_EQ(fleet.advance_all(2), 2u);
+    EXPECT_EQ(fleet.active(), 0u);
+    EXPECT_TRUE(fleet.is_finished(even));
+    EXPECT_TRUE(fleet.is_failed(odd));
+    EXPECT_FALSE(fleet.is_suspended(odd));
+    EXPECT_EQ(fleet.error<OddValue>(even), nullptr);
+    ASSERT_NE(fleet.error<OddValue>(odd), nullptr);
+    EXPECT_EQ(fleet.error<OddValue>(odd)->value, 3);
+    // The failed step is not called again.
+    EXPECT_FALSE(fleet.wake(odd));
+    EXPECT_EQ(fleet.advance_all(), 0u);
+    std::vector<size_t> failed;
+    EXPECT_EQ(fleet.compact([&failed](size_t id, const Chain& chain) {
+        if (chain.failed()) {
+            failed.push_back(id);
+        }
+    }), 2u);
+    EXPECT_EQ(failed, std::vector<size_t>{ odd });
+    EXPECT_FALSE(fleet.is_failed(odd));
+}
+
+TEST(ChainFleetTests, VisitUpdatesFlags) {
+    using Chain = decltype(steps_chain::StepsChain{ rejectOdd, doubleValue });
+    steps_chain::ChainFleet<Chain> fleet;
+    const size_t id = fleet.add(
+        initialized(steps_chain::StepsChain{ rejectOdd, doubleValue }, "3"));
+    fleet.advance_all();
+    ASSERT_TRUE(fleet.is_failed(id));
+    EXPECT_EQ(fleet.active(), 0u);
+    // Retried with another state.
+    fleet.visit(id, [](Chain& chain) { chain.initialize("4"); });
+    EXPECT_FALSE(fleet.is_failed(id));
+    EXPECT_EQ(fleet.active(), 1u);
+    EXPECT_EQ(fleet.advance_all(2), 2u);
+    EXPECT_TRUE(fleet.is_finished(id));
+    EXPECT_EQ(fleet.active(), 0u);
+    // Finished by hand.
+    fleet.visit(id, [](Chain& chain) { chain.initialize("6"); });
+    EXPECT_EQ(fleet.active(), 1u);
+    fleet.visit(id, [](Chain& chain) {
+        chain.advance();
+        chain.advance();
+    });
+    EXPECT_TRUE(fleet.is_finished(id));
+    EXPECT_EQ(fleet.active(), 0u);
+    EXPECT_EQ(fleet.advance_all(), 0u);
+}
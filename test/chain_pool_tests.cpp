@@ -0,0 +1,147 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <context_steps_chain.h>
+#include <chain_wrapper.h>
+#include <local_storage_wrapper.h>
+#include <chain_pool.h>
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+IntParameter increment(const IntParameter& p) {
+    return IntParameter{ p._value + 1 };
+}
+
+std::optional<IntParameter> waitForPositive(const IntParameter& p) {
+    if (p._value <= 0) {
+        return std::nullopt;
+    }
+    return p;
+}
+
+struct Counters {
+    int built{ 0 };
+    int allocations{ 0 };
+};
+
+// Counts the chains built by the factory and the memory allocated for them.
+struct CountingResource : std::pmr::memory_resource {
+    explicit CountingResource(Counters* c) : counters{ c } {}
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        ++counters->allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    Counters* counters;
+};
+
+};  // anonymous namespace
+
+TEST(ChainPoolTests, ReusesReleasedChains) {
+    int built = 0;
+    steps_chain::ChainPool<> pool{ [&built]() {
+        ++built;
+        return steps_chain::ChainWrapper{ steps_chain::StepsChain{ increment, increment } };
+    } };
+    auto first = pool.acquire("1");
+    auto second = pool.acquire("10", 1);
+    EXPECT_EQ(built, 2);
+    first.resume();
+    second.resume();
+    EXPECT_EQ(first.peek<IntParameter>()->_value, 3);
+    EXPECT_EQ(second.peek<IntParameter>()->_value, 11);
+    pool.release(std::move(first));
+    pool.release(std::move(second));
+    EXPECT_EQ(pool.idle(), 2u);
+    // The state of the previous request is replaced.
+    auto third = pool.acquire(std::string{ "5" });
+    EXPECT_EQ(built, 2);
+    EXPECT_EQ(pool.idle(), 1u);
+    const auto [step, state] = third.get_current_state();
+    EXPECT_EQ(step, 0u);
+    EXPECT_EQ(state, "5");
+    EXPECT_FALSE(third.is_finished());
+}
+
+TEST(ChainPoolTests, KeepsAtMostMaxIdle) {
+    steps_chain::ChainPool<> pool{
+        []() { return steps_chain::ChainWrapper{ steps_chain::StepsChain{ increment } }; }, 2 };
+    std::vector<steps_chain::ChainWrapper> chains;
+    for (int i = 0; i < 4; ++i) {
+        chains.push_back(pool.acquire("0"));
+    }
+    for (auto& chain : chains) {
+        pool.release(std::move(chain));
+    }
+    EXPECT_EQ(pool.idle(), 2u);
+    pool.prefill(5);
+    EXPECT_EQ(pool.idle(), 2u);
+}
+
+TEST(ChainPoolTests, DestroysChainsBeyondMaxIdleOnRelease) {
+    const auto token = std::make_shared<int>(0);
+    steps_chain::ChainPool<> pool{ [&token]() {
+        return steps_chain::ChainWrapper{ steps_chain::StepsChain{
+            [token](const IntParameter& p) { return p; } } };
+    }, 2 };
+    std::vector<steps_chain::ChainWrapper> chains;
+    for (int i = 0; i < 4; ++i) {
+        chains.push_back(pool.acquire("0"));
+    }
+    EXPECT_EQ(token.use_count(), 5);
+    for (auto& chain : chains) {
+        pool.release(std::move(chain));
+    }
+    // Only the idle chains hold the token, even though 'chains' is still alive.
+    EXPECT_EQ(token.use_count(), 3);
+}
+
+TEST(ChainPoolTests, NoAllocationsInSteadyState) {
+    Counters counters;
+    CountingResource resource{ &counters };
+    steps_chain::ChainPool<> pool{ [&]() {
+        ++counters.built;
+        return steps_chain::ChainWrapper{ std::allocator_arg, &resource,
+            steps_chain::StepsChain{ waitForPositive, increment, increment } };
+    } };
+    pool.prefill(4);
+    EXPECT_EQ(counters.built, 4);
+    EXPECT_EQ(counters.allocations, 4);
+    for (int request = 0; request < 100; ++request) {
+        // Some requests are suspended, the chain is released anyway.
+        auto chain = pool.acquire(std::to_string(request % 3 - 1));
+        chain.resume();
+        EXPECT_EQ(chain.is_finished(), request % 3 == 2);
+        pool.release(std::move(chain));
+    }
+    EXPECT_EQ(counters.built, 4);
+    EXPECT_EQ(counters.allocations, 4);
+}
+
+TEST(ChainPoolTests, LocalStorageWrapper) {
+    using Wrapper = steps_chain::ChainWrapperLS;
+    steps_chain::ChainPool<Wrapper> pool{
+        []() { return Wrapper{ steps_chain::StepsChain{ increment, increment, increment } }; } };
+    auto chain = pool.acquire("1");
+    chain.resume();
+    EXPECT_EQ(chain.peek<IntParameter>()->_value, 4);
+    pool.release(std::move(chain));
+    auto again = pool.acquire("7", 2);
+    again.resume();
+    EXPECT_EQ(again.peek<IntParameter>()->_value, 8);
+}
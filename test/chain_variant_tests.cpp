@@ -0,0 +1,113 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <context_steps_chain.h>
+#include <chain_variant.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+
+namespace {
+
+IntParameter doubleValue(const IntParameter& data) {
+    return IntParameter{ data._value * 2 };
+}
+
+auto make_chain() {
+    return steps_chain::StepsChain{
+        doubleValue,
+        doubleValue,
+        doubleValue
+    };
+}
+
+auto make_short_chain() {
+    return steps_chain::StepsChain{ doubleValue };
+}
+
+struct MockUserDB {
+    explicit MockUserDB(int count) : _userCount{ count } {}
+
+    int getUserCount() const { return _userCount; }
+
+    int _userCount;
+};
+
+IntParameter usersCount(EmptyParameter p, const MockUserDB& db) {
+    return IntParameter{ db.getUserCount() };
+}
+
+auto make_context_chain() {
+    return steps_chain::ContextStepsChain{ usersCount };
+}
+
+using Process = steps_chain::ChainVariant<
+    decltype(make_chain()),
+    decltype(make_short_chain()),
+    steps_chain::BoundChain<decltype(make_context_chain()), MockUserDB>>;
+
+};  // anonymous namespace
+
+TEST(ChainVariantTests, IndependentState) {
+    auto processes = std::vector<Process>{ make_chain(), make_chain(), make_short_chain() };
+    processes[0].initialize("1", 1);  // Start from the second step
+    while (!processes[0].is_finished()) {
+        processes[0].advance();
+    }
+    const auto [step_idx_after_0, data_after_0] = processes[0].get_current_state();
+    ASSERT_EQ(step_idx_after_0, 3);
+    ASSERT_EQ(data_after_0, "4");
+    const auto [step_idx_init_1, data_init_1] = processes[1].get_current_state();
+    ASSERT_EQ(step_idx_init_1, 0);  // Second chain remained uninitialized and did not run
+    ASSERT_EQ(data_init_1, "0");
+    processes[2].run("5");
+    ASSERT_EQ(processes[2].peek<IntParameter>()->_value, 10);
+    ASSERT_TRUE(processes[2].holds<decltype(make_short_chain())>());
+    ASSERT_FALSE(processes[1].is_finished());
+}
+
+// Each chain with context has an individual context instance.
+TEST(ChainVariantTests, WrappingChainsWithContext) {
+    std::unordered_map<std::string, Process> processes;
+    processes["userCount_10"] = Process{ make_context_chain(), MockUserDB{ 10 } };
+    processes["userCount_20"] = Process{ make_context_chain(), MockUserDB{ 20 } };
+    processes["octuple"] = make_chain();
+    processes["userCount_10"].run("");
+    processes["userCount_20"].run("");
+    processes["octuple"].initialize("1");
+    processes["octuple"].resume();
+    ASSERT_EQ(std::get<1>(processes["userCount_10"].get_current_state()), "10");
+    ASSERT_EQ(std::get<1>(processes["userCount_20"].get_current_state()), "20");
+    std::string buffer;
+    ASSERT_EQ(processes["octuple"].get_current_state(buffer), 3);
+    ASSERT_EQ(buffer, "8");
+    ASSERT_EQ(processes["octuple"].peek<EmptyParameter>(), nullptr);
+}
+
+TEST(ChainVariantTests, Checkpoints) {
+    Process process{ make_chain() };
+    process.initialize("1");
+    std::vector<std::string> states;
+    ASSERT_TRUE(process.run_with_checkpoints([&states](size_t, std::string_view state) {
+        states.emplace_back(state);
+    }));
+    ASSERT_EQ(states, (std::vector<std::string>{ "2", "4", "8" }));
+}
+
+TEST(ChainVariantTests, EmptyWrapper) {
+    Process empty;
+    ASSERT_TRUE(empty.empty());
+    auto copy = empty;
+    ASSERT_FALSE(copy.run("1"));
+    ASSERT_FALSE(copy.advance());
+    ASSERT_FALSE(copy.is_finished());
+    ASSERT_EQ(copy.peek<IntParameter>(), nullptr);
+    ASSERT_EQ(std::get<0>(copy.get_current_state()), static_cast<size_t>(-1));
+    copy = make_short_chain();
+    ASSERT_FALSE(copy.empty());
+    ASSERT_TRUE(copy.run("1"));
+}
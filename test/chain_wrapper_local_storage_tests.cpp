@@ -3,6 +3,8 @@
 #include <context_steps_chain.h>
 #include <local_storage_wrapper.h>
 
+#include <array>
+#include <memory>
 #include <optional>
 #include <string>
 #include <unordered_map>
@@ -147,3 +149,186 @@ TEST(ChainWrapperLSTests, WrappingChainsWithContext) {
         && processes["quadruple"].is_finished()
     );
 }
+
+namespace {
+
+struct SharedDB {
+    int _userCount{ 0 };
+};
+
+std::weak_ptr<SharedDB> observedDB;
+
+IntParameter registerUser(IntParameter p, SharedDB& db) {
+    // Only the test and the wrapper own the context, steps do not touch the reference counter.
+    EXPECT_EQ(observedDB.use_count(), 2);
+    return IntParameter{ ++db._userCount };
+}
+
+};  // anonymous namespace
+
+// Wrapper may own the context through a smart pointer, while steps take the context itself by
+// reference.
+TEST(ChainWrapperLSTests, ContextHeldBySmartPointer) {
+    auto db = std::make_shared<SharedDB>();
+    observedDB = db;
+    auto process = steps_chain::ChainWrapperLS{
+        steps_chain::ContextStepsChain{ registerUser, registerUser }, db };
+    process.run("0");
+    const auto [step_idx_after, data_after] = process.get_current_state();
+    ASSERT_EQ(step_idx_after, 2);
+    ASSERT_EQ(data_after, "2");
+    ASSERT_EQ(db->_userCount, 2);
+}
+
+TEST(ChainWrapperLSTests, StateIntoReusableBufferAndPeek) {
+    auto processes = std::vector<steps_chain::ChainWrapperLS>{
+        make_chain(),
+        steps_chain::ChainWrapperLS{ steps_chain::ContextStepsChain{ usersCount }, MockUserDB{ 5 } }
+    };
+    processes[0].initialize("1");
+    processes[1].initialize("");
+    std::string buffer;
+    for (auto& process : processes) {
+        while (process.advance()) {
+            buffer.clear();
+            process.get_current_state(buffer);
+        }
+    }
+    ASSERT_EQ(buffer, "5");
+    buffer.clear();
+    ASSERT_EQ(processes[0].get_current_state(buffer), 3);
+    ASSERT_EQ(buffer, "8");
+    ASSERT_EQ(processes[0].peek<IntParameter>()->_value, 8);
+    ASSERT_EQ(processes[0].peek<EmptyParameter>(), nullptr);
+    ASSERT_EQ(processes[1].peek<IntParameter>()->_value, 5);
+}
+
+namespace {
+
+struct HeavyDB {
+    int getUserCount() const { return _userCount; }
+
+    int _userCount{ 0 };
+    std::array<char, 256> _cache{};
+};
+
+IntParameter heavyUsersCount(EmptyParameter p, const HeavyDB& db) {
+    return IntParameter{ db.getUserCount() };
+}
+
+struct CachingPolicy : steps_chain::default_policy {
+    static constexpr bool cache_state = true;
+};
+
+// Counts live instances, moving it may throw as far as the wrapper knows.
+struct TrackedDB {
+    TrackedDB() { ++alive; }
+    TrackedDB(const TrackedDB&) { ++alive; }
+    TrackedDB(TrackedDB&&) { ++alive; }
+    ~TrackedDB() { --alive; }
+
+    static inline int alive = 0;
+};
+
+IntParameter trackedStep(IntParameter p, const TrackedDB&) {
+    return IntParameter{ p._value + 1 };
+}
+
+};  // anonymous namespace
+
+// Chains that do not fit in the buffer are kept on the heap, the wrapper works the same way.
+TEST(ChainWrapperLSTests, BufferCapacity) {
+    using SmallWrapper = steps_chain::BasicChainWrapperLS<sizeof(void*)>;
+    using BigWrapper = steps_chain::BasicChainWrapperLS<512, 64>;
+    static_assert(!SmallWrapper::stored_inline<decltype(make_chain())>);
+    static_assert(BigWrapper::stored_inline<decltype(make_chain())>);
+    static_assert(alignof(BigWrapper) == 64);
+    static_assert(!steps_chain::ChainWrapperLS::stored_inline<
+        std::pair<steps_chain::ContextStepsChain<steps_chain::default_policy,
+                                                 decltype(&heavyUsersCount)>, HeavyDB>>);
+
+    auto small = std::vector<SmallWrapper>{ make_chain(), make_chain() };
+    small[0].run("1");
+    auto copy = small[0];
+    small.push_back(std::move(small[1]));
+    small[2].run("2");
+    ASSERT_EQ(copy.peek<IntParameter>()->_value, 8);
+    ASSERT_EQ(small[2].peek<IntParameter>()->_value, 16);
+
+    HeavyDB db;
+    db._userCount = 42;
+    steps_chain::ChainWrapperLS heavy{ steps_chain::ContextStepsChain{ heavyUsersCount }, db };
+    auto heavyCopy = heavy;
+    heavy.run("");
+    heavyCopy = std::move(heavy);
+    ASSERT_TRUE(heavyCopy.is_finished());
+    ASSERT_EQ(heavyCopy.peek<IntParameter>()->_value, 42);
+}
+
+// Default-constructed and moved from wrappers can be copied, moved and called.
+TEST(ChainWrapperLSTests, EmptyWrapper) {
+    steps_chain::ChainWrapperLS empty;
+    auto copy = empty;
+    auto moved = std::move(copy);
+    ASSERT_FALSE(moved.run("1"));
+    ASSERT_FALSE(moved.advance());
+    ASSERT_FALSE(moved.is_finished());
+    ASSERT_EQ(moved.peek<IntParameter>(), nullptr);
+    ASSERT_EQ(std::get<0>(moved.get_current_state()), static_cast<size_t>(-1));
+
+    steps_chain::ChainWrapperLS process{ make_chain() };
+    auto target = std::move(process);
+    ASSERT_FALSE(process.run("1"));
+    process = target;
+    ASSERT_TRUE(process.run("1"));
+    target = empty;
+    ASSERT_FALSE(target.run("1"));
+    process = std::move(process);
+    ASSERT_EQ(process.peek<IntParameter>()->_value, 8);
+}
+
+// Chains of trivially relocatable steps and arguments are moved with memcpy, other ones with their
+// move constructors, both inside the buffer and on the heap.
+TEST(ChainWrapperLSTests, Relocation) {
+    static_assert(steps_chain::is_trivially_relocatable<decltype(make_chain())>::value);
+    static_assert(steps_chain::is_trivially_relocatable<
+        std::pair<steps_chain::ContextStepsChain<steps_chain::default_policy,
+                                                 decltype(&usersCount)>,
+                  std::shared_ptr<MockUserDB>>>::value);
+    static_assert(!steps_chain::is_trivially_relocatable<
+        steps_chain::StepsChain<CachingPolicy, decltype(&doubleValue)>>::value);
+
+    std::vector<steps_chain::ChainWrapperLS> processes;
+    auto db = std::make_shared<MockUserDB>(7);
+    std::string suffix{ "0" };
+    auto appending = steps_chain::StepsChain{ [suffix](const IntParameter& p) {
+        return IntParameter{ std::stoi(std::to_string(p._value) + suffix) };
+    } };
+    static_assert(!steps_chain::is_trivially_relocatable<decltype(appending)>::value);
+    static_assert(steps_chain::ChainWrapperLS::stored_inline<decltype(appending)>);
+    for (int i = 0; i < 1000; ++i) {
+        if (i % 4 == 3) {
+            processes.emplace_back(appending);
+        }
+        else if (i % 3 == 0) {
+            processes.emplace_back(steps_chain::ContextStepsChain{ usersCount }, db);
+        }
+        else if (i % 3 == 1) {
+            processes.emplace_back(steps_chain::ContextStepsChain{ trackedStep }, TrackedDB{});
+        }
+        else {
+            processes.emplace_back(make_chain());
+        }
+        processes.back().initialize(std::to_string(i));
+    }
+    ASSERT_EQ(db.use_count(), 251);
+    ASSERT_EQ(TrackedDB::alive, 250);
+    for (int i = 0; i < 1000; ++i) {
+        processes[i].run(std::to_string(i));
+        const int expected = i % 4 == 3 ? i * 10 : i % 3 == 0 ? 7 : i % 3 == 1 ? i + 1 : i * 8;
+        ASSERT_EQ(processes[i].peek<IntParameter>()->_value, expected);
+    }
+    processes.clear();
+    ASSERT_EQ(db.use_count(), 1);
+    ASSERT_EQ(TrackedDB::alive, 0);
+}
@@ -3,6 +3,10 @@
 #include <context_steps_chain.h>
 #include <chain_wrapper.h>
 
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <string>
 #include <unordered_map>
@@ -146,3 +150,139 @@ TEST(ChainWrapperTests, WrappingChainsWithContext) {
         && processes["quadruple"].is_finished()
     );
 }
+
+namespace {
+
+struct SharedDB {
+    int _userCount{ 0 };
+};
+
+std::weak_ptr<SharedDB> observedDB;
+
+IntParameter registerUser(IntParameter p, SharedDB& db) {
+    // Only the test and the wrapper own the context, steps do not touch the reference counter.
+    EXPECT_EQ(observedDB.use_count(), 2);
+    return IntParameter{ ++db._userCount };
+}
+
+};  // anonymous namespace
+
+// Wrapper may own the context through a smart pointer, while steps take the context itself by
+// reference.
+TEST(ChainWrapperTests, ContextHeldBySmartPointer) {
+    auto db = std::make_shared<SharedDB>();
+    observedDB = db;
+    auto process = steps_chain::ChainWrapper{
+        steps_chain::ContextStepsChain{ registerUser, registerUser }, db };
+    process.run("0");
+    const auto [step_idx_after, data_after] = process.get_current_state();
+    ASSERT_EQ(step_idx_after, 2);
+    ASSERT_EQ(data_after, "2");
+    ASSERT_EQ(db->_userCount, 2);
+}
+
+TEST(ChainWrapperTests, StateIntoReusableBufferAndPeek) {
+    auto processes = std::vector<steps_chain::ChainWrapper>{
+        make_chain(),
+        steps_chain::ChainWrapper{ steps_chain::ContextStepsChain{ usersCount }, MockUserDB{ 5 } }
+    };
+    processes[0].initialize("1");
+    processes[1].initialize("");
+    std::string buffer;
+    for (auto& process : processes) {
+        while (process.advance()) {
+            buffer.clear();
+            process.get_current_state(buffer);
+        }
+    }
+    ASSERT_EQ(buffer, "5");
+    buffer.clear();
+    ASSERT_EQ(processes[0].get_current_state(buffer), 3);
+    ASSERT_EQ(buffer, "8");
+    ASSERT_EQ(processes[0].peek<IntParameter>()->_value, 8);
+    ASSERT_EQ(processes[0].peek<EmptyParameter>(), nullptr);
+    ASSERT_EQ(processes[1].peek<IntParameter>()->_value, 5);
+}
+
+namespace {
+
+struct AllocationCounter {
+    int allocations{ 0 };
+    int deallocations{ 0 };
+};
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    explicit CountingAllocator(AllocationCounter* c) : counter{ c } {}
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : counter{ other.counter } {}
+
+    T* allocate(size_t n) {
+        ++counter->allocations;
+        return std::allocator<T>{}.allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        ++counter->deallocations;
+        std::allocator<T>{}.deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>& other) const { return counter == other.counter; }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U>& other) const { return counter != other.counter; }
+
+    AllocationCounter* counter;
+};
+
+};  // anonymous namespace
+
+// Wrapped chain, its copies included, is allocated with the given allocator.
+TEST(ChainWrapperTests, CustomAllocator) {
+    AllocationCounter counter;
+    {
+        steps_chain::ChainWrapper process{
+            std::allocator_arg, CountingAllocator<char>{ &counter }, make_chain() };
+        EXPECT_EQ(counter.allocations, 1);
+        auto copy = process;
+        EXPECT_EQ(counter.allocations, 2);
+        auto moved = std::move(process);
+        EXPECT_EQ(counter.allocations, 2);
+        copy.run("1");
+        ASSERT_EQ(copy.peek<IntParameter>()->_value, 8);
+        steps_chain::ChainWrapper withContext{
+            std::allocator_arg, CountingAllocator<char>{ &counter },
+            steps_chain::ContextStepsChain{ usersCount }, MockUserDB{ 7 } };
+        withContext.run("");
+        ASSERT_EQ(withContext.peek<IntParameter>()->_value, 7);
+        EXPECT_EQ(counter.allocations, 3);
+        EXPECT_EQ(counter.deallocations, 0);
+    }
+    EXPECT_EQ(counter.deallocations, 3);
+}
+
+TEST(ChainWrapperTests, MemoryResource) {
+    std::array<std::byte, 4096> buffer;
+    // Fails on any allocation beyond the buffer.
+    std::pmr::monotonic_buffer_resource arena{
+        buffer.data(), buffer.size(), std::pmr::null_memory_resource() };
+    std::pmr::unsynchronized_pool_resource pool{ &arena };
+    steps_chain::ChainWrapper process{ std::allocator_arg, &pool, make_chain() };
+    steps_chain::ChainWrapper withContext{
+        std::allocator_arg, &pool, steps_chain::ContextStepsChain{ usersCount }, MockUserDB{ 3 } };
+    auto copy = process;
+    process.run("2");
+    copy.run("1");
+    withContext.run("");
+    ASSERT_EQ(process.peek<IntParameter>()->_value, 16);
+    ASSERT_EQ(copy.peek<IntParameter>()->_value, 8);
+    ASSERT_EQ(withContext.peek<IntParameter>()->_value, 3);
+}
+
+TEST(ChainWrapperTests, CopyOfEmptyWrapper) {
+    steps_chain::ChainWrapper empty;
+    auto copy = empty;
+    ASSERT_FALSE(copy.run("1"));
+    ASSERT_FALSE(copy.is_finished());
+}
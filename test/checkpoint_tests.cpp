@@ -0,0 +1,166 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <context_steps_chain.h>
+#include <chain_wrapper.h>
+#include <local_storage_wrapper.h>
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using Checkpoints = std::vector<std::pair<int, std::string>>;
+
+IntParameter increment(const IntParameter& p) {
+    return IntParameter{ p._value + 1 };
+}
+
+std::optional<IntParameter> suspendOnThree(const IntParameter& p) {
+    if (p._value == 3) {
+        return std::nullopt;
+    }
+    return increment(p);
+}
+
+IntParameter throwOnTwo(const IntParameter& p) {
+    if (p._value == 2) {
+        throw std::runtime_error{ "two" };
+    }
+    return increment(p);
+}
+
+auto recorder(Checkpoints& checkpoints) {
+    return [&checkpoints](size_t step, std::string_view state) {
+        checkpoints.emplace_back(step, std::string{ state });
+    };
+}
+
+Checkpoints savedCheckpoints;
+
+void save(size_t step, std::string_view state) {
+    savedCheckpoints.emplace_back(step, std::string{ state });
+}
+
+};  // anonymous namespace
+
+TEST(CheckpointTests, EveryStep) {
+    auto chain = steps_chain::StepsChain{ increment, increment, increment };
+    chain.initialize("0");
+    Checkpoints checkpoints;
+    ASSERT_TRUE(chain.run_with_checkpoints(recorder(checkpoints)));
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 1, "1" }, { 2, "2" }, { 3, "3" } }));
+    ASSERT_FALSE(chain.run_with_checkpoints(recorder(checkpoints)));  // Already finished.
+    ASSERT_EQ(checkpoints.size(), 3);
+}
+
+TEST(CheckpointTests, FunctionAsSink) {
+    auto chain = steps_chain::StepsChain{ increment, increment };
+    savedCheckpoints.clear();
+    chain.initialize("0");
+    ASSERT_TRUE(chain.run_with_checkpoints(save));
+    chain.initialize("5");
+    steps_chain::StateSink sink{ &save };
+    ASSERT_TRUE(chain.run_with_checkpoints(sink, steps_chain::CheckpointPolicy::on_interruption()));
+    chain.initialize("5");
+    ASSERT_TRUE(chain.run_with_checkpoints(sink, steps_chain::CheckpointPolicy::every_n_steps(5)));
+    ASSERT_EQ(savedCheckpoints, (Checkpoints{ { 1, "1" }, { 2, "2" }, { 2, "7" } }));
+}
+
+TEST(CheckpointTests, EveryNSteps) {
+    auto chain = steps_chain::StepsChain{ increment, increment, increment, increment, increment };
+    chain.initialize("0");
+    Checkpoints checkpoints;
+    ASSERT_TRUE(chain.run_with_checkpoints(
+        recorder(checkpoints), steps_chain::CheckpointPolicy::every_n_steps(2)));
+    // Final state is always stored.
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 2, "2" }, { 4, "4" }, { 5, "5" } }));
+}
+
+TEST(CheckpointTests, BeforeSideEffects) {
+    auto chain = steps_chain::StepsChain{
+        increment,
+        increment,
+        steps_chain::side_effect(increment),
+        steps_chain::side_effect([](const IntParameter& p) { return increment(p); }),
+        increment
+    };
+    chain.initialize("0");
+    Checkpoints checkpoints;
+    ASSERT_TRUE(chain.run_with_checkpoints(
+        recorder(checkpoints), steps_chain::CheckpointPolicy::before_side_effects()));
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 2, "2" }, { 3, "3" }, { 5, "5" } }));
+
+    // State the chain was initialized with is considered stored already.
+    checkpoints.clear();
+    chain.initialize("0", 2);
+    ASSERT_TRUE(chain.run_with_checkpoints(
+        recorder(checkpoints), steps_chain::CheckpointPolicy::before_side_effects()));
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 3, "1" }, { 5, "3" } }));
+}
+
+TEST(CheckpointTests, OnInterruption) {
+    auto chain = steps_chain::StepsChain{ increment, increment, suspendOnThree, increment };
+    Checkpoints checkpoints;
+    const auto policy = steps_chain::CheckpointPolicy::on_interruption();
+    chain.initialize("1");
+    ASSERT_FALSE(chain.run_with_checkpoints(recorder(checkpoints), policy));
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 2, "3" } }));
+    checkpoints.clear();
+    chain.initialize("0");
+    ASSERT_TRUE(chain.run_with_checkpoints(recorder(checkpoints), policy));
+    ASSERT_TRUE(checkpoints.empty());
+}
+
+TEST(CheckpointTests, StateIsStoredOnException) {
+    auto chain = steps_chain::StepsChain{ increment, increment, throwOnTwo, increment };
+    Checkpoints checkpoints;
+    chain.initialize("0");
+    ASSERT_THROW(chain.run_with_checkpoints(
+        recorder(checkpoints), steps_chain::CheckpointPolicy::on_interruption()), std::runtime_error);
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 2, "2" } }));
+    checkpoints.clear();
+    chain.initialize("0");
+    ASSERT_THROW(chain.run_with_checkpoints(
+        recorder(checkpoints), steps_chain::CheckpointPolicy::every_n_steps(5)), std::runtime_error);
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 2, "2" } }));
+}
+
+namespace {
+
+struct Counter {
+    int _value{ 0 };
+};
+
+IntParameter addCounter(const IntParameter& p, Counter& c) {
+    return IntParameter{ p._value + ++c._value };
+}
+
+};  // anonymous namespace
+
+TEST(CheckpointTests, Wrappers) {
+    auto counter = std::make_shared<Counter>();
+    auto processes = std::vector<steps_chain::ChainWrapper>{
+        steps_chain::StepsChain{ increment, increment },
+        steps_chain::ChainWrapper{ steps_chain::ContextStepsChain{ addCounter, addCounter }, counter }
+    };
+    Checkpoints checkpoints;
+    for (auto& process : processes) {
+        process.initialize("0");
+        ASSERT_TRUE(process.run_with_checkpoints(recorder(checkpoints)));
+    }
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 1, "1" }, { 2, "2" }, { 1, "1" }, { 2, "3" } }));
+
+    checkpoints.clear();
+    auto local = steps_chain::ChainWrapperLS{
+        steps_chain::ContextStepsChain{ addCounter, addCounter }, Counter{} };
+    local.initialize("0");
+    ASSERT_TRUE(local.run_with_checkpoints(
+        recorder(checkpoints), steps_chain::CheckpointPolicy::every_n_steps(2)));
+    ASSERT_EQ(checkpoints, (Checkpoints{ { 2, "3" } }));
+}
@@ -0,0 +1,168 @@
+#include "parameters.h"
+#include <codec.h>
+#include <steps_chain.h>
+#include <context_steps_chain.h>
+#include <chain_wrapper.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+struct BinaryPolicy : steps_chain::default_policy {
+    using codec = steps_chain::binary_codec;
+};
+
+struct Point {
+    int32_t x;
+    int32_t y;
+};
+
+struct Transfer {
+    std::string requestId;
+    int consumerId{ 0 };
+    int amount{ 0 };
+    Point destination{ 0, 0 };
+
+    auto fields() { return std::tie(requestId, consumerId, amount, destination); }
+    auto fields() const { return std::tie(requestId, consumerId, amount, destination); }
+};
+
+struct Receipt {
+    std::string requestId;
+    int64_t total{ 0 };
+
+    auto fields() { return std::tie(requestId, total); }
+    auto fields() const { return std::tie(requestId, total); }
+};
+
+// Trivially copyable, but refers to memory, so it must not be stored as raw bytes.
+struct Reference {
+    const char* name;
+    int32_t size;
+};
+
+Receipt makeReceipt(const Transfer& t) {
+    return Receipt{ t.requestId, t.amount * 2 };
+}
+
+std::string encode(const Transfer& t) {
+    std::string out;
+    steps_chain::binary_codec::encode(t, out);
+    return out;
+}
+
+};  // anonymous namespace
+
+template <>
+struct steps_chain::raw_bytes<Point> : std::true_type {};
+
+static_assert(steps_chain::binary_codec::supports<Transfer>(),
+    "Types with fields() must be supported by binary_codec!");
+static_assert(steps_chain::binary_codec::supports<Point>(),
+    "Types opted in through raw_bytes must be supported by binary_codec!");
+static_assert(!steps_chain::binary_codec::supports<Reference>(),
+    "Trivially copyable types must not be stored as raw bytes without an opt-in!");
+static_assert(!steps_chain::binary_codec::supports<std::string_view>(),
+    "std::string_view must not be supported by binary_codec!");
+static_assert(!steps_chain::binary_codec::supports<CountingParameter>(),
+    "Types without fields() must not be supported by binary_codec!");
+static_assert(!steps_chain::string_codec::supports<Transfer>(),
+    "Types without serialize() must not be supported by string_codec!");
+
+TEST(CodecTests, BinaryRoundTrip) {
+    const Transfer original{ "ABCD-101", 1001, 3241, Point{ -5, 7 } };
+    const auto encoded = encode(original);
+    // 1 byte of length + 8 characters + 2 ints + 2 ints.
+    ASSERT_EQ(encoded.size(), 1 + 8 + 4 * sizeof(int32_t));
+    const auto decoded = steps_chain::binary_codec::decode<Transfer>(encoded);
+    ASSERT_EQ(decoded.requestId, original.requestId);
+    ASSERT_EQ(decoded.consumerId, original.consumerId);
+    ASSERT_EQ(decoded.amount, original.amount);
+    ASSERT_EQ(decoded.destination.x, original.destination.x);
+    ASSERT_EQ(decoded.destination.y, original.destination.y);
+}
+
+TEST(CodecTests, BinaryLongString) {
+    Transfer original;
+    original.requestId = std::string(300, 'x');
+    const auto encoded = encode(original);
+    ASSERT_EQ(encoded.size(), 2 + 300 + 4 * sizeof(int32_t));
+    ASSERT_EQ(steps_chain::binary_codec::decode<Transfer>(encoded).requestId, original.requestId);
+}
+
+TEST(CodecTests, BinaryMalformedInput) {
+    const auto encoded = encode(Transfer{ "ABCD-101", 1, 2, Point{ 3, 4 } });
+    ASSERT_THROW(steps_chain::binary_codec::decode<Transfer>(encoded.substr(0, encoded.size() - 1)),
+        std::invalid_argument);
+    ASSERT_THROW(steps_chain::binary_codec::decode<Transfer>(encoded + "x"), std::invalid_argument);
+}
+
+TEST(CodecTests, StringCodecAppends) {
+    std::string out{ "state:" };
+    steps_chain::string_codec::encode(IntParameter{ 42 }, out);
+    ASSERT_EQ(out, "state:42");
+    ASSERT_EQ(steps_chain::string_codec::decode<IntParameter>(std::string{ "42" })._value, 42);
+}
+
+TEST(CodecTests, ChainWithBinaryCodec) {
+    auto chain = steps_chain::StepsChain{
+        steps_chain::with_policy<BinaryPolicy>,
+        [](Transfer t) { t.amount += 1; return t; },
+        makeReceipt
+    };
+    chain.initialize(encode(Transfer{ "ABCD-101", 1001, 10, Point{ 0, 0 } }));
+    ASSERT_TRUE(chain.advance());
+    const auto [step_idx, data] = chain.get_current_state();
+    ASSERT_EQ(step_idx, 1);
+    ASSERT_EQ(steps_chain::binary_codec::decode<Transfer>(data).amount, 11);
+
+    // Restore state in another chain and finish there.
+    auto wrapped = steps_chain::ChainWrapper{ chain };
+    wrapped.initialize(data, step_idx);
+    ASSERT_TRUE(wrapped.resume());
+    const auto [step_idx_after, data_after] = wrapped.get_current_state();
+    ASSERT_EQ(step_idx_after, 2);
+    const auto receipt = steps_chain::binary_codec::decode<Receipt>(data_after);
+    ASSERT_EQ(receipt.requestId, "ABCD-101");
+    ASSERT_EQ(receipt.total, 22);
+}
+
+TEST(CodecTests, ContextChainWithBinaryCodec) {
+    struct EmptyContext {};
+    auto chain = steps_chain::ContextStepsChain{
+        steps_chain::with_policy<BinaryPolicy>,
+        [](const Transfer& t, EmptyContext) { return makeReceipt(t); }
+    };
+    chain.run(encode(Transfer{ "ABCD-101", 1001, 5, Point{ 0, 0 } }), EmptyContext{});
+    const auto [step_idx_after, data_after] = chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 1);
+    ASSERT_EQ(steps_chain::binary_codec::decode<Receipt>(data_after).total, 10);
+}
+
+TEST(CodecTests, StringCodecDecodesFromView) {
+    const std::string input{ "payload|42" };
+    const std::string_view view{ input.data(), 7 };
+    const auto parameter = steps_chain::string_codec::decode<ViewParameter>(view);
+    ASSERT_EQ(parameter._value, "payload");
+    ASSERT_TRUE(parameter._from_view);
+    // Types without string_view constructor fall back to the string one.
+    const auto number = steps_chain::string_codec::decode<IntParameter>(
+        std::string_view{ input }.substr(8));
+    ASSERT_EQ(number._value, 42);
+    ASSERT_FALSE(steps_chain::string_codec::decode<ViewParameter>(std::string{ "x" })._from_view);
+}
+
+TEST(CodecTests, BinaryCodecDecodesFromView) {
+    // Encoded state can live inside a bigger buffer, e.g. a memory mapped file.
+    const std::string buffer = "header" + encode(Transfer{ "ABCD-101", 1, 2, Point{ 3, 4 } });
+    const auto decoded = steps_chain::binary_codec::decode<Transfer>(
+        std::string_view{ buffer }.substr(6));
+    ASSERT_EQ(decoded.requestId, "ABCD-101");
+    ASSERT_EQ(decoded.destination.y, 4);
+}
@@ -0,0 +1,216 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <chain_wrapper.h>
+#include <local_storage_wrapper.h>
+#include <executor.h>
+#include <result.h>
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+IntParameter increment(const IntParameter& p) {
+    return IntParameter{ p._value + 1 };
+}
+
+IntParameter throwOnNegative(const IntParameter& p) {
+    if (p._value < 0) {
+        throw std::runtime_error{ "negative" };
+    }
+    return p;
+}
+
+struct NegativeValue {
+    int value;
+};
+
+steps_chain::result<IntParameter, NegativeValue> rejectNegative(const IntParameter& p) {
+    if (p._value < 0) {
+        return steps_chain::failure{ NegativeValue{ p._value } };
+    }
+    return p;
+}
+
+struct Results {
+    void add(steps_chain::ChainWrapper& chain) {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        _values.push_back(chain.peek<IntParameter>()->_value);
+    }
+
+    std::mutex _mutex;
+    std::vector<int> _values;
+};
+
+};  // anonymous namespace
+
+TEST(ExecutorTests, RunsAllChains) {
+    Results results;
+    std::atomic<int> errors{ 0 };
+    {
+        steps_chain::WorkStealingExecutor<> executor{
+            { [&results](auto, steps_chain::ChainWrapper& chain) { results.add(chain); },
+              [&errors](auto, steps_chain::ChainWrapper&, std::exception_ptr) { ++errors; },
+              nullptr },
+            4, 2 };
+        ASSERT_EQ(executor.threads(), 4);
+        for (int i = 0; i < 1000; ++i) {
+            steps_chain::ChainWrapper chain{
+                steps_chain::StepsChain{ throwOnNegative, increment, increment, increment, increment } };
+            chain.initialize(std::to_string(i % 100 == 0 ? -i : i));
+            executor.submit(std::move(chain));
+        }
+        executor.wait_idle();
+    }
+    ASSERT_EQ(errors.load(), 9);  // i = 100, 200, ... 900; 0 is not negative.
+    ASSERT_EQ(results._values.size(), 991);
+    long long sum = 0;
+    for (const int value : results._values) {
+        sum += value;
+    }
+    // Sum of (i + 4) over all i in [0, 1000) that are not multiples of 100, and 0 + 4.
+    ASSERT_EQ(sum, 999 * 1000 / 2 - (100 + 900) * 9 / 2 + 991 * 4);
+}
+
+TEST(ExecutorTests, ParkedChainIsRescheduled) {
+    std::atomic<bool> ready{ false };
+    std::atomic<int> finished{ 0 };
+    steps_chain::WorkStealingExecutor<steps_chain::ChainWrapperLS> executor{
+        { [&finished](auto, steps_chain::ChainWrapperLS&) { ++finished; }, nullptr, nullptr }, 2 };
+    steps_chain::ChainWrapperLS chain{ steps_chain::StepsChain{
+        increment,
+        [&ready](const IntParameter& p) -> std::optional<IntParameter> {
+            if (!ready.load()) {
+                return std::nullopt;
+            }
+            return p;
+        },
+        increment } };
+    chain.initialize("0");
+    const auto id = executor.submit(std::move(chain));
+    executor.wait_idle();
+    ASSERT_EQ(finished.load(), 0);
+    // Rescheduled chain that is still not ready is parked again.
+    ASSERT_TRUE(executor.reschedule(id));
+    executor.wait_idle();
+    ASSERT_EQ(finished.load(), 0);
+    ready = true;
+    ASSERT_TRUE(executor.reschedule(id));
+    executor.wait_idle();
+    ASSERT_EQ(finished.load(), 1);
+    ASSERT_FALSE(executor.reschedule(id));
+}
+
+TEST(ExecutorTests, RescheduleWhileRunning) {
+    // The step reschedules its own chain before suspending, as a fast I/O completion would.
+    std::atomic<int> attempts{ 0 };
+    std::atomic<int> finished{ 0 };
+    steps_chain::WorkStealingExecutor<> executor{
+        { [&finished](auto, steps_chain::ChainWrapper&) { ++finished; }, nullptr, nullptr }, 1 };
+    steps_chain::WorkStealingExecutor<>::chain_id id = 0;
+    std::atomic<bool> submitted{ false };
+    steps_chain::ChainWrapper chain{ steps_chain::StepsChain{
+        [&](const IntParameter& p) -> std::optional<IntParameter> {
+            while (!submitted.load()) {}
+            if (++attempts < 3) {
+                executor.reschedule(id);
+                return std::nullopt;
+            }
+            return p;
+        } } };
+    chain.initialize("0");
+    id = executor.submit(std::move(chain));
+    submitted = true;
+    executor.wait_idle();
+    ASSERT_EQ(attempts.load(), 3);
+    ASSERT_EQ(finished.load(), 1);
+}
+
+TEST(ExecutorTests, FailedChainsGoToOnFailed) {
+    Results results;
+    std::atomic<int> errors{ 0 };
+    std::mutex mutex;
+    std::vector<int> failed;
+    {
+        steps_chain::WorkStealingExecutor<> executor{
+            { [&results](auto, steps_chain::ChainWrapper& chain) { results.add(chain); },
+              [&errors](auto, steps_chain::ChainWrapper&, std::exception_ptr) { ++errors; },
+              [&mutex, &failed](auto, steps_chain::ChainWrapper& chain) {
+                  std::lock_guard<std::mutex> lock{ mutex };
+                  failed.push_back(chain.error<NegativeValue>()->value);
+              } },
+            2, 2 };
+        for (int i = 0; i < 100; ++i) {
+            steps_chain::ChainWrapper chain{
+                steps_chain::StepsChain{ increment, increment, rejectNegative, increment } };
+            chain.initialize(std::to_string(i % 10 == 0 ? -i : i));
+            executor.submit(std::move(chain));
+        }
+        executor.wait_idle();
+    }
+    ASSERT_EQ(errors.load(), 0);
+    ASSERT_EQ(results._values.size(), 91);
+    ASSERT_EQ(failed.size(), 9);  // i = 10, 20, ... 90, failing with -i + 2.
+    for (const int value : failed) {
+        ASSERT_EQ((value - 2) % 10, 0);
+        ASSERT_LT(value, 0);
+    }
+}
+
+TEST(ExecutorTests, CallbackExceptionIsRethrownFromWaitIdle) {
+    std::atomic<int> finished{ 0 };
+    steps_chain::WorkStealingExecutor<> executor{
+        { [&finished](auto, steps_chain::ChainWrapper&) {
+              if (++finished == 1) {
+                  throw std::runtime_error{ "callback" };
+              }
+          },
+          nullptr,
+          nullptr },
+        2 };
+    for (int i = 0; i < 10; ++i) {
+        steps_chain::ChainWrapper chain{ steps_chain::StepsChain{ increment, increment } };
+        chain.initialize(std::to_string(i));
+        executor.submit(std::move(chain));
+    }
+    // The worker that ran the throwing callback goes on with the other chains.
+    ASSERT_THROW(executor.wait_idle(), std::runtime_error);
+    executor.wait_idle();
+    ASSERT_EQ(finished.load(), 10);
+}
+
+TEST(ExecutorTests, StaleIdDoesNotMatchReusedSlot) {
+    std::atomic<int> finished{ 0 };
+    steps_chain::WorkStealingExecutor<> executor{
+        { [&finished](auto, steps_chain::ChainWrapper&) { ++finished; }, nullptr, nullptr }, 1 };
+    // Enough finished chains for the worker to hand some of their slots back to submit().
+    std::vector<steps_chain::WorkStealingExecutor<>::chain_id> ids;
+    for (int i = 0; i < 200; ++i) {
+        steps_chain::ChainWrapper chain{ steps_chain::StepsChain{ increment } };
+        chain.initialize("0");
+        ids.push_back(executor.submit(std::move(chain)));
+    }
+    executor.wait_idle();
+    ASSERT_EQ(finished.load(), 200);
+    steps_chain::ChainWrapper parked{ steps_chain::StepsChain{
+        [](const IntParameter&) -> std::optional<IntParameter> { return std::nullopt; } } };
+    parked.initialize("0");
+    const auto id = executor.submit(std::move(parked));
+    executor.wait_idle();
+    bool reused = false;
+    for (const auto stale : ids) {
+        ASSERT_NE(stale, id);
+        ASSERT_FALSE(executor.reschedule(stale));
+        reused = reused || static_cast<uint32_t>(stale) == static_cast<uint32_t>(id);
+    }
+    ASSERT_TRUE(reused);
+    ASSERT_TRUE(executor.reschedule(id));
+    executor.wait_idle();
+}
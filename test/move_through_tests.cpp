@@ -0,0 +1,163 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <context_steps_chain.h>
+
+#include <optional>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+struct MovingPolicy : steps_chain::default_policy {
+    static constexpr bool move_arguments = true;
+};
+
+CountingParameter appendByRef(const CountingParameter& p) {
+    return CountingParameter{ p._value + "a" };
+}
+
+CountingParameter appendByValue(CountingParameter p) {
+    p._value += "a";
+    return p;
+}
+
+CountingParameter appendByRvalue(CountingParameter&& p) {
+    p._value += "a";
+    return std::move(p);
+}
+
+std::optional<CountingParameter> suspendByValue(CountingParameter p [[maybe_unused]]) {
+    return std::nullopt;
+}
+
+struct CountingStep {
+    CountingStep() = default;
+    CountingStep(const CountingStep&) { ++copies; }
+    CountingStep(CountingStep&&) noexcept = default;
+    CountingParameter operator()(const CountingParameter& p) const { return appendByRef(p); }
+
+    static inline size_t copies = 0;
+};
+
+};  // anonymous namespace
+
+TEST(MoveThroughTests, ResultsAreNotCopied) {
+    auto chain = steps_chain::StepsChain{
+        appendByRef,
+        appendByRef,
+        appendByRef
+    };
+    chain.initialize("x");
+    CountingParameter::reset();
+    ASSERT_TRUE(chain.resume());
+    ASSERT_EQ(CountingParameter::copies, 0);
+    ASSERT_EQ(CountingParameter::moves, 3);  // Each result is moved into the chain once.
+    const auto [step_idx_after, data_after] = chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 3);
+    ASSERT_EQ(data_after, "xaaa");
+}
+
+// Values between the steps are not stored in the chain on run(), only the final result.
+TEST(MoveThroughTests, RunMovesOnlyTheResult) {
+    auto chain = steps_chain::StepsChain{
+        appendByRef,
+        appendByRef,
+        appendByRef
+    };
+    CountingParameter::reset();
+    ASSERT_TRUE(chain.run("x"));
+    ASSERT_EQ(CountingParameter::copies, 0);
+    ASSERT_EQ(CountingParameter::moves, 2);  // Decoded argument and the final result.
+    ASSERT_EQ(std::get<1>(chain.get_current_state()), "xaaa");
+}
+
+TEST(MoveThroughTests, ByValueArgumentsAreCopiedByDefault) {
+    auto chain = steps_chain::StepsChain{
+        appendByValue,
+        appendByValue
+    };
+    chain.initialize("x");
+    CountingParameter::reset();
+    ASSERT_TRUE(chain.resume());
+    ASSERT_EQ(CountingParameter::copies, 2);
+    const auto [step_idx_after, data_after] = chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 2);
+    ASSERT_EQ(data_after, "xaa");
+}
+
+TEST(MoveThroughTests, ByValueArgumentsAreMovedWithPolicy) {
+    auto chain = steps_chain::StepsChain{
+        steps_chain::with_policy<MovingPolicy>,
+        appendByValue,
+        appendByValue
+    };
+    chain.initialize("x");
+    CountingParameter::reset();
+    ASSERT_TRUE(chain.resume());
+    ASSERT_EQ(CountingParameter::copies, 0);
+    const auto [step_idx_after, data_after] = chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 2);
+    ASSERT_EQ(data_after, "xaa");
+}
+
+TEST(MoveThroughTests, RvalueArgumentsAreAlwaysMoved) {
+    auto chain = steps_chain::StepsChain{
+        appendByRvalue,
+        [](CountingParameter&& p) { p._value += "b"; return std::move(p); }
+    };
+    chain.initialize("x");
+    CountingParameter::reset();
+    ASSERT_TRUE(chain.resume());
+    ASSERT_EQ(CountingParameter::copies, 0);
+    const auto [step_idx_after, data_after] = chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 2);
+    ASSERT_EQ(data_after, "xab");
+}
+
+// Step that may return std::nullopt is given a copy, so the chain state survives suspension.
+TEST(MoveThroughTests, SuspendedStepKeepsArgument) {
+    auto chain = steps_chain::StepsChain{
+        steps_chain::with_policy<MovingPolicy>,
+        appendByValue,
+        suspendByValue,
+        appendByValue
+    };
+    chain.initialize("x");
+    CountingParameter::reset();
+    ASSERT_FALSE(chain.resume());
+    ASSERT_EQ(CountingParameter::copies, 1);
+    const auto [step_idx_after, data_after] = chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 1);
+    ASSERT_EQ(data_after, "xa");
+}
+
+TEST(MoveThroughTests, StepsAreMovedIntoChain) {
+    CountingStep::copies = 0;
+    auto chain = steps_chain::StepsChain{
+        CountingStep{},
+        CountingStep{}
+    };
+    ASSERT_EQ(CountingStep::copies, 0);
+    chain.run("x");
+    const auto [step_idx_after, data_after] = chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 2);
+    ASSERT_EQ(data_after, "xaa");
+}
+
+TEST(MoveThroughTests, ContextChainMovesArguments) {
+    struct EmptyContext {};
+    auto chain = steps_chain::ContextStepsChain{
+        steps_chain::with_policy<MovingPolicy>,
+        [](CountingParameter p, EmptyContext) { return appendByValue(std::move(p)); },
+        [](CountingParameter&& p, EmptyContext) { return appendByRvalue(std::move(p)); },
+        [](const CountingParameter& p, EmptyContext) { return appendByRef(p); }
+    };
+    chain.initialize("x");
+    CountingParameter::reset();
+    ASSERT_TRUE(chain.resume(EmptyContext{}));
+    ASSERT_EQ(CountingParameter::copies, 0);
+    const auto [step_idx_after, data_after] = chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 3);
+    ASSERT_EQ(data_after, "xaaa");
+}
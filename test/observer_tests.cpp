@@ -0,0 +1,135 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <context_steps_chain.h>
+#include <chain_wrapper.h>
+#include <chain_variant.h>
+#include <local_storage_wrapper.h>
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+
+namespace {
+
+// Records the calls as strings like "begin 0", "end 0 advanced".
+struct Recorder {
+    void on_step_begin(size_t step_idx) {
+        calls.push_back("begin " + std::to_string(step_idx));
+    }
+    void on_step_end(size_t step_idx, steps_chain::step_outcome outcome) {
+        calls.push_back("end " + std::to_string(step_idx) +
+            (outcome == steps_chain::step_outcome::advanced ? " advanced" : " suspended"));
+    }
+    void on_exception(size_t step_idx) {
+        calls.push_back("exception " + std::to_string(step_idx));
+    }
+
+    std::vector<std::string> calls;
+};
+
+struct RecordingPolicy : steps_chain::default_policy {
+    using observer = Recorder;
+};
+
+struct RuntimePolicy : steps_chain::default_policy {
+    using observer = steps_chain::runtime_observer;
+};
+
+class RuntimeRecorder : public steps_chain::StepObserver {
+public:
+    void on_step_begin(size_t step_idx) override { recorder.on_step_begin(step_idx); }
+    void on_step_end(size_t step_idx, steps_chain::step_outcome outcome) override {
+        recorder.on_step_end(step_idx, outcome);
+    }
+    void on_exception(size_t step_idx) override { recorder.on_exception(step_idx); }
+
+    Recorder recorder;
+};
+
+IntParameter doubleValue(const IntParameter& data) {
+    return IntParameter{ data._value * 2 };
+}
+
+bool ready = false;
+
+std::optional<IntParameter> waitUntilReady(const IntParameter& data) {
+    if (!ready) {
+        return std::nullopt;
+    }
+    return data;
+}
+
+IntParameter failOnOdd(const IntParameter& data) {
+    if (data._value % 2) {
+        throw std::runtime_error{ "odd" };
+    }
+    return data;
+}
+
+IntParameter addUsers(IntParameter p, const int& users) {
+    return IntParameter{ p._value + users };
+}
+
+};  // anonymous namespace
+
+TEST(ObserverTests, PolicyObserverSeesEachStep) {
+    ready = false;
+    auto chain = steps_chain::StepsChain{
+        steps_chain::with_policy<RecordingPolicy>, doubleValue, waitUntilReady, failOnOdd };
+    chain.initialize("1");
+    EXPECT_FALSE(chain.resume());
+    ready = true;
+    EXPECT_TRUE(chain.advance());
+    EXPECT_TRUE(chain.advance());
+    EXPECT_TRUE(chain.is_finished());
+    EXPECT_EQ(chain.observer().calls, (std::vector<std::string>{
+        "begin 0", "end 0 advanced", "begin 1", "end 1 suspended",
+        "begin 1", "end 1 advanced", "begin 2", "end 2 advanced" }));
+    chain.observer().calls.clear();
+    EXPECT_THROW(chain.run("3", 2), std::runtime_error);
+    EXPECT_EQ(chain.observer().calls, (std::vector<std::string>{ "begin 2", "exception 2" }));
+}
+
+TEST(ObserverTests, ContextChainObserver) {
+    auto chain = steps_chain::ContextStepsChain{
+        steps_chain::with_policy<RecordingPolicy>, addUsers, addUsers };
+    EXPECT_TRUE(chain.run("1", 10));
+    EXPECT_EQ(chain.observer().calls.size(), 4u);
+    EXPECT_EQ(chain.observer().calls.back(), "end 1 advanced");
+}
+
+// Observers are attached through the wrappers, chains with the default policy do not take them.
+TEST(ObserverTests, AttachedThroughWrappers) {
+    RuntimeRecorder observer;
+    auto make_chain = []() {
+        return steps_chain::StepsChain{
+            steps_chain::with_policy<RuntimePolicy>, doubleValue, doubleValue };
+    };
+    steps_chain::ChainWrapper wrapper{ make_chain() };
+    steps_chain::ChainWrapperLS local{ make_chain() };
+    steps_chain::ChainWrapperLS withContext{ steps_chain::ContextStepsChain{
+        steps_chain::with_policy<RuntimePolicy>, addUsers }, 5 };
+    steps_chain::ChainVariant<decltype(make_chain())> variant{ make_chain() };
+    EXPECT_TRUE(wrapper.set_observer(&observer));
+    EXPECT_TRUE(local.set_observer(&observer));
+    EXPECT_TRUE(withContext.set_observer(&observer));
+    EXPECT_TRUE(variant.set_observer(&observer));
+    wrapper.run("1");
+    local.run("1");
+    withContext.run("1");
+    variant.run("1");
+    EXPECT_EQ(observer.recorder.calls.size(), 14u);
+
+    EXPECT_TRUE(wrapper.set_observer(nullptr));
+    wrapper.run("1");
+    EXPECT_EQ(observer.recorder.calls.size(), 14u);
+
+    steps_chain::ChainWrapper plain{ steps_chain::StepsChain{ doubleValue } };
+    EXPECT_FALSE(plain.set_observer(&observer));
+    EXPECT_FALSE(steps_chain::ChainWrapperLS{}.set_observer(&observer));
+    EXPECT_FALSE(steps_chain::ChainWrapper{}.set_observer(&observer));
+}
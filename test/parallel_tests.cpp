@@ -0,0 +1,181 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <context_steps_chain.h>
+#include <parallel.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+IntParameter twice(const IntParameter& p) {
+    return IntParameter{ p._value * 2 };
+}
+
+IntParameter square(IntParameter p) {
+    return IntParameter{ p._value * p._value };
+}
+
+IntParameter sum(const steps_chain::joined<IntParameter, IntParameter>& j) {
+    const auto& [a, b] = j;
+    return IntParameter{ a._value + b._value };
+}
+
+std::optional<IntParameter> suspendOnZero(const IntParameter& p) {
+    if (p._value == 0) {
+        return std::nullopt;
+    }
+    return p;
+}
+
+IntParameter throwOnZero(const IntParameter& p) {
+    if (p._value == 0) {
+        throw std::runtime_error{ "zero" };
+    }
+    return p;
+}
+
+// Counts how many tasks the executor has started.
+struct CountingExecutor {
+    void operator()(std::function<void()> task) const {
+        ++started;
+        steps_chain::new_thread_executor{}(std::move(task));
+    }
+
+    mutable int started{ 0 };
+};
+
+};  // anonymous namespace
+
+TEST(ParallelTests, JoinsResults) {
+    CountingExecutor executor;
+    auto chain = steps_chain::StepsChain{
+        twice,
+        steps_chain::parallel(std::ref(executor), twice, square),
+        sum
+    };
+    ASSERT_TRUE(chain.run("3"));
+    // 6 * 2 + 6 * 6
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(3, std::string{ "48" }));
+    // The first branch runs on the calling thread.
+    ASSERT_EQ(executor.started, 1);
+
+    chain.initialize("5");
+    ASSERT_TRUE(chain.advance());
+    ASSERT_TRUE(chain.advance());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(2, std::string{ "2:203:100" }));
+    ASSERT_EQ(std::get<1>(*chain.peek<steps_chain::joined<IntParameter, IntParameter>>())._value,
+              100);
+    ASSERT_TRUE(chain.run("2:203:100", 2));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(3, std::string{ "120" }));
+    ASSERT_THROW(chain.initialize("2:20", 2), std::invalid_argument);
+}
+
+TEST(ParallelTests, BranchesRunConcurrently) {
+    // Each branch waits for the other one to start, so they would never finish one after another.
+    std::atomic<int> started{ 0 };
+    auto rendezvous = [&started](const IntParameter& p) {
+        ++started;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 10 };
+        while (started.load() < 2 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        return IntParameter{ started.load() };
+    };
+    auto chain = steps_chain::StepsChain{
+        steps_chain::parallel(steps_chain::new_thread_executor{}, rendezvous, rendezvous),
+        sum
+    };
+    ASSERT_TRUE(chain.run("0"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(2, std::string{ "4" }));
+}
+
+namespace {
+
+// Executor that is too busy to start anything until told to, like a pool whose every worker runs
+// a chain waiting in parallel().
+struct BusyExecutor {
+    void operator()(std::function<void()> task) {
+        queued.push_back(std::move(task));
+    }
+
+    std::vector<std::function<void()>> queued;
+};
+
+};  // anonymous namespace
+
+TEST(ParallelTests, CallerRunsBranchesNotStarted) {
+    BusyExecutor executor;
+    auto chain = steps_chain::StepsChain{
+        steps_chain::parallel(std::ref(executor), twice, square, twice),
+        [](const steps_chain::joined<IntParameter, IntParameter, IntParameter>& j) {
+            const auto& [a, b, c] = j;
+            return IntParameter{ a._value + b._value + c._value };
+        }
+    };
+    ASSERT_TRUE(chain.run("3"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(2, std::string{ "21" }));
+    // Tasks that start after the step is done find their branches taken and do nothing.
+    ASSERT_EQ(executor.queued.size(), 2u);
+    for (auto& task : executor.queued) {
+        task();
+    }
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(2, std::string{ "21" }));
+}
+
+TEST(ParallelTests, SuspendedBranchSuspendsStep) {
+    auto chain = steps_chain::StepsChain{
+        steps_chain::parallel(steps_chain::new_thread_executor{}, twice, suspendOnZero),
+        sum
+    };
+    ASSERT_FALSE(chain.run("0"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(0, std::string{ "0" }));
+    ASSERT_TRUE(chain.run("4"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(2, std::string{ "12" }));
+}
+
+TEST(ParallelTests, ExceptionIsRethrownAfterJoin) {
+    auto chain = steps_chain::StepsChain{
+        steps_chain::parallel(steps_chain::inline_executor{}, twice, throwOnZero),
+        sum
+    };
+    ASSERT_THROW(chain.run("0"), std::runtime_error);
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(0, std::string{ "0" }));
+}
+
+namespace {
+
+struct Factor {
+    int _value;
+};
+
+IntParameter multiply(const IntParameter& p, const Factor& f) {
+    return IntParameter{ p._value * f._value };
+}
+
+IntParameter add(const IntParameter& p, const Factor& f) {
+    return IntParameter{ p._value + f._value };
+}
+
+IntParameter sumWithFactor(const steps_chain::joined<IntParameter, IntParameter>& j, const Factor&) {
+    return sum(j);
+}
+
+};  // anonymous namespace
+
+TEST(ParallelTests, Context) {
+    auto chain = steps_chain::ContextStepsChain{
+        steps_chain::parallel(steps_chain::new_thread_executor{}, multiply, add),
+        sumWithFactor
+    };
+    ASSERT_TRUE(chain.run("5", Factor{ 3 }));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(2, std::string{ "23" }));
+}
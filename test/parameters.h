@@ -5,6 +5,7 @@
 #include "static_assert_tests.h"
 
 #include <string>
+#include <string_view>
 
 // All these parameter structs conforms to the requirements - they can be constructed from a string
 // (we use different kinds of argument passing for testing) and have 'serialize' method that
@@ -42,3 +43,62 @@ struct TwoIntParameter {
 
 static_assert(steps_chain::helpers::is_serializable<TwoIntParameter>::value,
     "TwoIntParameter must be valid!");
+
+// Counts copies and moves of all instances, used to check that chain does not copy arguments.
+struct CountingParameter {
+    CountingParameter() = default;
+    explicit CountingParameter(std::string s) : _value{ std::move(s) } {}
+    CountingParameter(const CountingParameter& other) : _value{ other._value } { ++copies; }
+    CountingParameter(CountingParameter&& other) noexcept : _value{ std::move(other._value) } {
+        ++moves;
+    }
+    CountingParameter& operator=(const CountingParameter& other) {
+        _value = other._value;
+        ++copies;
+        return *this;
+    }
+    CountingParameter& operator=(CountingParameter&& other) noexcept {
+        _value = std::move(other._value);
+        ++moves;
+        return *this;
+    }
+    std::string serialize() const { return _value; }
+
+    static void reset() { copies = moves = 0; }
+
+    std::string _value;
+    static inline size_t copies = 0;
+    static inline size_t moves = 0;
+};
+
+static_assert(steps_chain::helpers::is_serializable<CountingParameter>::value,
+    "CountingParameter must be valid!");
+
+// Can be built straight from a view, remembers whether an owned string was used instead.
+struct ViewParameter {
+    ViewParameter() = default;
+    explicit ViewParameter(std::string_view s) : _value{ s }, _from_view{ true } {}
+    explicit ViewParameter(std::string&& s) : _value{ std::move(s) }, _from_view{ false } {}
+    std::string serialize() const { return _value; }
+
+    std::string _value;
+    bool _from_view{ false };
+};
+
+static_assert(steps_chain::helpers::is_serializable<ViewParameter>::value,
+    "ViewParameter must be valid!");
+
+// Counts serialize() calls of all instances.
+struct ComparableParameter {
+    ComparableParameter() = default;
+    explicit ComparableParameter(int v) : _value{ v } {}
+    explicit ComparableParameter(std::string&& s) : _value{ std::stoi(s) } {}
+    std::string serialize() const { ++serializations; return std::to_string(_value); }
+    bool operator==(const ComparableParameter& other) const { return _value == other._value; }
+
+    int _value{ 0 };
+    static inline size_t serializations = 0;
+};
+
+static_assert(steps_chain::helpers::is_serializable<ComparableParameter>::value,
+    "ComparableParameter must be valid!");
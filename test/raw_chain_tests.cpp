@@ -1,7 +1,13 @@
 #include "parameters.h"
 #include <steps_chain.h>
 
+#include <cstdint>
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 #include <gtest/gtest.h>
 
@@ -11,6 +17,20 @@ IntParameter doubleValue(const IntParameter& data) {
     return IntParameter{ data._value * 2 };
 }
 
+IntParameter throwAbove(const IntParameter& data) {
+    if (data._value > 10) {
+        throw std::runtime_error{ "too big" };
+    }
+    return data;
+}
+
+std::optional<IntParameter> suspendAbove(const IntParameter& data) {
+    if (data._value > 10) {
+        return std::nullopt;
+    }
+    return data;
+}
+
 } // anonymous namespace
 
 TEST(RawChainTests, SingleStepChain) {
@@ -70,6 +90,13 @@ static_assert(steps_chain::helpers::are_chainable<decltype(foo)>(),
     "Single-element chain should be always valid!");
 static_assert(!steps_chain::helpers::are_chainable<decltype(foo_returns_int), decltype(foo)>(),
     "Mismatched signatures must be detected!");
+static_assert(!steps_chain::helpers::are_chainable<
+    decltype(foo), decltype(foo), decltype(foo_returns_int), decltype(foo), decltype(foo)>(),
+    "Mismatched signatures in the middle of the chain must be detected!");
+static_assert(std::is_same_v<steps_chain::helpers::step_index_t<255>, uint8_t> &&
+    std::is_same_v<steps_chain::helpers::step_index_t<256>, uint16_t> &&
+    std::is_same_v<steps_chain::helpers::step_index_t<70000>, uint32_t>,
+    "Step index type must fit the number of steps and the index of a finished chain!");
 
 // -----------------------------------------------------
 
@@ -155,3 +182,98 @@ TEST(RawChainTests, VariousCallablesInChain) {
     ASSERT_EQ(step_idx_after, 4);
     ASSERT_EQ(data_after, "0");
 }
+
+TEST(RawChainTests, StateIntoReusableBuffer) {
+    auto chain = steps_chain::StepsChain{
+        doubleValue,
+        [](const IntParameter& p) { return EmptyParameter{}; }
+    };
+    chain.initialize("21");
+    std::string buffer{ "21|" };
+    ASSERT_EQ(chain.get_current_state(buffer), 0);
+    ASSERT_EQ(buffer, "21|21");  // State is appended to the buffer content.
+    chain.advance();
+    buffer.clear();
+    ASSERT_EQ(chain.get_current_state(buffer), 1);
+    ASSERT_EQ(buffer, "42");
+}
+
+TEST(RawChainTests, PeekCurrentArgument) {
+    auto chain = steps_chain::StepsChain{
+        doubleValue,
+        [](const IntParameter& p) { return EmptyParameter{}; }
+    };
+    chain.initialize("21");
+    ASSERT_NE(chain.peek<IntParameter>(), nullptr);
+    ASSERT_EQ(chain.peek<IntParameter>()->_value, 21);
+    ASSERT_EQ(chain.peek<EmptyParameter>(), nullptr);
+    ASSERT_EQ(chain.peek<TwoIntParameter>(), nullptr);  // Not used in this chain at all.
+    chain.resume();
+    ASSERT_EQ(chain.peek<IntParameter>(), nullptr);
+    ASSERT_NE(chain.peek<EmptyParameter>(), nullptr);
+}
+
+TEST(RawChainTests, InitializeFromView) {
+    auto chain = steps_chain::StepsChain{
+        [](const ViewParameter& p) { return IntParameter{ static_cast<int>(p._value.size()) }; },
+        doubleValue
+    };
+    const std::string records{ "first;1" };
+    chain.initialize(std::string_view{ records }.substr(0, 5));
+    ASSERT_TRUE(chain.peek<ViewParameter>()->_from_view);
+    chain.resume();
+    const auto [step_idx_after, data_after] = chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 2);
+    ASSERT_EQ(data_after, "10");
+    // Types without string_view constructor are built from a temporary string.
+    chain.initialize(std::string_view{ records }.substr(6), 1);
+    chain.resume();
+    ASSERT_EQ(chain.peek<IntParameter>()->_value, 2);
+    // Owning string is moved into the chain.
+    chain.initialize(std::string{ "abc" });
+    ASSERT_FALSE(chain.peek<ViewParameter>()->_from_view);
+}
+
+namespace {
+
+IntParameter increment(const IntParameter& p) {
+    return IntParameter{ p._value + 1 };
+}
+
+template <size_t... Idx>
+auto makeIncrementChain(std::index_sequence<Idx...>) {
+    return steps_chain::StepsChain{ (static_cast<void>(Idx), increment)... };
+}
+
+} // anonymous namespace
+
+TEST(RawChainTests, LongChain) {
+    auto chain = makeIncrementChain(std::make_index_sequence<300>{});
+    static_assert(std::is_same_v<decltype(chain)::index_type, uint16_t>,
+        "Chain longer than 255 steps needs 16-bit index!");
+    chain.initialize("0", 260);
+    ASSERT_TRUE(chain.advance());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(uint16_t{ 261 }, std::string{ "1" }));
+    ASSERT_TRUE(chain.resume());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(uint16_t{ 300 }, std::string{ "40" }));
+    ASSERT_TRUE(chain.run("0"));
+    ASSERT_EQ(std::get<1>(chain.get_current_state()), "300");
+    // Indices past the end mean the chain is finished.
+    ASSERT_FALSE(chain.initialize("7", 1000));
+    ASSERT_TRUE(chain.is_finished());
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(uint16_t{ 300 }, std::string{ "7" }));
+}
+
+// run() keeps the values between the steps outside of the chain, and stores the argument of the
+// step where it stopped.
+TEST(RawChainTests, RunStopsInTheMiddle) {
+    auto chain = steps_chain::StepsChain{ doubleValue, suspendAbove, doubleValue, throwAbove };
+    ASSERT_THROW(chain.run("3"), std::runtime_error);
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(3, std::string{ "12" }));
+    ASSERT_FALSE(chain.run("6"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(1, std::string{ "12" }));
+    ASSERT_TRUE(chain.run("2", 2));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(4, std::string{ "4" }));
+    ASSERT_TRUE(chain.run("2"));
+    ASSERT_EQ(chain.get_current_state(), std::make_tuple(4, std::string{ "8" }));
+}
@@ -177,3 +177,39 @@ TEST(RawContextChainTests, VariousCallablesInChain) {
     ASSERT_EQ(step_idx_after, 4);
     ASSERT_EQ(data_after, "0");
 }
+
+namespace {
+
+struct CallCounter {
+    CallCounter() = default;
+    CallCounter(const CallCounter& other) : _calls{ other._calls } { ++copies; }
+
+    int _calls{ 0 };
+    static inline size_t copies = 0;
+};
+
+IntParameter countCall(const IntParameter& data, CallCounter& ctx) {
+    ++ctx._calls;
+    return IntParameter{ data._value + 1 };
+}
+
+};  // anonymous namespace
+
+// Context taken by non-const reference is forwarded to every step without copies.
+TEST(RawContextChainTests, MutableContextByReference) {
+    auto counting_chain = steps_chain::ContextStepsChain{
+        countCall,
+        countCall,
+        countCall
+    };
+    CallCounter counter;
+    CallCounter::copies = 0;
+    counting_chain.initialize("0");
+    counting_chain.advance(counter);
+    counting_chain.resume(counter);
+    ASSERT_EQ(counter._calls, 3);
+    ASSERT_EQ(CallCounter::copies, 0);
+    const auto [step_idx_after, data_after] = counting_chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 3);
+    ASSERT_EQ(data_after, "3");
+}
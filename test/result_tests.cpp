@@ -0,0 +1,151 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <context_steps_chain.h>
+#include <chain_variant.h>
+#include <chain_wrapper.h>
+#include <local_storage_wrapper.h>
+#include <result.h>
+
+#include <optional>
+#include <string>
+#include <tuple>
+
+#include <gtest/gtest.h>
+
+
+namespace {
+
+struct BalanceError {
+    int missing;
+};
+
+struct Rejection {
+    std::string reason;
+};
+
+IntParameter doubleValue(const IntParameter& data) {
+    return IntParameter{ data._value * 2 };
+}
+
+int balance = 0;
+
+steps_chain::result<IntParameter, BalanceError> unload(const IntParameter& data) {
+    if (data._value > balance) {
+        return steps_chain::failure{ BalanceError{ data._value - balance } };
+    }
+    balance -= data._value;
+    return data;
+}
+
+// Waits for a decision while it is 0, rejects negative values.
+steps_chain::result<std::optional<IntParameter>, Rejection> review(IntParameter data) {
+    if (data._value == 0) {
+        return std::nullopt;
+    }
+    if (data._value < 0) {
+        return steps_chain::failure{ Rejection{ "negative" } };
+    }
+    return std::optional<IntParameter>{ data };
+}
+
+IntParameter unloadWithContext(IntParameter data, int& account) {
+    if (data._value > account) {
+        throw std::runtime_error{ "unreachable" };
+    }
+    account -= data._value;
+    return data;
+}
+
+steps_chain::result<IntParameter, BalanceError> checkWithContext(IntParameter data, int& account) {
+    if (data._value > account) {
+        return steps_chain::failure{ BalanceError{ data._value - account } };
+    }
+    return data;
+}
+
+};  // anonymous namespace
+
+// Chain stops at the failed step and keeps its argument, the step is called again on advance().
+TEST(ResultTests, ChainStopsOnError) {
+    balance = 5;
+    auto chain = steps_chain::StepsChain{ doubleValue, unload, doubleValue };
+    EXPECT_FALSE(chain.failed());
+    EXPECT_FALSE(chain.run("3"));
+    EXPECT_TRUE(chain.failed());
+    EXPECT_FALSE(chain.is_finished());
+    ASSERT_NE(chain.error<BalanceError>(), nullptr);
+    EXPECT_EQ(chain.error<BalanceError>()->missing, 1);
+    EXPECT_EQ(chain.error<int>(), nullptr);
+    EXPECT_EQ(chain.get_current_state(), std::make_tuple(1, std::string{ "6" }));
+
+    EXPECT_FALSE(chain.advance());
+    EXPECT_TRUE(chain.failed());
+    balance = 6;
+    EXPECT_TRUE(chain.advance());
+    EXPECT_FALSE(chain.failed());
+    EXPECT_EQ(chain.error<BalanceError>(), nullptr);
+    EXPECT_TRUE(chain.advance());
+    EXPECT_TRUE(chain.is_finished());
+    EXPECT_EQ(chain.peek<IntParameter>()->_value, 12);
+    EXPECT_EQ(balance, 0);
+
+    EXPECT_FALSE(chain.run("1", 1));
+    EXPECT_TRUE(chain.failed());
+    chain.initialize("1", 1);
+    EXPECT_FALSE(chain.failed());
+}
+
+// A step returning result of std::optional can either suspend or fail.
+TEST(ResultTests, SuspendsOrFails) {
+    balance = 100;
+    auto chain = steps_chain::StepsChain{ review, unload };
+    EXPECT_FALSE(chain.run("0"));
+    EXPECT_FALSE(chain.failed());
+    chain.initialize("-1");
+    EXPECT_FALSE(chain.resume());
+    EXPECT_TRUE(chain.failed());
+    ASSERT_NE(chain.error<Rejection>(), nullptr);
+    EXPECT_EQ(chain.error<Rejection>()->reason, "negative");
+    EXPECT_EQ(chain.error<BalanceError>(), nullptr);
+
+    EXPECT_FALSE(chain.run("200"));
+    EXPECT_EQ(chain.error<Rejection>(), nullptr);
+    ASSERT_NE(chain.error<BalanceError>(), nullptr);
+    EXPECT_EQ(chain.error<BalanceError>()->missing, 100);
+    EXPECT_EQ(std::get<0>(chain.get_current_state()), 1);
+
+    EXPECT_TRUE(chain.run("30"));
+    EXPECT_EQ(balance, 70);
+}
+
+TEST(ResultTests, ErrorThroughWrappers) {
+    auto make_chain = []() {
+        return steps_chain::ContextStepsChain{ checkWithContext, unloadWithContext };
+    };
+    steps_chain::ChainWrapper wrapper{ make_chain(), 10 };
+    steps_chain::ChainWrapperLS local{ make_chain(), 10 };
+    steps_chain::ChainVariant<steps_chain::BoundChain<decltype(make_chain()), int>> variant{
+        make_chain(), 10 };
+
+    EXPECT_FALSE(wrapper.run("11"));
+    EXPECT_FALSE(local.run("12"));
+    EXPECT_FALSE(variant.run("13"));
+    EXPECT_TRUE(wrapper.failed());
+    EXPECT_TRUE(local.failed());
+    EXPECT_TRUE(variant.failed());
+    EXPECT_EQ(wrapper.error<BalanceError>()->missing, 1);
+    EXPECT_EQ(local.error<BalanceError>()->missing, 2);
+    EXPECT_EQ(variant.error<BalanceError>()->missing, 3);
+    EXPECT_EQ(wrapper.error<Rejection>(), nullptr);
+
+    EXPECT_TRUE(wrapper.run("4"));
+    EXPECT_FALSE(wrapper.failed());
+
+    steps_chain::ChainWrapper plain{ steps_chain::StepsChain{ doubleValue } };
+    EXPECT_TRUE(plain.run("1"));
+    EXPECT_FALSE(plain.failed());
+    EXPECT_EQ(plain.error<BalanceError>(), nullptr);
+    EXPECT_FALSE(steps_chain::ChainWrapper{}.failed());
+    EXPECT_FALSE(steps_chain::ChainWrapperLS{}.failed());
+    EXPECT_EQ(steps_chain::ChainWrapperLS{}.error<BalanceError>(), nullptr);
+}
@@ -0,0 +1,98 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <context_steps_chain.h>
+#include <chain_wrapper.h>
+
+#include <optional>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+struct CachingPolicy : steps_chain::default_policy {
+    static constexpr bool cache_state = true;
+};
+
+ComparableParameter increment(const ComparableParameter& p) {
+    return ComparableParameter{ p._value + 1 };
+}
+
+ComparableParameter same(const ComparableParameter& p) {
+    return p;
+}
+
+};  // anonymous namespace
+
+TEST(StateCacheTests, RepeatedQueriesSerializeOnce) {
+    auto chain = steps_chain::StepsChain{
+        steps_chain::with_policy<CachingPolicy>,
+        increment,
+        increment
+    };
+    chain.initialize("1");
+    ComparableParameter::serializations = 0;
+    std::string buffer;
+    for (int i = 0; i < 3; ++i) {
+        buffer.clear();
+        ASSERT_EQ(chain.get_current_state(buffer), 0);
+        ASSERT_EQ(buffer, "1");
+    }
+    ASSERT_EQ(std::get<1>(chain.get_current_state()), "1");
+    ASSERT_EQ(ComparableParameter::serializations, 1);
+    chain.advance();
+    ASSERT_EQ(std::get<1>(chain.get_current_state()), "2");
+    ASSERT_EQ(ComparableParameter::serializations, 2);
+}
+
+TEST(StateCacheTests, UnchangedValueKeepsCache) {
+    auto chain = steps_chain::StepsChain{
+        steps_chain::with_policy<CachingPolicy>,
+        same,
+        [](ComparableParameter p) -> std::optional<ComparableParameter> { return p; },
+        increment
+    };
+    chain.initialize("5");
+    ComparableParameter::serializations = 0;
+    chain.get_current_state();
+    chain.advance();
+    chain.advance();
+    const auto [step_idx, data] = chain.get_current_state();
+    ASSERT_EQ(step_idx, 2);
+    ASSERT_EQ(data, "5");
+    ASSERT_EQ(ComparableParameter::serializations, 1);
+    chain.advance();
+    const auto [step_idx_after, data_after] = chain.get_current_state();
+    ASSERT_EQ(step_idx_after, 3);
+    ASSERT_EQ(data_after, "6");
+    ASSERT_EQ(ComparableParameter::serializations, 2);
+}
+
+TEST(StateCacheTests, InitializeDropsCache) {
+    auto chain = steps_chain::ContextStepsChain{
+        steps_chain::with_policy<CachingPolicy>,
+        [](const ComparableParameter& p, int) { return same(p); }
+    };
+    chain.initialize("1");
+    ASSERT_EQ(std::get<1>(chain.get_current_state()), "1");
+    chain.initialize("7");
+    ASSERT_EQ(std::get<1>(chain.get_current_state()), "7");
+    chain.run("8", 0);
+    ASSERT_EQ(std::get<1>(chain.get_current_state()), "8");
+    // Cached state is visible through the wrapper as well.
+    auto wrapped = steps_chain::ChainWrapper{ chain, 0 };
+    ComparableParameter::serializations = 0;
+    std::string buffer;
+    ASSERT_EQ(wrapped.get_current_state(buffer), 1);
+    ASSERT_EQ(buffer, "8");
+    ASSERT_EQ(ComparableParameter::serializations, 0);
+}
+
+TEST(StateCacheTests, NoCacheByDefault) {
+    auto chain = steps_chain::StepsChain{ same };
+    chain.initialize("1");
+    ComparableParameter::serializations = 0;
+    chain.get_current_state();
+    chain.get_current_state();
+    ASSERT_EQ(ComparableParameter::serializations, 2);
+}
@@ -0,0 +1,204 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <state_log.h>
+
+#include <csignal>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+
+namespace {
+
+IntParameter doubleValue(const IntParameter& data) {
+    return IntParameter{ data._value * 2 };
+}
+
+// Log file in the temporary directory, removed by the test.
+struct TemporaryLog {
+    explicit TemporaryLog(const std::string& name) : path{ ::testing::TempDir() + name } {
+        std::remove(path.c_str());
+    }
+    ~TemporaryLog() {
+        std::remove(path.c_str());
+    }
+
+    std::string path;
+};
+
+std::map<std::string, std::tuple<size_t, std::string>> contentsOf(const steps_chain::StateLog& log) {
+    std::map<std::string, std::tuple<size_t, std::string>> contents;
+    log.for_each([&contents](std::string_view id, size_t step, std::string_view state) {
+        contents[std::string{ id }] = std::make_tuple(step, std::string{ state });
+    });
+    return contents;
+}
+
+};  // anonymous namespace
+
+TEST(StateLogTests, ReplaysLatestStates) {
+    TemporaryLog file{ "replay.log" };
+    {
+        steps_chain::StateLog log{ file.path };
+        EXPECT_EQ(log.size(), 0u);
+        auto chain = steps_chain::StepsChain{ doubleValue, doubleValue, doubleValue };
+        auto sink = log.sink("ABCD-101");
+        ASSERT_TRUE(chain.initialize("1"));
+        ASSERT_TRUE(chain.run_with_checkpoints(sink));
+        log.append("NJDS-102", 1, "7");
+        log.append("KLEN-103", 2, "");
+        EXPECT_TRUE(log.erase("KLEN-103"));
+        EXPECT_FALSE(log.erase("KLEN-103"));
+        EXPECT_EQ(log.commits(), 6u);
+    }
+    steps_chain::StateLog log{ file.path };
+    EXPECT_EQ(log.size(), 2u);
+    std::string state;
+    EXPECT_EQ(log.find("ABCD-101", state), 3u);
+    EXPECT_EQ(state, "8");
+    state.clear();
+    EXPECT_EQ(log.find("NJDS-102", state), 1u);
+    EXPECT_EQ(state, "7");
+    EXPECT_EQ(log.find("KLEN-103", state), std::nullopt);
+    EXPECT_EQ(log.commits(), 0u);
+}
+
+TEST(StateLogTests, CompactionDropsSupersededRecords) {
+    TemporaryLog file{ "compact.log" };
+    std::map<std::string, std::tuple<size_t, std::string>> contents;
+    size_t bytes = 0;
+    {
+        steps_chain::StateLog log{ file.path };
+        for (size_t step = 0; step < 100; ++step) {
+            log.append("a", step, std::string(100, 'a'));
+            log.append("b", step, "b");
+        }
+        log.erase("b");
+        const size_t before = log.log_bytes();
+        EXPECT_LT(log.live_bytes() * 100, before);
+        log.compact();
+        EXPECT_EQ(log.log_bytes(), log.live_bytes());
+        // The compacted file is locked as the old one was.
+        EXPECT_THROW(steps_chain::StateLog{ file.path }, std::runtime_error);
+        log.append("c", 1, "c");
+        contents = contentsOf(log);
+        bytes = log.log_bytes();
+    }
+
+    steps_chain::StateLog reopened{ file.path };
+    EXPECT_EQ(contentsOf(reopened), contents);
+    EXPECT_EQ(contents.size(), 2u);
+    EXPECT_EQ(contents.at("a"), std::make_tuple(size_t{ 99 }, std::string(100, 'a')));
+    EXPECT_EQ(reopened.log_bytes(), bytes);
+}
+
+// Only one StateLog at a time may have the file open, the second one would replay a log that the
+// first one keeps appending to.
+TEST(StateLogTests, SecondOpenThrows) {
+    TemporaryLog file{ "locked.log" };
+    {
+        steps_chain::StateLog log{ file.path };
+        log.append("a", 1, "first");
+        EXPECT_THROW(steps_chain::StateLog{ file.path }, std::runtime_error);
+        std::string state;
+        EXPECT_EQ(log.find("a", state), 1u);
+    }
+    steps_chain::StateLog log{ file.path };
+    std::string state;
+    EXPECT_EQ(log.find("a", state), 1u);
+}
+
+// A record torn by a crash is dropped, and the log goes on after the last complete one.
+TEST(StateLogTests, TornRecordIsCutOff) {
+    TemporaryLog file{ "torn.log" };
+    size_t complete = 0;
+    {
+        steps_chain::StateLog log{ file.path };
+        log.append("a", 1, "first");
+        complete = log.log_bytes();
+        log.append("a", 2, "second");
+        ASSERT_EQ(::truncate(file.path.c_str(), static_cast<off_t>(log.log_bytes() - 3)), 0);
+    }
+    {
+        steps_chain::StateLog log{ file.path };
+        EXPECT_EQ(log.log_bytes(), complete);
+        std::string state;
+        EXPECT_EQ(log.find("a", state), 1u);
+        EXPECT_EQ(state, "first");
+        log.append("b", 1, "third");
+    }
+    steps_chain::StateLog log{ file.path };
+    EXPECT_EQ(log.size(), 2u);
+}
+
+TEST(StateLogTests, AppendsFromManyThreads) {
+    TemporaryLog file{ "threads.log" };
+    constexpr size_t threads = 8;
+    constexpr size_t appends = 200;
+    {
+        steps_chain::StateLog log{ file.path };
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&log, t]() {
+                const std::string id = "chain-" + std::to_string(t);
+                for (size_t i = 0; i < appends; ++i) {
+                    log.append(id, i, std::to_string(i * t));
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        // Waiting appends are committed together, so there may be fewer syncs than appends.
+        EXPECT_LE(log.commits(), threads * appends);
+        EXPECT_GT(log.commits(), 0u);
+    }
+    steps_chain::StateLog log{ file.path };
+    ASSERT_EQ(log.size(), threads);
+    for (size_t t = 0; t < threads; ++t) {
+        std::string state;
+        EXPECT_EQ(log.find("chain-" + std::to_string(t), state), appends - 1);
+        EXPECT_EQ(state, std::to_string((appends - 1) * t));
+    }
+}
+
+// A failed write leaves nothing behind that could be taken for durable, and the log refuses to be
+// used until it is opened again.
+TEST(StateLogTests, FailedAppendIsNotApplied) {
+    TemporaryLog file{ "failed.log" };
+    {
+        steps_chain::StateLog log{ file.path };
+        log.append("a", 1, "first");
+
+        // Writes past the limit fail with EFBIG instead of raising SIGXFSZ.
+        const auto previous_handler = std::signal(SIGXFSZ, SIG_IGN);
+        rlimit previous_limit;
+        ASSERT_EQ(::getrlimit(RLIMIT_FSIZE, &previous_limit), 0);
+        rlimit limit = previous_limit;
+        limit.rlim_cur = static_cast<rlim_t>(log.log_bytes() + 16);
+        ASSERT_EQ(::setrlimit(RLIMIT_FSIZE, &limit), 0);
+        EXPECT_THROW(log.append("a", 2, std::string(100, 'b')), std::system_error);
+        ASSERT_EQ(::setrlimit(RLIMIT_FSIZE, &previous_limit), 0);
+        std::signal(SIGXFSZ, previous_handler);
+
+        std::string state;
+        EXPECT_THROW(log.find("a", state), std::system_error);
+        EXPECT_THROW(log.for_each([](std::string_view, size_t, std::string_view) {}),
+                     std::system_error);
+        EXPECT_THROW(log.append("a", 3, "third"), std::system_error);
+    }
+    steps_chain::StateLog log{ file.path };
+    std::string state;
+    EXPECT_EQ(log.find("a", state), 1u);
+    EXPECT_EQ(state, "first");
+}
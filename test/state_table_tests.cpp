@@ -0,0 +1,329 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <state_table.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+
+namespace {
+
+IntParameter doubleValue(const IntParameter& data) {
+    return IntParameter{ data._value * 2 };
+}
+
+// Table file in the temporary directory, removed by the test.
+struct TemporaryTable {
+    explicit TemporaryTable(const std::string& name) : path{ ::testing::TempDir() + name } {
+        std::remove(path.c_str());
+    }
+    ~TemporaryTable() {
+        std::remove(path.c_str());
+    }
+
+    std::string path;
+};
+
+steps_chain::StateTable::Layout smallLayout() {
+    steps_chain::StateTable::Layout layout;
+    layout.slots = 8;
+    layout.key_capacity = 16;
+    layout.inline_capacity = 8;
+    layout.overflow_bytes = 1024;
+    return layout;
+}
+
+std::map<std::string, std::tuple<size_t, std::string>> contentsOf(const steps_chain::StateTable& table) {
+    std::map<std::string, std::tuple<size_t, std::string>> contents;
+    table.for_each([&contents](std::string_view id, size_t step, std::string_view state) {
+        contents[std::string{ id }] = std::make_tuple(step, std::string{ state });
+    });
+    return contents;
+}
+
+};  // anonymous namespace
+
+TEST(StateTableTests, KeepsStatesAcrossRestarts) {
+    TemporaryTable file{ "restart.table" };
+    {
+        steps_chain::StateTable table{ file.path, smallLayout() };
+        EXPECT_EQ(table.capacity(), 8u);
+        auto chain = steps_chain::StepsChain{ doubleValue, doubleValue, doubleValue };
+        auto sink = table.sink("ABCD-101");
+        ASSERT_TRUE(chain.initialize("1"));
+        ASSERT_TRUE(chain.run_with_checkpoints(sink));
+        table.put("NJDS-102", 1, "7");
+        table.put("KLEN-103", 2, "");
+        EXPECT_TRUE(table.erase("KLEN-103"));
+        EXPECT_FALSE(table.erase("KLEN-103"));
+        EXPECT_EQ(table.size(), 2u);
+    }
+    steps_chain::StateTable table{ file.path };
+    EXPECT_EQ(table.capacity(), 8u);  // the layout of the file, not the default one
+    EXPECT_EQ(table.size(), 2u);
+    std::string state;
+    EXPECT_EQ(table.find("ABCD-101", state), 3u);
+    EXPECT_EQ(state, "8");
+    state.clear();
+    EXPECT_EQ(table.find("NJDS-102", state), 1u);
+    EXPECT_EQ(state, "7");
+    EXPECT_EQ(table.find("KLEN-103", state), std::nullopt);
+
+    // Erased slots are reused.
+    table.put("KLEN-103", 3, "9");
+    EXPECT_EQ(table.size(), 3u);
+    state.clear();
+    EXPECT_EQ(table.find("KLEN-103", state), 3u);
+    EXPECT_EQ(state, "9");
+}
+
+TEST(StateTableTests, LargeStatesGoToOverflowArea) {
+    TemporaryTable file{ "overflow.table" };
+    steps_chain::StateTable table{ file.path, smallLayout() };
+    table.put("a", 1, std::string(100, 'a'));
+    table.put("a", 2, std::string(90, 'b'));
+    table.put("a", 3, std::string(100, 'c'));
+    // One block for each of the two copies, reused while the state fits.
+    EXPECT_EQ(table.overflow_used(), 256u);
+    table.put("a", 4, "short");
+    std::string state;
+    EXPECT_EQ(table.find("a", state), 4u);
+    EXPECT_EQ(state, "short");
+
+    EXPECT_THROW(table.put("a", 5, std::string(1000, 'd')), std::length_error);
+    state.clear();
+    EXPECT_EQ(table.find("a", state), 4u);
+    EXPECT_EQ(state, "short");
+    EXPECT_THROW(table.put("a-very-long-request-id", 1, "x"), std::length_error);
+}
+
+TEST(StateTableTests, FullTableRejectsNewChains) {
+    TemporaryTable file{ "full.table" };
+    steps_chain::StateTable table{ file.path, smallLayout() };
+    for (size_t i = 0; i < table.capacity(); ++i) {
+        table.put("chain-" + std::to_string(i), i, std::to_string(i));
+    }
+    EXPECT_THROW(table.put("one-more", 1, "x"), std::length_error);
+    table.put("chain-3", 30, "updated");  // existing chains can still be updated
+    std::string state;
+    EXPECT_EQ(table.find("one-more", state), std::nullopt);
+    EXPECT_EQ(table.find("chain-3", state), 30u);
+    EXPECT_EQ(state, "updated");
+    EXPECT_EQ(contentsOf(table).size(), table.capacity());
+}
+
+// Erasing ids leaves no tombstones behind where no probe needs them, so a table that has seen far
+// more ids than it has slots still stops misses and new ids at an empty slot.
+TEST(StateTableTests, ChurnReclaimsTombstones) {
+    TemporaryTable file{ "churn.table" };
+    steps_chain::StateTable table{ file.path, smallLayout() };
+    table.put("live-1", 1, "1");
+    table.put("live-2", 2, "2");
+    std::string state;
+    for (size_t i = 0; i < 20 * table.capacity(); ++i) {
+        if (i >= 2) {
+            ASSERT_TRUE(table.erase("churn-" + std::to_string(i - 2)));
+        }
+        table.put("churn-" + std::to_string(i), i, "x");
+        ASSERT_LT(table.size() + table.tombstones(), table.capacity());
+        ASSERT_EQ(table.find("missing", state), std::nullopt);
+    }
+    EXPECT_EQ(table.find("live-2", state), 2u);
+
+    // Filled up and emptied, even with no empty slot left to start from.
+    for (size_t i = 0; table.size() < table.capacity(); ++i) {
+        table.put("fill-" + std::to_string(i), i, "x");
+    }
+    for (const auto& [id, entry] : contentsOf(table)) {
+        ASSERT_TRUE(table.erase(id));
+    }
+    EXPECT_EQ(table.size(), 0u);
+    EXPECT_EQ(table.tombstones(), 0u);
+}
+
+// Reclaiming tombstones never cuts a key off the probe path from its hash.
+TEST(StateTableTests, RandomPutsAndErasesMatchMap) {
+    TemporaryTable file{ "random.table" };
+    steps_chain::StateTable table{ file.path, smallLayout() };
+    std::map<std::string, std::tuple<size_t, std::string>> expected;
+    std::mt19937 random{ 7 };
+    for (size_t i = 0; i < 5000; ++i) {
+        const std::string id = "id-" + std::to_string(random() % 12);
+        if (random() % 2 && expected.size() < table.capacity()) {
+            table.put(id, i, std::to_string(i));
+            expected[id] = std::make_tuple(i, std::to_string(i));
+        }
+        else {
+            ASSERT_EQ(table.erase(id), expected.erase(id) == 1);
+        }
+        std::string state;
+        for (const auto& [key, entry] : expected) {
+            state.clear();
+            ASSERT_EQ(table.find(key, state), std::get<0>(entry));
+        }
+        ASSERT_EQ(contentsOf(table), expected);
+    }
+}
+
+// A file that is not a state table is never overwritten, only an empty one becomes a table.
+TEST(StateTableTests, OtherFilesAreLeftAlone) {
+    TemporaryTable file{ "other.table" };
+    const std::string contents = "not a state table, but some other data";
+    std::ofstream{ file.path, std::ios::binary } << contents;
+    EXPECT_THROW(steps_chain::StateTable(file.path, smallLayout()), std::runtime_error);
+    EXPECT_THROW(steps_chain::StateTable(file.path, steps_chain::StateTable::read_only),
+                 std::runtime_error);
+    std::ifstream in{ file.path, std::ios::binary };
+    EXPECT_EQ(std::string(std::istreambuf_iterator<char>{ in }, {}), contents);
+
+    std::ofstream{ file.path, std::ios::binary | std::ios::trunc };
+    steps_chain::StateTable table{ file.path, smallLayout() };
+    EXPECT_EQ(table.capacity(), 8u);
+}
+
+namespace {
+
+// Writes 'value' over the header of the file at 'offset'.
+template <typename T>
+void patchHeader(const std::string& path, std::streamoff offset, const T& value) {
+    std::fstream io{ path, std::ios::binary | std::ios::in | std::ios::out };
+    io.seekp(offset);
+    io.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T readHeader(const std::string& path, std::streamoff offset) {
+    std::ifstream in{ path, std::ios::binary };
+    T value{};
+    in.seekg(offset);
+    in.read(reinterpret_cast<char*>(&value), sizeof(value));
+    return value;
+}
+
+constexpr std::streamoff openForWritingOffset = 10;
+constexpr std::streamoff counterOffset = 48;  // size, then tombstones
+
+void writeTableWithErasedChain(const std::string& path) {
+    steps_chain::StateTable table{ path, smallLayout() };
+    table.put("a", 1, "1");
+    table.put("b", 1, "2");
+    table.put("c", 1, "3");
+    table.erase("b");
+    EXPECT_EQ(readHeader<uint16_t>(path, openForWritingOffset), 1u);
+}
+
+};  // anonymous namespace
+
+// After a clean close the counters in the header are taken as they are, the slots are not read.
+TEST(StateTableTests, CleanReopenDoesNotRecount) {
+    TemporaryTable file{ "clean.table" };
+    writeTableWithErasedChain(file.path);
+    EXPECT_EQ(readHeader<uint16_t>(file.path, openForWritingOffset), 0u);
+    const uint64_t marker[] = { 7, 5 };
+    patchHeader(file.path, counterOffset, marker);
+    steps_chain::StateTable table{ file.path };
+    EXPECT_EQ(table.size(), 7u);
+    EXPECT_EQ(table.tombstones(), 5u);
+}
+
+// A writer that dies between a control word store and the counter update leaves the counters in
+// the header wrong and the table marked as open; the next writer counts them again.
+TEST(StateTableTests, CountersAreRecountedAfterCrash) {
+    TemporaryTable file{ "recount.table" };
+    writeTableWithErasedChain(file.path);
+    size_t tombstones = 0;
+    {
+        steps_chain::StateTable table{ file.path, steps_chain::StateTable::read_only };
+        tombstones = table.tombstones();
+    }
+    const uint64_t wrong[] = { 7, 5 };
+    patchHeader(file.path, counterOffset, wrong);
+    patchHeader(file.path, openForWritingOffset, uint16_t{ 1 });
+    {
+        steps_chain::StateTable table{ file.path, steps_chain::StateTable::read_only };
+        EXPECT_EQ(table.size(), 7u);  // readers take the header as it is
+    }
+    {
+        steps_chain::StateTable table{ file.path };
+        EXPECT_EQ(table.size(), 2u);
+        EXPECT_EQ(table.tombstones(), tombstones);
+    }
+    EXPECT_EQ(readHeader<uint16_t>(file.path, openForWritingOffset), 0u);
+}
+
+// A header that claims more slots or overflow than the file has is rejected when opened.
+TEST(StateTableTests, DamagedHeaderIsRejected) {
+    TemporaryTable file{ "damaged.table" };
+    { steps_chain::StateTable table{ file.path, smallLayout() }; }
+    for (const size_t offset : { 16, 32 }) {  // slot count, overflow size
+        std::fstream io{ file.path, std::ios::binary | std::ios::in | std::ios::out };
+        uint64_t original = 0;
+        io.seekg(static_cast<std::streamoff>(offset));
+        io.read(reinterpret_cast<char*>(&original), sizeof(original));
+        const uint64_t damaged = uint64_t{ 1 } << 40;
+        io.seekp(static_cast<std::streamoff>(offset));
+        io.write(reinterpret_cast<const char*>(&damaged), sizeof(damaged));
+        io.flush();
+        EXPECT_THROW(steps_chain::StateTable(file.path, steps_chain::StateTable::read_only),
+                     std::runtime_error);
+        io.seekp(static_cast<std::streamoff>(offset));
+        io.write(reinterpret_cast<const char*>(&original), sizeof(original));
+    }
+    steps_chain::StateTable table{ file.path, steps_chain::StateTable::read_only };
+    EXPECT_EQ(table.capacity(), 8u);
+}
+
+TEST(StateTableTests, SingleWriterManyReaders) {
+    TemporaryTable file{ "readers.table" };
+    steps_chain::StateTable table{ file.path, smallLayout() };
+    EXPECT_THROW(steps_chain::StateTable(file.path), std::runtime_error);
+    steps_chain::StateTable reader{ file.path, steps_chain::StateTable::read_only };
+    EXPECT_THROW(reader.put("a", 1, "x"), std::logic_error);
+
+    // The length and the contents of a state follow from its step, so a torn read shows up.
+    const auto stateOf = [](size_t step) {
+        return std::string(step % 40, static_cast<char>('a' + step % 26));
+    };
+    constexpr size_t updates = 20000;
+    std::atomic<bool> done{ false };
+    std::atomic<size_t> reads{ 0 };
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < 2; ++t) {
+        readers.emplace_back([&, t]() {
+            const steps_chain::StateTable& from = t == 0 ? table : reader;
+            std::string state;
+            while (!done.load()) {
+                state.clear();
+                if (const auto step = from.find("chain", state)) {
+                    ASSERT_EQ(state, stateOf(*step));
+                    reads.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (size_t step = 0; step < updates; ++step) {
+        table.put("chain", step, stateOf(step));
+        if (step % 1000 == 0) {
+            std::this_thread::yield();
+        }
+    }
+    done.store(true);
+    for (auto& thread : readers) {
+        thread.join();
+    }
+    EXPECT_GT(reads.load(), 0u);
+    std::string state;
+    EXPECT_EQ(reader.find("chain", state), updates - 1);
+    EXPECT_EQ(state, stateOf(updates - 1));
+}
@@ -0,0 +1,182 @@
+#include <timer_wheel.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+TEST(TimerWheelTests, FiresOnExpirationTick) {
+    std::vector<std::string> fired;
+    steps_chain::TimerWheel<std::string> timers{
+        [&fired](const std::string& key) { fired.push_back(key); } };
+    timers.set("ABCD-101", 60);
+    EXPECT_TRUE(timers.contains("ABCD-101"));
+    EXPECT_EQ(timers.expires_at("ABCD-101"), 60u);
+    EXPECT_EQ(timers.advance(59), 0u);
+    EXPECT_TRUE(fired.empty());
+    EXPECT_EQ(timers.advance(1), 1u);
+    ASSERT_EQ(fired.size(), 1u);
+    EXPECT_EQ(fired[0], "ABCD-101");
+    EXPECT_FALSE(timers.contains("ABCD-101"));
+    EXPECT_TRUE(timers.empty());
+    EXPECT_EQ(timers.now(), 60u);
+}
+
+TEST(TimerWheelTests, ZeroDelayFiresOnNextTick) {
+    size_t fired = 0;
+    steps_chain::TimerWheel<int> timers{ [&fired](int) { ++fired; }, 1000 };
+    timers.set(1, 0);
+    EXPECT_EQ(timers.advance(0), 0u);
+    EXPECT_EQ(timers.advance(1), 1u);
+    EXPECT_EQ(fired, 1u);
+}
+
+TEST(TimerWheelTests, CancelAndRestart) {
+    std::vector<int> fired;
+    steps_chain::TimerWheel<int> timers{ [&fired](int key) { fired.push_back(key); } };
+    timers.set(1, 10);
+    timers.set(2, 10);
+    timers.set(3, 10);
+    EXPECT_TRUE(timers.cancel(2));
+    EXPECT_FALSE(timers.cancel(2));
+    EXPECT_FALSE(timers.cancel(4));
+    // Restarting moves the timer, it does not add another one.
+    timers.set(3, 100000);
+    EXPECT_EQ(timers.size(), 2u);
+    EXPECT_EQ(timers.advance(10), 1u);
+    EXPECT_EQ(fired, (std::vector<int>{ 1 }));
+    EXPECT_EQ(timers.advance(100000), 1u);
+    EXPECT_EQ(fired, (std::vector<int>{ 1, 3 }));
+}
+
+TEST(TimerWheelTests, FiresInOrderAcrossWheels) {
+    std::vector<uint64_t> fired;
+    uint64_t now = 0;
+    steps_chain::TimerWheel<uint64_t> timers{ [&](uint64_t delay) {
+        EXPECT_EQ(delay, now);
+        fired.push_back(delay);
+    }, 0 };
+    const std::vector<uint64_t> delays{
+        1, 255, 256, 257, 511, 65535, 65536, 65537, 16777216 + 3, uint64_t{ 1 } << 40,
+        (uint64_t{ 1 } << 40) + 1, uint64_t{ 1 } << 63 };
+    for (auto it = delays.rbegin(); it != delays.rend(); ++it) {
+        timers.set(*it, *it);
+    }
+    // Step to each expiration tick and check that nothing fires early.
+    for (const auto delay : delays) {
+        now = delay;
+        EXPECT_EQ(timers.advance_to(delay - 1), 0u);
+        EXPECT_EQ(timers.advance_to(delay), 1u);
+    }
+    EXPECT_EQ(fired, delays);
+    EXPECT_TRUE(timers.empty());
+}
+
+TEST(TimerWheelTests, StartsAtArbitraryTime) {
+    std::vector<std::string> fired;
+    steps_chain::TimerWheel<std::string> timers{
+        [&fired](const std::string& key) { fired.push_back(key); }, 0xFFFF'FFF0 };
+    timers.set("a", 0x20);   // crosses several wheels at once
+    timers.set("b", 0x10);
+    EXPECT_EQ(timers.advance(0x10), 1u);
+    EXPECT_EQ(timers.advance(0x0F), 0u);
+    EXPECT_EQ(timers.advance(0x01), 1u);
+    EXPECT_EQ(fired, (std::vector<std::string>{ "b", "a" }));
+}
+
+TEST(TimerWheelTests, CallbackMaySetTimerAgain) {
+    size_t retries = 0;
+    steps_chain::TimerWheel<std::string>* self = nullptr;
+    steps_chain::TimerWheel<std::string> timers{ [&](const std::string& key) {
+        if (++retries < 3) {
+            self->set(key, 60);
+        }
+    } };
+    self = &timers;
+    timers.set("IJSA-104", 60);
+    EXPECT_EQ(timers.advance(1000), 3u);
+    EXPECT_EQ(retries, 3u);
+    EXPECT_EQ(timers.now(), 1000u);
+    EXPECT_TRUE(timers.empty());
+}
+
+TEST(TimerWheelTests, ThrowingCallbackLeavesDueTimers) {
+    // Timers due at the same tick fire in no particular order, the first one throws.
+    std::vector<int> fired;
+    steps_chain::TimerWheel<int> timers{ [&fired](int key) {
+        fired.push_back(key);
+        if (fired.size() == 1) {
+            throw std::runtime_error{ "failed" };
+        }
+    } };
+    timers.set(1, 5);
+    timers.set(2, 5);
+    timers.set(3, 6);
+    EXPECT_THROW(timers.advance(10), std::runtime_error);
+    EXPECT_EQ(fired.size(), 1u);
+    EXPECT_EQ(timers.advance(10), 2u);
+    EXPECT_EQ(fired.size(), 3u);
+    EXPECT_EQ(fired.back(), 3);
+}
+
+TEST(TimerWheelTests, MatchesSortedOrder) {
+    std::vector<uint64_t> fired;
+    steps_chain::TimerWheel<uint64_t>* self = nullptr;
+    // Keys are expiration ticks.
+    steps_chain::TimerWheel<uint64_t> timers{ [&](uint64_t key) {
+        EXPECT_EQ(key, self->now());
+        fired.push_back(key);
+    } };
+    self = &timers;
+    std::mt19937_64 random{ 42 };
+    std::vector<uint64_t> expected;
+    for (int i = 0; i < 20000; ++i) {
+        const uint64_t delay = random() % 3'000'000 + 1;
+        if (!timers.contains(delay)) {
+            timers.set(delay, delay);
+            expected.push_back(delay);
+        }
+    }
+    // Cancel every third one.
+    std::vector<uint64_t> kept;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (i % 3 == 0) {
+            EXPECT_TRUE(timers.cancel(expected[i]));
+        }
+        else {
+            kept.push_back(expected[i]);
+        }
+    }
+    std::sort(kept.begin(), kept.end());
+    size_t total = 0;
+    while (!timers.empty()) {
+        total += timers.advance(random() % 5000 + 1);
+    }
+    EXPECT_EQ(total, kept.size());
+    EXPECT_EQ(fired, kept);
+}
+
+TEST(TimerWheelTests, KeepsTrackOfKeysThroughChurn) {
+    size_t fired = 0;
+    steps_chain::TimerWheel<std::string> timers{ [&fired](const std::string&) { ++fired; } };
+    // Timers come and go, so the index is full of removed entries.
+    for (int round = 0; round < 50; ++round) {
+        for (int i = 0; i < 1000; ++i) {
+            timers.set("req-" + std::to_string(round * 1000 + i), 10 + i % 7);
+        }
+        for (int i = 0; i < 1000; i += 2) {
+            EXPECT_TRUE(timers.cancel("req-" + std::to_string(round * 1000 + i)));
+        }
+        EXPECT_EQ(timers.size(), 500u);
+        EXPECT_FALSE(timers.contains("req-" + std::to_string(round * 1000)));
+        EXPECT_TRUE(timers.contains("req-" + std::to_string(round * 1000 + 1)));
+        EXPECT_EQ(timers.advance(20), 500u);
+        EXPECT_TRUE(timers.empty());
+    }
+    EXPECT_EQ(fired, 25000u);
+    EXPECT_THROW(timers.expires_at("req-1"), std::out_of_range);
+}
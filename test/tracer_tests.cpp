@@ -0,0 +1,170 @@
+#include "parameters.h"
+#include <steps_chain.h>
+#include <chain_wrapper.h>
+#include <tracer.h>
+
+#include <atomic>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+
+namespace {
+
+struct TracedPolicy : steps_chain::default_policy {
+    using observer = steps_chain::runtime_observer;
+};
+
+IntParameter doubleValue(const IntParameter& data) {
+    return IntParameter{ data._value * 2 };
+}
+
+bool ready = false;
+
+std::optional<IntParameter> waitUntilReady(const IntParameter& data) {
+    if (!ready) {
+        return std::nullopt;
+    }
+    return data;
+}
+
+IntParameter failOnOdd(const IntParameter& data) {
+    if (data._value % 2) {
+        throw std::runtime_error{ "odd" };
+    }
+    return data;
+}
+
+size_t occurrences(const std::string& text, const std::string& pattern) {
+    size_t count = 0;
+    for (size_t pos = text.find(pattern); pos != std::string::npos;
+         pos = text.find(pattern, pos + 1)) {
+        ++count;
+    }
+    return count;
+}
+
+};  // anonymous namespace
+
+TEST(TracerTests, RecordsStepsSuspensionsAndExceptions) {
+    ready = false;
+    steps_chain::Tracer tracer;
+    auto trace = tracer.trace("REQ-\"1\"");
+    ASSERT_TRUE(trace.sampled());
+    EXPECT_EQ(trace.id(), 1u);
+    steps_chain::ChainWrapper chain{ steps_chain::StepsChain{
+        steps_chain::with_policy<TracedPolicy>, doubleValue, waitUntilReady, failOnOdd } };
+    ASSERT_TRUE(chain.set_observer(&trace));
+    EXPECT_FALSE(chain.run("1"));
+    ready = true;
+    EXPECT_TRUE(chain.resume());
+    EXPECT_TRUE(chain.is_finished());
+    EXPECT_THROW(chain.run("3", 2), std::runtime_error);
+
+    std::string json;
+    // Begin and end of step 0, begin and suspension of step 1, resume and end of step 1,
+    // begin and end of step 2, begin and exception of step 2. Suspension is a slice of its own.
+    EXPECT_EQ(tracer.flush(json), 10u);
+    EXPECT_EQ(json.rfind("{\"traceEvents\":[", 0), 0u);
+    EXPECT_NE(json.find("\"args\":{\"name\":\"REQ-\\\"1\\\"\"}"), std::string::npos);
+    EXPECT_EQ(occurrences(json, "\"ph\":\"B\""), 6u);
+    EXPECT_EQ(occurrences(json, "\"ph\":\"E\""), 6u);
+    EXPECT_EQ(occurrences(json, "\"name\":\"suspended at step 1\""), 1u);
+    EXPECT_EQ(occurrences(json, "\"name\":\"step 2\""), 2u);
+    EXPECT_EQ(occurrences(json, "\"name\":\"exception\""), 1u);
+
+    json.clear();
+    EXPECT_EQ(tracer.flush(json), 0u);
+    EXPECT_EQ(tracer.dropped(), 0u);
+}
+
+// Same ids are sampled every time, not sampled chains record nothing.
+TEST(TracerTests, SamplesChainsById) {
+    steps_chain::Tracer tracer{ 4 };
+    size_t sampled = 0;
+    for (uint64_t id = 1; id <= 1000; ++id) {
+        const auto trace = tracer.trace(id);
+        EXPECT_EQ(trace.sampled(), tracer.sampled(id));
+        if (trace.sampled()) {
+            ++sampled;
+        }
+    }
+    EXPECT_GT(sampled, 150u);
+    EXPECT_LT(sampled, 350u);
+
+    uint64_t skipped = 1;
+    while (tracer.sampled(skipped)) {
+        ++skipped;
+    }
+    auto trace = tracer.trace(skipped);
+    trace.on_step_begin(0);
+    trace.on_step_end(0, steps_chain::step_outcome::advanced);
+    std::string json;
+    EXPECT_EQ(tracer.flush(json), 0u);
+}
+
+// Only sampled names are kept, and only until they are flushed.
+TEST(TracerTests, SamplesNamesAndDropsThemOnFlush) {
+    steps_chain::Tracer tracer{ 4 };
+    size_t sampled = 0;
+    for (int i = 0; i < 1000; ++i) {
+        const auto trace = tracer.trace("REQ-" + std::to_string(i));
+        if (trace.sampled()) {
+            EXPECT_EQ(trace.id(), ++sampled);
+        }
+    }
+    EXPECT_GT(sampled, 150u);
+    EXPECT_LT(sampled, 350u);
+    // Same name, same decision.
+    EXPECT_EQ(tracer.trace("REQ-7").sampled(), tracer.trace("REQ-7").sampled());
+
+    std::string json;
+    tracer.flush(json);
+    EXPECT_EQ(occurrences(json, "\"thread_name\""), sampled);
+    json.clear();
+    tracer.flush(json);
+    EXPECT_EQ(occurrences(json, "\"thread_name\""), 0u);
+}
+
+// Threads record into their own buffers while another one flushes, events that do not fit into
+// a full buffer are counted as dropped.
+TEST(TracerTests, RecordsFromManyThreads) {
+    steps_chain::Tracer tracer{ 1, 1000 };  // rounded up to 1024
+    constexpr size_t threads = 4;
+    constexpr size_t events = 20000;
+    std::atomic<size_t> running{ threads };
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&tracer, &running, t]() {
+            auto trace = tracer.trace(uint64_t{ t + 1 });
+            for (size_t i = 0; i < events / 2; ++i) {
+                trace.on_step_begin(i);
+                trace.on_step_end(i, steps_chain::step_outcome::advanced);
+            }
+            --running;
+        });
+    }
+    size_t flushed = 0;
+    std::string json;
+    while (running > 0) {
+        json.clear();
+        flushed += tracer.flush(json);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    flushed += tracer.flush(json);
+    EXPECT_EQ(flushed + tracer.dropped(), threads * events);
+
+    steps_chain::Tracer small{ 1, 8 };
+    auto trace = small.trace(uint64_t{ 1 });
+    for (size_t i = 0; i < 10; ++i) {
+        trace.on_exception(i);
+    }
+    EXPECT_EQ(small.dropped(), 2u);
+    EXPECT_EQ(small.flush(json), 8u);
+}